@@ -0,0 +1,381 @@
+#include "cachingfilesystem.h"
+
+#include "statistics.h"
+
+namespace
+{
+  std::string_view without_trailing_slash(std::string_view dirname)
+  {
+    return dirname.size() > 1 && dirname.ends_with('/')
+             ? dirname.substr(0, dirname.size() - 1)
+             : dirname;
+  }
+
+  std::string join(std::string_view dirname, std::string_view name)
+  {
+    std::string path{dirname};
+    if (!path.ends_with('/'))
+    {
+      path += '/';
+    }
+    return path.append(name);
+  }
+
+  /// The parent of dirname and the name of dirname in it, or nothing for
+  /// the root directory
+  std::optional<std::pair<std::string_view, std::string_view>>
+  split(std::string_view dirname)
+  {
+    auto pos = dirname.find_last_of('/');
+    if (pos == std::string_view::npos || dirname == "/")
+    {
+      return std::nullopt;
+    }
+    return std::make_pair(pos == 0 ? dirname.substr(0, 1)
+                                   : dirname.substr(0, pos),
+                          dirname.substr(pos + 1));
+  }
+
+}  // anonymous namespace
+
+fw::dm::dtls::DirectoryCache::DirectoryCache(StatFun stat_, ListFun list_) :
+  stat(std::move(stat_)), list(std::move(list_))
+{
+}
+
+bool fw::dm::dtls::DirectoryCache::add_watch(std::string_view dirname)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto key = without_trailing_slash(dirname);
+  auto iter = directories.find(key);
+  if (iter == std::end(directories))
+  {
+    iter = directories.emplace(std::string{key}, Directory{}).first;
+    iter->second.watched_as = dirname;
+  }
+  return iter->second.watches++ == 0;
+}
+
+bool fw::dm::dtls::DirectoryCache::remove_watch(std::string_view dirname)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = directories.find(without_trailing_slash(dirname));
+  if (iter == std::end(directories) || --iter->second.watches > 0)
+  {
+    return false;
+  }
+  directories.erase(iter);
+  return true;
+}
+
+std::vector<std::string> fw::dm::dtls::DirectoryCache::watched() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  std::vector<std::string> names;
+  for (const auto& d : directories)
+  {
+    names.push_back(d.second.watched_as);
+  }
+  return names;
+}
+
+std::optional<std::deque<fw::dm::fs::DirectoryEntry>>
+fw::dm::dtls::DirectoryCache::ls(std::string_view dirname)
+{
+  return ls(dirname, list);
+}
+
+std::optional<std::deque<fw::dm::fs::DirectoryEntry>>
+fw::dm::dtls::DirectoryCache::ls(std::string_view dirname,
+                                 const ListFun& list_uncached)
+{
+  static auto& hits = statistics().counter("cache.hits");
+  static auto& misses = statistics().counter("cache.misses");
+
+  std::unique_lock<std::mutex> lock(mutex);
+  const std::string key{without_trailing_slash(dirname)};
+  refresh_stale(lock, key);
+  auto iter = directories.find(key);
+  if (iter == std::end(directories))
+  {
+    ++misses;
+    return std::nullopt;
+  }
+
+  if (!iter->second.populated)
+  {
+    ++misses;
+    // list without holding the lock, so events are not held up by the disk,
+    // and only keep the listing if no event arrived in the meantime
+    auto version = iter->second.version;
+    lock.unlock();
+    auto listing = list_uncached(key);
+    lock.lock();
+
+    iter = directories.find(key);
+    if (iter != std::end(directories) && !iter->second.populated
+        && iter->second.version == version)
+    {
+      for (const auto& de : listing)
+      {
+        iter->second.entries.emplace(de.name, de);
+      }
+      iter->second.populated = true;
+    }
+    return listing;
+  }
+
+  ++hits;
+  std::deque<fs::DirectoryEntry> entries;
+  for (const auto& e : iter->second.entries)
+  {
+    entries.push_back(e.second);
+  }
+  return entries;
+}
+
+void fw::dm::dtls::DirectoryCache::mark_entries_stale(std::string_view dirname)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = directories.find(without_trailing_slash(dirname));
+  if (iter == std::end(directories) || !iter->second.populated)
+  {
+    return;
+  }
+  for (const auto& e : iter->second.entries)
+  {
+    iter->second.stale.insert(e.first);
+  }
+}
+
+std::optional<fw::dm::fs::Listing>
+fw::dm::dtls::DirectoryCache::listing(std::string_view dirname)
+{
+  static auto& hits = statistics().counter("cache.hits");
+  static auto& misses = statistics().counter("cache.misses");
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    const std::string key{without_trailing_slash(dirname)};
+    refresh_stale(lock, key);
+    auto iter = directories.find(key);
+    if (iter == std::end(directories))
+    {
+      ++misses;
+      return std::nullopt;
+    }
+    if (iter->second.populated)
+    {
+      ++hits;
+      std::size_t name_bytes = 0;
+      for (const auto& e : iter->second.entries)
+      {
+        name_bytes += e.first.size() + 1;
+      }
+      fs::Listing packed;
+      packed.reserve(iter->second.entries.size(), name_bytes);
+      for (const auto& [name, e] : iter->second.entries)
+      {
+        packed.add(name, e.is_dir, e.mtime, e.size);
+      }
+      return packed;
+    }
+  }
+
+  // listed from disk and cached by ls, the first time
+  auto entries = ls(dirname);
+  if (!entries)
+  {
+    return std::nullopt;
+  }
+  return fs::Listing(*entries);
+}
+
+fw::dm::dtls::DirectoryCache::Lookup
+fw::dm::dtls::DirectoryCache::get_direntry(std::string_view dirname,
+                                           std::string_view name)
+{
+  static auto& hits = statistics().counter("cache.hits");
+  static auto& misses = statistics().counter("cache.misses");
+
+  std::unique_lock<std::mutex> lock(mutex);
+  const std::string key{without_trailing_slash(dirname)};
+  refresh_stale(lock, key, name);
+  auto iter = directories.find(key);
+  if (iter == std::end(directories) || !iter->second.populated)
+  {
+    ++misses;
+    return Lookup{false, std::nullopt};
+  }
+
+  ++hits;
+  auto entry = iter->second.entries.find(name);
+  if (entry == std::end(iter->second.entries))
+  {
+    return Lookup{true, std::nullopt};
+  }
+  return Lookup{true, entry->second};
+}
+
+void fw::dm::dtls::DirectoryCache::refresh_stale(
+  std::unique_lock<std::mutex>& lock, const std::string& dirname,
+  std::optional<std::string_view> name)
+{
+  auto iter = directories.find(dirname);
+  if (iter == std::end(directories) || !iter->second.populated)
+  {
+    return;
+  }
+
+  std::vector<std::string> names;
+  const auto& stale = iter->second.stale;
+  if (!name)
+  {
+    names.assign(std::begin(stale), std::end(stale));
+  }
+  else if (stale.contains(*name))
+  {
+    names.emplace_back(*name);
+  }
+  if (names.empty())
+  {
+    return;
+  }
+
+  // stat without holding the lock, as in ls, so events are not held up by
+  // the disk
+  auto version = iter->second.version;
+  lock.unlock();
+  std::vector<std::optional<fs::DirectoryEntry>> direntries;
+  direntries.reserve(names.size());
+  for (const auto& n : names)
+  {
+    direntries.push_back(stat(join(dirname, n)));
+  }
+  lock.lock();
+
+  // an event in the meantime may have changed what was stat'ed, so leave
+  // the entries stale for the next reader
+  iter = directories.find(dirname);
+  if (iter == std::end(directories) || !iter->second.populated
+      || iter->second.version != version)
+  {
+    return;
+  }
+
+  auto& dir = iter->second;
+  for (std::size_t i = 0; i < names.size(); ++i)
+  {
+    if (direntries[i])
+    {
+      direntries[i]->name = names[i];
+      dir.entries.insert_or_assign(names[i], *direntries[i]);
+    }
+    else
+    {
+      dir.entries.erase(names[i]);
+    }
+    dir.stale.erase(names[i]);
+  }
+}
+
+void fw::dm::dtls::DirectoryCache::forget_entries(const std::string& dirname)
+{
+  auto iter = directories.find(dirname);
+  if (iter != std::end(directories))
+  {
+    iter->second.populated = false;
+    iter->second.entries.clear();
+    iter->second.stale.clear();
+  }
+}
+
+void fw::dm::dtls::DirectoryCache::mark_stale(const std::string& dirname)
+{
+  auto parent_and_name = split(dirname);
+  if (!parent_and_name)
+  {
+    return;
+  }
+
+  auto iter = directories.find(parent_and_name->first);
+  if (iter != std::end(directories) && iter->second.populated)
+  {
+    iter->second.stale.emplace(parent_and_name->second);
+  }
+}
+
+void fw::dm::dtls::DirectoryCache::notify(
+  filewatch::DirectoryEvent::Event event, std::string_view containing_dir,
+  std::string_view dir_name, uint64_t mtime, uint64_t size,
+  std::string_view old_name)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  const std::string key{without_trailing_slash(containing_dir)};
+  auto iter = directories.find(key);
+  if (iter == std::end(directories))
+  {
+    return;
+  }
+
+  auto& dir = iter->second;
+  ++dir.version;
+  if (!dir.populated)
+  {
+    return;
+  }
+
+  const std::string name{dir_name};
+  auto set_entry = [&](bool is_dir) {
+    dir.entries.insert_or_assign(name,
+                                 fs::DirectoryEntry{name, is_dir, mtime, size});
+    // an entry that could not be stat'ed is probably gone already
+    if (mtime == 0)
+    {
+      dir.stale.insert(name);
+    }
+    else
+    {
+      dir.stale.erase(name);
+    }
+  };
+
+  switch (event)
+  {
+  case filewatch::DirectoryEvent::FILE_ADDED:
+  case filewatch::DirectoryEvent::DIRECTORY_ADDED:
+    set_entry(event == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+    break;
+
+  case filewatch::DirectoryEvent::FILE_REMOVED:
+  case filewatch::DirectoryEvent::DIRECTORY_REMOVED:
+    dir.entries.erase(name);
+    dir.stale.erase(name);
+    if (event == filewatch::DirectoryEvent::DIRECTORY_REMOVED)
+    {
+      forget_entries(join(key, name));
+    }
+    break;
+
+  case filewatch::DirectoryEvent::FILE_RENAMED:
+  case filewatch::DirectoryEvent::DIRECTORY_RENAMED:
+    dir.entries.erase(std::string{old_name});
+    dir.stale.erase(std::string{old_name});
+    set_entry(event == filewatch::DirectoryEvent::DIRECTORY_RENAMED);
+    if (event == filewatch::DirectoryEvent::DIRECTORY_RENAMED)
+    {
+      forget_entries(join(key, old_name));
+    }
+    break;
+
+  case filewatch::DirectoryEvent::FILE_MODIFIED:
+    set_entry(false);
+    // the entries of the directory are the same, so its mtime is as well
+    return;
+
+  default:
+    return;
+  }
+
+  mark_stale(key);
+}
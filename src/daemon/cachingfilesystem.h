@@ -0,0 +1,395 @@
+#ifndef CACHINGFILESYSTEM_H
+#define CACHINGFILESYSTEM_H
+
+#include "directoryeventlistener.h"
+#include "filesystem.h"
+#include "statistics.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// The entries of watched directories, kept up to date by the
+      /// DirectoryEvents of the directories.  A directory is listed from
+      /// disk the first time it is asked for, and served from memory from
+      /// then on.  Thread safe.
+      class DirectoryCache : public DirectoryEventListener
+      {
+      public:
+        using StatFun = std::function<std::optional<fs::DirectoryEntry>(
+          const std::string& path)>;
+        using ListFun = std::function<std::deque<fs::DirectoryEntry>(
+          const std::string& dirname)>;
+
+        DirectoryCache(StatFun stat_, ListFun list_);
+
+        /// Returns true for the first watch of dirname, after which the
+        /// caller must make this cache a listener of dirname
+        bool add_watch(std::string_view dirname);
+        /// Returns true when the last watch of dirname is removed, after
+        /// which the caller must stop this cache listening to dirname
+        bool remove_watch(std::string_view dirname);
+        /// The names watched directories were added with
+        std::vector<std::string> watched() const;
+
+        /// The entries of dirname, or nothing if dirname is not watched
+        std::optional<std::deque<fs::DirectoryEntry>>
+        ls(std::string_view dirname);
+        /// As ls(dirname), but a directory that is not cached yet is
+        /// listed by list_uncached
+        std::optional<std::deque<fs::DirectoryEntry>>
+        ls(std::string_view dirname, const ListFun& list_uncached);
+        /// Have the cached entries of dirname stat'ed again before they
+        /// are next read, e.g., entries taken from a persisted index
+        void mark_entries_stale(std::string_view dirname);
+        /// As ls(dirname), packed from memory into one Listing
+        std::optional<fs::Listing> listing(std::string_view dirname);
+
+        struct Lookup
+        {
+          bool cached;  // false if the caller must ask the disk
+          std::optional<fs::DirectoryEntry> entry;
+        };
+        Lookup get_direntry(std::string_view dirname, std::string_view name);
+
+        void notify(filewatch::DirectoryEvent::Event event,
+                    std::string_view containing_dir,
+                    std::string_view dir_name,
+                    uint64_t mtime,
+                    uint64_t size,
+                    std::string_view old_name) override;
+
+      private:
+        struct Directory
+        {
+          std::string watched_as;
+          std::size_t watches = 0;
+          bool populated = false;
+          uint64_t version = 0;  // bumped by every event
+          std::map<std::string, fs::DirectoryEntry, std::less<>> entries;
+          // entries whose metadata the events do not tell, e.g., the mtime
+          // of a subdirectory which entries were added to
+          std::set<std::string, std::less<>> stale;
+        };
+
+        // stat the stale entries of dirname, or only name if given, with
+        // lock released, and keep the results if no event arrived for
+        // dirname in the meantime.  lock is held again on return.
+        void refresh_stale(std::unique_lock<std::mutex>& lock,
+                           const std::string& dirname,
+                           std::optional<std::string_view> name = {});
+        // mutex must be held by the callers of these
+        void forget_entries(const std::string& dirname);
+        void mark_stale(const std::string& dirname);
+
+        StatFun stat;
+        ListFun list;
+        mutable std::mutex mutex;
+        std::map<std::string, Directory, std::less<>> directories;
+      };
+
+    }  // namespace dtls
+
+    /// A file system that keeps the listings of watched directories in
+    /// memory
+    class ListingCache
+    {
+    public:
+      virtual ~ListingCache() = default;
+
+      /// Watch dirname as FileSystem::watch() does, and return its entries.
+      /// If dirname is not cached yet and its mtime on disk is still mtime,
+      /// entries are taken as its entries, for the cache and the watch,
+      /// instead of listing it, e.g., the entries of a persisted index.
+      /// Writing to a file does not change the mtime of its directory, so
+      /// the cached entries are stat'ed again when they are first read.
+      virtual std::deque<fs::DirectoryEntry>
+      watch_revalidated(std::string_view dirname,
+                        DirectoryEventListener& listener, uint64_t mtime,
+                        const std::deque<fs::DirectoryEntry>& entries) = 0;
+    };
+
+    /// Serves ls, get_direntry, exists and isdir of watched directories
+    /// from memory.  A directory is listed for the cache once its watch is
+    /// armed, so no change is missed.  The entries are patched by the
+    /// events of SuperClassT, so they are as fresh as the event stream,
+    /// e.g., the size of a file that is still open for writing is the size
+    /// at its last close.
+    /// Everything else is passed through to SuperClassT.
+    template<typename SuperClassT>
+    class CachingFileSystem : public SuperClassT, public ListingCache
+    {
+    public:
+      template<typename... Args>
+      explicit CachingFileSystem(Args&&... args);
+      CachingFileSystem(const CachingFileSystem&) = delete;
+      CachingFileSystem& operator=(const CachingFileSystem&) = delete;
+      CachingFileSystem(CachingFileSystem&&) = delete;
+      CachingFileSystem& operator=(CachingFileSystem&&) = delete;
+      ~CachingFileSystem() override;
+
+      std::deque<fs::DirectoryEntry>
+      ls(std::string_view dirname) const override;
+      fs::Listing list(std::string_view dirname) const override;
+
+      std::optional<fs::DirectoryEntry>
+      get_direntry(std::string_view entryname) const override;
+
+      std::deque<fs::DirectoryEntry>
+      watch_revalidated(std::string_view dirname,
+                        DirectoryEventListener& listener, uint64_t mtime,
+                        const std::deque<fs::DirectoryEntry>& entries) override;
+
+      bool exists(std::string_view filename) const override;
+      bool isdir(std::string_view dirname) const override;
+
+      void watch(std::string_view dirname,
+                 DirectoryEventListener& listener) override;
+      void stop_watching(std::string_view dirname,
+                         DirectoryEventListener& listener) override;
+
+    private:
+      dtls::DirectoryCache::Lookup lookup(std::string_view entryname) const;
+      /// Watch dirname, and return its entries.  The cache of a directory
+      /// not cached yet is made a listener of it by arm, and is filled by
+      /// list after that.  A listing an event arrives during is not cached.
+      std::deque<fs::DirectoryEntry>
+      watch_with(std::string_view dirname, DirectoryEventListener& listener,
+                 const std::function<void()>& arm,
+                 const dtls::DirectoryCache::ListFun& list);
+      /// SuperClassT::watch_listed() if there is one, so the watch takes
+      /// the entries listed for the cache
+      void watch_listed(std::string_view dirname,
+                        DirectoryEventListener& listener,
+                        const std::deque<fs::DirectoryEntry>& entries);
+
+      mutable dtls::DirectoryCache cache;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+
+template<typename SuperClassT>
+template<typename... Args>
+fw::dm::CachingFileSystem<SuperClassT>::CachingFileSystem(Args&&... args) :
+  SuperClassT(std::forward<Args>(args)...),
+  cache([this](const std::string& path) {
+          return SuperClassT::get_direntry(path);
+        },
+        [this](const std::string& dirname) {
+          return SuperClassT::ls(dirname);
+        })
+{
+}
+
+template<typename SuperClassT>
+fw::dm::CachingFileSystem<SuperClassT>::~CachingFileSystem()
+{
+  for (const auto& dirname : cache.watched())
+  {
+    SuperClassT::stop_watching(dirname, cache);
+  }
+}
+
+template<typename SuperClassT>
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::CachingFileSystem<SuperClassT>::ls(std::string_view dirname) const
+{
+  auto entries = cache.ls(dirname);
+  if (entries)
+  {
+    return std::move(*entries);
+  }
+  return SuperClassT::ls(dirname);
+}
+
+template<typename SuperClassT>
+fw::dm::fs::Listing
+fw::dm::CachingFileSystem<SuperClassT>::list(std::string_view dirname) const
+{
+  auto listing = cache.listing(dirname);
+  if (listing)
+  {
+    return std::move(*listing);
+  }
+  return SuperClassT::list(dirname);
+}
+
+template<typename SuperClassT>
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::CachingFileSystem<SuperClassT>::watch_revalidated(
+  std::string_view dirname, DirectoryEventListener& listener, uint64_t mtime,
+  const std::deque<fs::DirectoryEntry>& entries)
+{
+  static auto& reused = statistics().counter("cache.revalidated");
+
+  auto unchanged = [&]() {
+    auto direntry = SuperClassT::get_direntry(dirname);
+    return direntry && direntry->mtime == mtime;
+  };
+  bool taken = false;
+  auto arm = [&]() {
+    if (unchanged())
+    {
+      watch_listed(dirname, cache, entries);
+    }
+    else
+    {
+      SuperClassT::watch(dirname, cache);
+    }
+  };
+  auto listing =
+    watch_with(dirname, listener, arm, [&](const std::string& key) {
+      // again, as an entry added or removed before the watch was armed
+      // changed the mtime
+      if (unchanged())
+      {
+        ++reused;
+        taken = true;
+        return entries;
+      }
+      return SuperClassT::ls(key);
+    });
+  if (taken)
+  {
+    // e.g., a log appended to while the daemon was not running
+    cache.mark_entries_stale(dirname);
+  }
+  return listing;
+}
+
+template<typename SuperClassT>
+fw::dm::dtls::DirectoryCache::Lookup
+fw::dm::CachingFileSystem<SuperClassT>::lookup(std::string_view entryname) const
+{
+  if (entryname.empty() || entryname.front() != '/' || entryname == "/")
+  {
+    return dtls::DirectoryCache::Lookup{false, std::nullopt};
+  }
+  return cache.get_direntry(this->parent(entryname), this->leaf(entryname));
+}
+
+template<typename SuperClassT>
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::CachingFileSystem<SuperClassT>::get_direntry(
+  std::string_view entryname) const
+{
+  auto found = lookup(entryname);
+  if (found.cached)
+  {
+    return found.entry;
+  }
+  return SuperClassT::get_direntry(entryname);
+}
+
+template<typename SuperClassT>
+bool fw::dm::CachingFileSystem<SuperClassT>::exists(
+  std::string_view filename) const
+{
+  auto found = lookup(filename);
+  if (found.cached)
+  {
+    return found.entry.has_value();
+  }
+  return SuperClassT::exists(filename);
+}
+
+template<typename SuperClassT>
+bool fw::dm::CachingFileSystem<SuperClassT>::isdir(
+  std::string_view dirname) const
+{
+  auto found = lookup(dirname);
+  if (found.cached)
+  {
+    return found.entry && found.entry->is_dir;
+  }
+  return SuperClassT::isdir(dirname);
+}
+
+template<typename SuperClassT>
+void fw::dm::CachingFileSystem<SuperClassT>::watch(
+  std::string_view dirname, DirectoryEventListener& listener)
+{
+  watch_with(
+    dirname, listener, [&]() { SuperClassT::watch(dirname, cache); },
+    [this](const std::string& key) { return SuperClassT::ls(key); });
+}
+
+template<typename SuperClassT>
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::CachingFileSystem<SuperClassT>::watch_with(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::function<void()>& arm, const dtls::DirectoryCache::ListFun& list)
+{
+  if (cache.add_watch(dirname))
+  {
+    try
+    {
+      // before the cache is filled, or the changes in between are missed
+      arm();
+    }
+    catch (...)
+    {
+      cache.remove_watch(dirname);
+      throw;
+    }
+  }
+
+  try
+  {
+    SuperClassT::watch(dirname, listener);
+  }
+  catch (...)
+  {
+    if (cache.remove_watch(dirname))
+    {
+      SuperClassT::stop_watching(dirname, cache);
+    }
+    throw;
+  }
+
+  auto entries = cache.ls(dirname, list);
+  return entries ? std::move(*entries) : list(std::string{dirname});
+}
+
+template<typename SuperClassT>
+void fw::dm::CachingFileSystem<SuperClassT>::watch_listed(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::deque<fs::DirectoryEntry>& entries)
+{
+  if constexpr (requires(SuperClassT& base) {
+                  base.watch_listed(dirname, listener, entries);
+                })
+  {
+    SuperClassT::watch_listed(dirname, listener, entries);
+  }
+  else
+  {
+    SuperClassT::watch(dirname, listener);
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::CachingFileSystem<SuperClassT>::stop_watching(
+  std::string_view dirname, DirectoryEventListener& listener)
+{
+  SuperClassT::stop_watching(dirname, listener);
+  if (cache.remove_watch(dirname))
+  {
+    SuperClassT::stop_watching(dirname, cache);
+  }
+}
+
+#endif /* CACHINGFILESYSTEM_H */
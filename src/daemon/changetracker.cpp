@@ -0,0 +1,113 @@
+#include "changetracker.h"
+
+#include "eventjournal.h"
+
+#include <algorithm>
+
+fw::dm::ChangeTracker::ChangeTracker(std::size_t max_changes_) :
+  max_changes(std::max<std::size_t>(max_changes_, 1)),
+  complete_after(last_event_sequence()), current(complete_after)
+{
+}
+
+void fw::dm::ChangeTracker::restart(uint64_t sequence)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  complete_after = sequence;
+  current = sequence;
+  changes.clear();
+  by_generation.clear();
+}
+
+uint64_t fw::dm::ChangeTracker::generation() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  return current;
+}
+
+std::optional<std::vector<fw::dm::ChangeTracker::Change>>
+fw::dm::ChangeTracker::since(uint64_t generation) const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  if (generation < complete_after || generation > current)
+  {
+    return std::nullopt;
+  }
+
+  std::vector<Change> result;
+  for (auto iter = by_generation.upper_bound(generation);
+       iter != std::end(by_generation); ++iter)
+  {
+    result.push_back(changes.find(iter->second)->second);
+  }
+  return result;
+}
+
+void fw::dm::ChangeTracker::add(filewatch::DirectoryEvent::Event event,
+                                std::string_view dir_name,
+                                uint64_t mtime,
+                                uint64_t size,
+                                std::string_view old_name,
+                                uint64_t sequence)
+{
+  using filewatch::DirectoryEvent;
+
+  std::lock_guard<std::mutex> sentry(mutex);
+  switch (event)
+  {
+  case DirectoryEvent::FILE_ADDED:
+  case DirectoryEvent::FILE_MODIFIED:
+    record(dir_name, sequence, true, false, mtime, size);
+    break;
+  case DirectoryEvent::DIRECTORY_ADDED:
+    record(dir_name, sequence, true, true, mtime, 0);
+    break;
+  case DirectoryEvent::FILE_REMOVED:
+  case DirectoryEvent::DIRECTORY_REMOVED:
+    record(dir_name, sequence, false,
+           event == DirectoryEvent::DIRECTORY_REMOVED, 0, 0);
+    break;
+  case DirectoryEvent::FILE_RENAMED:
+  case DirectoryEvent::DIRECTORY_RENAMED:
+  {
+    const bool is_dir = event == DirectoryEvent::DIRECTORY_RENAMED;
+    record(old_name, sequence, false, is_dir, 0, 0);
+    record(dir_name, sequence, true, is_dir, mtime, size);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void fw::dm::ChangeTracker::record(std::string_view name, uint64_t generation,
+                                   bool exists, bool is_dir, uint64_t mtime,
+                                   uint64_t size)
+{
+  current = generation;
+  auto iter = changes.find(name);
+  if (iter != std::end(changes))
+  {
+    auto [first, last] = by_generation.equal_range(iter->second.generation);
+    by_generation.erase(std::find_if(
+      first, last, [&](const auto& g) { return g.second == iter->first; }));
+    iter->second = Change{iter->first, generation, exists, is_dir, mtime, size};
+  }
+  else
+  {
+    std::string key{name};
+    iter = changes
+             .emplace(key, Change{key, generation, exists, is_dir, mtime, size})
+             .first;
+  }
+  by_generation.emplace(generation, iter->first);
+
+  if (changes.size() > max_changes)
+  {
+    // forget the entry changed longest ago
+    auto oldest = std::begin(by_generation);
+    complete_after = oldest->first;
+    changes.erase(oldest->second);
+    by_generation.erase(oldest);
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef CHANGETRACKER_H
+#define CHANGETRACKER_H
+
+#include "filewatch.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    /// Remembers which entries of one directory changed at which
+    /// generation, to answer "what changed since generation g?" without
+    /// listing the directory.  Generations are the sequence numbers the
+    /// events were given, see next_event_sequence(), so that they compare
+    /// to the ones of a ListenForEvents stream.  Only the latest change of
+    /// every entry is kept, and at most max_changes entries.  Thread safe.
+    class ChangeTracker
+    {
+    public:
+      struct Change
+      {
+        std::string name;
+        uint64_t generation;
+        bool exists;  // false if the entry was removed
+        bool is_dir;
+        uint64_t mtime;
+        uint64_t size;
+      };
+
+      /// Changes are tracked from the current generation on
+      explicit ChangeTracker(std::size_t max_changes);
+
+      /// Forget the changes, and track the ones after sequence
+      void restart(uint64_t sequence);
+
+      /// The current generation, i.e., the one of the latest change
+      uint64_t generation() const;
+
+      /// The latest change of every entry changed after generation, oldest
+      /// first, or nothing if they are not known.
+      std::optional<std::vector<Change>> since(uint64_t generation) const;
+
+      /// Record the change of dir_name by an event of the directory, whose
+      /// sequence number must be larger than the ones recorded before it.
+      /// A rename records both names at sequence.
+      void add(filewatch::DirectoryEvent::Event event,
+               std::string_view dir_name,
+               uint64_t mtime,
+               uint64_t size,
+               std::string_view old_name,
+               uint64_t sequence);
+
+    private:
+      // mutex must be held
+      void record(std::string_view name, uint64_t generation, bool exists,
+                  bool is_dir, uint64_t mtime, uint64_t size);
+
+      std::size_t max_changes;
+      mutable std::mutex mutex;
+      uint64_t complete_after;  // no change after this was forgotten
+      uint64_t current;
+      std::map<std::string, Change, std::less<>> changes;
+      std::multimap<uint64_t, std::string> by_generation;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* CHANGETRACKER_H */
@@ -1,30 +1,103 @@
 #include "defaultfilesystem.h"
 
+#include "details/directoryreader.h"
+
 #include <spdlog/spdlog.h>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif  // __linux__
+
+#include <algorithm>
+#include <array>
 #include <fstream>
 
 fw::dm::DefaultFileSystem::DefaultFileSystem(std::string_view rootdir_) :
   FileSystem(std::filesystem::absolute(std::filesystem::path(rootdir_)))
 {
+#ifdef __linux__
+  try
+  {
+    handles = std::make_unique<dtls::DirectoryHandles>(rootdir.string());
+  }
+  catch (const std::runtime_error& e)
+  {
+    spdlog::warn("Resolving paths from /: {}", e.what());
+  }
+#endif  // __linux__
 }
 
 std::deque<fw::dm::fs::DirectoryEntry>
 fw::dm::DefaultFileSystem::ls(std::string_view dirname) const
 {
-  auto dir = join(rootdir.string(), dirname);
+#ifdef __linux__
+  // getdents64, and one statx per entry relative to the directory
+  const auto dir = resolve(dirname);
+  return dtls::DirectoryReader(dir.fd(), dir.relative).entries();
+#else
   std::deque<fw::dm::fs::DirectoryEntry> entries;
-  for (const auto& p : std::filesystem::directory_iterator(dir))
+  for (const auto& p :
+       std::filesystem::directory_iterator(join(rootdir.string(), dirname)))
   {
     entries.push_back(create_direntry(p.path()));
   }
 
   return entries;
+#endif  // __linux__
+}
+
+fw::dm::fs::Listing
+fw::dm::DefaultFileSystem::list(std::string_view dirname) const
+{
+#ifdef __linux__
+  const auto dir = resolve(dirname);
+  return dtls::DirectoryReader(dir.fd(), dir.relative).listing();
+#else
+  return FileSystem::list(dirname);
+#endif  // __linux__
+}
+
+fw::dm::fs::ListingPage
+fw::dm::DefaultFileSystem::list_page(std::string_view dirname,
+                                     uint64_t cursor,
+                                     std::size_t max_entries) const
+{
+#ifdef __linux__
+  // continues at the getdents64 offset, so only the page is read
+  const auto dir = resolve(dirname);
+  return dtls::DirectoryReader(dir.fd(), dir.relative)
+    .page(cursor, max_entries);
+#else
+  return FileSystem::list_page(dirname, cursor, max_entries);
+#endif  // __linux__
 }
 
 std::optional<fw::dm::fs::DirectoryEntry>
 fw::dm::DefaultFileSystem::get_direntry(std::string_view entryname) const
 {
+#ifdef __linux__
+  auto path = entryname;
+  while (!path.empty() && path.back() == '/')
+  {
+    path.remove_suffix(1);
+  }
+  if (path.empty())
+  {
+    return dtls::stat_entry(join(rootdir.string(), entryname));
+  }
+
+  // relative to the containing directory, so a watched directory that has
+  // been removed is not found through its own handle
+  const auto pos = path.find_last_of('/');
+  const auto dir =
+    resolve(pos == std::string_view::npos ? "/" : path.substr(0, pos));
+  const std::string name{
+    pos == std::string_view::npos ? path : path.substr(pos + 1)};
+  return dtls::stat_entry(dir.fd(), dir.relative == "."
+                                      ? name
+                                      : join(dir.relative, name));
+#else
   auto name = join(rootdir.string(), entryname);
   if (!std::filesystem::exists(name))
   {
@@ -32,24 +105,93 @@ fw::dm::DefaultFileSystem::get_direntry(std::string_view entryname) const
   }
 
   return create_direntry(name);
+#endif  // __linux__
 }
 
 bool fw::dm::DefaultFileSystem::exists(std::string_view filename) const
 {
+#ifdef __linux__
+  return get_direntry(filename).has_value();
+#else
   return std::filesystem::exists(join(rootdir.string(), filename));
+#endif  // __linux__
 }
 
 bool fw::dm::DefaultFileSystem::isdir(std::string_view dirname) const
 {
+#ifdef __linux__
+  auto dirent = get_direntry(dirname);
+  return dirent && dirent->is_dir;
+#else
   return std::filesystem::is_directory(join(rootdir.string(), dirname));
+#endif  // __linux__
 }
 
 std::string fw::dm::DefaultFileSystem::read(std::string_view filepath) const
 {
+#ifdef __linux__
+  const auto file = resolve(filepath);
+  const int fd =
+    ::openat(file.fd(), file.relative.c_str(), O_RDONLY | O_CLOEXEC);
+  std::string contents;
+  if (fd == -1)
+  {
+    return contents;
+  }
+  std::array<char, 64 * 1024> buffer;
+  for (;;)
+  {
+    auto size = ::read(fd, buffer.data(), buffer.size());
+    if (size <= 0)
+    {
+      break;
+    }
+    contents.append(buffer.data(), static_cast<std::size_t>(size));
+  }
+  ::close(fd);
+  // like std::getline up to '\0'
+  contents.resize(std::min(contents.size(), contents.find('\0')));
+  return contents;
+#else
   std::ifstream in(join(rootdir.string(), filepath));
   std::string contents;
   std::getline(in, contents, '\0');
   return contents;
+#endif  // __linux__
+}
+
+fw::dm::dtls::ResolvedPath
+fw::dm::DefaultFileSystem::resolve(std::string_view path) const
+{
+  if (handles == nullptr)
+  {
+    return dtls::ResolvedPath{nullptr, join(rootdir.string(), path)};
+  }
+  return handles->resolve(path);
+}
+
+void fw::dm::DefaultFileSystem::hold_directory(std::string_view dirname)
+{
+  if (handles != nullptr)
+  {
+    handles->hold(dirname);
+  }
+}
+
+void fw::dm::DefaultFileSystem::release_directory(std::string_view dirname)
+{
+  if (handles != nullptr)
+  {
+    handles->release(dirname);
+  }
+}
+
+void fw::dm::DefaultFileSystem::directory_moved(std::string_view dirname)
+{
+  if (handles != nullptr)
+  {
+    handles->invalidate(dirname);
+  }
 }
 
 namespace
@@ -70,12 +212,16 @@ namespace
     using ms64_t = duration<uint64_t, std::ratio<1, 1000>>;
     auto msecs = duration_cast<ms64_t>(t).count();
 
-    auto tp_t_c = decltype(sctp)::clock::to_time_t(sctp);
-    auto* tp_c = std::localtime(&tp_t_c);
-    std::ostringstream ost;
-    ost << std::put_time(tp_c, "%F %T");
-    spdlog::debug("path {} last write time: {} ms since epoch (at {}).\n",
-                  p.string(), msecs, ost.str());
+    // formatting the local time is expensive, so only when it is logged
+    if (spdlog::should_log(spdlog::level::debug))
+    {
+      auto tp_t_c = decltype(sctp)::clock::to_time_t(sctp);
+      auto* tp_c = std::localtime(&tp_t_c);
+      std::ostringstream ost;
+      ost << std::put_time(tp_c, "%F %T");
+      spdlog::debug("path {} last write time: {} ms since epoch (at {}).\n",
+                    p.string(), msecs, ost.str());
+    }
 
     return static_cast<uint64_t>(msecs);
   }
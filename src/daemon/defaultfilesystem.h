@@ -1,9 +1,11 @@
 #ifndef DEFAULTFILESYSTEM_H
 #define DEFAULTFILESYSTEM_H
 
+#include "daemon/details/directoryhandles.h"
 #include "daemon/filesystem.h"
 
 #include <filesystem>
+#include <memory>
 
 namespace fw
 {
@@ -16,6 +18,9 @@ namespace fw
 
       std::deque<fs::DirectoryEntry>
       ls(std::string_view dirname) const override;
+      fs::Listing list(std::string_view dirname) const override;
+      fs::ListingPage list_page(std::string_view dirname, uint64_t cursor,
+                                std::size_t max_entries) const override;
 
       std::optional<fs::DirectoryEntry>
       get_direntry(std::string_view entryname) const override;
@@ -27,6 +32,19 @@ namespace fw
 
     protected:
       static fs::DirectoryEntry create_direntry(const std::filesystem::path& p);
+
+      /// path relative to the open directory nearest above it, on Linux, or
+      /// else the absolute path
+      dtls::ResolvedPath resolve(std::string_view path) const;
+
+      void hold_directory(std::string_view dirname) override;
+      void release_directory(std::string_view dirname) override;
+      void directory_moved(std::string_view dirname) override;
+
+    private:
+      // the root and the watched directories, kept open; nullptr if not
+      // available
+      std::unique_ptr<dtls::DirectoryHandles> handles;
     };
 
   }  // namespace dm
@@ -0,0 +1,430 @@
+#include "daemon/details/directoryhandles.h"
+
+#ifdef __linux__
+
+#  include <fcntl.h>
+#  include <sys/inotify.h>
+#  include <unistd.h>
+
+#  include <spdlog/spdlog.h>
+
+#  include <algorithm>
+#  include <array>
+#  include <cerrno>
+#  include <cstring>
+#  include <sstream>
+#  include <stdexcept>
+
+namespace
+{
+  /// path without the slashes at its ends, "" for the root
+  std::string_view normalized(std::string_view path)
+  {
+    while (!path.empty() && path.front() == '/')
+    {
+      path.remove_prefix(1);
+    }
+    while (!path.empty() && path.back() == '/')
+    {
+      path.remove_suffix(1);
+    }
+    return path;
+  }
+
+}  // anonymous namespace
+
+fw::dm::dtls::DirectoryHandle::~DirectoryHandle() { ::close(fd); }
+
+int fw::dm::dtls::ResolvedPath::fd() const
+{
+  return dir ? dir->fd : AT_FDCWD;
+}
+
+fw::dm::dtls::DirectoryHandles::DirectoryHandles(
+  const std::string& rootdir_) :
+  rootdir(rootdir_)
+{
+  auto fd = ::open(rootdir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    std::ostringstream ost;
+    ost << "Could not open " << rootdir << ": " << std::strerror(errno)
+        << " [" << errno << "].";
+    throw std::runtime_error(ost.str());
+  }
+  root = std::make_shared<const DirectoryHandle>(fd);
+
+  inotify_fd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);  // NOLINT
+  if (inotify_fd == -1)
+  {
+    spdlog::warn("Moves of directories above held ones are not noticed: {}",
+                 std::strerror(errno));
+  }
+}
+
+fw::dm::dtls::DirectoryHandles::~DirectoryHandles()
+{
+  if (inotify_fd != -1)
+  {
+    ::close(inotify_fd);
+  }
+}
+
+void fw::dm::dtls::DirectoryHandles::hold(std::string_view dirname)
+{
+  const auto key = normalized(dirname);
+  if (key.empty())
+  {
+    return;  // the root is always open
+  }
+
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    auto iter = held.find(key);
+    if (iter == std::end(held))
+    {
+      iter = held.emplace(std::string{key}, Entry{}).first;
+    }
+    if (iter->second.holds++ > 0)
+    {
+      return;
+    }
+  }
+  open(std::string{key});
+}
+
+void fw::dm::dtls::DirectoryHandles::release(std::string_view dirname)
+{
+  const auto key = normalized(dirname);
+  std::lock_guard<std::mutex> watches_sentry(watches_mutex);
+  std::vector<int> wds;
+  std::string below;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    auto iter = held.find(key);
+    if (iter == std::end(held) || --iter->second.holds > 0)
+    {
+      return;
+    }
+    held.erase(iter);
+
+    // the watched directories no held directory is below anymore
+    auto ancestor = key;
+    while (!ancestor.empty())
+    {
+      auto w = watched.find(ancestor);
+      if (w != std::end(watched) && !holds_below(ancestor))
+      {
+        wds.push_back(w->second);
+        watched_by_descriptor.erase(w->second);
+        watched.erase(w);
+      }
+      auto pos = ancestor.find_last_of('/');
+      ancestor = pos == std::string_view::npos ? std::string_view{}
+                                               : ancestor.substr(0, pos);
+    }
+
+    // not held anymore, so the directories held below it learn of its
+    // moves from its watch
+    if (holds_below(key))
+    {
+      below = held.upper_bound(key)->first;
+    }
+  }
+  remove_watches(wds);
+  if (!below.empty())
+  {
+    watch_ancestors_locked(below);
+  }
+}
+
+void fw::dm::dtls::DirectoryHandles::invalidate(std::string_view dirname)
+{
+  std::vector<int> wds;
+  {
+    std::lock_guard<std::mutex> watches_sentry(watches_mutex);
+    std::lock_guard<std::mutex> sentry(mutex);
+    wds = invalidate_locked(normalized(dirname));
+  }
+  remove_watches(wds);
+}
+
+fw::dm::dtls::ResolvedPath
+fw::dm::dtls::DirectoryHandles::resolve(std::string_view path) const
+{
+  read_moves();
+
+  const auto key = normalized(path);
+  std::string closed;
+  ResolvedPath resolved;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    resolved = resolve_locked(key, closed);
+  }
+
+  // invalidated, or missing when it was held
+  if (!closed.empty())
+  {
+    if (auto handle = open(closed))
+    {
+      auto rest = key.substr(closed.size());
+      return ResolvedPath{handle,
+                          rest.empty() ? "." : std::string{rest.substr(1)}};
+    }
+  }
+  return resolved;
+}
+
+std::size_t fw::dm::dtls::DirectoryHandles::size() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  return static_cast<std::size_t>(
+    std::count_if(std::begin(held), std::end(held),
+                  [](const auto& h) { return h.second.handle != nullptr; }));
+}
+
+fw::dm::dtls::ResolvedPath
+fw::dm::dtls::DirectoryHandles::resolve_locked(std::string_view path,
+                                               std::string& closed) const
+{
+  // the nearest held directory at or above path
+  auto ancestor = path;
+  while (!ancestor.empty())
+  {
+    auto iter = held.find(ancestor);
+    if (iter != std::end(held))
+    {
+      if (iter->second.handle)
+      {
+        auto rest = path.substr(ancestor.size());
+        return ResolvedPath{iter->second.handle,
+                            rest.empty() ? "." : std::string{rest.substr(1)}};
+      }
+      if (closed.empty())
+      {
+        closed = iter->first;
+      }
+    }
+    auto pos = ancestor.find_last_of('/');
+    ancestor = pos == std::string_view::npos ? std::string_view{}
+                                             : ancestor.substr(0, pos);
+  }
+  return ResolvedPath{root, path.empty() ? "." : std::string{path}};
+}
+
+std::shared_ptr<const fw::dm::dtls::DirectoryHandle>
+fw::dm::dtls::DirectoryHandles::open(const std::string& dirname) const
+{
+  uint64_t seen = 0;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    seen = invalidations;
+  }
+
+  // watched before dirname is opened, so a move after the open is noticed
+  {
+    std::lock_guard<std::mutex> watches_sentry(watches_mutex);
+    watch_ancestors_locked(dirname);
+  }
+
+  auto fd = ::openat(root->fd, dirname.c_str(),
+                     O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    spdlog::debug("Unable to open {}: {}", dirname, std::strerror(errno));
+    return nullptr;
+  }
+  auto handle = std::make_shared<const DirectoryHandle>(fd);
+
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = held.find(dirname);
+  if (iter == std::end(held) || invalidations != seen)
+  {
+    return nullptr;
+  }
+  if (!iter->second.handle)
+  {
+    iter->second.handle = std::move(handle);
+  }
+  return iter->second.handle;
+}
+
+std::vector<int>
+fw::dm::dtls::DirectoryHandles::invalidate_locked(std::string_view key) const
+{
+  // at or below key, and not, e.g., "a-b" for "a"
+  auto is_below = [key](std::string_view name) {
+    const auto rest = name.substr(key.size());
+    return key.empty() || rest.empty() || rest.front() == '/';
+  };
+
+  ++invalidations;
+  for (auto iter = held.lower_bound(key);
+       iter != std::end(held) && iter->first.starts_with(key); ++iter)
+  {
+    if (is_below(iter->first))
+    {
+      iter->second.handle.reset();
+    }
+  }
+
+  // the watches moved along, and are watched again at their paths when
+  // the directories below them are opened again
+  std::vector<int> wds;
+  auto iter = watched.lower_bound(key);
+  while (iter != std::end(watched) && iter->first.starts_with(key))
+  {
+    if (is_below(iter->first))
+    {
+      wds.push_back(iter->second);
+      watched_by_descriptor.erase(iter->second);
+      iter = watched.erase(iter);
+    }
+    else
+    {
+      ++iter;
+    }
+  }
+  return wds;
+}
+
+void fw::dm::dtls::DirectoryHandles::read_moves() const
+{
+  if (inotify_fd == -1)
+  {
+    return;
+  }
+
+  alignas(inotify_event) std::array<char, 4096> buffer{};
+  for (;;)
+  {
+    auto count = ::read(inotify_fd, buffer.data(), buffer.size());
+    if (count <= 0)
+    {
+      return;  // EAGAIN when no directory was moved
+    }
+
+    std::vector<int> wds;
+    {
+      std::lock_guard<std::mutex> watches_sentry(watches_mutex);
+      std::lock_guard<std::mutex> sentry(mutex);
+      for (ssize_t pos = 0; pos < count;)
+      {
+        const auto* evt =
+          reinterpret_cast<const inotify_event*>(buffer.data() + pos);
+        pos += static_cast<ssize_t>(sizeof(inotify_event) + evt->len);
+
+        std::vector<int> removed;
+        if ((evt->mask & IN_Q_OVERFLOW) != 0)  // NOLINT
+        {
+          removed = invalidate_locked({});
+        }
+        else if ((evt->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) != 0)  // NOLINT
+        {
+          auto w = watched_by_descriptor.find(evt->wd);
+          if (w != std::end(watched_by_descriptor))
+          {
+            const std::string dirname = w->second;
+            removed = invalidate_locked(dirname);
+          }
+        }
+        wds.insert(std::end(wds), std::begin(removed), std::end(removed));
+      }
+    }
+    remove_watches(wds);
+  }
+}
+
+void fw::dm::dtls::DirectoryHandles::watch_ancestors_locked(
+  std::string_view dirname) const
+{
+  if (inotify_fd == -1)
+  {
+    return;
+  }
+
+  std::vector<std::string> ancestors;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    auto pos = dirname.find_last_of('/');
+    while (pos != std::string_view::npos)
+    {
+      dirname = dirname.substr(0, pos);
+      if (held.find(dirname) == std::end(held)
+          && watched.find(dirname) == std::end(watched))
+      {
+        ancestors.emplace_back(dirname);
+      }
+      pos = dirname.find_last_of('/');
+    }
+  }
+
+  for (const auto& ancestor : ancestors)
+  {
+    const auto path = rootdir + "/" + ancestor;
+    auto wd = ::inotify_add_watch(
+      inotify_fd, path.c_str(),
+      IN_MOVE_SELF | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW);  // NOLINT
+    if (wd == -1)
+    {
+      spdlog::debug("Unable to watch {} for moves: {}", ancestor,
+                    std::strerror(errno));
+      continue;
+    }
+    watched.emplace(ancestor, wd);
+    watched_by_descriptor.emplace(wd, ancestor);
+  }
+}
+
+bool fw::dm::dtls::DirectoryHandles::holds_below(
+  std::string_view dirname) const
+{
+  const auto prefix = std::string{dirname} + "/";
+  auto iter = held.lower_bound(prefix);
+  return iter != std::end(held) && iter->first.starts_with(prefix);
+}
+
+void fw::dm::dtls::DirectoryHandles::remove_watches(
+  const std::vector<int>& wds) const
+{
+  for (auto wd : wds)
+  {
+    // fails for the watches of removed directories, which are gone already
+    ::inotify_rm_watch(inotify_fd, wd);
+  }
+}
+
+#else  // __linux__
+
+#  include <stdexcept>
+
+fw::dm::dtls::DirectoryHandle::~DirectoryHandle() = default;
+
+int fw::dm::dtls::ResolvedPath::fd() const { return -1; }
+
+fw::dm::dtls::DirectoryHandles::DirectoryHandles(
+  const std::string& /*rootdir*/)
+{
+  throw std::runtime_error("Directory handles require Linux");
+}
+
+fw::dm::dtls::DirectoryHandles::~DirectoryHandles() = default;
+
+void fw::dm::dtls::DirectoryHandles::hold(std::string_view /*dirname*/) {}
+
+void fw::dm::dtls::DirectoryHandles::release(std::string_view /*dirname*/) {}
+
+void fw::dm::dtls::DirectoryHandles::invalidate(
+  std::string_view /*dirname*/)
+{
+}
+
+fw::dm::dtls::ResolvedPath
+fw::dm::dtls::DirectoryHandles::resolve(std::string_view path) const
+{
+  return ResolvedPath{nullptr, std::string{path}};
+}
+
+std::size_t fw::dm::dtls::DirectoryHandles::size() const { return 0; }
+
+#endif  // __linux__
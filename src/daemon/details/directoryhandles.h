@@ -0,0 +1,130 @@
+#ifndef details_directoryhandles_h
+#define details_directoryhandles_h
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// An open O_PATH file descriptor of a directory
+      class DirectoryHandle
+      {
+      public:
+        explicit DirectoryHandle(int fd_) : fd(fd_) {}
+        DirectoryHandle(const DirectoryHandle&) = delete;
+        DirectoryHandle& operator=(const DirectoryHandle&) = delete;
+        DirectoryHandle(DirectoryHandle&&) = delete;
+        DirectoryHandle& operator=(DirectoryHandle&&) = delete;
+        ~DirectoryHandle();
+
+        const int fd;
+      };
+
+      /// A path relative to an open directory, for the *at() syscalls.  The
+      /// directory stays open while the ResolvedPath lives.
+      struct ResolvedPath
+      {
+        std::shared_ptr<const DirectoryHandle> dir;
+        std::string relative;  // "." for the directory itself
+
+        int fd() const;  // AT_FDCWD if dir is nullptr
+      };
+
+      /// O_PATH file descriptors of the root directory and of the
+      /// directories held below it, e.g., the watched ones.  A path is
+      /// resolved relative to the nearest held directory above it, and
+      /// relative to the root otherwise.  A held descriptor follows its
+      /// directory when it, or a directory above it, is renamed.  The owner
+      /// invalidates the held directories it learns were moved or removed,
+      /// and the directories between the root and the held ones that are
+      /// not held themselves are watched for moves here.  An invalidated
+      /// directory is opened again at its path when a path below it is
+      /// resolved.  Directories are named relative to the root, "/" being
+      /// the root.
+      /// Thread safe, and no syscall is made with the lock held.  A
+      /// resolution reads the reported moves without blocking, and only
+      /// opens a directory that was invalidated.  Only available on Linux;
+      /// elsewhere the constructor throws.
+      class DirectoryHandles
+      {
+      public:
+        /// Throws std::runtime_error if rootdir cannot be opened
+        explicit DirectoryHandles(const std::string& rootdir);
+        DirectoryHandles(const DirectoryHandles&) = delete;
+        DirectoryHandles& operator=(const DirectoryHandles&) = delete;
+        DirectoryHandles(DirectoryHandles&&) = delete;
+        DirectoryHandles& operator=(DirectoryHandles&&) = delete;
+        ~DirectoryHandles();
+
+        /// Keep dirname open until it is released as many times.  A
+        /// directory that cannot be opened is resolved by path instead.
+        void hold(std::string_view dirname);
+        void release(std::string_view dirname);
+        /// Close dirname and the directories held below it, e.g., when
+        /// dirname was renamed or removed.  They stay held, and are opened
+        /// again at their path when a path below them is resolved.
+        void invalidate(std::string_view dirname);
+
+        ResolvedPath resolve(std::string_view path) const;
+
+        std::size_t size() const;
+
+      private:
+        struct Entry
+        {
+          std::shared_ptr<const DirectoryHandle> handle;
+          std::size_t holds = 0;
+        };
+
+        /// The handle of the held directory at or nearest above path, or
+        /// the root.  closed is set to a held directory nearer to path
+        /// whose handle is closed.  mutex must be held.
+        ResolvedPath resolve_locked(std::string_view path,
+                                    std::string& closed) const;
+        /// Open dirname at its path, and keep the handle if dirname is
+        /// still held and nothing was invalidated meanwhile
+        std::shared_ptr<const DirectoryHandle>
+        open(const std::string& dirname) const;
+        /// Close dirname and the directories held below it, and forget the
+        /// watches of the directories at and below it.  mutex and
+        /// watches_mutex must be held.  Returns the watches to remove.
+        std::vector<int> invalidate_locked(std::string_view dirname) const;
+        /// Invalidate the directories the kernel reported moves of
+        void read_moves() const;
+        /// Watch the directories above dirname that are not held or
+        /// watched yet.  watches_mutex must be held.
+        void watch_ancestors_locked(std::string_view dirname) const;
+        /// True if a directory below dirname is held.  mutex must be held.
+        bool holds_below(std::string_view dirname) const;
+        void remove_watches(const std::vector<int>& wds) const;
+
+        std::shared_ptr<const DirectoryHandle> root;
+        std::string rootdir;
+        int inotify_fd = -1;  // moves of the watched directories
+        mutable std::mutex mutex;
+        // handles are opened again when they are found to be moved
+        mutable std::map<std::string, Entry, std::less<>> held;
+        // bumped by every invalidation, so a directory opened meanwhile
+        // is not kept
+        mutable uint64_t invalidations = 0;
+        // serializes the changes of the watches, taken before mutex
+        mutable std::mutex watches_mutex;
+        mutable std::map<std::string, int, std::less<>> watched;
+        mutable std::map<int, std::string> watched_by_descriptor;
+      };
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+#endif  // details_directoryhandles_h
@@ -0,0 +1,297 @@
+#include "daemon/details/directoryreader.h"
+
+#ifdef __linux__
+
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+
+#  include <spdlog/spdlog.h>
+
+#  include <array>
+#  include <cerrno>
+#  include <cstddef>
+#  include <cstring>
+#  include <sstream>
+#  include <stdexcept>
+
+namespace
+{
+  /// The records getdents64 fills the buffer with
+  struct LinuxDirent64
+  {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];  // NOLINT - NUL terminated, d_reclen long
+  };
+
+  constexpr std::size_t buffer_size = 64 * 1024;
+
+  [[noreturn]] void throw_errno(const char* what, const std::string& path)
+  {
+    std::ostringstream ost;
+    ost << what << " " << path << ": " << std::strerror(errno) << " ["
+        << errno << "].";
+    throw std::runtime_error(ost.str());
+  }
+
+  uint64_t mtime_ms(const struct statx& stx)
+  {
+    return static_cast<uint64_t>(stx.stx_mtime.tv_sec) * 1000
+           + stx.stx_mtime.tv_nsec / 1000000;
+  }
+
+  /// What statx is asked for, given the d_type of an entry: the type is
+  /// known for directories and regular files, and directories have no size
+  unsigned statx_mask(unsigned char type)
+  {
+    switch (type)
+    {
+    case DT_DIR:
+      return STATX_MTIME;
+    case DT_REG:
+      return STATX_MTIME | STATX_SIZE;
+    default:
+      return STATX_TYPE | STATX_MTIME | STATX_SIZE;
+    }
+  }
+
+  std::optional<fw::dm::fs::DirectoryEntry>
+  statx_entry(int dirfd, const char* name, unsigned char type)
+  {
+    struct statx stx{};
+    if (::statx(dirfd, name, AT_STATX_SYNC_AS_STAT, statx_mask(type), &stx)
+        == -1)
+    {
+      spdlog::debug("statx({}) failed: {}", name, std::strerror(errno));
+      return std::nullopt;
+    }
+
+    fw::dm::fs::DirectoryEntry dirent;
+    dirent.is_dir =
+      type == DT_DIR || (type != DT_REG && S_ISDIR(stx.stx_mode));
+    dirent.mtime = mtime_ms(stx);
+    dirent.size = dirent.is_dir ? 0 : stx.stx_size;
+    return dirent;
+  }
+
+}  // anonymous namespace
+
+fw::dm::dtls::DirectoryReader::DirectoryReader(const std::string& path_) :
+  DirectoryReader(AT_FDCWD, path_)
+{
+}
+
+fw::dm::dtls::DirectoryReader::DirectoryReader(int atfd,
+                                               const std::string& path_) :
+  path(path_)
+{
+  dirfd = ::openat(atfd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd == -1)
+  {
+    throw_errno("Could not open", path);
+  }
+}
+
+fw::dm::dtls::DirectoryReader::~DirectoryReader() { ::close(dirfd); }
+
+void fw::dm::dtls::DirectoryReader::for_each(const Visitor& visit) const
+{
+  for_each_from(0,
+                [&](std::string_view name, unsigned char type, uint64_t) {
+                  visit(name, type);
+                  return true;
+                });
+}
+
+bool fw::dm::dtls::DirectoryReader::for_each_from(
+  uint64_t position, const PositionedVisitor& visit) const
+{
+  if (::lseek(dirfd, static_cast<off_t>(position), SEEK_SET) == -1)
+  {
+    throw_errno("Could not seek in", path);
+  }
+
+  alignas(LinuxDirent64) std::array<char, buffer_size> buffer;
+  for (;;)
+  {
+    auto size = ::syscall(SYS_getdents64, dirfd, buffer.data(), buffer.size());
+    if (size == -1)
+    {
+      throw_errno("Could not read", path);
+    }
+    if (size == 0)
+    {
+      return true;
+    }
+
+    for (std::size_t offset = 0; offset < static_cast<std::size_t>(size);)
+    {
+      const auto* dirent =
+        reinterpret_cast<const LinuxDirent64*>(&buffer[offset]);  // NOLINT
+      offset += dirent->d_reclen;
+      std::string_view name{&dirent->d_name[0]};  // NOLINT
+      if (name == "." || name == "..")
+      {
+        continue;
+      }
+      if (!visit(name, dirent->d_type, static_cast<uint64_t>(dirent->d_off)))
+      {
+        return false;
+      }
+    }
+  }
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::DirectoryReader::stat(std::string_view name,
+                                    unsigned char type) const
+{
+  std::string entryname{name};
+  auto dirent = statx_entry(dirfd, entryname.c_str(), type);
+  if (dirent)
+  {
+    dirent->name = std::move(entryname);
+  }
+  return dirent;  // nothing if removed since it was listed
+}
+
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::DirectoryReader::entries() const
+{
+  std::deque<fs::DirectoryEntry> result;
+  for_each([&](std::string_view name, unsigned char type) {
+    auto dirent = stat(name, type);
+    if (dirent)
+    {
+      result.push_back(std::move(*dirent));
+    }
+  });
+  return result;
+}
+
+fw::dm::fs::Listing fw::dm::dtls::DirectoryReader::listing() const
+{
+  fs::Listing result;
+  for_each([&](std::string_view name, unsigned char type) {
+    // name is NUL terminated in the getdents64 buffer
+    auto dirent = statx_entry(dirfd, name.data(), type);
+    if (dirent)
+    {
+      result.add(name, dirent->is_dir, dirent->mtime, dirent->size);
+    }
+  });
+  return result;
+}
+
+fw::dm::fs::ListingPage
+fw::dm::dtls::DirectoryReader::page(uint64_t position,
+                                    std::size_t max_entries) const
+{
+  fs::ListingPage result;
+  result.next = position;
+  result.end = for_each_from(
+    position, [&](std::string_view name, unsigned char type, uint64_t next) {
+      if (result.entries.size() == max_entries)
+      {
+        return false;
+      }
+      auto dirent = statx_entry(dirfd, name.data(), type);
+      if (dirent)
+      {
+        result.entries.add(name, dirent->is_dir, dirent->mtime, dirent->size);
+        result.cursors.push_back(next);
+      }
+      result.next = next;
+      return true;
+    });
+  return result;
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::stat_entry(const std::string& path)
+{
+  return stat_entry(AT_FDCWD, path);
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::stat_entry(int dirfd, const std::string& path)
+{
+  auto dirent = statx_entry(dirfd, path.c_str(), DT_UNKNOWN);
+  if (dirent)
+  {
+    auto pos = path.find_last_of('/');
+    dirent->name = pos == std::string::npos ? path : path.substr(pos + 1);
+  }
+  return dirent;
+}
+
+#else  // __linux__
+
+#  include <stdexcept>
+
+fw::dm::dtls::DirectoryReader::DirectoryReader(const std::string& /*path*/)
+{
+  throw std::runtime_error("getdents64 requires Linux");
+}
+
+fw::dm::dtls::DirectoryReader::DirectoryReader(int /*atfd*/,
+                                               const std::string& /*path*/)
+{
+  throw std::runtime_error("getdents64 requires Linux");
+}
+
+fw::dm::dtls::DirectoryReader::~DirectoryReader() = default;
+
+void fw::dm::dtls::DirectoryReader::for_each(const Visitor& /*visit*/) const
+{
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::DirectoryReader::stat(std::string_view /*name*/,
+                                    unsigned char /*type*/) const
+{
+  return std::nullopt;
+}
+
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::DirectoryReader::entries() const
+{
+  return {};
+}
+
+fw::dm::fs::Listing fw::dm::dtls::DirectoryReader::listing() const
+{
+  return {};
+}
+
+bool fw::dm::dtls::DirectoryReader::for_each_from(
+  uint64_t /*position*/, const PositionedVisitor& /*visit*/) const
+{
+  return true;
+}
+
+fw::dm::fs::ListingPage
+fw::dm::dtls::DirectoryReader::page(uint64_t /*position*/,
+                                    std::size_t /*max_entries*/) const
+{
+  return {};
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::stat_entry(const std::string& /*path*/)
+{
+  return std::nullopt;
+}
+
+std::optional<fw::dm::fs::DirectoryEntry>
+fw::dm::dtls::stat_entry(int /*dirfd*/, const std::string& /*path*/)
+{
+  return std::nullopt;
+}
+
+#endif  // __linux__
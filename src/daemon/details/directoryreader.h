@@ -0,0 +1,84 @@
+#ifndef details_directoryreader_h
+#define details_directoryreader_h
+
+#include "daemon/filesystem.h"
+
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// An open directory, whose entries are read in bulk with getdents64
+      /// and stat'ed relative to it, so no path is resolved per entry.
+      /// Only available on Linux; elsewhere the constructor throws.
+      class DirectoryReader
+      {
+      public:
+        /// The d_type of an entry, DT_UNKNOWN if the file system does not
+        /// tell
+        using Visitor =
+          std::function<void(std::string_view name, unsigned char type)>;
+        /// As Visitor, with the position after the entry.  Returns false to
+        /// stop.
+        using PositionedVisitor = std::function<bool(
+          std::string_view name, unsigned char type, uint64_t next)>;
+
+        /// Throws std::runtime_error if path cannot be opened as a directory
+        explicit DirectoryReader(const std::string& path);
+        /// path relative to the directory atfd, as for openat
+        DirectoryReader(int atfd, const std::string& path);
+        DirectoryReader(const DirectoryReader&) = delete;
+        DirectoryReader& operator=(const DirectoryReader&) = delete;
+        DirectoryReader(DirectoryReader&&) = delete;
+        DirectoryReader& operator=(DirectoryReader&&) = delete;
+        ~DirectoryReader();
+
+        int fd() const { return dirfd; }
+
+        /// Call visit for every entry but . and ..  Throws
+        /// std::runtime_error if the directory cannot be read.
+        void for_each(const Visitor& visit) const;
+        /// As for_each, from position on, 0 being the start, until visit
+        /// returns false.  Returns true if the end was reached.
+        bool for_each_from(uint64_t position,
+                           const PositionedVisitor& visit) const;
+
+        /// The entry name in the directory, following symbolic links, or
+        /// nothing if it does not exist.  One statx, asking only for the
+        /// fields type does not tell already.
+        std::optional<fs::DirectoryEntry>
+        stat(std::string_view name, unsigned char type) const;
+
+        /// for_each and stat of every entry
+        std::deque<fs::DirectoryEntry> entries() const;
+        /// As entries(), without allocating per entry
+        fs::Listing listing() const;
+        /// At most max_entries of listing(), from position on.  The
+        /// positions are getdents64 offsets, which the file systems keep
+        /// valid across opens, e.g., for NFS.
+        fs::ListingPage page(uint64_t position, std::size_t max_entries) const;
+
+      private:
+        int dirfd = -1;
+        std::string path;
+      };
+
+      /// The entry at path, following symbolic links, or nothing if it does
+      /// not exist.  One statx.
+      std::optional<fs::DirectoryEntry> stat_entry(const std::string& path);
+      /// path relative to the directory dirfd, as for statx
+      std::optional<fs::DirectoryEntry> stat_entry(int dirfd,
+                                                   const std::string& path);
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+#endif  // details_directoryreader_h
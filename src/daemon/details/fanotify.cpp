@@ -0,0 +1,124 @@
+#include "daemon/details/fanotify.h"
+
+#ifdef __linux__
+
+#  include <fcntl.h>
+#  include <sys/fanotify.h>
+#  include <unistd.h>
+
+#  include <array>
+#  include <cassert>
+#  include <cstring>
+#  include <stdexcept>
+
+fw::dm::dtls::Fanotify::Fanotify() = default;
+
+fw::dm::dtls::Fanotify::~Fanotify()
+{
+  assert(marked_path.empty());  // verify the filesystem was unmarked
+}
+
+namespace
+{
+  std::string handle_key(const file_handle& handle)
+  {
+    std::string key(sizeof(handle.handle_type) + handle.handle_bytes, '\0');
+    std::memcpy(key.data(), &handle.handle_type, sizeof(handle.handle_type));
+    std::memcpy(key.data() + sizeof(handle.handle_type),  // NOLINT
+                handle.f_handle, handle.handle_bytes);
+    return key;
+  }
+
+}  // anonymous namespace
+
+void fw::dm::dtls::Fanotify::add_directory(const std::string& absolute_path)
+{
+  alignas(file_handle) std::array<char, sizeof(file_handle) + MAX_HANDLE_SZ>
+    buf{};
+  auto* handle =  // NOLINTNEXTLINE - reinterpret_cast
+    reinterpret_cast<file_handle*>(buf.data());
+  handle->handle_bytes = MAX_HANDLE_SZ;
+  int mount_id = 0;
+  if (syscall_name_to_handle_at(AT_FDCWD, absolute_path.c_str(), handle,
+                                &mount_id, 0)
+      == -1)
+  {
+    throw std::runtime_error(
+      fmt::format("Could not get the file handle of {}: {} [{}].",
+                  absolute_path, std::strerror(errno), errno));
+  }
+
+  std::lock_guard<std::mutex> sentry(mutex);
+  std::erase_if(directories,
+                [&](const auto& d) { return d.second == absolute_path; });
+  directories[handle_key(*handle)] = absolute_path;
+}
+
+void fw::dm::dtls::Fanotify::remove_directory(std::string_view absolute_path)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  std::erase_if(directories,
+                [&](const auto& d) { return d.second == absolute_path; });
+}
+
+std::optional<std::string>
+fw::dm::dtls::Fanotify::directory_path(const file_handle& handle) const
+{
+  auto key = handle_key(handle);
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = directories.find(key);
+  if (iter == std::end(directories))
+  {
+    return std::optional<std::string>();
+  }
+  return iter->second;
+}
+
+int fw::dm::dtls::Fanotify::syscall_inotify_init()
+{
+  return fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC
+                         | FAN_NONBLOCK,  // NOLINT - signed bitwise
+                       O_RDONLY | O_CLOEXEC);
+}
+
+int fw::dm::dtls::Fanotify::syscall_inotify_add_watch(int fd,
+                                                      const char* pathname,
+                                                      uint32_t mask)
+{
+  auto rv = syscall_fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                                  mask, pathname);
+  if (rv == -1)
+  {
+    return -1;
+  }
+
+  marked_path = pathname;
+  marked_mask = mask;
+  return rv;
+}
+
+int fw::dm::dtls::Fanotify::syscall_inotify_rm_watch(int fd, int /*wd*/)
+{
+  auto rv = syscall_fanotify_mark(fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM,
+                                  marked_mask, marked_path.c_str());
+  marked_path.clear();
+  return rv;
+}
+
+int fw::dm::dtls::Fanotify::syscall_fanotify_mark(int fd, unsigned int flags,
+                                                  uint32_t mask,
+                                                  const char* pathname)
+{
+  return fanotify_mark(fd, flags, mask, AT_FDCWD, pathname);
+}
+
+int fw::dm::dtls::Fanotify::syscall_name_to_handle_at(int dirfd,
+                                                      const char* pathname,
+                                                      file_handle* handle,
+                                                      int* mount_id,
+                                                      int flags)
+{
+  return ::name_to_handle_at(dirfd, pathname, handle, mount_id, flags);
+}
+
+#endif  // __linux__
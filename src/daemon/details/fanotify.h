@@ -0,0 +1,83 @@
+#ifndef details_fanotify_h
+#define details_fanotify_h
+
+#ifdef __linux__
+
+#  include "daemon/details/inotify.h"
+
+#  include <map>
+#  include <mutex>
+#  include <optional>
+#  include <string>
+
+struct file_handle;
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// Handle a fanotify group reporting directory entry events for a
+      /// whole filesystem.
+      ///
+      /// The group is polled, read and woken up exactly like an inotify
+      /// instance.  add_watch() marks the entire filesystem containing
+      /// pathname, and events identify their directory by a file handle.
+      /// The handles of the watched directories are remembered by
+      /// add_directory(), so that directory_path() resolves them without
+      /// syscalls, and the events of the rest of the filesystem are
+      /// dropped by comparing handles.  Requires CAP_SYS_ADMIN.
+      class Fanotify : public Inotify
+      {
+      protected:
+        Fanotify();
+
+      public:
+        template<typename T>
+        static std::unique_ptr<Fanotify> create()
+        {
+          std::unique_ptr<Fanotify> ptr{new T};
+          ptr->init();
+          return ptr;
+        }
+
+        ~Fanotify() override;
+
+        /// Remember the handle of the directory at absolute_path, replacing
+        /// the one it had.  Throws std::runtime_error if it has none.
+        void add_directory(const std::string& absolute_path);
+        void remove_directory(std::string_view absolute_path);
+        /// Absolute path of the added directory identified by handle, or
+        /// nothing if handle is not one of theirs
+        std::optional<std::string>
+        directory_path(const file_handle& handle) const;
+
+      protected:
+        int syscall_inotify_init() override;
+        int syscall_inotify_add_watch(int fd, const char* pathname,
+                                      uint32_t mask) override;
+        int syscall_inotify_rm_watch(int fd, int wd) override;
+
+        virtual int syscall_fanotify_mark(int fd, unsigned int flags,
+                                          uint32_t mask, const char* pathname);
+        virtual int syscall_name_to_handle_at(int dirfd,
+                                              const char* pathname,
+                                              file_handle* handle,
+                                              int* mount_id, int flags);
+
+      private:
+        std::string marked_path;
+        uint32_t marked_mask = 0;
+        mutable std::mutex mutex;
+        std::map<std::string, std::string, std::less<>>
+          directories;  // handle type and bytes -> absolute path
+      };
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+#endif  // __linux__
+
+#endif  // details_fanotify_h
@@ -2,11 +2,13 @@
 
 #ifdef __linux__
 
-#  include "common/bw_combine.h"
-#  include <fcntl.h>
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
 #  include <sys/inotify.h>
 #  include <unistd.h>
 
+#  include <array>
+#  include <cstring>
 #  include <sstream>
 
 fw::dm::dtls::Inotify::Inotify() = default;
@@ -35,32 +37,87 @@ void fw::dm::dtls::Inotify::init()
     }
     throw std::runtime_error(ost.str());
   }
-  if (syscall_pipe2(pipe_fds, O_CLOEXEC) == -1)
+
+  try
+  {
+    init_epoll();
+  }
+  catch (...)
+  {
+    close();  // so the fds opened so far do not leak
+    throw;
+  }
+}
+
+void fw::dm::dtls::Inotify::init_epoll()
+{
+  epoll_fd = syscall_epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
   {
     std::ostringstream ost;
-    ost << "Could not initialize pipe: ";
+    ost << "Could not initialize epoll: ";
     switch (errno)
     {
-    case EFAULT:
-      ost << "pipefd is not valid [EFAULT].";
+    case EMFILE:
+      ost << "The per-user limit on the number of epoll instances or the\n"
+          << "per-process limit on open file descriptors has been reached "
+          << "[EMFILE].";
       break;
-
-    case EINVAL:
-      ost << "(pipe2()) Invalid value in flags [EINVAL].";
+    case ENFILE:
+      ost << "The system-wide limit on the total number of open files has\n"
+          << "been reached [ENFILE].";
+      break;
+    case ENOMEM:
+      ost << "Insufficient kernel memory available [ENOMEM].";
       break;
+    default:
+      ost << "Unknown error [" << errno << "].";
+      break;
+    }
+    throw std::runtime_error(ost.str());
+  }
 
+  event_fd = syscall_eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);  // NOLINT
+  if (event_fd == -1)
+  {
+    std::ostringstream ost;
+    ost << "Could not initialize eventfd: ";
+    switch (errno)
+    {
     case EMFILE:
       ost << "The per-process limit on the number of open file descriptors\n"
           << "has been reached [EMFILE].";
       break;
-
     case ENFILE:
       ost << "The system-wide limit on the total number of open files has\n"
           << "been reached [ENFILE].";
       break;
+    case ENOMEM:
+      ost << "Insufficient kernel memory available [ENOMEM].";
+      break;
+    default:
+      ost << "Unknown error [" << errno << "].";
+      break;
     }
     throw std::runtime_error(ost.str());
   }
+
+  register_fd(inotify_fd);
+  register_fd(event_fd);
+}
+
+void fw::dm::dtls::Inotify::register_fd(int fd)
+{
+  epoll_event evt{};
+  evt.events = EPOLLIN;
+  evt.data.fd = fd;
+  if (syscall_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &evt) == -1)
+  {
+    std::ostringstream ost;
+    ost << "Could not add fd " << fd << " to epoll: " << std::strerror(errno)
+        << " [" << errno << "].";
+    throw std::runtime_error(ost.str());
+  }
 }
 
 fw::dm::dtls::Inotify::~Inotify()
@@ -70,6 +127,14 @@ fw::dm::dtls::Inotify::~Inotify()
 
 int fw::dm::dtls::Inotify::close()
 {
+  for (auto* fd : {&event_fd, &epoll_fd})
+  {
+    if (*fd != -1)
+    {
+      syscall_close(*fd);
+      *fd = -1;
+    }
+  }
   auto rv = syscall_close(inotify_fd);
   inotify_fd = -1;
   return rv;
@@ -77,20 +142,12 @@ int fw::dm::dtls::Inotify::close()
 
 int fw::dm::dtls::Inotify::add_watch(const char* pathname, uint32_t mask)
 {
-  int rv = syscall_inotify_add_watch(inotify_fd, pathname, mask);
-  // wake up poll thread so that it can poll on the newly added wds
-  char buf = static_cast<char>(1);
-  syscall_write(pipe_fds[1], &buf, 1);
-  return rv;
+  return syscall_inotify_add_watch(inotify_fd, pathname, mask);
 }
 
 int fw::dm::dtls::Inotify::rm_watch(int wd)
 {
-  int rv = syscall_inotify_rm_watch(inotify_fd, wd);
-  // wake up poll thread so that it can poll on the remaining wds
-  char buf = static_cast<char>(2);
-  syscall_write(pipe_fds[1], &buf, 1);
-  return rv;
+  return syscall_inotify_rm_watch(inotify_fd, wd);
 }
 
 ssize_t fw::dm::dtls::Inotify::read(void* buf, size_t count) noexcept
@@ -100,69 +157,48 @@ ssize_t fw::dm::dtls::Inotify::read(void* buf, size_t count) noexcept
 
 void fw::dm::dtls::Inotify::terminate_poll()
 {
-  char buf = static_cast<char>(0);
-  syscall_write(pipe_fds[1], &buf, 1);
+  uint64_t one = 1;
+  syscall_write(event_fd, &one, sizeof(one));
 }
 
-namespace
+int fw::dm::dtls::Inotify::poll(uint32_t& revents, int timeout_ms) noexcept
 {
-  bool has_event(const struct pollfd& pfd, unsigned short expected_events)
+  std::array<epoll_event, 2> ready{};
+  int count =
+    syscall_epoll_wait(epoll_fd, ready.data(), static_cast<int>(ready.size()),
+                       timeout_ms);
+  if (count <= 0)
   {
-    return (static_cast<unsigned short>(pfd.revents) & expected_events) != 0;
+    return count;
   }
 
-}  // anonymous namespace
-
-int fw::dm::dtls::Inotify::poll(short events, short& revents,
-                                int timeout_ms) noexcept
-{
-  std::array<struct pollfd, 2> pfd{};
-  pfd[0].fd = inotify_fd;
-  pfd[0].events = events;
-  pfd[1].fd = pipe_fds[0];
-  pfd[1].events = events;
-  auto expected_events =
-    util::bw_combine<unsigned short>(events, POLLHUP, POLLERR, POLLNVAL);
-  while (true)
+  bool terminate = false;
+  for (std::size_t i = 0; i < static_cast<std::size_t>(count); ++i)
   {
-    int poll_result = syscall_poll(pfd.data(), 2, timeout_ms);
-    if (has_event(pfd[0], expected_events) || poll_result == -1)
+    if (ready[i].data.fd == inotify_fd)
     {
-      revents = pfd[0].revents;
-      return poll_result;
+      // pending inotify events are handled before a termination request,
+      // which stays signalled until the next poll
+      revents = ready[i].events;
+      return 1;
     }
+    terminate = terminate || ready[i].data.fd == event_fd;
+  }
 
-    if (has_event(pfd[1], expected_events))
-    {
-      char buf = 0;
-      syscall_read(pipe_fds[0], &buf, 1);  // remove written char from pipe
-      if (static_cast<int>(buf) == 0)
-      {
-        spdlog::debug("read termination signal from pipe");
-        errno = EINTR;
-        return -1;
-      }
-
-      if (static_cast<int>(buf) == 1)
-      {
-        spdlog::debug("read add signal from pipe - poll again");
-      }
-      else if (static_cast<int>(buf) == 2)
-      {
-        spdlog::debug("read rm signal from pipe - poll again");
-      }
-      else
-      {
-        spdlog::warn("read unknown signal from pipe: {} - poll again",
-                     static_cast<int>(buf));
-      }
-    }
+  if (terminate)
+  {
+    uint64_t value = 0;
+    syscall_read(event_fd, &value, sizeof(value));  // reset the eventfd
+    spdlog::debug("read termination signal from eventfd");
+    errno = EINTR;
+    return -1;
   }
+  return 0;
 }
 
 int fw::dm::dtls::Inotify::syscall_inotify_init()
 {
-  return inotify_init1(IN_CLOEXEC);
+  return inotify_init1(IN_CLOEXEC | IN_NONBLOCK);  // NOLINT - signed bitwise
 }
 
 int fw::dm::dtls::Inotify::syscall_close(int fd) { return ::close(fd); }
@@ -185,21 +221,32 @@ ssize_t fw::dm::dtls::Inotify::syscall_read(int fd, void* buf,
   return ::read(fd, buf, count);
 }
 
-int fw::dm::dtls::Inotify::syscall_poll(struct pollfd* fds, nfds_t nfds,
-                                        int timeout_ms)
+ssize_t fw::dm::dtls::Inotify::syscall_write(int fd, const void* buf,
+                                             size_t count)
 {
-  return ::poll(fds, nfds, timeout_ms);
+  return ::write(fd, buf, count);
 }
 
-int fw::dm::dtls::Inotify::syscall_pipe2(std::array<int, 2>& pipefd, int flags)
+int fw::dm::dtls::Inotify::syscall_epoll_create1(int flags)
 {
-  return ::pipe2(pipefd.data(), flags);
+  return ::epoll_create1(flags);
 }
 
-ssize_t fw::dm::dtls::Inotify::syscall_write(int fd, const void* buf,
-                                             size_t count)
+int fw::dm::dtls::Inotify::syscall_epoll_ctl(int epfd, int op, int fd,
+                                             epoll_event* event)
 {
-  return ::write(fd, buf, count);
+  return ::epoll_ctl(epfd, op, fd, event);
+}
+
+int fw::dm::dtls::Inotify::syscall_epoll_wait(int epfd, epoll_event* events,
+                                              int maxevents, int timeout_ms)
+{
+  return ::epoll_wait(epfd, events, maxevents, timeout_ms);
+}
+
+int fw::dm::dtls::Inotify::syscall_eventfd(unsigned int initval, int flags)
+{
+  return ::eventfd(initval, flags);
 }
 
 #endif  // __linux__
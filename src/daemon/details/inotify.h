@@ -3,12 +3,13 @@
 
 #ifdef __linux__
 
-#  include <poll.h>  // for nfds_t
-
 #  include <spdlog/spdlog.h>
 
+#  include <cstdint>
 #  include <memory>
 
+struct epoll_event;
+
 namespace fw
 {
   namespace dm
@@ -16,6 +17,14 @@ namespace fw
     namespace dtls
     {
       /// Handle the inotify subsystem on linux
+      ///
+      /// The inotify file descriptor is waited for with epoll, together with
+      /// an eventfd that terminate_poll() signals.  Both are registered once,
+      /// so adding or removing watches does not wake the polling thread.
+      ///
+      /// No other fds are registered: each watch thread owns its Inotify, and
+      /// the rename pairing, debounce and resync deadlines of that thread
+      /// are passed to poll() as its timeout rather than armed as timerfds.
       class Inotify
       {
       protected:
@@ -38,9 +47,13 @@ namespace fw
         int rm_watch(int wd);
         ssize_t read(void* buf, size_t count) noexcept;
         void terminate_poll();
-        int poll(short events, short& revents, int timeout_ms) noexcept;
+        /// Wait until inotify is readable, terminate_poll() is called or
+        /// timeout_ms has passed (-1 waits forever).  Returns 1 and the
+        /// epoll events of the inotify fd in revents, 0 on timeout, or -1
+        /// with errno set (EINTR after terminate_poll()).
+        int poll(uint32_t& revents, int timeout_ms) noexcept;
 
-      private:
+      protected:
         virtual int syscall_inotify_init();
         virtual int syscall_close(int fd);
 
@@ -48,13 +61,21 @@ namespace fw
                                               uint32_t mask);
         virtual int syscall_inotify_rm_watch(int fd, int wd);
         virtual ssize_t syscall_read(int fd, void* buf, size_t count) noexcept;
-        virtual int syscall_poll(struct pollfd* fds, nfds_t nfds,
-                                 int timeout_ms);
-        virtual int syscall_pipe2(std::array<int, 2>& pipefd, int flags);
         virtual ssize_t syscall_write(int fd, const void* buf, size_t count);
+        virtual int syscall_epoll_create1(int flags);
+        virtual int syscall_epoll_ctl(int epfd, int op, int fd,
+                                      epoll_event* event);
+        virtual int syscall_epoll_wait(int epfd, epoll_event* events,
+                                       int maxevents, int timeout_ms);
+        virtual int syscall_eventfd(unsigned int initval, int flags);
+
+      private:
+        void init_epoll();
+        void register_fd(int fd);
 
         int inotify_fd = -1;
-        std::array<int, 2> pipe_fds = {0, 0};
+        int epoll_fd = -1;
+        int event_fd = -1;
       };
 
     }  // namespace dtls
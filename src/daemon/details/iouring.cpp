@@ -0,0 +1,284 @@
+#include "daemon/details/iouring.h"
+
+#ifdef __linux__
+
+#  include <fcntl.h>
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+
+#  include <algorithm>
+#  include <atomic>
+#  include <cerrno>
+#  include <cstring>
+#  include <initializer_list>
+#  include <sstream>
+#  include <stdexcept>
+#  include <vector>
+
+namespace
+{
+  int io_uring_setup(unsigned entries, io_uring_params* params)
+  {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                     unsigned flags)
+  {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                      min_complete, flags, nullptr, 0));
+  }
+
+  int io_uring_register(int ring_fd, unsigned opcode, void* arg,
+                        unsigned nr_args)
+  {
+    return static_cast<int>(
+      ::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+  }
+
+  /// Whether the kernel of ring_fd supports each of opcodes.  Probing
+  /// needs Linux 5.6, as do the opcodes used here.
+  bool supports(int ring_fd, std::initializer_list<unsigned> opcodes)
+  {
+    constexpr unsigned max_ops = 256;
+    std::vector<char> buf(sizeof(io_uring_probe)
+                          + max_ops * sizeof(io_uring_probe_op));
+    auto* probe =  // NOLINTNEXTLINE - reinterpret_cast
+      reinterpret_cast<io_uring_probe*>(buf.data());
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, max_ops)
+        == -1)
+    {
+      return false;
+    }
+    return std::all_of(std::begin(opcodes), std::end(opcodes), [&](auto op) {
+      return op <= probe->last_op
+             && (probe->ops[op].flags  // NOLINT - pointer arithmetic
+                 & IO_URING_OP_SUPPORTED)
+                  != 0;
+    });
+  }
+
+  template<typename T>
+  T* at_offset(void* base, std::size_t offset)
+  {
+    // NOLINTNEXTLINE - reinterpret_cast, pointer arithmetic
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+
+  unsigned load_acquire(unsigned* ptr)
+  {
+    return std::atomic_ref<unsigned>(*ptr).load(std::memory_order_acquire);
+  }
+
+  void store_release(unsigned* ptr, unsigned value)
+  {
+    std::atomic_ref<unsigned>(*ptr).store(value, std::memory_order_release);
+  }
+
+  [[noreturn]] void throw_errno(const char* what)
+  {
+    std::ostringstream ost;
+    ost << what << ": " << std::strerror(errno) << " [" << errno << "].";
+    throw std::runtime_error(ost.str());
+  }
+
+}  // anonymous namespace
+
+fw::dm::dtls::IoUring::IoUring(unsigned entries)
+{
+  io_uring_params params{};
+  ring_fd = io_uring_setup(entries, &params);
+  if (ring_fd == -1)
+  {
+    throw_errno("Could not initialize io_uring");
+  }
+  if (!supports(ring_fd, {IORING_OP_STATX, IORING_OP_READ}))
+  {
+    ::close(ring_fd);
+    throw std::runtime_error(
+      "io_uring does not support statx and read (Linux 5.6 or later).");
+  }
+  sq_entries = params.sq_entries;
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap)
+  {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+
+  sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED)  // NOLINT - c-style cast in macro
+  {
+    sq_ring = nullptr;
+    ::close(ring_fd);
+    throw_errno("Could not map io_uring submission queue");
+  }
+  cq_ring = single_mmap ? sq_ring
+                        : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd,
+                                 IORING_OFF_CQ_RING);
+  if (cq_ring == MAP_FAILED)  // NOLINT - c-style cast in macro
+  {
+    cq_ring = nullptr;
+    ::munmap(sq_ring, sq_ring_size);
+    ::close(ring_fd);
+    throw_errno("Could not map io_uring completion queue");
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes_ptr = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED)  // NOLINT - c-style cast in macro
+  {
+    if (!single_mmap)
+    {
+      ::munmap(cq_ring, cq_ring_size);
+    }
+    ::munmap(sq_ring, sq_ring_size);
+    ::close(ring_fd);
+    throw_errno("Could not map io_uring submission queue entries");
+  }
+  sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+  sq_head = at_offset<unsigned>(sq_ring, params.sq_off.head);
+  sq_tail = at_offset<unsigned>(sq_ring, params.sq_off.tail);
+  sq_mask = at_offset<unsigned>(sq_ring, params.sq_off.ring_mask);
+  sq_array = at_offset<unsigned>(sq_ring, params.sq_off.array);
+  cq_head = at_offset<unsigned>(cq_ring, params.cq_off.head);
+  cq_tail = at_offset<unsigned>(cq_ring, params.cq_off.tail);
+  cq_mask = at_offset<unsigned>(cq_ring, params.cq_off.ring_mask);
+  cqes = at_offset<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+}
+
+fw::dm::dtls::IoUring::~IoUring()
+{
+  ::munmap(sqes, sqes_size);
+  if (cq_ring != sq_ring)
+  {
+    ::munmap(cq_ring, cq_ring_size);
+  }
+  ::munmap(sq_ring, sq_ring_size);
+  ::close(ring_fd);
+}
+
+io_uring_sqe* fw::dm::dtls::IoUring::next_sqe()
+{
+  if (queued == sq_entries)
+  {
+    return nullptr;
+  }
+
+  const auto tail = *sq_tail + queued;
+  const auto index = tail & *sq_mask;
+  auto* sqe = &sqes[index];  // NOLINT - pointer arithmetic
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  sq_array[index] = index;  // NOLINT - pointer arithmetic
+  ++queued;
+  return sqe;
+}
+
+bool fw::dm::dtls::IoUring::prepare_read(int fd, void* buf, unsigned len,
+                                         uint64_t offset, uint64_t user_data)
+{
+  auto* sqe = next_sqe();
+  if (sqe == nullptr)
+  {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);  // NOLINT - reinterpret_cast
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool fw::dm::dtls::IoUring::prepare_statx(int dirfd, const char* pathname,
+                                          int flags, unsigned mask,
+                                          struct statx* statxbuf,
+                                          uint64_t user_data)
+{
+  auto* sqe = next_sqe();
+  if (sqe == nullptr)
+  {
+    return false;
+  }
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = dirfd;
+  sqe->addr = reinterpret_cast<uint64_t>(pathname);  // NOLINT
+  sqe->len = mask;
+  sqe->off = reinterpret_cast<uint64_t>(statxbuf);  // NOLINT
+  sqe->statx_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = user_data;
+  return true;
+}
+
+void fw::dm::dtls::IoUring::submit_and_wait(
+  const std::function<void(uint64_t, int)>& on_complete)
+{
+  store_release(sq_tail, *sq_tail + queued);
+  auto to_submit = queued;
+  auto remaining = queued;
+  queued = 0;
+
+  while (remaining > 0)
+  {
+    auto rv = io_uring_enter(ring_fd, to_submit, remaining,
+                             IORING_ENTER_GETEVENTS);
+    if (rv == -1)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+      {
+        continue;
+      }
+      const auto err = errno;
+      discard(remaining - to_submit);
+      errno = err;
+      throw_errno("io_uring_enter failed");
+    }
+    to_submit -= std::min(to_submit, static_cast<unsigned>(rv));
+
+    auto head = *cq_head;
+    while (head != load_acquire(cq_tail))
+    {
+      const auto& cqe = cqes[head & *cq_mask];  // NOLINT - pointer arithmetic
+      on_complete(cqe.user_data, cqe.res);
+      ++head;
+      --remaining;
+    }
+    store_release(cq_head, head);
+  }
+}
+
+void fw::dm::dtls::IoUring::discard(unsigned in_flight) noexcept
+{
+  // the kernel only reads the submission queue in io_uring_enter, so the
+  // operations it has not taken yet can be taken back
+  store_release(sq_tail, load_acquire(sq_head));
+
+  // the ones it has write to buffers of the caller, so wait for them
+  while (in_flight > 0)
+  {
+    if (io_uring_enter(ring_fd, 0, in_flight, IORING_ENTER_GETEVENTS) == -1
+        && errno != EINTR)
+    {
+      return;
+    }
+
+    auto head = *cq_head;
+    while (head != load_acquire(cq_tail) && in_flight > 0)
+    {
+      ++head;
+      --in_flight;
+    }
+    store_release(cq_head, head);
+  }
+}
+
+#endif  // __linux__
@@ -0,0 +1,87 @@
+#ifndef details_iouring_h
+#define details_iouring_h
+
+#ifdef __linux__
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <functional>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct statx;
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// A minimal io_uring instance for submitting batches of operations
+      /// and waiting for all of them to complete.  Not thread safe; use one
+      /// instance per thread.
+      class IoUring
+      {
+      public:
+        /// Throws std::runtime_error if the kernel does not provide
+        /// io_uring (or it is disabled, e.g. by seccomp), or does not
+        /// support the operations prepared below
+        explicit IoUring(unsigned entries);
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+        IoUring(IoUring&&) = delete;
+        IoUring& operator=(IoUring&&) = delete;
+        ~IoUring();
+
+        /// Number of operations that can be prepared before submitting
+        unsigned capacity() const { return sq_entries; }
+
+        /// Queue operations, returns false if the submission queue is full
+        bool prepare_read(int fd, void* buf, unsigned len, uint64_t offset,
+                          uint64_t user_data);
+        bool prepare_statx(int dirfd, const char* pathname, int flags,
+                           unsigned mask, struct statx* statxbuf,
+                           uint64_t user_data);
+
+        /// Submit the queued operations with one syscall and wait for all of
+        /// them.  on_complete is called with the user_data and result (as
+        /// the syscall would return it, or -errno) of each operation, and
+        /// must not throw.  Throws std::runtime_error if io_uring fails, in
+        /// which case the operations not yet submitted are dropped and the
+        /// submitted ones are waited for, unreported.
+        void submit_and_wait(
+          const std::function<void(uint64_t user_data, int result)>&
+            on_complete);
+
+      private:
+        io_uring_sqe* next_sqe();
+        void discard(unsigned in_flight) noexcept;
+
+        int ring_fd = -1;
+        unsigned sq_entries = 0;
+        void* sq_ring = nullptr;
+        std::size_t sq_ring_size = 0;
+        void* cq_ring = nullptr;
+        std::size_t cq_ring_size = 0;
+        io_uring_sqe* sqes = nullptr;
+        std::size_t sqes_size = 0;
+
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned* sq_mask = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned* cq_mask = nullptr;
+        io_uring_cqe* cqes = nullptr;
+
+        unsigned queued = 0;
+      };
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+#endif  // __linux__
+
+#endif  // details_iouring_h
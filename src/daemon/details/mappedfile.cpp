@@ -0,0 +1,123 @@
+#include "daemon/details/mappedfile.h"
+
+#ifdef __linux__
+
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+
+#  include <cerrno>
+#  include <cstring>
+#  include <sstream>
+#  include <stdexcept>
+
+namespace
+{
+  [[noreturn]] void throw_errno(const char* what, const std::string& path)
+  {
+    std::ostringstream ost;
+    ost << what << " " << path << ": " << std::strerror(errno) << " ["
+        << errno << "].";
+    throw std::runtime_error(ost.str());
+  }
+
+}  // anonymous namespace
+
+fw::dm::dtls::MappedFile::MappedFile(const std::string& path, bool writable)
+{
+  fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd == -1)
+  {
+    throw_errno("Could not open", path);
+  }
+
+  struct stat st{};
+  if (::fstat(fd, &st) == -1)
+  {
+    ::close(fd);
+    throw_errno("Could not stat", path);
+  }
+  length = static_cast<std::size_t>(st.st_size);
+  map(path, writable);
+}
+
+fw::dm::dtls::MappedFile::MappedFile(const std::string& path,
+                                     std::size_t size) :
+  length(size)
+{
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    throw_errno("Could not create", path);
+  }
+
+  // unlike ftruncate, which leaves a sparse file
+  const auto error =
+    size == 0 ? 0 : ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+  if (error != 0)
+  {
+    ::close(fd);
+    ::unlink(path.c_str());
+    errno = error;  // returned, not set by posix_fallocate
+    throw_errno("Could not allocate", path);
+  }
+  map(path, true);
+}
+
+void fw::dm::dtls::MappedFile::map(const std::string& path, bool writable)
+{
+  if (length == 0)
+  {
+    return;
+  }
+
+  void* mapped =
+    ::mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+           MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)  // NOLINT - c-style cast in macro
+  {
+    ::close(fd);
+    throw_errno("Could not map", path);
+  }
+  ptr = static_cast<char*>(mapped);
+}
+
+fw::dm::dtls::MappedFile::~MappedFile()
+{
+  if (ptr != nullptr)
+  {
+    ::munmap(ptr, length);
+  }
+  ::close(fd);
+}
+
+void fw::dm::dtls::MappedFile::flush()
+{
+  if (ptr != nullptr)
+  {
+    ::msync(ptr, length, MS_ASYNC);
+  }
+}
+
+#else  // __linux__
+
+#  include <stdexcept>
+
+fw::dm::dtls::MappedFile::MappedFile(const std::string& /*path*/,
+                                     bool /*writable*/)
+{
+  throw std::runtime_error("Memory mapped files require Linux");
+}
+
+fw::dm::dtls::MappedFile::MappedFile(const std::string& /*path*/,
+                                     std::size_t /*size*/)
+{
+  throw std::runtime_error("Memory mapped files require Linux");
+}
+
+fw::dm::dtls::MappedFile::~MappedFile() = default;
+
+void fw::dm::dtls::MappedFile::flush() {}
+
+#endif  // __linux__
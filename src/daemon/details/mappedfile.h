@@ -0,0 +1,52 @@
+#ifndef details_mappedfile_h
+#define details_mappedfile_h
+
+#include <cstddef>
+#include <string>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// A file mapped shared into memory, so what is written to data()
+      /// reaches the file without a syscall and survives the process.
+      /// Only available on Linux; elsewhere the constructors throw.
+      class MappedFile
+      {
+      public:
+        /// Map an existing file, read only unless writable.  Throws
+        /// std::runtime_error on failure.
+        MappedFile(const std::string& path, bool writable);
+        /// Create a zero filled file of size bytes and map it writable.
+        /// The blocks are allocated up front, so that writing to the
+        /// mapping cannot raise SIGBUS when the disk fills up; instead this
+        /// throws std::runtime_error if they cannot be allocated.
+        MappedFile(const std::string& path, std::size_t size);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&&) = delete;
+        MappedFile& operator=(MappedFile&&) = delete;
+        ~MappedFile();
+
+        char* data() { return ptr; }
+        const char* data() const { return ptr; }
+        std::size_t size() const { return length; }
+
+        /// Schedule the dirty pages to be written, without waiting for it
+        void flush();
+
+      private:
+        void map(const std::string& path, bool writable);
+
+        int fd = -1;
+        char* ptr = nullptr;
+        std::size_t length = 0;
+      };
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+#endif  // details_mappedfile_h
@@ -12,10 +12,14 @@ namespace fw
     public:
       virtual ~DirectoryEventListener() = 0;
 
+      /// size is the size of a file in bytes, old_name the previous name of
+      /// a renamed entry.  Both are unused (0 and "") otherwise.
       virtual void notify(filewatch::DirectoryEvent::Event event,
                           std::string_view containing_dir,
                           std::string_view dir_name,
-                          uint64_t mtime) = 0;
+                          uint64_t mtime,
+                          uint64_t size,
+                          std::string_view old_name) = 0;
     };
 
   }  // namespace dm
@@ -1,9 +1,13 @@
 #ifndef DIRECTORYVIEW_H
 #define DIRECTORYVIEW_H
 
+#include <cstddef>
+#include <string_view>
+
 namespace filewatch
 {
   class DirList;
+  class EntryList;
   class FileList;
 }  // namespace filewatch
 
@@ -27,11 +31,35 @@ namespace fw
       fill_dir_list(filewatch::DirList& response) const = 0;
       virtual grpc::Status
       fill_file_list(filewatch::FileList& response) const = 0;
+      /// The files and the directories, from one listing
+      virtual grpc::Status
+      fill_entries(filewatch::EntryList& response) const = 0;
+
+      /// As fill_dir_list and fill_file_list, but at most page_size entries,
+      /// continuing at page_token, the next_page_token of the previous
+      /// page, or "" for the first.  next_page_token is left empty on the
+      /// last page.
+      virtual grpc::Status fill_dir_page(filewatch::DirList& response,
+                                         std::string_view page_token,
+                                         std::size_t page_size) const = 0;
+      virtual grpc::Status fill_file_page(filewatch::FileList& response,
+                                          std::string_view page_token,
+                                          std::size_t page_size) const = 0;
+      virtual grpc::Status
+      fill_entries_page(filewatch::EntryList& response,
+                        std::string_view page_token,
+                        std::size_t page_size) const = 0;
 
       virtual void
       register_event_listener(DirectoryEventListener& listener) = 0;
       virtual void
       unregister_event_listener(DirectoryEventListener& listener) = 0;
+
+      /// Listen for events in this directory and all its subdirectories
+      virtual void
+      register_recursive_event_listener(DirectoryEventListener& listener) = 0;
+      virtual void unregister_recursive_event_listener(
+        DirectoryEventListener& listener) = 0;
     };
 
   }  // namespace dm
@@ -2,9 +2,14 @@
 
 #include "filesystem.h"
 #include "filewatch.pb.h"
+#include "recursiveeventlistener.h"
 
 #include <grpcpp/impl/codegen/status.h>
 
+#include <charconv>
+#include <optional>
+#include <string>
+
 fw::dm::DirectoryWatcher::DirectoryWatcher(std::string_view dirname_,
                                            FileSystem& fs_) :
   dirname(dirname_),
@@ -12,52 +17,128 @@ fw::dm::DirectoryWatcher::DirectoryWatcher(std::string_view dirname_,
 {
 }
 
+fw::dm::DirectoryWatcher::~DirectoryWatcher() = default;
+
 namespace
 {
 
-  template<typename ModificationTimeContainerT>
-  void set_mtime_of(ModificationTimeContainerT& mtc,
-                    const fw::dm::fs::DirectoryEntry& entry)
+  template<typename ModificationTimeContainerT, typename EntryT>
+  void set_mtime_of(ModificationTimeContainerT& mtc, const EntryT& entry)
   {
     mtc.mutable_modification_time()->set_epoch(entry.mtime);
   }
 
   template<typename EntryContainerT>
   void fill_entry(EntryContainerT& dest,
-                  const fw::dm::fs::DirectoryEntry& entry)
+                  const fw::dm::fs::Listing::Entry& entry)
   {
-    dest.set_name(entry.name);
+    dest.set_name(entry.name.data(), entry.name.size());
     set_mtime_of(dest, entry);
   }
 
+  bool none(const fw::dm::fs::Listing::Entry& /*direntry*/) { return false; }
+
+  bool is_file(const fw::dm::fs::Listing::Entry& direntry)
+  {
+    return !direntry.is_dir;
+  }
+
+  bool is_dir(const fw::dm::fs::Listing::Entry& direntry)
+  {
+    return direntry.is_dir;
+  }
+
+  void add_dir(filewatch::DirList& resp,
+               const fw::dm::fs::Listing::Entry& direntry)
+  {
+    auto* dn = resp.add_dirnames();
+    fill_entry(*dn, direntry);
+  }
+
+  void fill_file(filewatch::Filename& fn,
+                 const filewatch::Directoryname& containing_dir,
+                 const fw::dm::fs::Listing::Entry& direntry)
+  {
+    // the containing directory, as stat'ed once by check_directory
+    *fn.mutable_dirname() = containing_dir;
+    fill_entry(fn, direntry);
+    fn.set_size(direntry.size);
+  }
+
+  void add_file(filewatch::FileList& resp,
+                const fw::dm::fs::Listing::Entry& direntry)
+  {
+    fill_file(*resp.add_filenames(), resp.name(), direntry);
+  }
+
+  void add_any(filewatch::EntryList& resp,
+               const fw::dm::fs::Listing::Entry& direntry)
+  {
+    if (direntry.is_dir)
+    {
+      fill_entry(*resp.add_directories(), direntry);
+    }
+    else
+    {
+      fill_file(*resp.add_files(), resp.name(), direntry);
+    }
+  }
+
+  /// The cursor of a page token, 0 for the first page
+  std::optional<uint64_t> parse_page_token(std::string_view page_token)
+  {
+    uint64_t cursor = 0;
+    const auto* end = page_token.data() + page_token.size();
+    auto [ptr, ec] = std::from_chars(page_token.data(), end, cursor);
+    if (!page_token.empty() && (ec != std::errc{} || ptr != end))
+    {
+      return std::nullopt;
+    }
+    return cursor;
+  }
+
 }  // anonymous namespace
 
 grpc::Status
 fw::dm::DirectoryWatcher::fill_dir_list(filewatch::DirList& response) const
 {
-  return fill_entry_list(
-    response,
-    [](const fs::DirectoryEntry& direntry) { return !direntry.is_dir; },
-    [](filewatch::DirList& resp, const fs::DirectoryEntry& direntry) {
-      auto* dn = resp.add_dirnames();
-      fill_entry(*dn, direntry);
-    });
+  return fill_entry_list(response, is_file, add_dir);
 }
 
 grpc::Status
 fw::dm::DirectoryWatcher::fill_file_list(filewatch::FileList& response) const
 {
-  return fill_entry_list(
-    response,
-    [](const fs::DirectoryEntry& direntry) { return direntry.is_dir; },
-    [&](filewatch::FileList& resp, const fs::DirectoryEntry& direntry) {
-      auto* fn = resp.add_filenames();
-      fn->mutable_dirname()->set_name(this->dirname);
-      auto containing_dir_entry = fs.get_direntry(this->dirname);
-      set_mtime_of(*fn->mutable_dirname(), *containing_dir_entry);
-      fill_entry(*fn, direntry);
-      fn->set_size(direntry.size);
-    });
+  return fill_entry_list(response, is_dir, add_file);
+}
+
+grpc::Status
+fw::dm::DirectoryWatcher::fill_entries(filewatch::EntryList& response) const
+{
+  return fill_entry_list(response, none, add_any);
+}
+
+grpc::Status
+fw::dm::DirectoryWatcher::fill_dir_page(filewatch::DirList& response,
+                                        std::string_view page_token,
+                                        std::size_t page_size) const
+{
+  return fill_entry_page(response, page_token, page_size, is_file, add_dir);
+}
+
+grpc::Status
+fw::dm::DirectoryWatcher::fill_file_page(filewatch::FileList& response,
+                                         std::string_view page_token,
+                                         std::size_t page_size) const
+{
+  return fill_entry_page(response, page_token, page_size, is_dir, add_file);
+}
+
+grpc::Status
+fw::dm::DirectoryWatcher::fill_entries_page(filewatch::EntryList& response,
+                                            std::string_view page_token,
+                                            std::size_t page_size) const
+{
+  return fill_entry_page(response, page_token, page_size, none, add_any);
 }
 
 void fw::dm::DirectoryWatcher::register_event_listener(
@@ -72,11 +153,29 @@ void fw::dm::DirectoryWatcher::unregister_event_listener(
   fs.stop_watching(dirname, listener);
 }
 
-template<typename ResponseListT, typename AddEntryFunctionT>
+void fw::dm::DirectoryWatcher::register_recursive_event_listener(
+  DirectoryEventListener& listener)
+{
+  auto recursive =
+    std::make_unique<RecursiveEventListener>(fs, dirname, listener);
+  recursive->start();
+  recursive_listeners[&listener] = std::move(recursive);
+}
+
+void fw::dm::DirectoryWatcher::unregister_recursive_event_listener(
+  DirectoryEventListener& listener)
+{
+  auto iter = recursive_listeners.find(&listener);
+  if (iter != std::end(recursive_listeners))
+  {
+    iter->second->stop();
+    recursive_listeners.erase(iter);
+  }
+}
+
+template<typename ResponseListT>
 grpc::Status
-fw::dm::DirectoryWatcher::fill_entry_list(ResponseListT& response,
-                                          const FilterFunction& filter,
-                                          AddEntryFunctionT add_entry) const
+fw::dm::DirectoryWatcher::check_directory(ResponseListT& response) const
 {
   response.mutable_name()->set_name(dirname);
 
@@ -92,8 +191,22 @@ fw::dm::DirectoryWatcher::fill_entry_list(ResponseListT& response,
   }
 
   set_mtime_of(*response.mutable_name(), *fs.get_direntry(dirname));
+  return grpc::Status::OK;
+}
+
+template<typename ResponseListT, typename AddEntryFunctionT>
+grpc::Status
+fw::dm::DirectoryWatcher::fill_entry_list(ResponseListT& response,
+                                          const FilterFunction& filter,
+                                          AddEntryFunctionT add_entry) const
+{
+  auto status = check_directory(response);
+  if (!status.ok())
+  {
+    return status;
+  }
 
-  for (const auto& direntry : fs.ls(dirname))
+  for (const auto& direntry : fs.list(dirname))
   {
     if (filter(direntry))
     {
@@ -104,3 +217,60 @@ fw::dm::DirectoryWatcher::fill_entry_list(ResponseListT& response,
   }
   return grpc::Status::OK;
 }
+
+template<typename ResponseListT, typename AddEntryFunctionT>
+grpc::Status
+fw::dm::DirectoryWatcher::fill_entry_page(ResponseListT& response,
+                                          std::string_view page_token,
+                                          std::size_t page_size,
+                                          const FilterFunction& filter,
+                                          AddEntryFunctionT add_entry) const
+{
+  if (page_size == 0)
+  {
+    return grpc::Status(grpc::INVALID_ARGUMENT, "The page size must be > 0");
+  }
+  auto cursor = parse_page_token(page_token);
+  if (!cursor)
+  {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "Invalid page token '" + std::string{page_token}
+                          + "'");
+  }
+
+  auto status = check_directory(response);
+  if (!status.ok())
+  {
+    return status;
+  }
+
+  // the entries filtered out do not count, so pages of the file system are
+  // read until page_size entries are added
+  std::size_t added = 0;
+  for (;;)
+  {
+    auto page = fs.list_page(dirname, *cursor, page_size);
+    for (std::size_t i = 0; i < page.entries.size(); ++i)
+    {
+      const auto direntry = page.entries[i];
+      if (filter(direntry))
+      {
+        continue;
+      }
+
+      add_entry(response, direntry);
+      if (++added == page_size
+          && (i + 1 < page.entries.size() || !page.end))
+      {
+        response.set_next_page_token(std::to_string(page.cursors[i]));
+        return grpc::Status::OK;
+      }
+    }
+
+    if (page.end)
+    {
+      return grpc::Status::OK;
+    }
+    *cursor = page.next;
+  }
+}
@@ -2,8 +2,11 @@
 #define DIRECTORYWATCHER_H
 
 #include "daemon/directoryview.h"
+#include "daemon/listing.h"
 
 #include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -11,34 +14,61 @@ namespace fw
 {
   namespace dm
   {
-    namespace fs
-    {
-      struct DirectoryEntry;
-    }  // namespace fs
-
-
     class FileSystem;
+    class RecursiveEventListener;
 
     class DirectoryWatcher : public DirectoryView
     {
     public:
       DirectoryWatcher(std::string_view dirname, FileSystem& fs);
+      DirectoryWatcher(const DirectoryWatcher&) = delete;
+      DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+      DirectoryWatcher(DirectoryWatcher&&) = delete;
+      DirectoryWatcher& operator=(DirectoryWatcher&&) = delete;
+      ~DirectoryWatcher() override;
 
       grpc::Status fill_dir_list(filewatch::DirList& response) const override;
       grpc::Status fill_file_list(filewatch::FileList& response) const override;
+      grpc::Status fill_entries(filewatch::EntryList& response) const override;
+      grpc::Status fill_dir_page(filewatch::DirList& response,
+                                 std::string_view page_token,
+                                 std::size_t page_size) const override;
+      grpc::Status fill_file_page(filewatch::FileList& response,
+                                  std::string_view page_token,
+                                  std::size_t page_size) const override;
+      grpc::Status fill_entries_page(filewatch::EntryList& response,
+                                     std::string_view page_token,
+                                     std::size_t page_size) const override;
       void register_event_listener(DirectoryEventListener& listener) override;
       void unregister_event_listener(DirectoryEventListener& listener) override;
+      void register_recursive_event_listener(
+        DirectoryEventListener& listener) override;
+      void unregister_recursive_event_listener(
+        DirectoryEventListener& listener) override;
 
     private:
-      typedef std::function<bool(const fs::DirectoryEntry&)> FilterFunction;
+      typedef std::function<bool(const fs::Listing::Entry&)> FilterFunction;
+
+      /// Names response after the directory, and checks that it is one
+      template<typename ResponseListT>
+      grpc::Status check_directory(ResponseListT& response) const;
 
       template<typename ResponseListT, typename AddEntryFunctionT>
       grpc::Status fill_entry_list(ResponseListT& response,
                                    const FilterFunction& filter,
                                    AddEntryFunctionT add_entry) const;
+      template<typename ResponseListT, typename AddEntryFunctionT>
+      grpc::Status fill_entry_page(ResponseListT& response,
+                                   std::string_view page_token,
+                                   std::size_t page_size,
+                                   const FilterFunction& filter,
+                                   AddEntryFunctionT add_entry) const;
 
       std::string dirname;
       FileSystem& fs;
+      std::map<DirectoryEventListener*,
+               std::unique_ptr<RecursiveEventListener>>
+        recursive_listeners;
     };
 
   }  // namespace dm
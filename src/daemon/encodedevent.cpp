@@ -0,0 +1,150 @@
+#include "encodedevent.h"
+
+#include "statistics.h"
+
+#include <grpcpp/impl/codegen/proto_utils.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+  bool is_file_event(filewatch::DirectoryEvent::Event event)
+  {
+    switch (event)
+    {
+    case filewatch::DirectoryEvent::FILE_ADDED:
+    case filewatch::DirectoryEvent::FILE_REMOVED:
+    case filewatch::DirectoryEvent::FILE_RENAMED:
+    case filewatch::DirectoryEvent::FILE_MODIFIED:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /// The last event encoded on this thread, by relative path
+  class EncodingCache
+  {
+  public:
+    fw::dm::EncodedEventPtr find(const fw::dm::EventDescription& desc)
+    {
+      if (!same_event(desc))
+      {
+        return nullptr;
+      }
+
+      auto iter = std::find_if(
+        std::begin(encodings), std::end(encodings),
+        [&](const auto& e) { return e.first == desc.relative_path; });
+      return iter == std::end(encodings) ? nullptr : iter->second;
+    }
+
+    void insert(const fw::dm::EventDescription& desc,
+                fw::dm::EncodedEventPtr encoded)
+    {
+      if (!same_event(desc))
+      {
+        event = desc.event;
+        sequence = desc.sequence;
+        mtime = desc.mtime;
+        size = desc.size;
+        containing_dir = desc.containing_dir;
+        dir_name = desc.dir_name;
+        old_name = desc.old_name;
+        encodings.clear();
+      }
+
+      // recursive subscriptions from many different roots are rare
+      constexpr std::size_t max_encodings = 16;
+      if (encodings.size() == max_encodings)
+      {
+        encodings.erase(std::begin(encodings));
+      }
+      encodings.emplace_back(std::string{desc.relative_path},
+                             std::move(encoded));
+    }
+
+  private:
+    bool same_event(const fw::dm::EventDescription& desc) const
+    {
+      return desc.event == event && desc.sequence == sequence
+             && desc.mtime == mtime && desc.size == size
+             && desc.containing_dir == containing_dir
+             && desc.dir_name == dir_name && desc.old_name == old_name;
+    }
+
+    filewatch::DirectoryEvent::Event event =
+      filewatch::DirectoryEvent::WATCHING_DIRECTORY;
+    uint64_t sequence = 0;
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    std::string containing_dir;
+    std::string dir_name;
+    std::string old_name;
+    std::vector<std::pair<std::string, fw::dm::EncodedEventPtr>> encodings;
+  };
+
+}  // anonymous namespace
+
+fw::dm::EncodedEvent::EncodedEvent(const filewatch::DirectoryEvent& event) :
+  type(event.event()), containing_dir(event.name()),
+  entry(event.dirname().name()), old(event.old_name()),
+  modified(event.modification_time().epoch()),
+  file_size(event.filename().size()), seq(event.sequence())
+{
+  bool own_buffer = false;
+  auto status =
+    grpc::SerializationTraits<filewatch::DirectoryEvent>::Serialize(
+      event, &buffer, &own_buffer);
+  if (!status.ok())
+  {
+    throw std::runtime_error("Unable to serialize DirectoryEvent: "
+                             + status.error_message());
+  }
+}
+
+filewatch::DirectoryEvent fw::dm::to_message(const EventDescription& desc)
+{
+  filewatch::DirectoryEvent direvt;
+  direvt.set_event(desc.event);
+  direvt.set_name(std::string(desc.containing_dir));
+  direvt.mutable_modification_time()->set_epoch(desc.mtime);
+  direvt.mutable_dirname()->set_name(std::string(desc.dir_name));
+  direvt.mutable_dirname()->mutable_modification_time()->set_epoch(desc.mtime);
+  direvt.set_relative_path(std::string(desc.relative_path));
+  direvt.set_sequence(desc.sequence);
+  if (is_file_event(desc.event))
+  {
+    auto* filename = direvt.mutable_filename();
+    filename->mutable_dirname()->set_name(std::string(desc.containing_dir));
+    filename->set_name(std::string(desc.dir_name));
+    filename->mutable_modification_time()->set_epoch(desc.mtime);
+    filename->set_size(desc.size);
+  }
+  if (!desc.old_name.empty())
+  {
+    direvt.set_old_name(std::string(desc.old_name));
+  }
+  return direvt;
+}
+
+fw::dm::EncodedEventPtr fw::dm::encode_shared(const EventDescription& desc)
+{
+  static auto& encoded = statistics().counter("events.encoded");
+  static auto& shared = statistics().counter("events.shared");
+  thread_local EncodingCache cache;
+
+  auto encoding = cache.find(desc);
+  if (encoding)
+  {
+    ++shared;
+    return encoding;
+  }
+
+  encoding = std::make_shared<const EncodedEvent>(to_message(desc));
+  cache.insert(desc, encoding);
+  ++encoded;
+  return encoding;
+}
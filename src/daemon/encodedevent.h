@@ -0,0 +1,78 @@
+#ifndef ENCODEDEVENT_H
+#define ENCODEDEVENT_H
+
+#include "filewatch.pb.h"
+
+#include <grpcpp/support/byte_buffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace fw
+{
+  namespace dm
+  {
+    /// A DirectoryEvent serialized once.  The bytes are reference counted
+    /// slices, so writing them to any number of streams copies nothing.
+    /// Keeps the fields EventQueue needs to coalesce events, and the ones
+    /// ChangeTracker records.
+    class EncodedEvent
+    {
+    public:
+      explicit EncodedEvent(const filewatch::DirectoryEvent& event);
+
+      const grpc::ByteBuffer& bytes() const { return buffer; }
+
+      filewatch::DirectoryEvent::Event event() const { return type; }
+      /// The directory the event happened in
+      const std::string& name() const { return containing_dir; }
+      /// The entry of name the event is about
+      const std::string& entry_name() const { return entry; }
+      bool is_rename() const { return !old.empty(); }
+      const std::string& old_name() const { return old; }
+      uint64_t mtime() const { return modified; }
+      /// The size of the file, 0 for directories
+      uint64_t size() const { return file_size; }
+      uint64_t sequence() const { return seq; }
+
+    private:
+      grpc::ByteBuffer buffer;
+      filewatch::DirectoryEvent::Event type;
+      std::string containing_dir;
+      std::string entry;
+      std::string old;
+      uint64_t modified;
+      uint64_t file_size;
+      uint64_t seq;
+    };
+
+    using EncodedEventPtr = std::shared_ptr<const EncodedEvent>;
+
+    /// What a DirectoryEventListener is notified about, and the path of
+    /// containing_dir relative to the directory the subscriber listens to
+    struct EventDescription
+    {
+      filewatch::DirectoryEvent::Event event;
+      std::string_view containing_dir;
+      std::string_view dir_name;
+      uint64_t mtime;
+      uint64_t size;
+      std::string_view old_name;
+      std::string_view relative_path;
+      uint64_t sequence;
+    };
+
+    filewatch::DirectoryEvent to_message(const EventDescription& desc);
+
+    /// The encoding of desc.  The feeds of an event get it delivered one
+    /// after another on the same thread with the same sequence, see
+    /// EventDispatch, so they share the encoding made for the first of
+    /// them with the same relative_path.
+    EncodedEventPtr encode_shared(const EventDescription& desc);
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* ENCODEDEVENT_H */
@@ -0,0 +1,193 @@
+#include "eventjournal.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <utility>
+
+namespace
+{
+  std::atomic<uint64_t>& sequence()
+  {
+    static std::atomic<uint64_t> seq{static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch())
+        .count())};
+    return seq;
+  }
+
+  thread_local fw::dm::EventDispatch* current_dispatch = nullptr;
+
+}  // anonymous namespace
+
+uint64_t fw::dm::next_event_sequence()
+{
+  return ++sequence();
+}
+
+uint64_t fw::dm::last_event_sequence()
+{
+  return sequence().load();
+}
+
+void fw::dm::advance_event_sequence(uint64_t sequence_)
+{
+  auto current = sequence().load();
+  while (current < sequence_
+         && !sequence().compare_exchange_weak(current, sequence_))
+  {
+  }
+}
+
+fw::dm::EventDispatch::EventDispatch() :
+  outer(current_dispatch),
+  outermost(outer != nullptr ? outer->outermost : this),
+  event(outermost->events++)
+{
+  current_dispatch = this;
+}
+
+fw::dm::EventDispatch::~EventDispatch()
+{
+  current_dispatch = outer;
+  if (outer == nullptr)
+  {
+    run_deliveries();
+  }
+}
+
+void fw::dm::EventDispatch::run_deliveries() noexcept
+{
+  if (deliveries.empty())
+  {
+    return;
+  }
+
+  // the deliveries of an event dispatched while another one is may be
+  // asked for before the rest of the other's, but are numbered after them
+  std::stable_sort(
+    std::begin(deliveries), std::end(deliveries),
+    [](const auto& a, const auto& b) { return a.event < b.event; });
+
+  for (auto first = std::begin(deliveries); first != std::end(deliveries);)
+  {
+    auto last = std::find_if(first, std::end(deliveries), [&](const auto& d) {
+      return d.event != first->event;
+    });
+
+    // in the order of their addresses, as every thread does
+    std::vector<std::mutex*> orders;
+    for (auto iter = first; iter != last; ++iter)
+    {
+      orders.push_back(iter->order);
+    }
+    std::sort(std::begin(orders), std::end(orders));
+    orders.erase(std::unique(std::begin(orders), std::end(orders)),
+                 std::end(orders));
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(orders.size());
+    for (auto* order : orders)
+    {
+      locks.emplace_back(*order);
+    }
+
+    const auto sequence = next_event_sequence();
+    for (; first != last; ++first)
+    {
+      try
+      {
+        first->deliver(sequence);
+      }
+      catch (const std::exception& e)
+      {
+        spdlog::error("Unable to deliver event {}: {}", sequence, e.what());
+      }
+    }
+  }
+}
+
+void fw::dm::sequenced(std::mutex& order,
+                       std::function<void(uint64_t)> deliver)
+{
+  if (current_dispatch == nullptr)
+  {
+    std::lock_guard<std::mutex> sentry(order);
+    deliver(next_event_sequence());
+    return;
+  }
+
+  current_dispatch->outermost->deliveries.push_back(EventDispatch::Delivery{
+    current_dispatch->event, &order, std::move(deliver)});
+}
+
+fw::dm::EventJournal::EventJournal(std::size_t max_size,
+                                   uint64_t first_after) :
+  ring(max_size), complete_after(first_after), last(first_after)
+{
+}
+
+void fw::dm::EventJournal::append(EncodedEventPtr event)
+{
+  assert(event->sequence() > last);
+  last = event->sequence();
+  if (ring.empty())
+  {
+    complete_after = last;
+    return;
+  }
+
+  if (count == ring.size())
+  {
+    complete_after = ring[oldest]->sequence();
+    ring[oldest] = std::move(event);
+    oldest = (oldest + 1) % ring.size();
+    return;
+  }
+
+  ring[(oldest + count) % ring.size()] = std::move(event);
+  ++count;
+}
+
+std::optional<std::vector<fw::dm::EncodedEventPtr>>
+fw::dm::EventJournal::since(uint64_t sequence) const
+{
+  if (sequence < complete_after || sequence > last)
+  {
+    return std::nullopt;
+  }
+
+  // binary search for the first event after sequence
+  std::size_t first = 0;
+  std::size_t end = count;
+  while (first < end)
+  {
+    auto middle = first + (end - first) / 2;
+    if (at(middle)->sequence() <= sequence)
+    {
+      first = middle + 1;
+    }
+    else
+    {
+      end = middle;
+    }
+  }
+
+  std::vector<EncodedEventPtr> events;
+  events.reserve(count - first);
+  for (auto i = first; i < count; ++i)
+  {
+    events.push_back(at(i));
+  }
+  return events;
+}
+
+const fw::dm::EncodedEventPtr&
+fw::dm::EventJournal::at(std::size_t index) const
+{
+  return ring[(oldest + index) % ring.size()];
+}
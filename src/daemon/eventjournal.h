@@ -0,0 +1,127 @@
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include "encodedevent.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    struct EventJournalOptions
+    {
+      std::size_t max_size = 4096;  // events kept per subscription
+      // how long the events of a subscription are recorded after its last
+      // subscriber is gone
+      std::chrono::milliseconds retention{60000};
+    };
+
+    /// The next sequence number of the daemon.  Sequence numbers start at
+    /// the time the daemon started in microseconds, so they keep increasing
+    /// across restarts and a client cannot resume from a sequence number
+    /// of an earlier run by mistake.  Thread safe.
+    uint64_t next_event_sequence();
+    /// The sequence number handed out last
+    uint64_t last_event_sequence();
+    /// Make the next sequence numbers larger than sequence, e.g., the last
+    /// one an earlier run of the daemon logged
+    void advance_event_sequence(uint64_t sequence);
+
+    /// Gives the listeners of one event the same sequence number, and has
+    /// the events of all threads delivered to each listener in the order
+    /// of their numbers.  Whatever originates events, e.g., a watch thread,
+    /// keeps an
+    /// EventDispatch while it notifies the listeners of an event.  The
+    /// deliveries the listeners ask for with sequenced() run as the
+    /// outermost EventDispatch of the thread ends, i.e., after the
+    /// listeners, which may watch and unwatch directories, are done.  An
+    /// event a listener originates while it is notified, e.g., for the
+    /// entries of an added directory, has an EventDispatch of its own and
+    /// is numbered after the event being dispatched.
+    class EventDispatch
+    {
+    public:
+      EventDispatch();
+      ~EventDispatch();
+
+      EventDispatch(const EventDispatch&) = delete;
+      EventDispatch& operator=(const EventDispatch&) = delete;
+      EventDispatch(EventDispatch&&) = delete;
+      EventDispatch& operator=(EventDispatch&&) = delete;
+
+    private:
+      friend void sequenced(std::mutex& order,
+                            std::function<void(uint64_t)> deliver);
+
+      struct Delivery
+      {
+        std::size_t event;  // in the order the events were dispatched
+        std::mutex* order;
+        std::function<void(uint64_t)> deliver;
+      };
+
+      void run_deliveries() noexcept;
+
+      // of the outermost EventDispatch only, so first
+      std::size_t events = 0;
+      std::vector<Delivery> deliveries;
+
+      EventDispatch* outer;
+      EventDispatch* outermost;
+      std::size_t event;
+    };
+
+    /// Have deliver called with the sequence number of the event being
+    /// dispatched on this thread, see EventDispatch, or right away with a
+    /// number of its own outside any.  order is the mutex of what deliver
+    /// records the event in, e.g., an EventFeed.  The mutexes of all the
+    /// deliveries of an event are locked before its number is drawn, and
+    /// held while they run, so whoever holds order sees increasing numbers
+    /// only.  The deliveries of events without a mutex in common run in
+    /// parallel.  deliver must not lock order, nor call sequenced().
+    void sequenced(std::mutex& order, std::function<void(uint64_t)> deliver);
+
+    /// Ring buffer of the latest events of a subscription, ordered by their
+    /// sequence numbers.  The journal is not thread safe.
+    class EventJournal
+    {
+    public:
+      /// All events with sequence numbers after first_after are recorded,
+      /// until they are evicted by newer events
+      EventJournal(std::size_t max_size, uint64_t first_after);
+
+      /// The sequence number of event must be larger than the ones
+      /// appended before it
+      void append(EncodedEventPtr event);
+
+      /// The events after sequence, or nothing if some of them are not in
+      /// the journal, i.e., they are evicted or were never recorded.
+      std::optional<std::vector<EncodedEventPtr>>
+      since(uint64_t sequence) const;
+
+      /// The sequence number of the newest event, first_after if none
+      uint64_t last_sequence() const { return last; }
+
+      std::size_t size() const { return count; }
+
+    private:
+      const EncodedEventPtr& at(std::size_t index) const;
+
+      std::vector<EncodedEventPtr> ring;
+      std::size_t oldest = 0;
+      std::size_t count = 0;
+      uint64_t complete_after;  // no event after this is evicted
+      uint64_t last;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* EVENTJOURNAL_H */
@@ -0,0 +1,403 @@
+#include "eventlog.h"
+
+#include "details/mappedfile.h"
+#include "statistics.h"
+
+#include <grpcpp/support/slice.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+  constexpr std::array<char, 8> magic{'f', 'w', 'e', 'v', 'l', 'o', 'g', '1'};
+  constexpr std::size_t alignment = 8;
+  constexpr std::string_view suffix{".log"};
+  constexpr std::size_t min_segment_size = 4096;
+
+  /// Starts every segment
+  struct SegmentHeader
+  {
+    std::array<char, 8> magic;
+    uint64_t previous_sequence;  // of the last event before the segment
+  };
+
+  /// Precedes the serialized event of every record.  A size of 0 marks the
+  /// end of the records, as the segments are zero filled.
+  struct RecordHeader
+  {
+    uint32_t size;
+    uint32_t checksum;
+    uint64_t sequence;
+    uint64_t timestamp;
+  };
+
+  std::size_t aligned(std::size_t size)
+  {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  std::size_t record_size(std::size_t event_size)
+  {
+    return sizeof(RecordHeader) + aligned(event_size);
+  }
+
+  /// FNV-1a, to tell a record torn by a crash from a complete one
+  uint32_t checksum(uint64_t sequence, uint64_t timestamp, const char* data,
+                    std::size_t size)
+  {
+    uint32_t hash = 2166136261U;
+    auto add = [&](const char* bytes, std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        hash ^= static_cast<unsigned char>(bytes[i]);  // NOLINT
+        hash *= 16777619U;
+      }
+    };
+    add(reinterpret_cast<const char*>(&sequence), sizeof sequence);  // NOLINT
+    add(reinterpret_cast<const char*>(&timestamp), sizeof timestamp);  // NOLINT
+    add(data, size);
+    return hash;
+  }
+
+  std::string segment_name(uint64_t first_sequence)
+  {
+    auto digits = std::to_string(first_sequence);
+    return std::string(20 - std::min<std::size_t>(20, digits.size()), '0')
+           + digits + std::string{suffix};
+  }
+
+  bool is_segment_name(const std::string& name)
+  {
+    if (name.size() <= suffix.size() || !name.ends_with(suffix))
+    {
+      return false;
+    }
+    uint64_t sequence = 0;
+    auto end = name.data() + name.size() - suffix.size();  // NOLINT
+    return std::from_chars(name.data(), end, sequence).ptr == end;
+  }
+
+  /// The records of a segment read_after() reads, after releasing the
+  /// mutex
+  struct SegmentRange
+  {
+    std::shared_ptr<const fw::dm::dtls::MappedFile> file;
+    std::size_t offset;
+    std::size_t end;
+  };
+
+  /// Visit the records of a segment in order, from the one at offset
+  /// until visit returns false.  Returns the offset after the last valid
+  /// record.  The checksums are verified if verify, i.e., for the records
+  /// of a segment being opened; the ones before its end are valid.
+  template<typename VisitT>
+  std::size_t for_each_record(const char* data, std::size_t size,
+                              std::size_t offset, bool verify, VisitT visit)
+  {
+    while (offset + sizeof(RecordHeader) <= size)
+    {
+      RecordHeader header{};
+      std::memcpy(&header, data + offset, sizeof header);  // NOLINT
+      const char* event = data + offset + sizeof header;  // NOLINT
+      if (header.size == 0
+          || record_size(header.size) > size - offset
+          || (verify
+              && header.checksum
+                   != checksum(header.sequence, header.timestamp, event,
+                               header.size)))
+      {
+        break;
+      }
+      if (!visit(header, event, offset))
+      {
+        break;
+      }
+      offset += record_size(header.size);
+    }
+    return offset;
+  }
+
+}  // anonymous namespace
+
+fw::dm::EventLog::EventLog(const EventLogOptions& options_,
+                           uint64_t first_after_) :
+  options(options_),
+  first_after(first_after_)
+{
+  if (options.segment_size < min_segment_size)
+  {
+    throw std::invalid_argument("Event log segments must be at least "
+                                + std::to_string(min_segment_size)
+                                + " bytes");
+  }
+  std::filesystem::create_directories(options.directory);
+
+  std::vector<std::string> paths;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(options.directory))
+  {
+    if (entry.is_regular_file()
+        && is_segment_name(entry.path().filename().string()))
+    {
+      paths.push_back(entry.path().string());
+    }
+  }
+  // the names are zero padded, so they sort by sequence number
+  std::sort(std::begin(paths), std::end(paths));
+
+  std::lock_guard<std::mutex> sentry(mutex);
+  for (const auto& path : paths)
+  {
+    open_segment(path);
+  }
+  statistics().counter("eventlog.segments") = segments.size();
+  spdlog::info("Event log {} has {} segments, last sequence {}",
+               options.directory, segments.size(), last_sequence_locked());
+}
+
+fw::dm::EventLog::~EventLog()
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  if (!segments.empty())
+  {
+    segments.back().file->flush();
+  }
+}
+
+void fw::dm::EventLog::Segment::add(uint64_t sequence, uint64_t timestamp,
+                                    std::size_t offset)
+{
+  if (records % index_interval == 0)
+  {
+    index.push_back(IndexEntry{sequence, timestamp, offset});
+  }
+  ++records;
+  last_sequence = sequence;
+  last_timestamp = timestamp;
+}
+
+std::size_t fw::dm::EventLog::Segment::offset_after(uint64_t sequence) const
+{
+  auto iter = std::upper_bound(
+    std::begin(index), std::end(index), sequence,
+    [](uint64_t s, const IndexEntry& e) { return s < e.sequence; });
+  return iter == std::begin(index) ? sizeof(SegmentHeader)
+                                   : std::prev(iter)->offset;
+}
+
+void fw::dm::EventLog::open_segment(const std::string& path)
+{
+  Segment segment;
+  segment.path = path;
+  segment.file = std::make_shared<dtls::MappedFile>(path, false);
+  const char* data = segment.file->data();
+  auto size = segment.file->size();
+  SegmentHeader header{};
+  if (size < sizeof header)
+  {
+    spdlog::warn("Ignoring {}: not an event log segment", path);
+    return;
+  }
+  std::memcpy(&header, data, sizeof header);
+  if (header.magic != magic)
+  {
+    spdlog::warn("Ignoring {}: not an event log segment", path);
+    return;
+  }
+
+  segment.previous_sequence = header.previous_sequence;
+  segment.last_sequence = header.previous_sequence;
+  // stops at a record torn by a crash, if any
+  segment.end = for_each_record(
+    data, size, sizeof header, true,
+    [&](const RecordHeader& record, const char* /*event*/,
+        std::size_t offset) {
+      segment.add(record.sequence, record.timestamp, offset);
+      return true;
+    });
+  segments.push_back(std::move(segment));
+}
+void fw::dm::EventLog::start_segment(uint64_t first_sequence)
+{
+  if (!segments.empty())
+  {
+    segments.back().file->flush();
+  }
+
+  SegmentHeader header{magic, last_sequence_locked()};
+  Segment segment;
+  segment.path =
+    (std::filesystem::path(options.directory) / segment_name(first_sequence))
+      .string();
+  segment.file =
+    std::make_shared<dtls::MappedFile>(segment.path, options.segment_size);
+  std::memcpy(segment.file->data(), &header, sizeof header);
+  segment.end = sizeof header;
+  segment.previous_sequence = header.previous_sequence;
+  segment.last_sequence = header.previous_sequence;
+  segment.writable = true;
+  segments.push_back(std::move(segment));
+}
+
+void fw::dm::EventLog::drop_expired_segments(uint64_t now)
+{
+  auto retention = static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(options.retention)
+      .count());
+  auto expired = std::find_if(
+    std::begin(segments), std::prev(std::end(segments)),
+    [&](const Segment& s) { return s.last_timestamp + retention >= now; });
+  for (auto iter = std::begin(segments); iter != expired; ++iter)
+  {
+    std::error_code ec;
+    std::filesystem::remove(iter->path, ec);
+    if (ec)
+    {
+      spdlog::warn("Could not remove {}: {}", iter->path, ec.message());
+    }
+  }
+  segments.erase(std::begin(segments), expired);
+}
+
+void fw::dm::EventLog::append(const EncodedEvent& event, uint64_t timestamp)
+{
+  static auto& appended = statistics().counter("eventlog.appended");
+  static auto& segment_count = statistics().counter("eventlog.segments");
+
+  thread_local std::vector<grpc::Slice> slices;
+  slices.clear();
+  event.bytes().Dump(&slices);
+  std::size_t size = 0;
+  for (const auto& s : slices)
+  {
+    size += s.size();
+  }
+  if (sizeof(SegmentHeader) + record_size(size) > options.segment_size)
+  {
+    spdlog::error("Event {} of {} bytes does not fit in an event log segment",
+                  event.sequence(), size);
+    return;
+  }
+
+  std::lock_guard<std::mutex> sentry(mutex);
+  if (segments.empty() || !segments.back().writable
+      || record_size(size)
+           > segments.back().file->size() - segments.back().end)
+  {
+    start_segment(event.sequence());
+    drop_expired_segments(timestamp);
+    segment_count = segments.size();
+  }
+
+  auto& segment = segments.back();
+  char* record = segment.file->data() + segment.end;  // NOLINT
+  char* data = record + sizeof(RecordHeader);  // NOLINT
+  std::size_t offset = 0;
+  for (const auto& s : slices)
+  {
+    std::memcpy(data + offset, s.begin(), s.size());  // NOLINT
+    offset += s.size();
+  }
+  RecordHeader header{static_cast<uint32_t>(size),
+                      checksum(event.sequence(), timestamp, data, size),
+                      event.sequence(), timestamp};
+  std::memcpy(record, &header, sizeof header);
+
+  segment.add(event.sequence(), timestamp, segment.end);
+  segment.end += record_size(size);
+  ++appended;
+}
+
+std::vector<fw::dm::EventLog::Record>
+fw::dm::EventLog::read_after(uint64_t sequence, std::size_t max_records) const
+{
+  std::vector<SegmentRange> ranges;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    auto first = std::find_if(
+      std::begin(segments), std::end(segments),
+      [&](const Segment& s) { return s.last_sequence > sequence; });
+    for (auto iter = first; iter != std::end(segments); ++iter)
+    {
+      ranges.push_back(
+        SegmentRange{iter->file, iter->offset_after(sequence), iter->end});
+    }
+  }
+
+  std::vector<Record> records;
+  for (auto iter = std::begin(ranges);
+       iter != std::end(ranges) && records.size() < max_records; ++iter)
+  {
+    for_each_record(
+      iter->file->data(), iter->end, iter->offset, false,
+      [&](const RecordHeader& header, const char* event,
+          std::size_t /*offset*/) {
+        if (header.sequence > sequence)
+        {
+          records.push_back(Record{header.sequence, header.timestamp,
+                                   std::string(event, header.size)});
+        }
+        return records.size() < max_records;
+      });
+  }
+  return records;
+}
+
+uint64_t fw::dm::EventLog::sequence_before(uint64_t timestamp) const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto segment = std::find_if(
+    std::begin(segments), std::end(segments),
+    [&](const Segment& s) { return s.last_timestamp >= timestamp; });
+  if (segment == std::end(segments))
+  {
+    return last_sequence_locked();
+  }
+
+  uint64_t before = segment->previous_sequence;
+  std::size_t offset = sizeof(SegmentHeader);
+  auto entry = std::lower_bound(
+    std::begin(segment->index), std::end(segment->index), timestamp,
+    [](const IndexEntry& e, uint64_t t) { return e.timestamp < t; });
+  if (entry != std::begin(segment->index))
+  {
+    before = std::prev(entry)->sequence;
+    offset = std::prev(entry)->offset;
+  }
+  for_each_record(segment->file->data(), segment->end, offset, false,
+                  [&](const RecordHeader& header, const char* /*event*/,
+                      std::size_t /*offset*/) {
+                    if (header.timestamp >= timestamp)
+                    {
+                      return false;
+                    }
+                    before = header.sequence;
+                    return true;
+                  });
+  return before;
+}
+
+uint64_t fw::dm::EventLog::complete_after() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  return segments.empty() ? first_after : segments.front().previous_sequence;
+}
+
+uint64_t fw::dm::EventLog::last_sequence() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  return last_sequence_locked();
+}
+
+uint64_t fw::dm::EventLog::last_sequence_locked() const
+{
+  return segments.empty() ? first_after : segments.back().last_sequence;
+}
@@ -0,0 +1,132 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include "encodedevent.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      class MappedFile;
+    }
+
+    struct EventLogOptions
+    {
+      std::string directory;  // where the segments are kept, empty for none
+      std::size_t segment_size = 16 * 1024 * 1024;
+      // segments whose newest event is older than this are deleted
+      std::chrono::seconds retention{24 * 60 * 60};
+    };
+
+    /// Append-only log of encoded events on local disk, e.g., to replay
+    /// the events that happened while a client was not connected, or
+    /// before the daemon was restarted.
+    ///
+    /// The log is a series of segment files of segment_size bytes, named
+    /// by the sequence number of their first event.  The segments are
+    /// memory mapped, so appending an event is a copy into the page cache.
+    /// A new segment is started when an event does not fit in the newest
+    /// one, and the segments older than the retention are deleted then.
+    /// The segments of an earlier run are only read, so an event torn by
+    /// a crash ends their records.  The checksums of the records are
+    /// verified as a segment is opened, and every index_interval-th record
+    /// of a segment is indexed, so reading starts near the records asked
+    /// for.  Records are read without holding up append(), as the records
+    /// of a segment do not change once appended.
+    /// Thread safe.  Only available on Linux.
+    class EventLog
+    {
+    public:
+      struct Record
+      {
+        uint64_t sequence;
+        uint64_t timestamp;  // milliseconds since epoch
+        std::string event;  // serialized DirectoryEvent
+      };
+
+      /// Open the segments in options.directory, which is created if it
+      /// does not exist.  A log without segments records the events after
+      /// first_after.  Throws std::runtime_error on failure.
+      EventLog(const EventLogOptions& options, uint64_t first_after);
+      EventLog(const EventLog&) = delete;
+      EventLog& operator=(const EventLog&) = delete;
+      EventLog(EventLog&&) = delete;
+      EventLog& operator=(EventLog&&) = delete;
+      ~EventLog();
+
+      /// The sequence number of event must be larger than the ones
+      /// appended before it.  Throws std::runtime_error if a new segment
+      /// cannot be created, e.g., as the disk is full.
+      void append(const EncodedEvent& event, uint64_t timestamp);
+
+      /// Up to max_records records after sequence, oldest first
+      std::vector<Record> read_after(uint64_t sequence,
+                                     std::size_t max_records) const;
+
+      /// The sequence number before the first record at or after timestamp
+      uint64_t sequence_before(uint64_t timestamp) const;
+
+      /// Every event after this sequence number is in the log, as far as
+      /// the daemon was running.  Older ones are deleted by the retention.
+      uint64_t complete_after() const;
+      /// The sequence number of the newest record, complete_after() if
+      /// there is none
+      uint64_t last_sequence() const;
+
+    private:
+      static constexpr std::size_t index_interval = 64;
+
+      struct IndexEntry
+      {
+        uint64_t sequence;
+        uint64_t timestamp;
+        std::size_t offset;
+      };
+
+      struct Segment
+      {
+        /// Account for the record at offset, the newest of the segment
+        void add(uint64_t sequence, uint64_t timestamp, std::size_t offset);
+        /// The offset of a record at or before the first one after
+        /// sequence, see index_interval
+        std::size_t offset_after(uint64_t sequence) const;
+
+        std::string path;
+        // shared with readers, so that dropping the segment does not unmap
+        // it while it is read
+        std::shared_ptr<dtls::MappedFile> file;
+        std::size_t end = 0;  // offset after the last record
+        bool writable = false;  // only the segment started last
+        uint64_t previous_sequence = 0;  // of the last event before it
+        uint64_t last_sequence = 0;
+        uint64_t last_timestamp = 0;
+        std::size_t records = 0;
+        std::vector<IndexEntry> index;  // every index_interval-th record
+      };
+
+      // mutex must be held by the callers of these
+      void open_segment(const std::string& path);
+      void start_segment(uint64_t first_sequence);
+      void drop_expired_segments(uint64_t now);
+      uint64_t last_sequence_locked() const;
+
+      EventLogOptions options;
+      uint64_t first_after;
+      mutable std::mutex mutex;
+      std::vector<Segment> segments;  // oldest first
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* EVENTLOG_H */
@@ -0,0 +1,95 @@
+#include "eventqueue.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+fw::dm::OverflowPolicy fw::dm::parse_overflow_policy(std::string_view name)
+{
+  if (name == "drop-oldest")
+  {
+    return OverflowPolicy::drop_oldest;
+  }
+  if (name == "coalesce")
+  {
+    return OverflowPolicy::coalesce;
+  }
+  if (name == "disconnect")
+  {
+    return OverflowPolicy::disconnect;
+  }
+  throw std::invalid_argument("Unknown overflow policy: " + std::string{name});
+}
+
+fw::dm::EventQueue::EventQueue(const EventQueueOptions& options,
+                               std::string root_) :
+  max_size(std::max<std::size_t>(options.max_size, 1)),
+  overflow_policy(options.overflow_policy), root(std::move(root_))
+{
+}
+
+fw::dm::EventQueue::PushResult
+fw::dm::EventQueue::push(EncodedEventPtr event)
+{
+  auto result = PushResult::queued;
+  auto first_waiting = std::begin(events) + (in_flight ? 1 : 0);
+  if (events.size() - (in_flight ? 1 : 0) >= max_size)
+  {
+    if (overflow_policy == OverflowPolicy::drop_oldest)
+    {
+      events.erase(first_waiting);
+      result = PushResult::dropped_oldest;
+    }
+    else if (overflow_policy == OverflowPolicy::coalesce && coalesce(*event))
+    {
+      result = PushResult::coalesced;
+    }
+    else
+    {
+      events.erase(first_waiting, std::end(events));
+      // the resync replaces the events up to this one, so a client that
+      // rescans resumes from its sequence
+      events.push_back(std::make_shared<const EncodedEvent>(
+        to_message(EventDescription{filewatch::DirectoryEvent::RESYNC_REQUIRED,
+                                    root, ".", 0, 0, {}, ".",
+                                    event->sequence()})));
+      return PushResult::resync_required;
+    }
+  }
+
+  events.push_back(std::move(event));
+  return result;
+}
+
+const fw::dm::EncodedEvent& fw::dm::EventQueue::start_write()
+{
+  in_flight = true;
+  return *events.front();
+}
+
+void fw::dm::EventQueue::pop()
+{
+  in_flight = false;
+  events.pop_front();
+}
+
+bool fw::dm::EventQueue::coalesce(const EncodedEvent& event)
+{
+  auto first_waiting = std::begin(events) + (in_flight ? 1 : 0);
+  auto iter = std::find_if(
+    first_waiting, std::end(events), [&](const EncodedEventPtr& e) {
+      // a rename is about two entries, and cannot be replaced by an event
+      // about one of them
+      return e->name() == event.name()
+             && e->entry_name() == event.entry_name() && !e->is_rename();
+    });
+  if (iter == std::end(events))
+  {
+    return false;
+  }
+
+  // the newest event about an entry describes its current state
+  events.erase(iter);
+  return true;
+}
@@ -0,0 +1,80 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include "encodedevent.h"
+#include "filewatch.pb.h"
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+namespace fw
+{
+  namespace dm
+  {
+    /// What to do when an event arrives at a full EventQueue.
+    enum class OverflowPolicy
+    {
+      drop_oldest,  // discard the oldest waiting event
+      coalesce,  // replace a waiting event about the same entry if any,
+                 // otherwise disconnect
+      disconnect  // replace waiting events with RESYNC_REQUIRED and close
+    };
+
+    OverflowPolicy parse_overflow_policy(std::string_view name);
+
+    struct EventQueueOptions
+    {
+      std::size_t max_size = 1024;  // max number of events waiting to be sent
+      OverflowPolicy overflow_policy = OverflowPolicy::disconnect;
+    };
+
+    /// Bounded queue of events waiting to be written to one subscriber.
+    /// The events are encoded already, and may be shared with the queues
+    /// of other subscribers.
+    ///
+    /// The event at the front may be in flight (handed to the writer with
+    /// start_write()) and is never dropped or coalesced before pop().  The
+    /// queue is not thread safe.
+    ///
+    /// root is the directory subscribed to, which RESYNC_REQUIRED is about
+    /// even if the event that overflowed the queue is from a subdirectory.
+    class EventQueue
+    {
+    public:
+      enum class PushResult
+      {
+        queued,
+        dropped_oldest,
+        coalesced,
+        resync_required  // queue replaced with a RESYNC_REQUIRED event
+      };
+
+      EventQueue(const EventQueueOptions& options, std::string root_);
+
+      PushResult push(EncodedEventPtr event);
+
+      /// Mark the front event as in flight and return it.  The event stays
+      /// valid until pop().
+      const EncodedEvent& start_write();
+      void pop();
+
+      bool empty() const { return events.empty(); }
+      std::size_t size() const { return events.size(); }
+      bool writing() const { return in_flight; }
+
+    private:
+      bool coalesce(const EncodedEvent& event);
+
+      std::size_t max_size;
+      OverflowPolicy overflow_policy;
+      std::string root;
+      std::deque<EncodedEventPtr> events;
+      bool in_flight = false;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* EVENTQUEUE_H */
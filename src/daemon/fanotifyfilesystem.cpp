@@ -0,0 +1,211 @@
+#include "fanotifyfilesystem.h"
+
+#ifdef __linux__
+
+#  include "statistics.h"
+#  include <fcntl.h>
+#  include <sys/fanotify.h>
+
+#  include <cstring>
+
+std::vector<filewatch::DirectoryEvent::Event>
+fw::dm::dtls::fanotify_event_types(uint64_t mask, bool exists)
+{
+  const bool is_dir = (mask & FAN_ONDIR) != 0;
+  const auto added = is_dir ? filewatch::DirectoryEvent::DIRECTORY_ADDED
+                            : filewatch::DirectoryEvent::FILE_ADDED;
+  const auto removed = is_dir ? filewatch::DirectoryEvent::DIRECTORY_REMOVED
+                              : filewatch::DirectoryEvent::FILE_REMOVED;
+  // fanotify has no rename cookies, so moves are additions and removals
+  const bool created = (mask & (FAN_CREATE | FAN_MOVED_TO)) != 0;
+  const bool deleted = (mask & (FAN_DELETE | FAN_MOVED_FROM)) != 0;
+  const bool modified = (mask & FAN_CLOSE_WRITE) != 0 && !is_dir;
+
+  if (created && deleted)
+  {
+    return exists ? std::vector{removed, added} : std::vector{added, removed};
+  }
+  if (created)
+  {
+    return {added};
+  }
+  if (deleted)
+  {
+    return {removed};
+  }
+  if (modified && exists)
+  {
+    return {filewatch::DirectoryEvent::FILE_MODIFIED};
+  }
+  return {};
+}
+
+std::optional<std::string>
+fw::dm::dtls::watched_dirname(std::string_view rootdir,
+                              std::string_view dirpath)
+{
+  if (rootdir.size() > 1 && rootdir.ends_with('/'))
+  {
+    rootdir.remove_suffix(1);
+  }
+
+  if (dirpath == rootdir)
+  {
+    return std::string("/");
+  }
+  if (rootdir == "/")
+  {
+    return std::string(dirpath);
+  }
+  if (dirpath.starts_with(rootdir) && dirpath.size() > rootdir.size()
+      && dirpath[rootdir.size()] == '/')
+  {
+    return std::string(dirpath.substr(rootdir.size()));
+  }
+  return std::optional<std::string>();
+}
+
+uint32_t fw::dm::dtls::fanotify_mask() noexcept
+{
+  return static_cast<uint32_t>(FAN_CREATE | FAN_DELETE  // NOLINT - signed
+                               | FAN_MOVED_FROM | FAN_MOVED_TO  // NOLINT
+                               | FAN_CLOSE_WRITE | FAN_ONDIR);  // NOLINT
+}
+
+std::string fw::dm::dtls::fanotify_mark_error(int err)
+{
+  switch (err)
+  {
+  case EPERM:
+    return "Marking a filesystem with fanotify requires CAP_SYS_ADMIN "
+           "[EPERM].";
+  case ENODEV:
+    return "The filesystem object is not associated with a filesystem that "
+           "supports fsid [ENODEV].";
+  case EOPNOTSUPP:
+    return "The filesystem does not support reporting events with file "
+           "handles [EOPNOTSUPP].";
+  case EXDEV:
+    return "The filesystem is a subvolume and cannot be marked as a whole "
+           "[EXDEV].";
+  case ENOENT:
+    return "A directory component in pathname does not exist [ENOENT].";
+  case ENOSPC:
+    return "The limit on the number of fanotify marks was reached [ENOSPC].";
+  default:
+    return fmt::format("{} [{}].", std::strerror(err), err);
+  }
+}
+
+namespace
+{
+  std::size_t dispatch_fanotify_events(fw::dm::dtls::Fanotify& fanotify,
+                                       const fw::dm::dtls::FanotifyEventFun&
+                                         on_event,
+                                       char* buf, ssize_t len,
+                                       bool& overflowed) noexcept
+  {
+    static auto& unwatched =
+      fw::dm::statistics().counter("fanotify.unwatched_events");
+
+    std::size_t count = 0;
+    // NOLINTNEXTLINE - reinterpret_cast
+    auto* metadata = reinterpret_cast<fanotify_event_metadata*>(buf);
+    for (; FAN_EVENT_OK(metadata, len);  // NOLINT - c-style casts in macro
+         metadata = FAN_EVENT_NEXT(metadata, len))  // NOLINT
+    {
+      ++count;
+      if (metadata->vers != FANOTIFY_METADATA_VERSION)
+      {
+        spdlog::error("fanotify metadata version mismatch: {} != {}",
+                      metadata->vers, FANOTIFY_METADATA_VERSION);
+        return count;
+      }
+
+      if ((metadata->mask & FAN_Q_OVERFLOW) != 0)
+      {
+        ++fw::dm::statistics().counter("fanotify.queue_overflows");
+        overflowed = true;
+        continue;
+      }
+
+      // FAN_REPORT_DFID_NAME: the directory file handle and the entry name
+      // follow the metadata
+      if (metadata->event_len
+          < sizeof(fanotify_event_metadata) + sizeof(fanotify_event_info_fid))
+      {
+        continue;
+      }
+      auto* fid =  // NOLINTNEXTLINE - reinterpret_cast, pointer arithmetic
+        reinterpret_cast<fanotify_event_info_fid*>(metadata + 1);
+      if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+      {
+        continue;
+      }
+      auto* handle =  // NOLINTNEXTLINE - reinterpret_cast
+        reinterpret_cast<file_handle*>(fid->handle);
+      std::string_view filename{  // NOLINTNEXTLINE - pointer arithmetic
+        reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes)};
+
+      // the rest of the filesystem is dropped by its unknown handles
+      auto dirpath = fanotify.directory_path(*handle);
+      if (!dirpath)
+      {
+        ++unwatched;
+        continue;
+      }
+
+      try
+      {
+        on_event(*dirpath, filename, metadata->mask);
+      }
+      catch (const std::exception& e)
+      {
+        spdlog::error("Exception caught while processing events: {}",
+                      e.what());
+      }
+      catch (...)
+      {
+        spdlog::error("Unknown exception caught while processing events.");
+      }
+    }
+    return count;
+  }
+
+}  // anonymous namespace
+
+bool fw::dm::dtls::process_fanotify_events(Fanotify& fanotify,
+                                           const FanotifyEventFun& on_event,
+                                           std::span<char> buffer) noexcept
+{
+  static auto& reads = statistics().counter("fanotify.reads");
+  static auto& events = statistics().counter("fanotify.events");
+
+  bool overflowed = false;
+  while (true)
+  {
+    auto len = fanotify.read(buffer.data(), buffer.size());
+    if (len == -1)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+      {
+        spdlog::error("read(fanotify_fd) failed: {} [{}]",
+                      std::strerror(errno), errno);
+      }
+      return overflowed;
+    }
+    if (len == 0)
+    {
+      return overflowed;
+    }
+
+    auto count =
+      dispatch_fanotify_events(fanotify, on_event, buffer.data(), len,
+                               overflowed);
+    spdlog::debug("read {} bytes, {} fanotify event(s)", len, count);
+    ++reads;
+    events += count;
+  }
+}
+
+#endif  // __linux__
@@ -0,0 +1,448 @@
+#ifndef FANOTIFYFILESYSTEM_H
+#define FANOTIFYFILESYSTEM_H
+
+#ifdef __linux__
+
+#  include "common/loop_thread.h"
+#  include "details/fanotify.h"
+#  include "directoryeventlistener.h"
+#  include "linuxfilesystem.h"
+
+#  include <spdlog/spdlog.h>
+#  include <sys/fanotify.h>
+
+#  include <functional>
+#  include <optional>
+#  include <span>
+#  include <string>
+#  include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace dtls
+    {
+      /// Called for each directory entry event, with the absolute path of
+      /// the directory it happened in and the fanotify event mask
+      using FanotifyEventFun = std::function<void(
+        std::string_view dirpath, std::string_view filename, uint64_t mask)>;
+
+    }  // namespace dtls
+
+    /// Watches directories below rootdir with one fanotify mark on the
+    /// filesystem containing rootdir, instead of one inotify watch per
+    /// directory.  Emits the same DirectoryEvents as OSFileSystem.
+    template<typename SuperClassT>
+    class FanotifyFileSystem : public SuperClassT
+    {
+    public:
+      explicit FanotifyFileSystem(
+        std::string_view rootdir,
+        std::unique_ptr<dtls::Fanotify> fan_ptr = nullptr,
+        std::unique_ptr<threading::LoopThreadFactory> thr_fac = nullptr,
+        const WatchOptions& options = WatchOptions{});
+      ~FanotifyFileSystem();
+
+      void watch(std::string_view dirname,
+                 DirectoryEventListener& listener) override;
+      void stop_watching(std::string_view dirname,
+                         DirectoryEventListener& listener) override;
+      /// As watch(dirname, listener), but if dirname is not watched yet,
+      /// its entries are taken to be entries instead of listing it again,
+      /// e.g., as CachingFileSystem listed it for itself
+      void watch_listed(std::string_view dirname,
+                        DirectoryEventListener& listener,
+                        const std::deque<fs::DirectoryEntry>& entries);
+
+    private:
+      /// Lists dirname if it is not watched yet, unless entries are given
+      void watch_with(std::string_view dirname,
+                      DirectoryEventListener& listener,
+                      const std::deque<fs::DirectoryEntry>* entries);
+      void mark();
+      void unmark();
+      std::string absolute_path(const std::string& dirname) const;
+      void poll_events();
+      void event(std::string_view dirpath, std::string_view filename,
+                 uint64_t mask);
+      void resync_dirty_directories();
+      void flush_debounced();
+
+      std::unique_ptr<dtls::Fanotify> fanotify;
+      std::string absolute_rootdir;
+      bool marked = false;
+      dtls::DirectoryStateMap directories;
+      dtls::ResyncQueue resync_queue;
+      dtls::Debouncer debouncer;
+      std::vector<char> read_buffer;
+      std::unique_ptr<threading::LoopThreadFactory> thread_factory;
+      std::unique_ptr<threading::LoopThread> watch_thread;
+      std::atomic<int> currently_polling = 0;
+    };
+
+    namespace dtls
+    {
+      /// Read and dispatch fanotify events until the (non-blocking) fanotify
+      /// file descriptor is drained.  Returns true if the kernel reported
+      /// that its event queue overflowed, i.e., that events were lost.
+      bool process_fanotify_events(Fanotify& fanotify,
+                                   const FanotifyEventFun& on_event,
+                                   std::span<char> buffer) noexcept;
+      /// The DirectoryEvents a fanotify event mask stands for.  fanotify
+      /// merges a creation and a deletion of the same name into one event,
+      /// which is ordered by whether the entry exists now.  A close-write
+      /// of a file is a modification, unless it was added as well.
+      std::vector<filewatch::DirectoryEvent::Event>
+      fanotify_event_types(uint64_t mask, bool exists);
+      /// The watched directory name ("/" or "/sub/dir") of the absolute
+      /// path dirpath, or nothing if dirpath is outside rootdir
+      std::optional<std::string> watched_dirname(std::string_view rootdir,
+                                                 std::string_view dirpath);
+      /// The fanotify events watched by FanotifyFileSystem
+      uint32_t fanotify_mask() noexcept;
+      /// Error message for a failed fanotify_mark() with errno err
+      std::string fanotify_mark_error(int err);
+
+    }  // namespace dtls
+  }  // namespace dm
+}  // namespace fw
+
+
+template<typename SuperClassT>
+fw::dm::FanotifyFileSystem<SuperClassT>::FanotifyFileSystem(
+  std::string_view rootdir_,
+  std::unique_ptr<dtls::Fanotify>
+    fan_ptr,
+  std::unique_ptr<threading::LoopThreadFactory>
+    thr_fac,
+  const WatchOptions& options) :
+  SuperClassT(rootdir_),
+  fanotify(), absolute_rootdir(), directories(),
+  resync_queue(options.resync_interval, options.resync_batch_size),
+  debouncer(options.debounce_window, options.clock),
+  read_buffer(std::max(options.read_buffer_size, std::size_t{4096})),
+  thread_factory()
+{
+  if (fan_ptr == nullptr)
+    fan_ptr = dtls::Fanotify::create<dtls::Fanotify>();
+
+  if (thr_fac == nullptr)
+    thr_fac = threading::create_thread_factory();
+
+  fanotify = std::move(fan_ptr);
+  thread_factory = std::move(thr_fac);
+  absolute_rootdir =
+    std::filesystem::weakly_canonical(std::filesystem::absolute(this->rootdir))
+      .string();
+
+  watch_thread = thread_factory->create_thread([&]() { this->poll_events(); },
+                                               true /* create_suspended */);
+}
+
+template<typename SuperClassT>
+fw::dm::FanotifyFileSystem<SuperClassT>::~FanotifyFileSystem()
+{
+  // the watch thread uses the directories until it is joined
+  watch_thread->stop();
+  if (watch_thread->is_joinable())
+  {
+    if (currently_polling > 0)
+    {
+      fanotify->terminate_poll();
+    }
+    spdlog::debug("watch_thread->join()");
+    watch_thread->join();
+  }
+
+  directories.clear();
+  unmark();
+  close_inotify(*fanotify);
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::watch(
+  std::string_view dirname, DirectoryEventListener& listener)
+{
+  watch_with(dirname, listener, nullptr);
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::watch_listed(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::deque<fs::DirectoryEntry>& entries)
+{
+  watch_with(dirname, listener, &entries);
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::watch_with(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::deque<fs::DirectoryEntry>* entries)
+{
+  // watched directories are looked up by the paths the kernel reports
+  const auto dn =
+    dirname == "/" ? std::string(dirname) : this->no_slash_at_end(dirname);
+  try
+  {
+    auto unsuspend_watch_thread = directories.empty();
+    if (unsuspend_watch_thread)
+    {
+      mark();
+    }
+
+    auto iter = directories.find(dn);
+    if (iter == std::end(directories))
+    {
+      fanotify->add_directory(absolute_path(dn));
+      iter = directories
+               .emplace(dn, dtls::DirectoryState{entries != nullptr
+                                                   ? *entries
+                                                   : SuperClassT::ls(dn)})
+               .first;
+      this->hold_directory(dn);
+    }
+    iter->second.add_listener(listener);
+    listener.notify(filewatch::DirectoryEvent::WATCHING_DIRECTORY, dirname, ".",
+                    0, 0, {});
+
+    if (unsuspend_watch_thread)
+    {
+      watch_thread->unsuspend();
+      spdlog::debug("unsuspended watch thread");
+    }
+  }
+  catch (const std::runtime_error& e)
+  {
+    throw std::runtime_error(dn + " error: " + e.what());
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::stop_watching(
+  std::string_view dirname, DirectoryEventListener& listener)
+{
+  const auto dn =
+    dirname == "/" ? std::string(dirname) : this->no_slash_at_end(dirname);
+  auto iter = directories.find(dn);
+  if (iter == std::end(directories))
+  {
+    return;
+  }
+
+  if (iter->second.remove_listener(listener))
+  {
+    resync_queue.forget(iter->first);
+    debouncer.forget(iter->first);
+    directories.erase(iter);
+    fanotify->remove_directory(absolute_path(dn));
+    this->release_directory(dn);
+  }
+
+  if (directories.empty())
+  {
+    unmark();
+    watch_thread->suspend();
+    spdlog::debug("suspended watch thread");
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::mark()
+{
+  if (marked)
+  {
+    return;
+  }
+
+  if (fanotify->add_watch(absolute_rootdir.c_str(), dtls::fanotify_mask())
+      == -1)
+  {
+    throw std::runtime_error(dtls::fanotify_mark_error(errno));
+  }
+  marked = true;
+  spdlog::info("Watching filesystem of {} with fanotify", absolute_rootdir);
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::unmark()
+{
+  if (!marked)
+  {
+    return;
+  }
+
+  if (fanotify->rm_watch(0) == -1)
+  {
+    spdlog::warn("Unable to remove fanotify mark on {}: {}", absolute_rootdir,
+                 dtls::fanotify_mark_error(errno));
+  }
+  marked = false;
+}
+
+template<typename SuperClassT>
+std::string fw::dm::FanotifyFileSystem<SuperClassT>::absolute_path(
+  const std::string& dirname) const
+{
+  if (dirname == "/")
+  {
+    return absolute_rootdir;
+  }
+  return absolute_rootdir == "/" ? dirname : absolute_rootdir + dirname;
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::poll_events()
+{
+  auto optional_revents = safe_poll_inotify(
+    *fanotify, currently_polling,
+    dtls::earliest_timeout_ms(resync_queue.poll_timeout_ms(),
+                              debouncer.poll_timeout_ms()));
+  if (!optional_revents)
+    return;
+
+  auto overflowed = process_fanotify_events(
+    *fanotify,
+    [&](std::string_view dirpath, std::string_view filename, uint64_t mask) {
+      this->event(dirpath, filename, mask);
+    },
+    read_buffer);
+
+  if (overflowed)
+  {
+    spdlog::warn("fanotify event queue overflowed, resyncing {} directories",
+                 directories.size());
+    // the rescan reports the net effect of the debounced events as well
+    debouncer.clear();
+    resync_queue.mark_dirty(directories);
+  }
+
+  flush_debounced();
+  resync_dirty_directories();
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::event(std::string_view dirpath,
+                                                    std::string_view filename,
+                                                    uint64_t mask)
+{
+  auto dirname = dtls::watched_dirname(absolute_rootdir, dirpath);
+  if (!dirname)
+  {
+    return;
+  }
+
+  auto iter = directories.find(*dirname);
+  if (iter == std::end(directories))
+  {
+    return;
+  }
+
+  const bool created_dir =
+    (mask & FAN_ONDIR) != 0
+    && (mask & (FAN_CREATE | FAN_MOVED_TO)) != 0;  // NOLINT - signed bitwise
+  if (created_dir)
+  {
+    // a watched directory replaced by another one has a new handle
+    auto subdir = this->join(iter->first, filename);
+    if (directories.contains(subdir))
+    {
+      try
+      {
+        fanotify->add_directory(absolute_path(subdir));
+      }
+      catch (const std::runtime_error& e)
+      {
+        spdlog::warn("{}", e.what());
+      }
+    }
+  }
+
+  const bool removed_dir =
+    (mask & FAN_ONDIR) != 0
+    && (mask & (FAN_DELETE | FAN_MOVED_FROM)) != 0;  // NOLINT - signed bitwise
+  if (removed_dir)
+  {
+    // before anyone looks it up by its path again
+    this->directory_moved(this->join(iter->first, filename));
+  }
+
+  if (debouncer.enabled())
+  {
+    // only a merged creation and deletion needs a stat, to order them
+    const auto created = FAN_CREATE | FAN_MOVED_TO;  // NOLINT - signed bitwise
+    const auto deleted = FAN_DELETE | FAN_MOVED_FROM;  // NOLINT
+    const bool merged = (mask & created) != 0 && (mask & deleted) != 0;
+    const bool exists =
+      !merged
+      || SuperClassT::get_direntry(this->join(iter->first, filename));
+    for (auto event_type : dtls::fanotify_event_types(mask, exists))
+    {
+      if (event_type == filewatch::DirectoryEvent::FILE_MODIFIED)
+      {
+        debouncer.record_modified(iter->first, filename);
+        continue;
+      }
+      auto added = event_type == filewatch::DirectoryEvent::DIRECTORY_ADDED
+                   || event_type == filewatch::DirectoryEvent::FILE_ADDED;
+      debouncer.record(iter->first, filename, added,
+                       (mask & FAN_ONDIR) != 0);
+    }
+    return;
+  }
+
+  auto direntry =
+    SuperClassT::get_direntry(this->join(iter->first, filename));
+  for (auto event_type : dtls::fanotify_event_types(mask, direntry.has_value()))
+  {
+    auto removed = event_type == filewatch::DirectoryEvent::DIRECTORY_REMOVED
+                   || event_type == filewatch::DirectoryEvent::FILE_REMOVED;
+    iter->second.notify(event_type, iter->first, filename,
+                        !removed && direntry ? direntry->mtime : 0,
+                        !removed && direntry ? direntry->size : 0);
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::flush_debounced()
+{
+  for (const auto& entry : debouncer.take_due())
+  {
+    auto iter = directories.find(entry.dirname);
+    if (iter != std::end(directories))
+    {
+      dtls::Debouncer::emit(
+        entry, iter->second,
+        [&](std::string_view containing_dir, std::string_view filename) {
+          return SuperClassT::get_direntry(
+            this->join(containing_dir, filename));
+        });
+    }
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::FanotifyFileSystem<SuperClassT>::resync_dirty_directories()
+{
+  for (const auto& dirname : resync_queue.take_due())
+  {
+    auto iter = directories.find(dirname);
+    if (iter == std::end(directories))
+    {
+      continue;
+    }
+
+    try
+    {
+      iter->second.resync(iter->first, SuperClassT::ls(dirname));
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::warn("Unable to resync {}: {}", dirname, e.what());
+    }
+  }
+}
+
+#endif  // __linux__
+
+#endif /* FANOTIFYFILESYSTEM_H */
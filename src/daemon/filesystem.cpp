@@ -1,14 +1,106 @@
 #include "filesystem.h"
 
+#include "cachingfilesystem.h"
 #include "common/loop_thread.h"
+#include "fanotifyfilesystem.h"
 #include "linuxfilesystem.h"
+#include "uringfilesystem.h"
 #include "windowsfilesystem.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 fw::dm::FileSystem::~FileSystem() = default;
 
+fw::dm::fs::Listing fw::dm::FileSystem::list(std::string_view dirname) const
+{
+  return fs::Listing(ls(dirname));
+}
+
+fw::dm::fs::ListingPage
+fw::dm::FileSystem::list_page(std::string_view dirname, uint64_t cursor,
+                              std::size_t max_entries) const
+{
+  const auto all = list(dirname);
+  fs::ListingPage page;
+  auto i = static_cast<std::size_t>(std::min<uint64_t>(cursor, all.size()));
+  for (; i < all.size() && page.entries.size() < max_entries; ++i)
+  {
+    const auto entry = all[i];
+    page.entries.add(entry.name, entry.is_dir, entry.mtime, entry.size);
+    page.cursors.push_back(i + 1);
+  }
+  page.next = i;
+  page.end = i == all.size();
+  return page;
+}
+
+fw::dm::WatchBackend fw::dm::parse_watch_backend(std::string_view name)
+{
+  if (name == "inotify")
+  {
+    return WatchBackend::inotify;
+  }
+  if (name == "fanotify")
+  {
+    return WatchBackend::fanotify;
+  }
+  throw std::invalid_argument("Unknown watch backend: " + std::string{name});
+}
+
+fw::dm::IoEngine fw::dm::parse_io_engine(std::string_view name)
+{
+  if (name == "sync")
+  {
+    return IoEngine::sync;
+  }
+  if (name == "io_uring")
+  {
+    return IoEngine::io_uring;
+  }
+  throw std::invalid_argument("Unknown I/O engine: " + std::string{name});
+}
+
+namespace
+{
+  template<typename WatchingT>
+  std::unique_ptr<fw::dm::FileSystem>
+  create_cached_filesystem(std::string_view rootdir,
+                           const fw::dm::WatchOptions& options)
+  {
+    if (options.metadata_cache)
+    {
+      return std::make_unique<fw::dm::CachingFileSystem<WatchingT>>(
+        rootdir, nullptr, nullptr, options);
+    }
+    return std::make_unique<WatchingT>(rootdir, nullptr, nullptr, options);
+  }
+
+  template<typename BaseT>
+  std::unique_ptr<fw::dm::FileSystem>
+  create_watching_filesystem(std::string_view rootdir,
+                             const fw::dm::WatchOptions& options)
+  {
+#ifdef __linux__
+    if (options.backend == fw::dm::WatchBackend::fanotify)
+    {
+      return create_cached_filesystem<fw::dm::FanotifyFileSystem<BaseT>>(
+        rootdir, options);
+    }
+#endif  // __linux__
+    return create_cached_filesystem<fw::dm::OSFileSystem<BaseT>>(rootdir,
+                                                                 options);
+  }
+
+}  // anonymous namespace
+
 std::unique_ptr<fw::dm::FileSystem>
-fw::dm::create_filesystem(std::string_view rootdir)
+fw::dm::create_filesystem(std::string_view rootdir,
+                          const WatchOptions& options)
 {
-  return std::make_unique<fw::dm::OSFileSystem<fw::dm::DefaultFileSystem>>(
-    rootdir);
+  if (options.io_engine == IoEngine::io_uring)
+  {
+    return create_watching_filesystem<UringFileSystem>(rootdir, options);
+  }
+  return create_watching_filesystem<DefaultFileSystem>(rootdir, options);
 }
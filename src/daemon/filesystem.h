@@ -1,9 +1,13 @@
 #ifndef FILESYSTEM_H
 #define FILESYSTEM_H
 
+#include "daemon/listing.h"
+
 #include <cassert>
+#include <chrono>
 #include <deque>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
@@ -35,6 +39,16 @@ namespace fw
 
       virtual std::deque<fs::DirectoryEntry>
       ls(std::string_view dirname) const = 0;
+      /// As ls(dirname), packed into one Listing, e.g., for filling a
+      /// response.  Packs ls(dirname) unless overridden.
+      virtual fs::Listing list(std::string_view dirname) const;
+      /// At most max_entries entries of dirname, from cursor on, to page
+      /// through directories too large to list at once.  Entries added or
+      /// removed meanwhile may be left out.  Pages list(dirname) by index
+      /// unless overridden.
+      virtual fs::ListingPage list_page(std::string_view dirname,
+                                        uint64_t cursor,
+                                        std::size_t max_entries) const;
 
       virtual std::optional<fs::DirectoryEntry>
       get_direntry(std::string_view entryname) const = 0;
@@ -80,8 +94,21 @@ namespace fw
                          DirectoryEventListener& listener) = 0;
       virtual void stop_watching(std::string_view dirname,
                                  DirectoryEventListener& listener) = 0;
+      /// Run task once the watch thread calling this is done dispatching
+      /// events, e.g., to stop watching directories from a listener, as
+      /// stop_watching() waits for the watch threads.  Runs task at once on
+      /// other threads, and unless overridden.
+      virtual void after_dispatch(std::function<void()> task) { task(); }
 
     protected:
+      /// Called when dirname starts and stops being watched, e.g., to keep
+      /// it open meanwhile
+      virtual void hold_directory(std::string_view /*dirname*/) {}
+      virtual void release_directory(std::string_view /*dirname*/) {}
+      /// Called when the watch learns that dirname was renamed or removed,
+      /// so it, and the directories below it, are not at their paths anymore
+      virtual void directory_moved(std::string_view /*dirname*/) {}
+
       std::string no_slash_at_end(std::string_view entry) const
       {
         return std::string(
@@ -101,7 +128,52 @@ namespace fw
       std::filesystem::path rootdir;
     };
 
-    std::unique_ptr<FileSystem> create_filesystem(std::string_view rootdir);
+    /// The kernel interface used to watch directories on linux
+    enum class WatchBackend
+    {
+      inotify,  // one watch per watched directory
+      fanotify  // one mark on the whole filesystem, requires CAP_SYS_ADMIN
+    };
+
+    WatchBackend parse_watch_backend(std::string_view name);
+
+    /// How directories are listed and files are read
+    enum class IoEngine
+    {
+      sync,  // blocking syscalls
+      io_uring  // batched through io_uring, where the kernel provides it
+    };
+
+    IoEngine parse_io_engine(std::string_view name);
+
+    /// Tuning of how the file system is watched for changes
+    struct WatchOptions
+    {
+      WatchBackend backend = WatchBackend::inotify;
+      IoEngine io_engine = IoEngine::sync;
+      std::size_t read_buffer_size = 64 * 1024;  // bytes read from inotify
+                                                 // per syscall
+      // Number of inotify instances, each polled by its own thread, that
+      // the watched directories are spread over
+      std::size_t watch_threads = 1;
+      // After an event queue overflow, at most resync_batch_size watched
+      // directories are rescanned every resync_interval.
+      std::chrono::milliseconds resync_interval{100};
+      std::size_t resync_batch_size = 16;
+      // Events of the same directory entry within debounce_window are
+      // folded into their net effect.  0 disables debouncing.
+      std::chrono::milliseconds debounce_window{0};
+      // The time debounce windows are measured in, replaced in tests
+      std::function<std::chrono::steady_clock::time_point()> clock =
+        std::chrono::steady_clock::now;
+      // Serve listings of watched directories from memory, patched by
+      // their events
+      bool metadata_cache = false;
+    };
+
+    std::unique_ptr<FileSystem>
+    create_filesystem(std::string_view rootdir,
+                      const WatchOptions& options = WatchOptions{});
 
   }  // namespace dm
 }  // namespace fw
@@ -0,0 +1,216 @@
+#include "indexfile.h"
+
+#include "details/mappedfile.h"
+
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+  constexpr std::array<char, 8> magic{'f', 'w', 'i', 'n', 'd', 'e', 'x', '1'};
+
+  /// Starts the index file.  The body is, for every directory, its path,
+  /// mtime and number of entries, followed by the name, is_dir, mtime and
+  /// size of every entry.  Strings are preceded by their uint32_t size.
+  struct Header
+  {
+    std::array<char, 8> magic;
+    uint64_t timestamp;
+    uint64_t directories;
+    uint64_t checksum;  // of the body
+  };
+
+  uint64_t checksum(const char* data, std::size_t size)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      hash ^= static_cast<unsigned char>(data[i]);  // NOLINT
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  std::size_t string_size(const std::string& str)
+  {
+    return sizeof(uint32_t) + str.size();
+  }
+
+  std::size_t body_size(const fw::dm::IndexSnapshot& snapshot)
+  {
+    std::size_t size = 0;
+    for (const auto& [path, dir] : snapshot.directories)
+    {
+      size += string_size(path) + sizeof(uint64_t) + sizeof(uint32_t);
+      for (const auto& entry : dir.entries)
+      {
+        size += string_size(entry.name) + 1 + 2 * sizeof(uint64_t);
+      }
+    }
+    return size;
+  }
+
+  class Writer
+  {
+  public:
+    explicit Writer(char* data_) : data(data_) {}
+
+    template<typename T>
+    void put(T value)
+    {
+      std::memcpy(data, &value, sizeof value);
+      data += sizeof value;
+    }
+
+    void put(const std::string& str)
+    {
+      put(static_cast<uint32_t>(str.size()));
+      std::memcpy(data, str.data(), str.size());
+      data += str.size();
+    }
+
+  private:
+    char* data;
+  };
+
+  /// Reads the body, throwing std::out_of_range past its end
+  class Reader
+  {
+  public:
+    Reader(const char* data_, std::size_t size) : data(data_), end(data_ + size)
+    {
+    }
+
+    template<typename T>
+    T get()
+    {
+      T value;
+      std::memcpy(&value, take(sizeof value), sizeof value);
+      return value;
+    }
+
+    std::string get_string()
+    {
+      auto size = get<uint32_t>();
+      return std::string(take(size), size);
+    }
+
+    bool at_end() const { return data == end; }
+
+  private:
+    const char* take(std::size_t size)
+    {
+      if (static_cast<std::size_t>(end - data) < size)
+      {
+        throw std::out_of_range("truncated index");
+      }
+      const auto* taken = data;
+      data += size;
+      return taken;
+    }
+
+    const char* data;
+    const char* end;
+  };
+
+}  // anonymous namespace
+
+void fw::dm::save_index(const std::string& path, const IndexSnapshot& snapshot)
+{
+  const auto temporary = path + ".tmp";
+  std::error_code ec;
+  std::filesystem::remove(temporary, ec);  // left by a crash
+
+  {
+    const auto size = body_size(snapshot);
+    dtls::MappedFile file(temporary, sizeof(Header) + size);
+    Writer writer(file.data() + sizeof(Header));
+    for (const auto& [dirname, dir] : snapshot.directories)
+    {
+      writer.put(dirname);
+      writer.put(dir.mtime);
+      writer.put(static_cast<uint32_t>(dir.entries.size()));
+      for (const auto& entry : dir.entries)
+      {
+        writer.put(entry.name);
+        writer.put(static_cast<uint8_t>(entry.is_dir));
+        writer.put(entry.mtime);
+        writer.put(entry.size);
+      }
+    }
+
+    Header header{magic, snapshot.timestamp, snapshot.directories.size(),
+                  checksum(file.data() + sizeof(Header), size)};
+    std::memcpy(file.data(), &header, sizeof header);
+    file.flush();
+  }
+
+  std::filesystem::rename(temporary, path, ec);
+  if (ec)
+  {
+    throw std::runtime_error("Unable to replace " + path + ": "
+                             + ec.message());
+  }
+}
+
+std::optional<fw::dm::IndexSnapshot>
+fw::dm::load_index(const std::string& path)
+{
+  std::error_code ec;
+  if (!std::filesystem::exists(path, ec))
+  {
+    return std::nullopt;
+  }
+
+  try
+  {
+    dtls::MappedFile file(path, false);
+    Header header{};
+    if (file.size() < sizeof header)
+    {
+      throw std::out_of_range("truncated header");
+    }
+    std::memcpy(&header, file.data(), sizeof header);
+    const auto* body = file.data() + sizeof header;
+    const auto size = file.size() - sizeof header;
+    if (header.magic != magic || header.checksum != checksum(body, size))
+    {
+      throw std::runtime_error("not an intact index file");
+    }
+
+    IndexSnapshot snapshot;
+    snapshot.timestamp = header.timestamp;
+    Reader reader(body, size);
+    for (uint64_t i = 0; i < header.directories; ++i)
+    {
+      auto dirname = reader.get_string();
+      IndexedDirectory dir{reader.get<uint64_t>(), {}};
+      auto count = reader.get<uint32_t>();
+      for (uint32_t j = 0; j < count; ++j)
+      {
+        fs::DirectoryEntry entry;
+        entry.name = reader.get_string();
+        entry.is_dir = reader.get<uint8_t>() != 0;
+        entry.mtime = reader.get<uint64_t>();
+        entry.size = reader.get<uint64_t>();
+        dir.entries.push_back(std::move(entry));
+      }
+      snapshot.directories.emplace(std::move(dirname), std::move(dir));
+    }
+    if (!reader.at_end())
+    {
+      throw std::runtime_error("trailing bytes");
+    }
+    return snapshot;
+  }
+  catch (const std::exception& e)
+  {
+    spdlog::warn("Ignoring index {}: {}", path, e.what());
+    return std::nullopt;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include "filesystem.h"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace fw
+{
+  namespace dm
+  {
+    /// A directory of a persisted TreeIndex
+    struct IndexedDirectory
+    {
+      uint64_t mtime;  // of the directory when it was listed
+      std::deque<fs::DirectoryEntry> entries;
+    };
+
+    /// The directories of a TreeIndex by their path, as saved to and
+    /// loaded from an index file
+    struct IndexSnapshot
+    {
+      uint64_t timestamp = 0;  // milliseconds since epoch, before listing
+      std::map<std::string, IndexedDirectory, std::less<>> directories;
+    };
+
+    /// Write snapshot to path, replacing the file only once it is complete.
+    /// Throws std::runtime_error on failure.
+    void save_index(const std::string& path, const IndexSnapshot& snapshot);
+
+    /// The snapshot in path, or nothing if there is none or it is not
+    /// intact
+    std::optional<IndexSnapshot> load_index(const std::string& path);
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* INDEXFILE_H */
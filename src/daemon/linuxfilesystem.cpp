@@ -5,23 +5,87 @@
 #  include "common/bw_combine.h"
 #  include "common/loop_thread.h"
 #  include "directoryeventlistener.h"
+#  include "eventjournal.h"
+#  include "statistics.h"
 #  include <sys/inotify.h>
 
+#  include <iterator>
+#  include <thread>
+
+namespace
+{
+  /// The registry whose reader this thread is, if it is a watch thread
+  thread_local fw::dm::dtls::WatchRegistry* read_registry = nullptr;
+
+}  // anonymous namespace
+
+fw::dm::dtls::DirectoryState::DirectoryState(
+  const std::deque<fs::DirectoryEntry>& direntries) :
+  listeners(std::make_shared<const Listeners>())
+{
+  for (const auto& de : direntries)
+  {
+    (de.is_dir ? directories : files).insert(de.name);
+  }
+}
+
+fw::dm::dtls::DirectoryState::DirectoryState(DirectoryState&& other) noexcept :
+  listeners(other.listeners.load()),
+  directories(std::move(other.directories)), files(std::move(other.files))
+{
+}
+
+fw::dm::dtls::DirectoryState&
+fw::dm::dtls::DirectoryState::operator=(DirectoryState&& other) noexcept
+{
+  if (&other != this)
+  {
+    listeners = other.listeners.load();
+    directories = std::move(other.directories);
+    files = std::move(other.files);
+  }
+  return *this;
+}
+
+void fw::dm::dtls::DirectoryState::add_listener(
+  DirectoryEventListener& listener)
+{
+  auto next = std::make_shared<Listeners>(*listeners.load());
+  next->insert(&listener);
+  listeners = std::move(next);
+}
+
+bool fw::dm::dtls::DirectoryState::remove_listener(
+  DirectoryEventListener& listener)
+{
+  auto next = std::make_shared<Listeners>(*listeners.load());
+  next->erase(&listener);
+  const bool empty = next->empty();
+  listeners = std::move(next);
+  return empty;
+}
+
+bool fw::dm::dtls::DirectoryState::is_directory(const std::string& name) const
+{
+  return directories.find(name) != std::end(directories);
+}
+
 fw::dm::dtls::Watch::Watch(Inotify& inotify_,
                            const std::filesystem::path& fullpath,
                            const std::deque<fs::DirectoryEntry>& direntries) :
-  inotify(inotify_),
-  wd(inotify.add_watch(fullpath.string().c_str(),
-                       util::bw_combine<unsigned short>(
-                         IN_CLOSE_WRITE, IN_CREATE, IN_DELETE, IN_DELETE_SELF,
-                         IN_MOVE_SELF, IN_MOVED_FROM, IN_MOVED_TO)))
+  DirectoryState(direntries),
+  inotify(&inotify_),
+  wd(inotify_.add_watch(fullpath.string().c_str(),
+                        util::bw_combine<unsigned short>(
+                          IN_CLOSE_WRITE, IN_CREATE, IN_DELETE,
+                          IN_DELETE_SELF, IN_MOVE_SELF, IN_MOVED_FROM,
+                          IN_MOVED_TO)))
 {
   std::ostringstream ost;
   for (const auto& de : direntries)
   {
     if (de.is_dir)
     {
-      directories.insert(de.name);
       ost << " " << de.name;
     }
   }
@@ -77,8 +141,8 @@ fw::dm::dtls::Watch::Watch(Inotify& inotify_,
 }
 
 fw::dm::dtls::Watch::Watch(Watch&& other) noexcept :
-  inotify(other.inotify), wd(other.wd), listeners(std::move(other.listeners)),
-  directories(std::move(other.directories))
+  DirectoryState(std::move(other)), inotify(other.inotify), wd(other.wd),
+  removed(other.removed)
 {
   other.wd = -1;
 }
@@ -87,34 +151,216 @@ fw::dm::dtls::Watch& fw::dm::dtls::Watch::operator=(Watch&& other) noexcept
 {
   if (&other != this)
   {
+    DirectoryState::operator=(std::move(other));
     inotify = other.inotify;
     wd = other.wd;
-    listeners = std::move(other.listeners);
-    directories = std::move(other.directories);
+    removed = other.removed;
 
     other.wd = -1;
   }
   return *this;
 }
 
-fw::dm::dtls::Watch::~Watch()
+fw::dm::dtls::Watch::~Watch() { remove(); }
+
+void fw::dm::dtls::Watch::remove()
 {
-  if (wd != -1)
+  // wd is kept, as it is the key of this watch in the registry
+  if (wd != -1 && !removed)
   {
-    inotify.rm_watch(wd);
+    inotify->rm_watch(wd);
     spdlog::info("rm_watch [{}]", wd);
+    removed = true;
+  }
+}
+
+namespace
+{
+  std::size_t bucket_of(std::size_t hash, std::size_t bucket_count) noexcept
+  {
+    // the low bits of the name hashes pick the shard
+    constexpr std::size_t fibonacci = 0x9E3779B9U;
+    return ((hash * fibonacci) >> 16U) % bucket_count;
+  }
+
+  std::string_view key_of(const fw::dm::dtls::WatchPtr& entry,
+                          std::string_view /*tag*/) noexcept
+  {
+    return entry->first;
+  }
+
+  int key_of(const fw::dm::dtls::WatchPtr& entry, int /*tag*/) noexcept
+  {
+    return entry->second.descriptor();
+  }
+
+  template<typename KeyT, typename BucketT>
+  auto lower_bound(const BucketT& bucket, KeyT key)
+  {
+    return std::lower_bound(
+      std::begin(bucket), std::end(bucket), key,
+      [](const auto& entry, KeyT k) { return key_of(entry, k) < k; });
   }
+
+  template<typename KeyT, typename BucketT>
+  const fw::dm::dtls::WatchPtr* find_in(const BucketT& bucket, KeyT key)
+  {
+    if (!bucket)
+    {
+      return nullptr;
+    }
+    auto iter = lower_bound(*bucket, key);
+    if (iter == std::end(*bucket) || key_of(*iter, key) != key)
+    {
+      return nullptr;
+    }
+    return &*iter;
+  }
+
+  /// A copy of bucket with entry inserted (insert == true) or removed
+  template<typename KeyT, typename BucketPtrT>
+  BucketPtrT changed(const BucketPtrT& bucket,
+                     const fw::dm::dtls::WatchPtr& entry, KeyT key,
+                     bool insert)
+  {
+    using Bucket = std::vector<fw::dm::dtls::WatchPtr>;
+    auto next = bucket ? std::make_shared<Bucket>(*bucket)
+                       : std::make_shared<Bucket>();
+    auto iter = lower_bound(*next, key);
+    if (insert)
+    {
+      next->insert(iter, entry);
+    }
+    else
+    {
+      // several directories may share a watch descriptor, e.g., through
+      // symbolic links
+      while (iter != std::end(*next) && key_of(*iter, key) == key
+             && *iter != entry)
+      {
+        ++iter;
+      }
+      if (iter != std::end(*next) && *iter == entry)
+      {
+        next->erase(iter);
+      }
+    }
+    if (next->empty())
+    {
+      return nullptr;
+    }
+    return next;
+  }
+
+}  // anonymous namespace
+
+const fw::dm::dtls::WatchPtr*
+fw::dm::dtls::WatchRegistry::Version::find(std::string_view dirname) const
+{
+  const auto hash = std::hash<std::string_view>{}(dirname);
+  return find_in(by_name[bucket_of(hash, bucket_count)], dirname);
+}
+
+const fw::dm::dtls::WatchPtr*
+fw::dm::dtls::WatchRegistry::Version::find(int wd) const
+{
+  return find_in(by_descriptor[static_cast<std::size_t>(wd) % bucket_count],
+                 wd);
+}
+
+std::shared_ptr<const fw::dm::dtls::WatchRegistry::Version>
+fw::dm::dtls::WatchRegistry::Version::with(const WatchPtr& entry) const
+{
+  const std::string_view name{entry->first};
+  const int wd = entry->second.descriptor();
+  const auto name_bucket =
+    bucket_of(std::hash<std::string_view>{}(name), bucket_count);
+  const auto wd_bucket = static_cast<std::size_t>(wd) % bucket_count;
+
+  auto next = std::make_shared<Version>(*this);
+  next->by_name[name_bucket] =
+    changed(by_name[name_bucket], entry, name, true);
+  next->by_descriptor[wd_bucket] =
+    changed(by_descriptor[wd_bucket], entry, wd, true);
+  ++next->count;
+  return next;
+}
+
+std::shared_ptr<const fw::dm::dtls::WatchRegistry::Version>
+fw::dm::dtls::WatchRegistry::Version::without(const WatchPtr& entry) const
+{
+  const std::string_view name{entry->first};
+  const int wd = entry->second.descriptor();
+  if (find(name) == nullptr)
+  {
+    return std::make_shared<Version>(*this);
+  }
+
+  const auto name_bucket =
+    bucket_of(std::hash<std::string_view>{}(name), bucket_count);
+  const auto wd_bucket = static_cast<std::size_t>(wd) % bucket_count;
+
+  auto next = std::make_shared<Version>(*this);
+  next->by_name[name_bucket] =
+    changed(by_name[name_bucket], entry, name, false);
+  next->by_descriptor[wd_bucket] =
+    changed(by_descriptor[wd_bucket], entry, wd, false);
+  --next->count;
+  return next;
+}
+
+fw::dm::dtls::WatchRegistry::WatchRegistry() :
+  current(std::make_shared<const Version>())
+{
+}
+
+std::shared_ptr<const fw::dm::dtls::WatchRegistry::Version>
+fw::dm::dtls::WatchRegistry::snapshot() const noexcept
+{
+  return current.load();
+}
+
+void fw::dm::dtls::WatchRegistry::publish(
+  std::shared_ptr<const Version> version) noexcept
+{
+  static auto& versions = statistics().counter("registry.versions");
+  current = std::move(version);
+  ++versions;
+}
+
+void fw::dm::dtls::WatchRegistry::begin_read() noexcept
+{
+  read_registry = this;
+  state += reading;
 }
 
-void fw::dm::dtls::Watch::add_listener(DirectoryEventListener& listener)
+void fw::dm::dtls::WatchRegistry::end_read() noexcept
 {
-  listeners.insert(&listener);
+  read_registry = nullptr;
+  state += read_count - reading;
+  state.notify_all();
 }
 
-bool fw::dm::dtls::Watch::remove_listener(DirectoryEventListener& listener)
+bool fw::dm::dtls::WatchRegistry::read_by_this_thread() const noexcept
 {
-  listeners.erase(&listener);
-  return listeners.empty();
+  return read_registry == this;
+}
+
+void fw::dm::dtls::WatchRegistry::synchronize() const noexcept
+{
+  if (read_registry == this)
+  {
+    return;
+  }
+
+  const auto started = state.load();
+  auto observed = started;
+  while ((observed & reading) != 0
+         && observed / read_count == started / read_count)
+  {
+    state.wait(observed);
+    observed = state.load();
+  }
 }
 
 namespace
@@ -122,16 +368,22 @@ namespace
   std::optional<filewatch::DirectoryEvent::Event>
   choose_event_type(inotify_event& evt, bool is_dir)
   {
-    if ((evt.mask & IN_CREATE) != 0)  // NOLINT
+    // IN_MOVED_FROM / IN_MOVED_TO get here when the other half of the
+    // rename is outside the watched directory
+    if ((evt.mask & (IN_CREATE | IN_MOVED_TO)) != 0)  // NOLINT
     {
       return is_dir ? filewatch::DirectoryEvent::DIRECTORY_ADDED
                     : filewatch::DirectoryEvent::FILE_ADDED;
     }
-    if ((evt.mask & IN_DELETE) != 0)  // NOLINT
+    if ((evt.mask & (IN_DELETE | IN_MOVED_FROM)) != 0)  // NOLINT
     {
       return is_dir ? filewatch::DirectoryEvent::DIRECTORY_REMOVED
                     : filewatch::DirectoryEvent::FILE_REMOVED;
     }
+    if ((evt.mask & IN_CLOSE_WRITE) != 0 && !is_dir)  // NOLINT
+    {
+      return filewatch::DirectoryEvent::FILE_MODIFIED;
+    }
 
     return std::optional<filewatch::DirectoryEvent::Event>();
   }
@@ -175,73 +427,515 @@ bool fw::dm::dtls::Watch::event(std::string_view containing_dir,
   }
 
   uint64_t mtime = 0;
-  auto pre = fmt::format("event:{} (0x{:x}), {}, {}, I have {} listeners",
-                         masktostr(evt->mask), evt->mask, evt->cookie, filename,
-                         listeners.size());
+  uint64_t size = 0;
+  // Only formatted when logged, as most events are not
+  const auto pre = [evt, event_name = filename]
+  {
+    return fmt::format("event:{} (0x{:x}), {}, {}", masktostr(evt->mask),
+                       evt->mask, evt->cookie, event_name);
+  };
 
   auto direntry = get_direntry(containing_dir, filename);
   bool is_dir = false;
   if (direntry)
   {
     mtime = direntry->mtime;
+    size = direntry->size;
     filename = direntry->name;
     is_dir = direntry->is_dir;
   }
   else
   {
-    is_dir = directories.find(std::string{filename}) != std::end(directories);
-    spdlog::debug("{}, but my direntry was empty [isdir: {}].", pre, is_dir);
+    is_dir = is_directory(std::string{filename});
+    if (spdlog::should_log(spdlog::level::debug))
+    {
+      spdlog::debug("{}, but my direntry was empty [isdir: {}].", pre(),
+                    is_dir);
+    }
   }
 
   auto event_type = choose_event_type(*evt, is_dir);
   if (!event_type)
   {
-    spdlog::warn("{}. Unsupported event mask.", pre);
+    spdlog::warn("{}. Unsupported event mask.", pre());
     return false;
   }
 
-  spdlog::debug("{}, and my {}name is \"{}\".", pre,
-                is_dir ? "directory " : "file", filename);
+  if (spdlog::should_log(spdlog::level::debug))
+  {
+    spdlog::debug("{}, and my {}name is \"{}\".", pre(),
+                  is_dir ? "directory " : "file", filename);
+  }
+
+  notify(*event_type, containing_dir, filename, mtime, size);
+  return true;
+}
 
-  if (*event_type == filewatch::DirectoryEvent::DIRECTORY_ADDED)
+void fw::dm::dtls::DirectoryState::resync(
+  std::string_view containing_dir,
+  const std::deque<fs::DirectoryEntry>& direntries) const
+{
+  std::set<std::string> current_directories;
+  std::set<std::string> current_files;
+  for (const auto& de : direntries)
   {
-    spdlog::debug("Directory added: {}", filename);
-    directories.insert(std::string{filename});
+    (de.is_dir ? current_directories : current_files).insert(de.name);
   }
-  else if (*event_type == filewatch::DirectoryEvent::DIRECTORY_REMOVED)
+
+  // notify() updates directories and files, so collect before notifying
+  std::vector<std::string> removed_directories;
+  std::vector<std::string> removed_files;
+  std::set_difference(std::begin(directories), std::end(directories),
+                      std::begin(current_directories),
+                      std::end(current_directories),
+                      std::back_inserter(removed_directories));
+  std::set_difference(std::begin(files), std::end(files),
+                      std::begin(current_files), std::end(current_files),
+                      std::back_inserter(removed_files));
+
+  for (const auto& name : removed_directories)
+  {
+    notify(filewatch::DirectoryEvent::DIRECTORY_REMOVED, containing_dir, name,
+           0, 0);
+  }
+  for (const auto& name : removed_files)
+  {
+    notify(filewatch::DirectoryEvent::FILE_REMOVED, containing_dir, name, 0,
+           0);
+  }
+  for (const auto& de : direntries)
+  {
+    const auto& known = de.is_dir ? directories : files;
+    if (known.count(de.name) == 0)
+    {
+      notify(de.is_dir ? filewatch::DirectoryEvent::DIRECTORY_ADDED
+                       : filewatch::DirectoryEvent::FILE_ADDED,
+             containing_dir, de.name, de.mtime, de.size);
+    }
+  }
+}
+
+void fw::dm::dtls::DirectoryState::notify(
+  filewatch::DirectoryEvent::Event event_type,
+  std::string_view containing_dir,
+  std::string_view filename,
+  uint64_t mtime,
+  uint64_t size,
+  std::string_view old_name) const
+{
+  switch (event_type)
   {
+  case filewatch::DirectoryEvent::DIRECTORY_ADDED:
+    spdlog::debug("Directory added: {}", filename);
+    directories.insert(std::string{filename});
+    break;
+  case filewatch::DirectoryEvent::DIRECTORY_REMOVED:
     spdlog::debug("Directory removed: {}", filename);
     directories.erase(std::string{filename});
+    break;
+  case filewatch::DirectoryEvent::FILE_ADDED:
+    files.insert(std::string{filename});
+    break;
+  case filewatch::DirectoryEvent::FILE_REMOVED:
+    files.erase(std::string{filename});
+    break;
+  case filewatch::DirectoryEvent::DIRECTORY_RENAMED:
+  case filewatch::DirectoryEvent::FILE_RENAMED:
+    spdlog::debug("Renamed: {} -> {}", old_name, filename);
+    // the new name replaces whatever entry had that name
+    directories.erase(std::string{old_name});
+    files.erase(std::string{old_name});
+    directories.erase(std::string{filename});
+    files.erase(std::string{filename});
+    (event_type == filewatch::DirectoryEvent::DIRECTORY_RENAMED ? directories
+                                                                : files)
+      .insert(std::string{filename});
+    break;
+  default:
+    break;
   }
 
-  spdlog::info("notify {} listeners about {}/{}: {}", listeners.size(),
-               containing_dir, filename, *event_type);
-  for (auto* listener : listeners)
+  auto current = listeners.load();
+  spdlog::info("notify {} listeners about {}/{}: {}", current->size(),
+               containing_dir, filename, event_type);
+  EventDispatch dispatch;
+  for (auto* listener : *current)
   {
-    listener->notify(*event_type, containing_dir, filename, mtime);
+    listener->notify(event_type, containing_dir, filename, mtime, size,
+                     old_name);
   }
-  return true;
 }
 
-std::optional<short>
+fw::dm::dtls::ResyncQueue::ResyncQueue(std::chrono::milliseconds interval_,
+                                       std::size_t batch_size_) :
+  interval(interval_),
+  batch_size(std::max<std::size_t>(batch_size_, 1))
+{
+}
+
+fw::dm::dtls::ResyncQueue::~ResyncQueue()
+{
+  dirty.clear();
+  update_pending();
+}
+
+void fw::dm::dtls::ResyncQueue::update_pending() const
+{
+  // resync.pending is the sum over the queues of all shards
+  auto& pending = statistics().counter("resync.pending");
+  pending += dirty.size();
+  pending -= reported_pending;
+  reported_pending = dirty.size();
+}
+
+void fw::dm::dtls::ResyncQueue::mark_dirty(
+  const WatchRegistry::Version& watches)
+{
+  watches.for_each([&](const WatchEntry& w) { dirty.insert(w.first); });
+  update_pending();
+}
+
+void fw::dm::dtls::ResyncQueue::forget(const std::string& dirname)
+{
+  dirty.erase(dirname);
+  update_pending();
+}
+
+int fw::dm::dtls::ResyncQueue::poll_timeout_ms() const
+{
+  if (dirty.empty())
+  {
+    return -1;
+  }
+
+  using namespace std::chrono;
+  auto wait = duration_cast<milliseconds>(next_resync - steady_clock::now());
+  return static_cast<int>(std::max<milliseconds::rep>(wait.count(), 0));
+}
+
+std::vector<std::string> fw::dm::dtls::ResyncQueue::take_due()
+{
+  std::vector<std::string> due;
+  auto now = std::chrono::steady_clock::now();
+  if (dirty.empty() || now < next_resync)
+  {
+    return due;
+  }
+
+  while (!dirty.empty() && due.size() < batch_size)
+  {
+    due.push_back(dirty.extract(std::begin(dirty)).value());
+  }
+  next_resync = now + interval;
+
+  statistics().counter("resync.scans") += due.size();
+  update_pending();
+  return due;
+}
+
+fw::dm::dtls::Debouncer::Debouncer(std::chrono::milliseconds window_,
+                                   ClockFun clock_) :
+  window(window_),
+  clock(std::move(clock_))
+{
+}
+
+fw::dm::dtls::Debouncer::Entry&
+fw::dm::dtls::Debouncer::entry(const std::string& dirname,
+                               std::string_view name, bool existed_before,
+                               bool is_dir)
+{
+  Key key{dirname, std::string{name}};
+  auto iter = entries.find(key);
+  if (iter != std::end(entries))
+  {
+    ++statistics().counter("debounce.folded");
+    return iter->second;
+  }
+
+  iter = entries
+           .emplace(key, Entry{dirname, std::string{name}, existed_before,
+                               is_dir, existed_before, is_dir, false, false})
+           .first;
+  deadlines.emplace_back(clock() + window, std::move(key));
+  return iter->second;
+}
+
+void fw::dm::dtls::Debouncer::record(const std::string& dirname,
+                                     std::string_view name, bool exists,
+                                     bool is_dir)
+{
+  // an entry that is added now did not exist before the window, and vice
+  // versa
+  auto& e = entry(dirname, name, !exists, is_dir);
+  e.replaced = e.replaced || (e.existed_before && !exists);
+  e.exists = exists;
+  e.is_dir = is_dir;
+}
+
+void fw::dm::dtls::Debouncer::record_modified(const std::string& dirname,
+                                              std::string_view name)
+{
+  entry(dirname, name, true, false).modified = true;
+}
+
+void fw::dm::dtls::Debouncer::forget(const std::string& dirname)
+{
+  std::erase_if(entries,
+                [&](const auto& e) { return e.first.first == dirname; });
+  std::erase_if(deadlines,
+                [&](const auto& d) { return d.second.first == dirname; });
+}
+
+void fw::dm::dtls::Debouncer::clear()
+{
+  entries.clear();
+  deadlines.clear();
+}
+
+int fw::dm::dtls::Debouncer::poll_timeout_ms() const
+{
+  if (deadlines.empty())
+  {
+    return -1;
+  }
+
+  using namespace std::chrono;
+  // round up, or poll returns immediately until the window has closed
+  auto wait = ceil<milliseconds>(deadlines.front().first - clock());
+  return static_cast<int>(std::max<milliseconds::rep>(wait.count(), 0));
+}
+
+std::vector<fw::dm::dtls::Debouncer::Entry>
+fw::dm::dtls::Debouncer::take_due()
+{
+  std::vector<Entry> due;
+  auto now = clock();
+  while (!deadlines.empty() && deadlines.front().first <= now)
+  {
+    auto node = entries.extract(deadlines.front().second);
+    deadlines.pop_front();
+    if (node)
+    {
+      due.push_back(std::move(node.mapped()));
+    }
+  }
+  return due;
+}
+
+std::optional<fw::dm::dtls::Debouncer::Entry>
+fw::dm::dtls::Debouncer::take(const std::string& dirname,
+                              std::string_view name)
+{
+  Key key{dirname, std::string{name}};
+  auto node = entries.extract(key);
+  if (!node)
+  {
+    return std::optional<Entry>();
+  }
+  // or it would end the window of the next entry of name early
+  std::erase_if(deadlines, [&](const auto& d) { return d.second == key; });
+  return std::move(node.mapped());
+}
+
+std::vector<fw::dm::dtls::Debouncer::Entry>
+fw::dm::dtls::Debouncer::take_all(const std::string& dirname)
+{
+  std::vector<Entry> taken;
+  for (auto iter = std::begin(deadlines); iter != std::end(deadlines);)
+  {
+    if (iter->second.first != dirname)
+    {
+      ++iter;
+      continue;
+    }
+    auto node = entries.extract(iter->second);
+    if (node)
+    {
+      taken.push_back(std::move(node.mapped()));
+    }
+    iter = deadlines.erase(iter);
+  }
+  return taken;
+}
+
+void fw::dm::dtls::Debouncer::emit(const Entry& entry,
+                                   const DirectoryState& state,
+                                   const GetDirEntryFun& get_direntry)
+{
+  if (entry.replaced)
+  {
+    const bool was_dir = entry.was_dir || state.is_directory(entry.name);
+    state.notify(was_dir ? filewatch::DirectoryEvent::DIRECTORY_REMOVED
+                         : filewatch::DirectoryEvent::FILE_REMOVED,
+                 entry.dirname, entry.name, 0, 0);
+  }
+  if (!entry.exists)
+  {
+    if (!entry.existed_before)
+    {
+      spdlog::debug("{}/{} came and went within the debounce window",
+                    entry.dirname, entry.name);
+    }
+    return;
+  }
+
+  auto direntry = get_direntry(entry.dirname, entry.name);
+  const bool is_dir = direntry ? direntry->is_dir : entry.is_dir;
+  const uint64_t mtime = direntry ? direntry->mtime : 0;
+  const uint64_t size = direntry ? direntry->size : 0;
+  if (entry.existed_before && !entry.replaced)
+  {
+    // only written to, an addition reports the new size already
+    if (entry.modified && !is_dir)
+    {
+      state.notify(filewatch::DirectoryEvent::FILE_MODIFIED, entry.dirname,
+                   entry.name, mtime, size);
+    }
+    return;
+  }
+  state.notify(is_dir ? filewatch::DirectoryEvent::DIRECTORY_ADDED
+                      : filewatch::DirectoryEvent::FILE_ADDED,
+               entry.dirname, entry.name, mtime, size);
+}
+
+fw::dm::dtls::PendingMoves::PendingMoves(std::chrono::milliseconds window_,
+                                         ClockFun clock_) :
+  window(window_),
+  clock(std::move(clock_))
+{
+}
+
+void fw::dm::dtls::PendingMoves::add(uint32_t cookie, Move move)
+{
+  if (auto iter = moves.find(cookie); iter != std::end(moves))
+  {
+    forget(cookie, iter->second.second);
+  }
+  cookies.insert_or_assign(NameKey{move.watch.get(), move.name}, cookie);
+  moves.insert_or_assign(cookie, std::make_pair(clock() + window,
+                                                std::move(move)));
+}
+
+std::optional<fw::dm::dtls::PendingMoves::Move>
+fw::dm::dtls::PendingMoves::take(uint32_t cookie)
+{
+  auto node = moves.extract(cookie);
+  if (!node)
+  {
+    return std::optional<Move>();
+  }
+  forget(cookie, node.mapped().second);
+  return std::move(node.mapped().second);
+}
+
+std::vector<fw::dm::dtls::PendingMoves::Move>
+fw::dm::dtls::PendingMoves::take(const WatchEntry& watch,
+                                 std::string_view name)
+{
+  std::vector<Move> taken;
+  if (cookies.empty())
+  {
+    return taken;
+  }
+
+  auto first = cookies.lower_bound(NameKey{&watch, std::string{name}});
+  auto last = first;
+  while (last != std::end(cookies) && last->first.first == &watch
+         && (name.empty() || last->first.second == name))
+  {
+    auto node = moves.extract(last->second);
+    taken.push_back(std::move(node.mapped().second));
+    ++last;
+  }
+  cookies.erase(first, last);
+  return taken;
+}
+
+void fw::dm::dtls::PendingMoves::forget(uint32_t cookie, const Move& move)
+{
+  auto iter = cookies.find(NameKey{move.watch.get(), move.name});
+  if (iter != std::end(cookies) && iter->second == cookie)
+  {
+    cookies.erase(iter);
+  }
+}
+
+std::vector<fw::dm::dtls::PendingMoves::Move>
+fw::dm::dtls::PendingMoves::take_expired()
+{
+  std::vector<Move> expired;
+  const auto now = clock();
+  for (auto iter = std::begin(moves); iter != std::end(moves);)
+  {
+    if (iter->second.first <= now)
+    {
+      forget(iter->first, iter->second.second);
+      expired.push_back(std::move(iter->second.second));
+      iter = moves.erase(iter);
+    }
+    else
+    {
+      ++iter;
+    }
+  }
+  return expired;
+}
+
+int fw::dm::dtls::PendingMoves::poll_timeout_ms() const
+{
+  if (moves.empty())
+  {
+    return -1;
+  }
+
+  using namespace std::chrono;
+  auto earliest = std::min_element(
+    std::begin(moves), std::end(moves), [](const auto& lhs, const auto& rhs) {
+      return lhs.second.first < rhs.second.first;
+    });
+  // round up, or poll returns immediately until the window has closed
+  auto wait = ceil<milliseconds>(earliest->second.first - clock());
+  return static_cast<int>(std::max<milliseconds::rep>(wait.count(), 0));
+}
+
+int fw::dm::dtls::earliest_timeout_ms(int lhs, int rhs) noexcept
+{
+  if (lhs < 0)
+  {
+    return rhs;
+  }
+  if (rhs < 0)
+  {
+    return lhs;
+  }
+  return std::min(lhs, rhs);
+}
+
+std::optional<uint32_t>
 fw::dm::dtls::safe_poll_inotify(Inotify& inotify,
-                                std::atomic<int>& currently_polling) noexcept
+                                std::atomic<int>& currently_polling,
+                                int timeout_ms) noexcept
 {
   spdlog::debug("poll_watches...");
-  short revents = 0;
+  uint32_t revents = 0;
   currently_polling = 1;
-  int event_count = inotify.poll(POLLIN, revents, -1);  // -1 => block forever
+  // timeout_ms == -1 => block forever
+  int event_count = inotify.poll(revents, timeout_ms);
   currently_polling = 0;
   if (event_count == -1)
   {
-    const auto* pre = "poll error: ";
+    const auto* pre = "epoll_wait error: ";
     switch (errno)
     {
+    case EBADF:
+      spdlog::error("{}epfd is not a valid file descriptor. [EBADF]", pre);
+      break;
+
     case EFAULT:
       spdlog::error(
-        "{}fds points outside the process's accessible address\n"
-        "space. The array given as argument was not contained in\n"
-        "the calling program's address space. [EFAULT]",
+        "{}The memory area pointed to by events is not accessible\n"
+        "with write permissions. [EFAULT]",
         pre);
       break;
 
@@ -251,16 +945,8 @@ fw::dm::dtls::safe_poll_inotify(Inotify& inotify,
 
     case EINVAL:
       spdlog::error(
-        "{}The nfds value exceeds the RLIMIT_NOFILE value or the\n"
-        "timeout value expressed in *ip is invalid (negative).\n"
-        "[EINVAL]",
-        pre);
-      break;
-
-    case ENOMEM:
-      spdlog::error(
-        "{}Unable to allocate memory for kernel data structures.\n"
-        "[ENOMEM]",
+        "{}epfd is not an epoll file descriptor, or maxevents is\n"
+        "less than or equal to zero. [EINVAL]",
         pre);
       break;
 
@@ -268,7 +954,7 @@ fw::dm::dtls::safe_poll_inotify(Inotify& inotify,
       spdlog::error("{}unknown errno value [{}]", pre, errno);
       break;
     }
-    return std::optional<short>();
+    return std::optional<uint32_t>();
   }
   spdlog::debug("poll_watches -> {} [0x{:x}]", event_count, revents);
   return revents;
@@ -276,7 +962,7 @@ fw::dm::dtls::safe_poll_inotify(Inotify& inotify,
 
 namespace
 {
-  template<int alignment, typename T>
+  template<std::size_t alignment, typename T>
   T* align_ptr(T* ptr, std::size_t& wanted_size) noexcept
   {
     void* vptr = reinterpret_cast<void*>(ptr);  // NOLINT - reinterpret_cast
@@ -284,53 +970,287 @@ namespace
     return reinterpret_cast<T*>(alignedvptr);  // NOLINT - reinterpret_cast
   }
 
-}  // namespace
+  void notify_removed(const fw::dm::dtls::WatchEntry& w,
+                      const std::string& name, bool is_dir,
+                      fw::dm::dtls::Debouncer& debouncer)
+  {
+    if (debouncer.enabled())
+    {
+      debouncer.record(w.first, name, false, is_dir);
+      return;
+    }
+    w.second.notify(is_dir || w.second.is_directory(name)
+                      ? filewatch::DirectoryEvent::DIRECTORY_REMOVED
+                      : filewatch::DirectoryEvent::FILE_REMOVED,
+                    w.first, name, 0, 0);
+  }
+
+  /// Deliver the events waiting in debouncer for name in w, or for all of
+  /// w if name is empty, ahead of an event that is not debounced
+  void flush_pending(const fw::dm::dtls::WatchEntry& w, std::string_view name,
+                     const fw::dm::dtls::GetDirEntryFun& get_direntry,
+                     fw::dm::dtls::Debouncer& debouncer)
+  {
+    if (!debouncer.enabled())
+    {
+      return;
+    }
+
+    if (name.empty())
+    {
+      for (const auto& entry : debouncer.take_all(w.first))
+      {
+        fw::dm::dtls::Debouncer::emit(entry, w.second, get_direntry);
+      }
+    }
+    else if (auto entry = debouncer.take(w.first, name))
+    {
+      fw::dm::dtls::Debouncer::emit(*entry, w.second, get_direntry);
+    }
+  }
+
+  void notify_renamed(const fw::dm::dtls::WatchEntry& w,
+                      const fw::dm::dtls::PendingMoves::Move& from,
+                      std::string_view to,
+                      const fw::dm::dtls::GetDirEntryFun& get_direntry,
+                      fw::dm::dtls::Debouncer& debouncer)
+  {
+    // e.g., the creation of from.name happened before the rename
+    flush_pending(w, from.name, get_direntry, debouncer);
+    flush_pending(w, to, get_direntry, debouncer);
+
+    auto direntry = get_direntry(w.first, to);
+    const bool is_dir = direntry ? direntry->is_dir : from.is_dir;
+    w.second.notify(is_dir ? filewatch::DirectoryEvent::DIRECTORY_RENAMED
+                           : filewatch::DirectoryEvent::FILE_RENAMED,
+                    w.first, to, direntry ? direntry->mtime : 0,
+                    direntry ? direntry->size : 0, from.name);
+  }
+
+  /// Report the moves of name out of w, or of all of w if name is empty,
+  /// that still wait for their second half as removals, ahead of a later
+  /// event about the same name
+  void flush_moved_away(const fw::dm::dtls::WatchEntry& w,
+                        std::string_view name,
+                        fw::dm::dtls::PendingMoves& moves,
+                        fw::dm::dtls::Debouncer& debouncer)
+  {
+    for (const auto& move : moves.take(w, name))
+    {
+      notify_removed(w, move.name, move.is_dir, debouncer);
+    }
+  }
+
+  /// Returns true if evt was the second half of a rename, and was handled
+  bool pair_move(const fw::dm::dtls::WatchPtr& watch,
+                 const inotify_event& evt, std::string_view filename,
+                 fw::dm::dtls::PendingMoves& moves,
+                 const fw::dm::dtls::GetDirEntryFun& get_direntry,
+                 fw::dm::dtls::Debouncer& debouncer)
+  {
+    const bool is_dir = (evt.mask & IN_ISDIR) != 0;  // NOLINT
+    if ((evt.mask & IN_MOVED_FROM) != 0)  // NOLINT
+    {
+      flush_moved_away(*watch, filename, moves, debouncer);
+      moves.add(evt.cookie, fw::dm::dtls::PendingMoves::Move{
+                              watch, std::string{filename}, is_dir});
+      return true;
+    }
+    if ((evt.mask & IN_MOVED_TO) == 0)  // NOLINT
+    {
+      flush_moved_away(*watch, filename, moves, debouncer);
+      return false;
+    }
+
+    // e.g., mv a b while b has been moved away, in that order
+    auto pending = moves.take(evt.cookie);
+    flush_moved_away(*watch, filename, moves, debouncer);
+    if (!pending)
+    {
+      // moved in from outside the watched directories
+      return false;
+    }
+
+    const auto& from = *pending;
+    const auto& w = *watch;
+    if (from.watch != watch)
+    {
+      // moved between watched directories, which is a removal from one and
+      // an addition to the other for their listeners
+      notify_removed(*from.watch, from.name, from.is_dir, debouncer);
+      return false;
+    }
+
+    ++fw::dm::statistics().counter("inotify.renames");
+    notify_renamed(w, from, filename, get_direntry, debouncer);
+    return true;
+  }
 
-void fw::dm::dtls::process_inotify_events(
-  Inotify& inotify,
-  const std::map<std::string, dtls::Watch>& watches,
-  const fw::dm::dtls::GetDirEntryFun& get_direntry) noexcept
-{
-  constexpr const std::size_t maxstructsize =
-    sizeof(inotify_event) + NAME_MAX + 1 + 4;
-  std::array<char, maxstructsize> buf{};
-  auto actualsize = maxstructsize;
-  char* alignedbuf = align_ptr<4>(buf.data(), actualsize);
-
-  auto len = inotify.read(alignedbuf, actualsize);
-  spdlog::debug("read {} bytes", len);
-  inotify_event* event = nullptr;
-  // NOLINTNEXTLINE - pointer arithmetic
-  for (char* ptr = alignedbuf; ptr < alignedbuf + len;
-       ptr += sizeof(inotify_event) + event->len)  // NOLINT - ptr arithmetic
-  {
-    event = reinterpret_cast<inotify_event*>(ptr);  // NOLINT - reinterpret_cast
-    std::string_view filename{event->name,  // NOLINT
-                              std::min(static_cast<std::size_t>(event->len),
-                                       std::strlen(event->name))};  // NOLINT
-    spdlog::debug("processing event: {}, {} registered watche(s).", event->wd,
-                  watches.size());
-
-    for (const auto& w : watches)
+  std::size_t
+  dispatch_inotify_events(const fw::dm::dtls::WatchRegistry::Version& watches,
+                          const fw::dm::dtls::GetDirEntryFun& get_direntry,
+                          const fw::dm::dtls::DirectoryMovedFun&
+                            directory_moved,
+                          fw::dm::dtls::Debouncer& debouncer,
+                          fw::dm::dtls::PendingMoves& moves, char* buf,
+                          ssize_t len,
+                          bool& overflowed) noexcept
+  {
+    std::size_t count = 0;
+    inotify_event* event = nullptr;
+    // NOLINTNEXTLINE - pointer arithmetic
+    for (char* ptr = buf; ptr < buf + len;
+         ptr += sizeof(inotify_event) + event->len)  // NOLINT - ptr arithmetic
     {
+      ++count;
+      event = reinterpret_cast<inotify_event*>(ptr);  // NOLINT
+      std::string_view filename{event->name,  // NOLINT
+                                std::min(static_cast<std::size_t>(event->len),
+                                         std::strlen(event->name))};  // NOLINT
+      spdlog::debug("processing event: {}, {} registered watche(s).",
+                    event->wd, watches.size());
+
+      if ((event->mask & IN_Q_OVERFLOW) != 0)  // NOLINT
+      {
+        ++fw::dm::statistics().counter("inotify.queue_overflows");
+        overflowed = true;
+        continue;
+      }
+
+      const auto* found = watches.find(event->wd);
+      if (found == nullptr)
+      {
+        spdlog::debug("no watch for wd {}, event ignored", event->wd);
+        continue;
+      }
+
+      const auto& w = **found;
       try
       {
-        if (w.second.event(w.first, filename, get_direntry, event))
+        // before anyone looks the directory up by its path again
+        const auto mask = event->mask;
+        if ((mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0)  // NOLINT
+        {
+          directory_moved(w.first, {});
+        }
+        else if ((mask & IN_ISDIR) != 0  // NOLINT
+                 && (mask & (IN_DELETE | IN_MOVED_FROM)) != 0)  // NOLINT
+        {
+          directory_moved(w.first, filename);
+        }
+
+        if (pair_move(*found, *event, filename, moves, get_direntry,
+                      debouncer))
+        {
+          continue;
+        }
+
+        if (debouncer.enabled()
+            && (mask & (IN_CREATE | IN_DELETE | IN_MOVED_TO)) != 0)  // NOLINT
+        {
+          debouncer.record(w.first, filename,
+                           (mask & (IN_CREATE | IN_MOVED_TO)) != 0,  // NOLINT
+                           (mask & IN_ISDIR) != 0);  // NOLINT
+        }
+        else if (debouncer.enabled() && (mask & IN_CLOSE_WRITE) != 0)  // NOLINT
         {
-          spdlog::debug("event processed");
-          break;
+          debouncer.record_modified(w.first, filename);
+        }
+        else
+        {
+          // self events have no name, and come after everything pending
+          flush_pending(w, filename, get_direntry, debouncer);
+          if (w.second.event(w.first, filename, get_direntry, event))
+          {
+            spdlog::debug("event processed");
+          }
         }
       }
       catch (const std::exception& e)
       {
-        spdlog::error("Exception caught while processing events: {}", e.what());
+        spdlog::error("Exception caught while processing events: {}",
+                      e.what());
       }
       catch (...)
       {
         spdlog::error("Unknown exception caught while processing events.");
       }
     }
+    return count;
+  }
+
+}  // namespace
+
+std::size_t fw::dm::dtls::min_inotify_read_size() noexcept
+{
+  return sizeof(inotify_event) + NAME_MAX + 1 + alignof(inotify_event);
+}
+
+bool fw::dm::dtls::process_inotify_events(
+  Inotify& inotify, const WatchRegistry& registry,
+  const fw::dm::dtls::GetDirEntryFun& get_direntry,
+  const DirectoryMovedFun& directory_moved, std::span<char> buffer,
+  Debouncer& debouncer, PendingMoves& moves) noexcept
+{
+  static auto& reads = statistics().counter("inotify.reads");
+  static auto& events = statistics().counter("inotify.events");
+  static auto& events_per_read =
+    statistics().counter("inotify.events_per_read");
+  static auto& max_events_per_read =
+    statistics().counter("inotify.max_events_per_read");
+
+  auto actualsize = buffer.size();
+  char* alignedbuf =
+    align_ptr<alignof(inotify_event)>(buffer.data(), actualsize);
+
+  bool overflowed = false;
+  while (true)
+  {
+    auto len = inotify.read(alignedbuf, actualsize);
+    if (len == -1)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+      {
+        spdlog::error("read(inotify_fd) failed: {} [{}]", std::strerror(errno),
+                      errno);
+      }
+      break;
+    }
+    if (len == 0)
+    {
+      break;
+    }
+
+    // a watch added after the read has no events in it, and one removed
+    // since has no listeners left
+    auto current = registry.snapshot();
+    auto count =
+      dispatch_inotify_events(*current, get_direntry, directory_moved,
+                              debouncer, moves, alignedbuf, len, overflowed);
+    spdlog::debug("read {} bytes, {} event(s)", len, count);
+    ++reads;
+    events += count;
+    events_per_read = count;
+    if (count > max_events_per_read)
+    {
+      max_events_per_read = count;
+    }
+  }
+
+  // a move whose IN_MOVED_TO has not come by now left the watched
+  // directories
+  for (const auto& move : moves.take_expired())
+  {
+    try
+    {
+      notify_removed(*move.watch, move.name, move.is_dir, debouncer);
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::error("Exception caught while processing events: {}", e.what());
+    }
   }
+  return overflowed;
 }
 
 void fw::dm::dtls::close_inotify(Inotify& inotify) noexcept
@@ -362,4 +1282,28 @@ void fw::dm::dtls::close_inotify(Inotify& inotify) noexcept
   }
 }
 
+std::vector<std::unique_ptr<fw::dm::dtls::Inotify>>
+fw::dm::dtls::create_inotify_shards(std::unique_ptr<Inotify> in_ptr,
+                                    std::size_t count)
+{
+  std::vector<std::unique_ptr<Inotify>> inotifies;
+  if (in_ptr != nullptr)
+  {
+    inotifies.push_back(std::move(in_ptr));
+    return inotifies;
+  }
+
+  for (std::size_t i = 0; i < std::max<std::size_t>(count, 1); ++i)
+  {
+    inotifies.push_back(Inotify::create<Inotify>());
+  }
+  return inotifies;
+}
+
+std::size_t fw::dm::dtls::shard_index(std::string_view dirname,
+                                      std::size_t shard_count) noexcept
+{
+  return std::hash<std::string_view>{}(dirname) % shard_count;
+}
+
 #endif  // __linux__
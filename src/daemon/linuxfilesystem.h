@@ -10,9 +10,20 @@
 
 #  include <spdlog/spdlog.h>
 
+#  include <algorithm>
+#  include <array>
+#  include <atomic>
+#  include <chrono>
+#  include <deque>
 #  include <functional>
 #  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <optional>
 #  include <set>
+#  include <span>
+#  include <unordered_map>
+#  include <vector>
 
 struct inotify_event;
 
@@ -24,8 +35,57 @@ namespace fw
     {
       using GetDirEntryFun = std::function<std::optional<fs::DirectoryEntry>(
         std::string_view, std::string_view)>;
+      /// Told about a directory that was renamed or removed: dir_name in
+      /// containing_dir, or containing_dir itself if dir_name is empty
+      using DirectoryMovedFun = std::function<void(
+        std::string_view containing_dir, std::string_view dir_name)>;
+      using ClockFun = std::function<std::chrono::steady_clock::time_point()>;
+
+      /// What is known about the entries of one watched directory, and who
+      /// listens to it.
+      ///
+      /// The listeners are replaced rather than modified, so they can be
+      /// changed while another thread notifies them.  Changes must still be
+      /// serialized by the caller.
+      class DirectoryState
+      {
+      public:
+        explicit DirectoryState(
+          const std::deque<fs::DirectoryEntry>& direntries);
+        DirectoryState(const DirectoryState&) = delete;
+        DirectoryState& operator=(const DirectoryState&) = delete;
+        DirectoryState(DirectoryState&& other) noexcept;
+        DirectoryState& operator=(DirectoryState&& other) noexcept;
+        ~DirectoryState() = default;
+
+        void add_listener(DirectoryEventListener& listener);
+        bool remove_listener(DirectoryEventListener& listener);
+
+        bool is_directory(const std::string& name) const;
+
+        /// Compare the current contents of the directory with what is
+        /// known, and notify listeners about the differences.
+        void resync(std::string_view containing_dir,
+                    const std::deque<fs::DirectoryEntry>& direntries) const;
+
+        void notify(filewatch::DirectoryEvent::Event event_type,
+                    std::string_view containing_dir,
+                    std::string_view filename,
+                    uint64_t mtime,
+                    uint64_t size,
+                    std::string_view old_name = {}) const;
+
+      private:
+        using Listeners = std::set<DirectoryEventListener*>;
+
+        std::atomic<std::shared_ptr<const Listeners>> listeners;
+        mutable std::set<std::string> directories;
+        mutable std::set<std::string> files;
+      };
+
+      using DirectoryStateMap = std::map<std::string, DirectoryState>;
 
-      class Watch
+      class Watch : public DirectoryState
       {
       public:
         Watch(Inotify& inotify_, const std::filesystem::path& fullpath,
@@ -36,8 +96,10 @@ namespace fw
         Watch& operator=(Watch&&) noexcept;
         ~Watch();
 
-        void add_listener(DirectoryEventListener& listener);
-        bool remove_listener(DirectoryEventListener& listener);
+        int descriptor() const { return wd; }
+        /// Remove the inotify watch now, instead of when the last reference
+        /// to this Watch is gone
+        void remove();
 
         bool event(std::string_view containing_dir,
                    std::string_view filename,
@@ -45,119 +107,518 @@ namespace fw
                    inotify_event* evt) const;
 
       private:
-        Inotify& inotify;
+        Inotify* inotify;
         int wd;
-        std::set<DirectoryEventListener*> listeners;
-        mutable std::set<std::string> directories;
+        bool removed = false;
       };
 
+      /// A watched directory and its watch
+      using WatchEntry = std::pair<const std::string, Watch>;
+      using WatchPtr = std::shared_ptr<WatchEntry>;
+
+      /// The watches of one inotify instance, read by its watch thread and
+      /// changed by watch() and stop_watching() on any thread.
+      ///
+      /// The reader never locks: it takes a snapshot of the current,
+      /// immutable, version.  Writers derive a new version from the current
+      /// one and publish it, serialized by writer_mutex().  A writer that
+      /// must know that the reader no longer uses a replaced version, e.g.,
+      /// before a removed listener is destroyed, calls synchronize().
+      class WatchRegistry
+      {
+      public:
+        /// Watches by directory name and by watch descriptor.  The watches
+        /// are spread over buckets that versions share, so a new version
+        /// only copies the buckets that changed.
+        class Version
+        {
+        public:
+          const WatchPtr* find(std::string_view dirname) const;
+          const WatchPtr* find(int wd) const;
+          std::size_t size() const { return count; }
+          bool empty() const { return count == 0; }
+
+          template<typename FunT>
+          void for_each(FunT fun) const
+          {
+            for (const auto& bucket : by_name)
+            {
+              if (bucket)
+              {
+                for (const auto& entry : *bucket)
+                {
+                  fun(*entry);
+                }
+              }
+            }
+          }
+
+          /// This version with entry added, or removed
+          std::shared_ptr<const Version> with(const WatchPtr& entry) const;
+          std::shared_ptr<const Version> without(const WatchPtr& entry) const;
+
+        private:
+          static constexpr std::size_t bucket_count = 256;
+          // sorted by name and watch descriptor respectively
+          using Bucket = std::vector<WatchPtr>;
+          using Buckets = std::array<std::shared_ptr<const Bucket>,
+                                     bucket_count>;
+
+          Buckets by_name;
+          Buckets by_descriptor;
+          std::size_t count = 0;
+        };
+
+        WatchRegistry();
+
+        std::shared_ptr<const Version> snapshot() const noexcept;
+        void publish(std::shared_ptr<const Version> version) noexcept;
+        std::recursive_mutex& writer_mutex() noexcept { return mutex; }
+
+        /// Bracket the reader's use of snapshots, on its watch thread
+        void begin_read() noexcept;
+        void end_read() noexcept;
+        /// True on the reader's thread between begin_read() and end_read()
+        bool read_by_this_thread() const noexcept;
+        /// Wait until the reader is done with the snapshots it took before
+        /// the call, blocking rather than spinning.  Returns at once on the
+        /// reader's own thread.  The reader of another registry must not
+        /// call this, as that reader may be waited for in turn.
+        void synchronize() const noexcept;
+
+      private:
+        static constexpr uint64_t reading = 1;  // the reader uses a snapshot
+        static constexpr uint64_t read_count = 2;  // unit of finished reads
+
+        std::atomic<std::shared_ptr<const Version>> current;
+        std::atomic<uint64_t> state = 0;
+        std::recursive_mutex mutex;
+      };
+
+      /// Watched directories that may have missed events, e.g., after the
+      /// kernel event queue overflowed, and must be rescanned.  Rescans are
+      /// rate limited to batch_size directories every interval.
+      class ResyncQueue
+      {
+      public:
+        ResyncQueue(std::chrono::milliseconds interval,
+                    std::size_t batch_size);
+        ResyncQueue(const ResyncQueue&) = delete;
+        ResyncQueue& operator=(const ResyncQueue&) = delete;
+        ResyncQueue(ResyncQueue&&) = delete;
+        ResyncQueue& operator=(ResyncQueue&&) = delete;
+        ~ResyncQueue();
+
+        template<typename WatchMapT>
+        void mark_dirty(const WatchMapT& watches)
+        {
+          for (const auto& w : watches)
+          {
+            dirty.insert(w.first);
+          }
+          update_pending();
+        }
+        void mark_dirty(const WatchRegistry::Version& watches);
+        void forget(const std::string& dirname);
+        bool empty() const { return dirty.empty(); }
+
+        /// Poll timeout until the next rescan is due, -1 if none is pending
+        int poll_timeout_ms() const;
+        /// Remove and return the directories due for rescanning now
+        std::vector<std::string> take_due();
+
+      private:
+        void update_pending() const;
+
+        std::chrono::milliseconds interval;
+        std::size_t batch_size;
+        std::set<std::string> dirty;
+        mutable std::size_t reported_pending = 0;
+        std::chrono::steady_clock::time_point next_resync;
+      };
+
+      /// Folds the events of each directory entry during a debounce window
+      /// into their net effect, e.g., a file created and deleted within the
+      /// window yields no event at all.  Entries are stat'ed once, when
+      /// their window has passed, instead of once per event.
+      class Debouncer
+      {
+      public:
+        /// A window of 0 disables debouncing
+        explicit Debouncer(std::chrono::milliseconds window,
+                           ClockFun clock = std::chrono::steady_clock::now);
+
+        bool enabled() const { return window.count() > 0; }
+
+        /// Record that name in the watched directory dirname was added
+        /// (exists == true) or removed
+        void record(const std::string& dirname, std::string_view name,
+                    bool exists, bool is_dir);
+        /// Record that the file name in dirname was written to
+        void record_modified(const std::string& dirname,
+                             std::string_view name);
+        void forget(const std::string& dirname);
+        void clear();
+
+        struct Entry
+        {
+          std::string dirname;
+          std::string name;
+          bool existed_before;
+          bool was_dir;
+          bool exists;
+          bool is_dir;
+          bool replaced;  // the entry that existed before was removed
+          bool modified;
+        };
+
+        /// Poll timeout until the next window closes, -1 if none is open
+        int poll_timeout_ms() const;
+        /// Remove and return the entries whose window has closed
+        std::vector<Entry> take_due();
+        /// Remove and return the entry of name in dirname, if any, before
+        /// its window has closed.  An event about name that is not
+        /// debounced is to be delivered after it.
+        std::optional<Entry> take(const std::string& dirname,
+                                  std::string_view name);
+        /// Remove and return the entries of dirname, in the order they were
+        /// recorded, e.g., before the directory itself is removed
+        std::vector<Entry> take_all(const std::string& dirname);
+
+        /// Notify the listeners of state about the net effect of entry
+        static void emit(const Entry& entry, const DirectoryState& state,
+                         const GetDirEntryFun& get_direntry);
+
+      private:
+        using Key = std::pair<std::string, std::string>;
+
+        Entry& entry(const std::string& dirname, std::string_view name,
+                     bool existed_before, bool is_dir);
+
+        std::chrono::milliseconds window;
+        ClockFun clock;
+        std::map<Key, Entry> entries;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, Key>>
+          deadlines;
+      };
+
+      /// Renames whose IN_MOVED_FROM has been read, waiting for the
+      /// IN_MOVED_TO with the same cookie.  The kernel queues both halves
+      /// together, but a drain can end between them, so the first half is
+      /// kept over drains until window has passed.  Only then is it a move
+      /// out of the watched directories, or when a later event about its
+      /// name in its directory is read, e.g., a file that is rotated and
+      /// created again.
+      class PendingMoves
+      {
+      public:
+        struct Move
+        {
+          WatchPtr watch;
+          std::string name;
+          bool is_dir;
+        };
+
+        explicit PendingMoves(std::chrono::milliseconds window,
+                              ClockFun clock = std::chrono::steady_clock::now);
+
+        void add(uint32_t cookie, Move move);
+        /// Remove and return the move with cookie, if any
+        std::optional<Move> take(uint32_t cookie);
+        /// Remove and return the moves of name out of watch, or of all
+        /// moves out of watch if name is empty
+        std::vector<Move> take(const WatchEntry& watch, std::string_view name);
+        /// Remove and return the moves whose window has passed
+        std::vector<Move> take_expired();
+        /// Poll timeout until the next window closes, -1 if none is open
+        int poll_timeout_ms() const;
+        void clear()
+        {
+          moves.clear();
+          cookies.clear();
+        }
+
+      private:
+        using Deadline = std::chrono::steady_clock::time_point;
+        using NameKey = std::pair<const WatchEntry*, std::string>;
+
+        void forget(uint32_t cookie, const Move& move);
+
+        std::chrono::milliseconds window;
+        ClockFun clock;
+        std::unordered_map<uint32_t, std::pair<Deadline, Move>> moves;
+        std::map<NameKey, uint32_t> cookies;
+      };
+
+      /// How long the first half of a rename waits for its second half
+      constexpr std::chrono::milliseconds move_pairing_window{10};
+
+      /// Shortest of two poll timeouts, where -1 means none
+      int earliest_timeout_ms(int lhs, int rhs) noexcept;
+
     }  // namespace dtls
 
+    /// Watches directories with one or more inotify instances, each polled
+    /// by its own watch thread.  Directories are assigned to the instances
+    /// (shards) by the hash of their name, so the events of a directory are
+    /// always dispatched in order, by the same thread.
     template<typename SuperClassT>
     class OSFileSystem : public SuperClassT
     {
     public:
+      /// Without in_ptr, options.watch_threads inotify instances are created
       explicit OSFileSystem(
         std::string_view rootdir,
         std::unique_ptr<dtls::Inotify> in_ptr = nullptr,
-        std::unique_ptr<threading::LoopThreadFactory> thr_fac = nullptr);
+        std::unique_ptr<threading::LoopThreadFactory> thr_fac = nullptr,
+        const WatchOptions& options = WatchOptions{});
+      /// One shard per inotify instance in inotifies
+      OSFileSystem(std::string_view rootdir,
+                   std::vector<std::unique_ptr<dtls::Inotify>> inotifies,
+                   std::unique_ptr<threading::LoopThreadFactory> thr_fac,
+                   const WatchOptions& options = WatchOptions{});
+      OSFileSystem(const OSFileSystem&) = delete;
+      OSFileSystem& operator=(const OSFileSystem&) = delete;
+      OSFileSystem(OSFileSystem&&) = delete;
+      OSFileSystem& operator=(OSFileSystem&&) = delete;
       ~OSFileSystem();
 
       void watch(std::string_view dirname,
                  DirectoryEventListener& listener) override;
+      /// Waits until no watch thread notifies listener anymore.  A watch
+      /// thread must call it through after_dispatch() for the directories
+      /// of other shards, as their watch threads may be waiting for it.
       void stop_watching(std::string_view dirname,
                          DirectoryEventListener& listener) override;
+      /// Queued on the shard of the calling watch thread while it
+      /// dispatches, and run when it has finished reading its registry
+      void after_dispatch(std::function<void()> task) override;
+      /// As watch(dirname, listener), but if dirname is not watched yet,
+      /// its entries are taken to be entries instead of listing it again,
+      /// e.g., as CachingFileSystem listed it for itself
+      void watch_listed(std::string_view dirname,
+                        DirectoryEventListener& listener,
+                        const std::deque<fs::DirectoryEntry>& entries);
 
     private:
-      void poll_watches();
+      /// An inotify instance, the directories it watches and the thread
+      /// polling it.  Only the watch thread of the shard dispatches its
+      /// events, and only it uses resync_queue and debouncer.
+      struct Shard
+      {
+        Shard(std::unique_ptr<dtls::Inotify> in_ptr,
+              const WatchOptions& options);
+
+        std::unique_ptr<dtls::Inotify> inotify;
+        dtls::WatchRegistry registry;
+        dtls::ResyncQueue resync_queue;
+        dtls::Debouncer debouncer;
+        dtls::PendingMoves moves;
+        std::vector<char> read_buffer;
+        std::unique_ptr<threading::LoopThread> watch_thread;
+        std::atomic<int> currently_polling = 0;
+        // directories no longer watched, whose debounced events and pending
+        // rescans the watch thread must drop
+        std::mutex forgotten_mutex;
+        std::vector<std::string> forgotten;
+        // given to after_dispatch() by the watch thread, which runs them
+        std::vector<std::function<void()>> after_dispatch;
+      };
+
+      /// Lists dirname if it is not watched yet, unless entries are given
+      void watch_with(std::string_view dirname,
+                      DirectoryEventListener& listener,
+                      const std::deque<fs::DirectoryEntry>* entries);
+      Shard& shard_of(const std::string& dirname);
+      void drop_forgotten(Shard& shard);
+      void poll_watches(Shard& shard);
+      void resync_dirty_watches(Shard& shard);
+      void flush_debounced(Shard& shard);
 
-      std::unique_ptr<dtls::Inotify> inotify;
-      std::map<std::string, dtls::Watch> watches;
       std::unique_ptr<threading::LoopThreadFactory> thread_factory;
-      std::unique_ptr<threading::LoopThread> watch_thread;
-      std::atomic<int> currently_polling = 0;
+      std::vector<std::unique_ptr<Shard>> shards;
     };
 
     namespace dtls
     {
-      std::optional<short>
-      safe_poll_inotify(Inotify& inotify,
-                        std::atomic<int>& currently_polling) noexcept;
-      void
-      process_inotify_events(Inotify& inotify,
-                             const std::map<std::string, dtls::Watch>& watches,
-                             const GetDirEntryFun& get_direntry) noexcept;
+      std::optional<uint32_t>
+      safe_poll_inotify(Inotify& inotify, std::atomic<int>& currently_polling,
+                        int timeout_ms = -1) noexcept;
+      /// Read and dispatch inotify events until the (non-blocking) inotify
+      /// file descriptor is drained.  Returns true if the kernel reported
+      /// that its event queue overflowed, i.e., that events were lost.
+      /// Additions and removals are recorded in debouncer if it is enabled.
+      /// The first halves of renames wait in moves for their second halves,
+      /// and the ones that waited too long are reported as removals.  The
+      /// watches are looked up in a snapshot of registry taken after every
+      /// read.  Renamed and removed directories are passed to
+      /// directory_moved before their events are dispatched.
+      bool process_inotify_events(Inotify& inotify,
+                                  const WatchRegistry& registry,
+                                  const GetDirEntryFun& get_direntry,
+                                  const DirectoryMovedFun& directory_moved,
+                                  std::span<char> buffer,
+                                  Debouncer& debouncer,
+                                  PendingMoves& moves) noexcept;
+      /// Smallest buffer guaranteed to hold one inotify event
+      std::size_t min_inotify_read_size() noexcept;
       void close_inotify(Inotify& inotify) noexcept;
+      /// in_ptr if set, otherwise count (at least one) new inotify instances
+      std::vector<std::unique_ptr<Inotify>>
+      create_inotify_shards(std::unique_ptr<Inotify> in_ptr,
+                            std::size_t count);
+      /// The shard, of shard_count, that watches dirname
+      std::size_t shard_index(std::string_view dirname,
+                              std::size_t shard_count) noexcept;
 
     }  // namespace dtls
   }  // namespace dm
 }  // namespace fw
 
 
+template<typename SuperClassT>
+fw::dm::OSFileSystem<SuperClassT>::Shard::Shard(
+  std::unique_ptr<dtls::Inotify> in_ptr, const WatchOptions& options) :
+  inotify(std::move(in_ptr)),
+  registry(),
+  resync_queue(options.resync_interval, options.resync_batch_size),
+  debouncer(options.debounce_window, options.clock),
+  moves(dtls::move_pairing_window, options.clock),
+  read_buffer(
+    std::max(options.read_buffer_size, dtls::min_inotify_read_size()))
+{
+}
+
 template<typename SuperClassT>
 fw::dm::OSFileSystem<SuperClassT>::OSFileSystem(
   std::string_view rootdir_,
   std::unique_ptr<dtls::Inotify>
     in_ptr,
   std::unique_ptr<threading::LoopThreadFactory>
-    thr_fac) :
-  SuperClassT(rootdir_),
-  inotify(), watches(), thread_factory()
+    thr_fac,
+  const WatchOptions& options) :
+  OSFileSystem(rootdir_,
+               dtls::create_inotify_shards(std::move(in_ptr),
+                                           options.watch_threads),
+               std::move(thr_fac), options)
 {
-  if (in_ptr == nullptr)
-    in_ptr = dtls::Inotify::create<dtls::Inotify>();
+}
 
+template<typename SuperClassT>
+fw::dm::OSFileSystem<SuperClassT>::OSFileSystem(
+  std::string_view rootdir_,
+  std::vector<std::unique_ptr<dtls::Inotify>>
+    inotifies,
+  std::unique_ptr<threading::LoopThreadFactory>
+    thr_fac,
+  const WatchOptions& options) :
+  SuperClassT(rootdir_),
+  thread_factory(), shards()
+{
   if (thr_fac == nullptr)
     thr_fac = threading::create_thread_factory();
 
-  inotify = std::move(in_ptr);
   thread_factory = std::move(thr_fac);
 
-  watch_thread = thread_factory->create_thread([&]() { this->poll_watches(); },
-                                               true /* create_suspended */);
+  for (auto& in_ptr : inotifies)
+  {
+    shards.push_back(std::make_unique<Shard>(std::move(in_ptr), options));
+    auto* shard = shards.back().get();
+    shard->watch_thread = thread_factory->create_thread(
+      [this, shard]() { this->poll_watches(*shard); },
+      true /* create_suspended */);
+  }
 }
 
 template<typename SuperClassT>
 fw::dm::OSFileSystem<SuperClassT>::~OSFileSystem()
 {
-  watches.clear();
-  watch_thread->stop();
+  for (auto& shard : shards)
+  {
+    shard->registry.publish(
+      std::make_shared<const dtls::WatchRegistry::Version>());
+    shard->watch_thread->stop();
+  }
 
-  if (watch_thread->is_joinable())
+  for (auto& shard : shards)
   {
-    if (currently_polling > 0)
+    if (shard->watch_thread->is_joinable())
     {
-      inotify->terminate_poll();
+      if (shard->currently_polling > 0)
+      {
+        shard->inotify->terminate_poll();
+      }
+      spdlog::debug("watch_thread->join()");
+      shard->watch_thread->join();
     }
-    spdlog::debug("watch_thread->join()");
-    watch_thread->join();
+    close_inotify(*shard->inotify);
   }
-  close_inotify(*inotify);
+}
+
+template<typename SuperClassT>
+typename fw::dm::OSFileSystem<SuperClassT>::Shard&
+fw::dm::OSFileSystem<SuperClassT>::shard_of(const std::string& dirname)
+{
+  return *shards[dtls::shard_index(dirname, shards.size())];
 }
 
 template<typename SuperClassT>
 void fw::dm::OSFileSystem<SuperClassT>::watch(std::string_view dirname,
                                               DirectoryEventListener& listener)
+{
+  watch_with(dirname, listener, nullptr);
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::watch_listed(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::deque<fs::DirectoryEntry>& entries)
+{
+  watch_with(dirname, listener, &entries);
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::watch_with(
+  std::string_view dirname, DirectoryEventListener& listener,
+  const std::deque<fs::DirectoryEntry>* entries)
 {
   const std::string dn{dirname};
   try
   {
-    auto unsuspend_watch_thread = watches.empty();
-
-    auto iter = watches.find(dn);
-    if (iter == std::end(watches))
+    auto& shard = shard_of(dn);
+    std::lock_guard<std::recursive_mutex> sentry(
+      shard.registry.writer_mutex());
+    auto current = shard.registry.snapshot();
+    auto unsuspend_watch_thread = current->empty();
+
+    const auto* found = current->find(dn);
+    if (found == nullptr)
     {
-      dtls::Watch w{*inotify, this->join(this->rootdir.string(), dirname),
-                    this->ls(dirname)};
-      iter = watches.insert(std::make_pair(dn, std::move(w))).first;
+      std::deque<fs::DirectoryEntry> listed;
+      if (entries == nullptr)
+      {
+        listed = SuperClassT::ls(dirname);
+        entries = &listed;
+      }
+      auto entry = std::make_shared<dtls::WatchEntry>(
+        std::piecewise_construct, std::forward_as_tuple(dn),
+        std::forward_as_tuple(*shard.inotify,
+                              this->join(this->rootdir.string(), dirname),
+                              *entries));
+      entry->second.add_listener(listener);
+      shard.registry.publish(current->with(entry));
+      this->hold_directory(dn);
+    }
+    else
+    {
+      (*found)->second.add_listener(listener);
     }
-    iter->second.add_listener(listener);
     listener.notify(filewatch::DirectoryEvent::WATCHING_DIRECTORY, dirname, ".",
-                    0);
+                    0, 0, {});
 
     if (unsuspend_watch_thread)
     {
-      watch_thread->unsuspend();
+      shard.watch_thread->unsuspend();
       spdlog::debug("unsuspended watch thread");
     }
   }
@@ -171,36 +632,168 @@ template<typename SuperClassT>
 void fw::dm::OSFileSystem<SuperClassT>::stop_watching(
   std::string_view dirname, DirectoryEventListener& listener)
 {
-  auto iter = watches.find(std::string(dirname));
-  if (iter == std::end(watches))
+  const std::string dn{dirname};
+  auto& shard = shard_of(dn);
   {
-    return;
-  }
+    std::lock_guard<std::recursive_mutex> sentry(
+      shard.registry.writer_mutex());
+    auto current = shard.registry.snapshot();
+    const auto* found = current->find(dn);
+    if (found == nullptr)
+    {
+      return;
+    }
 
-  if (iter->second.remove_listener(listener))
-  {
-    watches.erase(iter);
+    auto entry = *found;
+    if (entry->second.remove_listener(listener))
+    {
+      auto next = current->without(entry);
+      const bool empty = next->empty();
+      shard.registry.publish(std::move(next));
+      entry->second.remove();
+      this->release_directory(dn);
+      {
+        std::lock_guard<std::mutex> forgotten_sentry(shard.forgotten_mutex);
+        shard.forgotten.push_back(dn);
+      }
+
+      if (empty)
+      {
+        shard.watch_thread->suspend();
+        spdlog::debug("suspended watch thread");
+      }
+    }
   }
 
-  if (watches.empty())
+  // the caller may destroy listener once this returns
+  shard.registry.synchronize();
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::after_dispatch(
+  std::function<void()> task)
+{
+  for (auto& shard : shards)
   {
-    watch_thread->suspend();
-    spdlog::debug("suspended watch thread");
+    if (shard->registry.read_by_this_thread())
+    {
+      shard->after_dispatch.push_back(std::move(task));
+      return;
+    }
   }
+  task();
 }
 
 template<typename SuperClassT>
-void fw::dm::OSFileSystem<SuperClassT>::poll_watches()
+void fw::dm::OSFileSystem<SuperClassT>::poll_watches(Shard& shard)
 {
-  auto optional_revents = safe_poll_inotify(*inotify, currently_polling);
+  // the registry is only read between begin_read() and end_read(), so the
+  // wait for events does not hold up writers
+  auto optional_revents = safe_poll_inotify(
+    *shard.inotify, shard.currently_polling,
+    dtls::earliest_timeout_ms(
+      shard.resync_queue.poll_timeout_ms(),
+      dtls::earliest_timeout_ms(shard.debouncer.poll_timeout_ms(),
+                                shard.moves.poll_timeout_ms())));
   if (!optional_revents)
     return;
 
-  process_inotify_events(
-    *inotify, watches,
+  shard.registry.begin_read();
+  drop_forgotten(shard);
+  auto overflowed = process_inotify_events(
+    *shard.inotify, shard.registry,
     [&](std::string_view containing_dir, std::string_view filename) {
-      return this->get_direntry(this->join(containing_dir, filename));
-    });
+      return SuperClassT::get_direntry(this->join(containing_dir, filename));
+    },
+    [&](std::string_view containing_dir, std::string_view dir_name) {
+      this->directory_moved(dir_name.empty()
+                              ? std::string{containing_dir}
+                              : this->join(containing_dir, dir_name));
+    },
+    shard.read_buffer, shard.debouncer, shard.moves);
+
+  if (overflowed)
+  {
+    auto current = shard.registry.snapshot();
+    spdlog::warn("inotify event queue overflowed, resyncing {} directories",
+                 current->size());
+    // the rescan reports the net effect of the debounced events and the
+    // pending moves as well
+    shard.debouncer.clear();
+    shard.moves.clear();
+    shard.resync_queue.mark_dirty(*current);
+  }
+
+  flush_debounced(shard);
+  resync_dirty_watches(shard);
+  shard.registry.end_read();
+
+  // no longer reading, so waiting for the watch threads of other shards
+  // cannot wait for this one in turn
+  auto tasks = std::move(shard.after_dispatch);
+  shard.after_dispatch.clear();
+  for (const auto& task : tasks)
+  {
+    task();
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::drop_forgotten(Shard& shard)
+{
+  std::vector<std::string> dirnames;
+  {
+    std::lock_guard<std::mutex> sentry(shard.forgotten_mutex);
+    dirnames.swap(shard.forgotten);
+  }
+
+  for (const auto& dirname : dirnames)
+  {
+    shard.resync_queue.forget(dirname);
+    shard.debouncer.forget(dirname);
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::flush_debounced(Shard& shard)
+{
+  auto current = shard.registry.snapshot();
+  for (const auto& entry : shard.debouncer.take_due())
+  {
+    const auto* found = current->find(entry.dirname);
+    if (found != nullptr)
+    {
+      dtls::Debouncer::emit(
+        entry, (*found)->second,
+        [&](std::string_view containing_dir, std::string_view filename) {
+          return SuperClassT::get_direntry(
+            this->join(containing_dir, filename));
+        });
+    }
+  }
+}
+
+template<typename SuperClassT>
+void fw::dm::OSFileSystem<SuperClassT>::resync_dirty_watches(Shard& shard)
+{
+  auto current = shard.registry.snapshot();
+  for (const auto& dirname : shard.resync_queue.take_due())
+  {
+    const auto* found = current->find(dirname);
+    if (found == nullptr)
+    {
+      continue;
+    }
+
+    try
+    {
+      (*found)->second.resync(dirname, SuperClassT::ls(dirname));
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::warn("Unable to resync {}: {}", dirname, e.what());
+    }
+  }
 }
 
 #endif  // __linux__
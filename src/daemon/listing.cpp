@@ -0,0 +1,55 @@
+#include "listing.h"
+
+#include "filesystem.h"
+
+fw::dm::fs::Listing::Listing(const std::deque<DirectoryEntry>& entries)
+{
+  std::size_t name_bytes = 0;
+  for (const auto& e : entries)
+  {
+    name_bytes += e.name.size() + 1;
+  }
+  reserve(entries.size(), name_bytes);
+  for (const auto& e : entries)
+  {
+    add(e.name, e.is_dir, e.mtime, e.size);
+  }
+}
+
+void fw::dm::fs::Listing::reserve(std::size_t entries, std::size_t name_bytes)
+{
+  records.reserve(entries);
+  names.reserve(name_bytes);
+}
+
+void fw::dm::fs::Listing::add(std::string_view name, bool is_dir,
+                              uint64_t mtime, uint64_t size)
+{
+  records.push_back(Record{mtime, size, static_cast<uint32_t>(names.size()),
+                           static_cast<uint32_t>(name.size()), is_dir});
+  names.append(name);
+  names.push_back('\0');
+}
+
+fw::dm::fs::Listing::Entry fw::dm::fs::Listing::operator[](std::size_t i) const
+{
+  const auto& r = records[i];
+  return Entry{std::string_view(names).substr(r.name_offset, r.name_size),
+               r.is_dir, r.mtime, r.size};
+}
+
+const char* fw::dm::fs::Listing::c_str(std::size_t i) const
+{
+  return names.data() + records[i].name_offset;
+}
+
+std::deque<fw::dm::fs::DirectoryEntry> fw::dm::fs::Listing::entries() const
+{
+  std::deque<DirectoryEntry> result;
+  for (const auto& e : *this)
+  {
+    result.push_back(DirectoryEntry{std::string(e.name), e.is_dir, e.mtime,
+                                    e.size});
+  }
+  return result;
+}
@@ -0,0 +1,105 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    namespace fs
+    {
+      struct DirectoryEntry;
+
+      /// The entries of a directory, their names packed into one buffer and
+      /// their metadata into fixed size records, so that listing n entries
+      /// takes a few allocations instead of n.  The names are NUL terminated
+      /// in the buffer, for the syscalls taking them.
+      class Listing
+      {
+      public:
+        /// Valid until the next add to the listing
+        struct Entry
+        {
+          std::string_view name;
+          bool is_dir;
+          uint64_t mtime;  // milliseconds since epoch
+          uint64_t size;  // size of file in bytes, 0 for directories
+        };
+
+        class const_iterator
+        {
+        public:
+          const_iterator(const Listing& listing_, std::size_t index_) :
+            listing(&listing_), index(index_)
+          {
+          }
+
+          Entry operator*() const { return (*listing)[index]; }
+          const_iterator& operator++()
+          {
+            ++index;
+            return *this;
+          }
+          bool operator==(const const_iterator& other) const = default;
+
+        private:
+          const Listing* listing;
+          std::size_t index;
+        };
+
+        Listing() = default;
+        explicit Listing(const std::deque<DirectoryEntry>& entries);
+
+        void reserve(std::size_t entries, std::size_t name_bytes);
+        void add(std::string_view name, bool is_dir, uint64_t mtime,
+                 uint64_t size);
+
+        std::size_t size() const { return records.size(); }
+        bool empty() const { return records.empty(); }
+
+        Entry operator[](std::size_t i) const;
+        /// The NUL terminated name of entry i
+        const char* c_str(std::size_t i) const;
+
+        const_iterator begin() const { return const_iterator(*this, 0); }
+        const_iterator end() const { return const_iterator(*this, size()); }
+
+        /// A DirectoryEntry, and its own name, per entry
+        std::deque<DirectoryEntry> entries() const;
+
+      private:
+        struct Record
+        {
+          uint64_t mtime;
+          uint64_t size;
+          uint32_t name_offset;
+          uint32_t name_size;
+          bool is_dir;
+        };
+
+        std::vector<Record> records;
+        std::string names;
+      };
+
+      /// Part of a listing, read from a cursor on.  A cursor is 0 at the
+      /// start of a directory, and otherwise only meaningful to the file
+      /// system that returned it.
+      struct ListingPage
+      {
+        Listing entries;
+        std::vector<uint64_t> cursors;  // to continue after each entry
+        uint64_t next = 0;  // to continue after the page
+        bool end = false;  // true if nothing follows the page
+      };
+
+    }  // namespace fs
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* LISTING_H */
@@ -25,11 +25,16 @@
 */
 
 #include "common/tee_output.h"
+#include "eventjournal.h"
+#include "eventlog.h"
+#include "eventqueue.h"
 #include "filesystem.h"
 #include "filesystemwatcherfactory.h"
 #include "server.h"
+#include "treeindex.h"
 
 #define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #include <docopt/docopt.h>
 #include <spdlog/spdlog.h>
@@ -40,7 +45,7 @@ static constexpr auto USAGE =
   R"(filewatch daemon.
 
 Usage:
-    fwdaemon [--log-level=LEVEL] DIR
+    fwdaemon [--log-level=LEVEL] [--event-queue-size=N] [--overflow-policy=POLICY] [--journal-size=N] [--journal-retention=MS] [--event-log=DIR] [--event-log-segment-size=BYTES] [--event-log-retention=S] [--watch-backend=BACKEND] [--io-engine=ENGINE] [--inotify-buffer-size=BYTES] [--watch-threads=N] [--resync-interval=MS] [--resync-batch-size=N] [--debounce-window=MS] [--metadata-cache] [--warm-index] [--scan-threads=N] [--index-file=FILE] [--index-save-interval=S] DIR
     fwdaemon --run-unit-tests [--tee-output=FILE] [--use-colour=(auto|yes|no)] [--list-tests] [--log-level=LEVEL]
     fwdaemon (-h | --help)
     fwdaemon --version
@@ -52,6 +57,65 @@ Options:
     --use-colour=(auto|yes|no)  Use colour in output.
     --log-level=LEVEL           Set log level (error|warn|info|debug).
                                 Default: info.
+    --event-queue-size=N        Max number of events waiting to be sent to
+                                one subscriber. [default: 1024]
+    --overflow-policy=POLICY    What to do when a subscriber's event queue is
+                                full (drop-oldest|coalesce|disconnect).
+                                disconnect sends RESYNC_REQUIRED and closes
+                                the stream. [default: disconnect]
+    --journal-size=N            Number of events kept per subscription for
+                                clients resuming a dropped stream.
+                                [default: 4096]
+    --journal-retention=MS      Keep recording the events of a subscription
+                                for MS milliseconds after its last
+                                subscriber is gone. [default: 60000]
+    --event-log=DIR             Log all events to memory mapped segment
+                                files in DIR, to be replayed with
+                                ReplayEvents, also after a restart.
+    --event-log-segment-size=BYTES  Size of each event log segment file.
+                                [default: 16777216]
+    --event-log-retention=S     Delete event log segments whose newest
+                                event is older than S seconds.
+                                [default: 86400]
+    --watch-backend=BACKEND     Kernel interface used to watch directories
+                                (inotify|fanotify).  fanotify marks the
+                                whole filesystem instead of every watched
+                                directory, and requires CAP_SYS_ADMIN.
+                                [default: inotify]
+    --io-engine=ENGINE          How directories are listed and files are read
+                                (sync|io_uring).  io_uring stats directory
+                                entries and reads file chunks in batches.
+                                [default: sync]
+    --inotify-buffer-size=BYTES  Size of the buffer inotify (or fanotify)
+                                events are read into. [default: 65536]
+    --watch-threads=N           Number of inotify instances, each with its
+                                own thread, that watched directories are
+                                spread over. [default: 1]
+    --resync-interval=MS        After inotify's event queue overflowed,
+                                rescan watched directories at most every
+                                MS milliseconds. [default: 100]
+    --resync-batch-size=N       Number of directories rescanned per
+                                resync interval. [default: 16]
+    --debounce-window=MS        Fold the events of a directory entry within
+                                MS milliseconds into their net effect, e.g.,
+                                drop files that are created and deleted
+                                again.  0 disables debouncing. [default: 0]
+    --metadata-cache            Serve listings and stats of watched
+                                directories from memory, kept up to date
+                                by their events.
+    --warm-index                Watch and list the whole tree at startup,
+                                so listings are served from memory from
+                                the first request on.  Implies
+                                --metadata-cache.
+    --scan-threads=N            Number of threads listing the tree for
+                                --warm-index. [default: 8]
+    --index-file=FILE           Save the index of --warm-index to FILE at
+                                shutdown, and start from it: only the
+                                directories whose mtime changed are listed
+                                again, the entries of the others are only
+                                stat-ed.  Implies --warm-index.
+    --index-save-interval=S     Also save the index every S seconds.  0
+                                only saves it at shutdown. [default: 0]
     -h --help                   Show this screen.
     --version                   Show version.
 )";
@@ -115,11 +179,72 @@ int main(int argc, const char* argv[])
     }
 
     spdlog::info("filewatch 0.1 daemon monitoring {}", args["DIR"].asString());
-    auto fs = fw::dm::create_filesystem(args["DIR"].asString());
+    fw::dm::EventQueueOptions queue_options;
+    queue_options.max_size =
+      static_cast<std::size_t>(args["--event-queue-size"].asLong());
+    queue_options.overflow_policy =
+      fw::dm::parse_overflow_policy(args["--overflow-policy"].asString());
+
+    fw::dm::EventJournalOptions journal_options;
+    journal_options.max_size =
+      static_cast<std::size_t>(args["--journal-size"].asLong());
+    journal_options.retention =
+      std::chrono::milliseconds(args["--journal-retention"].asLong());
+
+    fw::dm::EventLogOptions log_options;
+    if (args["--event-log"])
+    {
+      log_options.directory = args["--event-log"].asString();
+    }
+    log_options.segment_size =
+      static_cast<std::size_t>(args["--event-log-segment-size"].asLong());
+    log_options.retention =
+      std::chrono::seconds(args["--event-log-retention"].asLong());
+
+    fw::dm::WatchOptions watch_options;
+    watch_options.backend =
+      fw::dm::parse_watch_backend(args["--watch-backend"].asString());
+    watch_options.io_engine =
+      fw::dm::parse_io_engine(args["--io-engine"].asString());
+    watch_options.read_buffer_size =
+      static_cast<std::size_t>(args["--inotify-buffer-size"].asLong());
+    watch_options.watch_threads =
+      static_cast<std::size_t>(args["--watch-threads"].asLong());
+    watch_options.resync_interval =
+      std::chrono::milliseconds(args["--resync-interval"].asLong());
+    watch_options.resync_batch_size =
+      static_cast<std::size_t>(args["--resync-batch-size"].asLong());
+    watch_options.debounce_window =
+      std::chrono::milliseconds(args["--debounce-window"].asLong());
+    fw::dm::TreeIndexOptions index_options;
+    index_options.scan_threads =
+      static_cast<std::size_t>(args["--scan-threads"].asLong());
+    if (args["--index-file"])
+    {
+      index_options.path = args["--index-file"].asString();
+    }
+    index_options.save_interval =
+      std::chrono::seconds(args["--index-save-interval"].asLong());
+
+    const bool warm_index =
+      args["--warm-index"].asBool() || !index_options.path.empty();
+    watch_options.metadata_cache =
+      args["--metadata-cache"].asBool() || warm_index;
+
+    auto fs = fw::dm::create_filesystem(args["DIR"].asString(), watch_options);
+    auto& filesystem = *fs;
     auto factory =
       std::make_unique<fw::dm::FileSystemWatcherFactory>(std::move(fs));
 
-    fw::dm::Server server(std::move(factory));
+    fw::dm::Server server(std::move(factory), queue_options, journal_options,
+                          log_options);
+    std::unique_ptr<fw::dm::TreeIndex> index;
+    if (warm_index)
+    {
+      index =
+        std::make_unique<fw::dm::TreeIndex>(filesystem, "/", index_options);
+      index->start();
+    }
     return server.run();
   }
   catch (const std::exception& e)
@@ -0,0 +1,191 @@
+#include "recursiveeventlistener.h"
+
+#include "eventjournal.h"
+#include "filesystem.h"
+
+#include <spdlog/spdlog.h>
+
+fw::dm::RecursiveEventListener::RecursiveEventListener(
+  FileSystem& fs_, std::string_view rootdir_, DirectoryEventListener& target_) :
+  fs(fs_),
+  rootdir(rootdir_), target(target_)
+{
+}
+
+fw::dm::RecursiveEventListener::~RecursiveEventListener() { stop(); }
+
+void fw::dm::RecursiveEventListener::start()
+{
+  std::lock_guard<std::recursive_mutex> sentry(mutex);
+  stopped = false;
+  watch_subtree(rootdir, false);
+}
+
+void fw::dm::RecursiveEventListener::stop()
+{
+  std::vector<std::string> dirnames;
+  {
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    stopped = true;
+    unwatched.wait(lock, [this] { return pending_unwatches == 0; });
+    dirnames.assign(std::begin(watched), std::end(watched));
+    watched.clear();
+  }
+  stop_watching(dirnames);
+}
+
+void fw::dm::RecursiveEventListener::notify(
+  filewatch::DirectoryEvent::Event event, std::string_view containing_dir,
+  std::string_view dir_name, uint64_t mtime, uint64_t size,
+  std::string_view old_name)
+{
+  if (event == filewatch::DirectoryEvent::WATCHING_DIRECTORY)
+  {
+    // only the subscribed directory is announced, subdirectories are
+    // announced by their DIRECTORY_ADDED event
+    if (containing_dir == rootdir)
+    {
+      target.notify(event, containing_dir, dir_name, mtime, size, old_name);
+    }
+    return;
+  }
+
+  std::vector<std::string> removed;
+  {
+    // fs.watch() notifies synchronously, hence the recursive mutex
+    std::lock_guard<std::recursive_mutex> sentry(mutex);
+    if (stopped)
+    {
+      return;
+    }
+    target.notify(event, containing_dir, dir_name, mtime, size, old_name);
+
+    if (event == filewatch::DirectoryEvent::DIRECTORY_ADDED)
+    {
+      watch_subtree(fs.join(containing_dir, dir_name), true);
+    }
+    else if (event == filewatch::DirectoryEvent::DIRECTORY_REMOVED)
+    {
+      removed = take_subtree(fs.join(containing_dir, dir_name));
+    }
+    else if (event == filewatch::DirectoryEvent::DIRECTORY_RENAMED)
+    {
+      // the entries moved along with the directory, so the subscriber knows
+      // them under their new path already
+      removed = take_subtree(fs.join(containing_dir, old_name));
+      watch_subtree(fs.join(containing_dir, dir_name), false);
+    }
+  }
+
+  if (!removed.empty())
+  {
+    stop_watching_after_dispatch(std::move(removed));
+  }
+}
+
+void fw::dm::RecursiveEventListener::watch_subtree(const std::string& dirname,
+                                                   bool report_entries)
+{
+  if (watched.count(dirname) != 0)
+  {
+    return;
+  }
+
+  try
+  {
+    fs.watch(dirname, *this);
+    watched.insert(dirname);
+  }
+  catch (const std::exception& e)
+  {
+    if (dirname == rootdir)
+    {
+      throw;
+    }
+    spdlog::warn("Unable to watch {}: {}", dirname, e.what());
+    return;
+  }
+
+  try
+  {
+    for (const auto& entry : fs.ls(dirname))
+    {
+      if (report_entries)
+      {
+        EventDispatch dispatch;
+        target.notify(entry.is_dir ? filewatch::DirectoryEvent::DIRECTORY_ADDED
+                                   : filewatch::DirectoryEvent::FILE_ADDED,
+                      dirname, entry.name, entry.mtime, entry.size, {});
+      }
+      if (entry.is_dir)
+      {
+        watch_subtree(fs.join(dirname, entry.name), report_entries);
+      }
+    }
+  }
+  catch (const std::exception& e)
+  {
+    spdlog::warn("Unable to list {}: {}", dirname, e.what());
+  }
+}
+
+std::vector<std::string>
+fw::dm::RecursiveEventListener::take_subtree(const std::string& dirname)
+{
+  std::vector<std::string> dirnames;
+  auto iter = watched.find(dirname);
+  if (iter != std::end(watched))
+  {
+    dirnames.push_back(*iter);
+    watched.erase(iter);
+  }
+
+  const auto prefix = dirname + "/";
+  iter = watched.lower_bound(prefix);
+  while (iter != std::end(watched) && iter->starts_with(prefix))
+  {
+    dirnames.push_back(*iter);
+    iter = watched.erase(iter);
+  }
+  return dirnames;
+}
+
+void fw::dm::RecursiveEventListener::stop_watching(
+  const std::vector<std::string>& dirnames)
+{
+  for (const auto& dirname : dirnames)
+  {
+    fs.stop_watching(dirname, *this);
+
+    // added again while it was being stopped, e.g., a directory created
+    // again right after it was removed
+    std::lock_guard<std::recursive_mutex> sentry(mutex);
+    if (!stopped && watched.count(dirname) != 0)
+    {
+      try
+      {
+        fs.watch(dirname, *this);
+      }
+      catch (const std::exception& e)
+      {
+        spdlog::warn("Unable to watch {}: {}", dirname, e.what());
+        watched.erase(dirname);
+      }
+    }
+  }
+}
+
+void fw::dm::RecursiveEventListener::stop_watching_after_dispatch(
+  std::vector<std::string> dirnames)
+{
+  {
+    std::lock_guard<std::recursive_mutex> sentry(mutex);
+    ++pending_unwatches;
+  }
+  fs.after_dispatch([this, dirnames = std::move(dirnames)]() {
+    stop_watching(dirnames);
+    std::lock_guard<std::recursive_mutex> sentry(mutex);
+    --pending_unwatches;
+    unwatched.notify_all();
+  });
+}
@@ -0,0 +1,75 @@
+#ifndef RECURSIVEEVENTLISTENER_H
+#define RECURSIVEEVENTLISTENER_H
+
+#include "directoryeventlistener.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    class FileSystem;
+
+    /// Watches a directory and all its subdirectories, and forwards their
+    /// events to one listener.
+    ///
+    /// Subdirectories are watched when they are added or renamed, and no
+    /// longer watched when they are removed.  The entries of a subdirectory
+    /// created before its watch was in place are reported as added when the
+    /// watch is added.
+    class RecursiveEventListener : public DirectoryEventListener
+    {
+    public:
+      RecursiveEventListener(FileSystem& fs, std::string_view rootdir,
+                             DirectoryEventListener& target);
+      RecursiveEventListener(const RecursiveEventListener&) = delete;
+      RecursiveEventListener& operator=(const RecursiveEventListener&) = delete;
+      RecursiveEventListener(RecursiveEventListener&&) = delete;
+      RecursiveEventListener& operator=(RecursiveEventListener&&) = delete;
+      ~RecursiveEventListener() override;
+
+      void start();
+      void stop();
+
+      void notify(filewatch::DirectoryEvent::Event event,
+                  std::string_view containing_dir,
+                  std::string_view dir_name,
+                  uint64_t mtime,
+                  uint64_t size,
+                  std::string_view old_name) override;
+
+    private:
+      // mutex must be held by the callers of these
+      void watch_subtree(const std::string& dirname, bool report_entries);
+      /// Remove dirname and the directories below it from watched, and
+      /// return them for stop_watching()
+      std::vector<std::string> take_subtree(const std::string& dirname);
+
+      /// mutex must not be held, as fs.stop_watching() waits for the watch
+      /// threads, which may be waiting for the mutex in notify()
+      void stop_watching(const std::vector<std::string>& dirnames);
+      /// stop_watching() once the watch thread is done dispatching, as the
+      /// directories may be watched by other watch threads
+      void stop_watching_after_dispatch(std::vector<std::string> dirnames);
+
+      FileSystem& fs;
+      std::string rootdir;
+      DirectoryEventListener& target;
+      std::recursive_mutex mutex;
+      bool stopped = false;
+      std::set<std::string> watched;
+      // stop_watching_after_dispatch() calls that have not run yet, which
+      // stop() waits for
+      std::size_t pending_unwatches = 0;
+      std::condition_variable_any unwatched;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* RECURSIVEEVENTLISTENER_H */
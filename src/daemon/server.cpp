@@ -26,20 +26,36 @@
 
 #include "server.h"
 
+#include "changetracker.h"
 #include "directoryeventlistener.h"
 #include "directoryview.h"
+#include "encodedevent.h"
+#include "eventjournal.h"
+#include "eventlog.h"
+#include "eventqueue.h"
 #include "filesystemfactory.h"
 #include "fileview.h"
 #include "filewatch.grpc.pb.h"
+#include "statistics.h"
 
+#include <fmt/format.h>
 #include <grpc++/security/server_credentials.h>
 #include <grpc++/server.h>
 #include <grpc++/server_builder.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 namespace fw::dm
 {
@@ -66,45 +82,893 @@ namespace fw::dm
         response->set_revision(0);
         return grpc::Status::OK;
       }
+
+      ::grpc::Status GetStatistics(::grpc::ServerContext* /*context*/,
+                                   const ::filewatch::Void* /*request*/,
+                                   ::filewatch::Statistics* response) override
+      {
+        for (const auto& c : statistics().snapshot())
+        {
+          auto* counter = response->add_counters();
+          counter->set_name(c.first);
+          counter->set_value(c.second);
+        }
+        return grpc::Status::OK;
+      }
     };
 
 
-    class MyDirEventListener : public fw::dm::DirectoryEventListener
+    constexpr std::size_t default_page_size = 1000;
+    constexpr std::size_t max_page_size = 10000;
+
+    std::size_t page_size_of(const filewatch::ListingRequest& request)
+    {
+      return request.page_size() == 0
+               ? default_page_size
+               : std::min<std::size_t>(request.page_size(), max_page_size);
+    }
+
+
+    std::string_view without_trailing_slash(std::string_view path)
+    {
+      return path.size() > 1 && path.ends_with('/')
+               ? path.substr(0, path.size() - 1)
+               : path;
+    }
+
+    /// Path of path relative to rootdir, "." if they are the same
+    std::string relative_path(std::string_view rootdir, std::string_view path)
+    {
+      rootdir = without_trailing_slash(rootdir);
+      path = without_trailing_slash(path);
+      if (path == rootdir)
+      {
+        return ".";
+      }
+      if (rootdir == "/" && path.starts_with('/'))
+      {
+        return std::string{path.substr(1)};
+      }
+      if (path.starts_with(rootdir) && path.size() > rootdir.size()
+          && path[rootdir.size()] == '/')
+      {
+        return std::string{path.substr(rootdir.size() + 1)};
+      }
+      return std::string{path};
+    }
+
+    /// Whether path is dirname, or below it if recursive
+    bool is_in(std::string_view path, std::string_view dirname, bool recursive)
+    {
+      path = without_trailing_slash(path);
+      dirname = without_trailing_slash(dirname);
+      if (path == dirname)
+      {
+        return true;
+      }
+      return recursive
+             && (dirname == "/"
+                 || (path.starts_with(dirname) && path.size() > dirname.size()
+                     && path[dirname.size()] == '/'));
+    }
+
+    /// Receives the events of an EventFeed
+    class FeedSubscriber
+    {
+    public:
+      virtual ~FeedSubscriber() = default;
+
+      virtual void deliver(const EncodedEventPtr& event) = 0;
+    };
+
+    /// The events of one subscription, i.e., a directory and whether it is
+    /// recursive, shared by all its subscribers.  Every event is delivered
+    /// with the sequence number of the watch event it comes from, the same
+    /// in every feed and in the EventLog, see EventDispatch.  It is encoded
+    /// once and is recorded in an EventJournal, so a subscriber whose
+    /// stream ended can resume where it left off.
+    class EventFeed : public DirectoryEventListener
     {
     public:
-      explicit MyDirEventListener(
-        ::grpc::ServerWriter<::filewatch::DirectoryEvent>* writer_) :
-        writer(writer_)
+      EventFeed(FileSystemFactory& factory, std::string dirname_,
+                bool recursive_, std::size_t journal_size) :
+        dirname(std::move(dirname_)),
+        recursive(recursive_), journal(journal_size, last_event_sequence())
+      {
+        dirview = factory.create_directory(dirname);
+        if (recursive)
+        {
+          dirview->register_recursive_event_listener(*this);
+        }
+        else
+        {
+          dirview->register_event_listener(*this);
+        }
+      }
+
+      EventFeed(const EventFeed&) = delete;
+      EventFeed& operator=(const EventFeed&) = delete;
+      EventFeed(EventFeed&&) = delete;
+      EventFeed& operator=(EventFeed&&) = delete;
+
+      ~EventFeed() override
+      {
+        if (recursive)
+        {
+          dirview->unregister_recursive_event_listener(*this);
+        }
+        else
+        {
+          dirview->unregister_event_listener(*this);
+        }
+      }
+
+      /// Deliver WATCHING_DIRECTORY, the events after resume_from unless it
+      /// is 0, and every new event from then on to subscriber.  If the
+      /// events after resume_from are not in the journal, or there are
+      /// more than max_replay of them, SNAPSHOT_REQUIRED is delivered
+      /// instead.
+      void subscribe(FeedSubscriber& subscriber, uint64_t resume_from,
+                     std::size_t max_replay)
       {
+        static auto& replayed = statistics().counter("journal.replayed");
+        static auto& snapshots =
+          statistics().counter("journal.snapshots_required");
+
+        // while the mutex is held, every event of the feed with a sequence
+        // number is in the journal already, see sequenced(), so the events
+        // after the journal are delivered to subscriber
+        std::lock_guard<std::mutex> sentry(mutex);
+        subscriber.deliver(
+          encode(filewatch::DirectoryEvent::WATCHING_DIRECTORY, dirname, ".",
+                 0, 0, {}, 0));
+        if (resume_from != 0)
+        {
+          auto missed = journal.since(resume_from);
+          if (missed && missed->size() <= max_replay)
+          {
+            for (const auto& event : *missed)
+            {
+              subscriber.deliver(event);
+            }
+            replayed += missed->size();
+          }
+          else
+          {
+            subscriber.deliver(
+              encode(filewatch::DirectoryEvent::SNAPSHOT_REQUIRED, dirname,
+                     ".", 0, 0, {}, journal.last_sequence()));
+            ++snapshots;
+          }
+        }
+        subscribers.push_back(&subscriber);
+      }
+
+      /// Stop delivering to subscriber.  As events are delivered with the
+      /// mutex held, no deliver() to subscriber is in progress on return,
+      /// and the subscriber may be destroyed.
+      void unsubscribe(FeedSubscriber& subscriber)
+      {
+        std::lock_guard<std::mutex> sentry(mutex);
+        subscribers.erase(
+          std::remove(std::begin(subscribers), std::end(subscribers),
+                      &subscriber),
+          std::end(subscribers));
       }
 
       void notify(filewatch::DirectoryEvent::Event event,
                   std::string_view containing_dir,
                   std::string_view dir_name,
-                  uint64_t mtime) override
+                  uint64_t mtime,
+                  uint64_t size,
+                  std::string_view old_name) override
+      {
+        if (event == filewatch::DirectoryEvent::WATCHING_DIRECTORY)
+        {
+          return;  // every subscriber is told in subscribe()
+        }
+
+        // the feed outlives the dispatch, as unwatching waits for the
+        // watch threads.  Delivered with the mutex held.
+        sequenced(mutex, [this, event, containing = std::string{containing_dir},
+                          name = std::string{dir_name}, mtime, size,
+                          old = std::string{old_name}](uint64_t sequence) {
+          auto encoded =
+            encode(event, containing, name, mtime, size, old, sequence);
+          journal.append(encoded);
+          for (auto* subscriber : subscribers)
+          {
+            subscriber->deliver(encoded);
+          }
+        });
+      }
+
+    private:
+      EncodedEventPtr encode(filewatch::DirectoryEvent::Event event,
+                             std::string_view containing_dir,
+                             std::string_view dir_name,
+                             uint64_t mtime,
+                             uint64_t size,
+                             std::string_view old_name,
+                             uint64_t sequence) const
+      {
+        auto relpath = relative_path(dirname, containing_dir);
+        return encode_shared(EventDescription{event, containing_dir,
+                                              dir_name, mtime, size,
+                                              old_name, relpath, sequence});
+      }
+
+      std::string dirname;
+      bool recursive;
+      std::unique_ptr<DirectoryView> dirview;
+      std::mutex mutex;
+      EventJournal journal;
+      std::vector<FeedSubscriber*> subscribers;
+    };
+
+    /// The EventFeeds of the current subscriptions, and of the ones whose
+    /// last subscriber left less than EventJournalOptions::retention ago.
+    /// Expired feeds are dropped by a thread of their own, so that their
+    /// watches do not outlive them until the next subscriber comes or goes.
+    class EventFeeds
+    {
+    public:
+      EventFeeds(FileSystemFactory& factory_,
+                 const EventJournalOptions& options_) :
+        factory(factory_),
+        options(options_), reaper([this]() { reap(); })
+      {
+      }
+
+      EventFeeds(const EventFeeds&) = delete;
+      EventFeeds& operator=(const EventFeeds&) = delete;
+      EventFeeds(EventFeeds&&) = delete;
+      EventFeeds& operator=(EventFeeds&&) = delete;
+
+      ~EventFeeds()
+      {
+        {
+          std::lock_guard<std::mutex> sentry(mutex);
+          stopping = true;
+        }
+        feed_idle.notify_one();
+        reaper.join();
+      }
+
+      std::shared_ptr<EventFeed>
+      subscribe(const filewatch::EventSubscription& subscription,
+                FeedSubscriber& subscriber, std::size_t max_replay)
+      {
+        // "/dir" and "/dir/" are the same subscription
+        Key key{std::string{without_trailing_slash(subscription.name())},
+                subscription.recursive()};
+        auto feed = find_active(key);
+        if (!feed)
+        {
+          // without holding the mutex, as a recursive subscription watches
+          // the whole subtree
+          auto created = std::make_shared<EventFeed>(
+            factory, key.first, key.second, options.max_size);
+          std::lock_guard<std::mutex> sentry(mutex);
+          auto& entry = feeds[key];
+          if (!entry.feed)
+          {
+            entry.feed = std::move(created);
+          }
+          ++entry.subscribers;
+          feed = entry.feed;
+        }
+
+        feed->subscribe(subscriber, subscription.resume_from(), max_replay);
+        return feed;
+      }
+
+      void unsubscribe(const std::shared_ptr<EventFeed>& feed,
+                       FeedSubscriber& subscriber)
+      {
+        feed->unsubscribe(subscriber);
+
+        // destroyed after the mutex is released, as unwatching waits for
+        // the watch threads
+        std::vector<std::shared_ptr<EventFeed>> expired;
+        std::lock_guard<std::mutex> sentry(mutex);
+        auto now = std::chrono::steady_clock::now();
+        for (auto& f : feeds)
+        {
+          if (f.second.feed == feed && --f.second.subscribers == 0)
+          {
+            f.second.idle_since = now;
+            feed_idle.notify_one();
+          }
+        }
+        drop_expired(now, expired);
+      }
+
+    private:
+      using Key = std::pair<std::string, bool>;
+
+      struct Entry
+      {
+        std::shared_ptr<EventFeed> feed;
+        std::size_t subscribers = 0;
+        std::chrono::steady_clock::time_point idle_since;
+      };
+
+      std::shared_ptr<EventFeed> find_active(const Key& key)
+      {
+        std::vector<std::shared_ptr<EventFeed>> expired;
+        std::lock_guard<std::mutex> sentry(mutex);
+        drop_expired(std::chrono::steady_clock::now(), expired);
+        auto iter = feeds.find(key);
+        if (iter == std::end(feeds))
+        {
+          return nullptr;
+        }
+        ++iter->second.subscribers;
+        return iter->second.feed;
+      }
+
+      // mutex must be held
+      void drop_expired(std::chrono::steady_clock::time_point now,
+                        std::vector<std::shared_ptr<EventFeed>>& expired)
+      {
+        for (auto iter = std::begin(feeds); iter != std::end(feeds);)
+        {
+          if (iter->second.subscribers == 0
+              && now - iter->second.idle_since >= options.retention)
+          {
+            expired.push_back(std::move(iter->second.feed));
+            iter = feeds.erase(iter);
+          }
+          else
+          {
+            ++iter;
+          }
+        }
+      }
+
+      // mutex must be held
+      std::optional<std::chrono::steady_clock::time_point> next_expiry() const
+      {
+        std::optional<std::chrono::steady_clock::time_point> next;
+        for (const auto& f : feeds)
+        {
+          if (f.second.subscribers == 0
+              && (!next || f.second.idle_since + options.retention < *next))
+          {
+            next = f.second.idle_since + options.retention;
+          }
+        }
+        return next;
+      }
+
+      /// Drop the feeds as they expire, until the destructor is called
+      void reap()
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+          std::vector<std::shared_ptr<EventFeed>> expired;
+          drop_expired(std::chrono::steady_clock::now(), expired);
+          if (!expired.empty())
+          {
+            lock.unlock();
+            expired.clear();  // unwatching waits for the watch threads
+            lock.lock();
+            continue;
+          }
+
+          auto next = next_expiry();
+          if (next)
+          {
+            feed_idle.wait_until(lock, *next);
+          }
+          else
+          {
+            feed_idle.wait(lock);
+          }
+        }
+      }
+
+      FileSystemFactory& factory;
+      EventJournalOptions options;
+      std::mutex mutex;
+      std::map<Key, Entry> feeds;
+      std::condition_variable feed_idle;
+      bool stopping = false;
+      std::thread reaper;  // last, as it uses the members above
+    };
+
+    /// Tracks the changes of a directory for GetChangesSince, from the
+    /// events of its EventFeed, so that a directory with subscribers is not
+    /// watched twice and the generations are the sequence numbers of the
+    /// events
+    class TrackedDirectory : public FeedSubscriber
+    {
+    public:
+      /// Throws std::runtime_error if dirname cannot be watched
+      TrackedDirectory(EventFeeds& feeds_, const std::string& dirname,
+                       std::size_t max_changes) :
+        feeds(feeds_), tracker(max_changes)
+      {
+        filewatch::EventSubscription subscription;
+        subscription.set_name(dirname);
+        feed = feeds.subscribe(subscription, *this, 0);
+      }
+
+      TrackedDirectory(const TrackedDirectory&) = delete;
+      TrackedDirectory& operator=(const TrackedDirectory&) = delete;
+      TrackedDirectory(TrackedDirectory&&) = delete;
+      TrackedDirectory& operator=(TrackedDirectory&&) = delete;
+
+      ~TrackedDirectory() override { feeds.unsubscribe(feed, *this); }
+
+      void deliver(const EncodedEventPtr& event) override
+      {
+        if (event->event() == filewatch::DirectoryEvent::WATCHING_DIRECTORY)
+        {
+          // delivered as the feed is subscribed to, so the events of the
+          // feed after this sequence are the ones delivered from now on.
+          // A sequence of its own, as generation 0 means not tracked.
+          tracker.restart(next_event_sequence());
+          return;
+        }
+        if (event->event() == filewatch::DirectoryEvent::RESYNC_REQUIRED)
+        {
+          tracker.restart(event->sequence());  // the changes before are lost
+          return;
+        }
+        tracker.add(event->event(), event->entry_name(), event->mtime(),
+                    event->size(), event->old_name(), event->sequence());
+      }
+
+      const ChangeTracker& changes() const { return tracker; }
+
+    private:
+      EventFeeds& feeds;
+      ChangeTracker tracker;
+      std::shared_ptr<EventFeed> feed;
+    };
+
+    /// The directories asked for changes less than
+    /// EventJournalOptions::retention ago.  Expired directories are dropped
+    /// as directories are tracked.  A directory is only tracked once asked
+    /// for its changes, so listing a directory costs no watch.
+    class TrackedDirectories
+    {
+    public:
+      TrackedDirectories(EventFeeds& feeds_,
+                         const EventJournalOptions& options_) :
+        feeds(feeds_),
+        options(options_)
+      {
+      }
+
+      /// Start tracking the changes of dirname, unless they are tracked
+      /// already.  Nullptr if dirname cannot be watched.
+      std::shared_ptr<TrackedDirectory> track(std::string_view name)
+      {
+        static auto& tracked = statistics().counter("changes.tracked");
+
+        const std::string dirname{without_trailing_slash(name)};
+        // destroyed after the mutex is released, as unwatching waits for
+        // the watch threads
+        std::vector<std::shared_ptr<TrackedDirectory>> expired;
+        std::shared_ptr<TrackedDirectory> created;
+        {
+          std::lock_guard<std::mutex> sentry(mutex);
+          auto now = std::chrono::steady_clock::now();
+          drop_expired(now, expired);
+          auto iter = directories.find(dirname);
+          if (iter != std::end(directories))
+          {
+            iter->second.last_used = now;
+            return iter->second.directory;
+          }
+        }
+
+        try
+        {
+          created = std::make_shared<TrackedDirectory>(feeds, dirname,
+                                                       options.max_size);
+        }
+        catch (const std::exception& e)
+        {
+          spdlog::debug("Not tracking the changes of {}: {}", dirname,
+                        e.what());
+          return nullptr;
+        }
+
+        std::lock_guard<std::mutex> sentry(mutex);
+        auto& entry = directories[dirname];
+        if (!entry.directory)
+        {
+          entry.directory = std::move(created);
+          ++tracked;
+        }
+        entry.last_used = std::chrono::steady_clock::now();
+        return entry.directory;
+      }
+
+      /// The directory tracking the changes of name, nullptr unless they
+      /// are tracked already
+      std::shared_ptr<TrackedDirectory> find(std::string_view name)
+      {
+        std::lock_guard<std::mutex> sentry(mutex);
+        auto iter = directories.find(without_trailing_slash(name));
+        if (iter == std::end(directories))
+        {
+          return nullptr;
+        }
+        iter->second.last_used = std::chrono::steady_clock::now();
+        return iter->second.directory;
+      }
+
+    private:
+      struct Entry
+      {
+        std::shared_ptr<TrackedDirectory> directory;
+        std::chrono::steady_clock::time_point last_used;
+      };
+
+      // mutex must be held
+      void drop_expired(std::chrono::steady_clock::time_point now,
+                        std::vector<std::shared_ptr<TrackedDirectory>>& expired)
+      {
+        for (auto iter = std::begin(directories);
+             iter != std::end(directories);)
+        {
+          if (now - iter->second.last_used >= options.retention)
+          {
+            expired.push_back(std::move(iter->second.directory));
+            iter = directories.erase(iter);
+          }
+          else
+          {
+            ++iter;
+          }
+        }
+      }
+
+      EventFeeds& feeds;
+      EventJournalOptions options;
+      std::mutex mutex;
+      std::map<std::string, Entry, std::less<>> directories;
+    };
+
+    /// Appends the events of the whole tree to an EventLog, from the watch
+    /// threads.  Stops at the first event that cannot be logged, e.g., as
+    /// the disk is full, since the log would be missing events after it.
+    class EventLogWriter : public FeedSubscriber
+    {
+    public:
+      EventLogWriter(EventFeeds& feeds_, const EventLogOptions& options) :
+        feeds(feeds_), log(options, last_event_sequence())
+      {
+        advance_event_sequence(log.last_sequence());
+        if (log.last_sequence() != log.complete_after())
+        {
+          // the daemon was restarted, and what happened while it was not
+          // running is unknown
+          log.append(*encode_shared(EventDescription{
+                       filewatch::DirectoryEvent::SNAPSHOT_REQUIRED, "/",
+                       ".", 0, 0, {}, ".", next_event_sequence()}),
+                     now_ms());
+        }
+
+        filewatch::EventSubscription subscription;
+        subscription.set_name("/");
+        subscription.set_recursive(true);
+        feed = feeds.subscribe(subscription, *this, 0);
+      }
+
+      EventLogWriter(const EventLogWriter&) = delete;
+      EventLogWriter& operator=(const EventLogWriter&) = delete;
+      EventLogWriter(EventLogWriter&&) = delete;
+      EventLogWriter& operator=(EventLogWriter&&) = delete;
+
+      ~EventLogWriter() override { feeds.unsubscribe(feed, *this); }
+
+      void deliver(const EncodedEventPtr& event) override
       {
-        filewatch::DirectoryEvent direvt;
-        direvt.set_event(event);
-        direvt.set_name(std::string(containing_dir));
-        direvt.mutable_modification_time()->set_epoch(mtime);
-        direvt.mutable_dirname()->set_name(std::string(dir_name));
-        direvt.mutable_dirname()->mutable_modification_time()->set_epoch(mtime);
-        writer->Write(direvt);
+        if (event->sequence() == 0 || failed)
+        {
+          return;  // WATCHING_DIRECTORY, or the log is disabled
+        }
+
+        try
+        {
+          log.append(*event, now_ms());
+        }
+        catch (const std::exception& e)
+        {
+          failed = true;
+          spdlog::error("Disabling the event log, as event {} could not be "
+                        "logged: {}",
+                        event->sequence(), e.what());
+        }
       }
 
+      const EventLog& events() const { return log; }
+      /// true if an event could not be appended to the log
+      bool disabled() const { return failed; }
+
     private:
-      ::grpc::ServerWriter<::filewatch::DirectoryEvent>* writer;
+      static uint64_t now_ms()
+      {
+        return static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+      }
+
+      EventFeeds& feeds;
+      EventLog log;
+      std::atomic<bool> failed{false};
+      std::shared_ptr<EventFeed> feed;
     };
 
-    class DirService : public filewatch::Directory::Service
+    /// Streams directory events to one ListenForEvents subscriber.
+    ///
+    /// Events are queued by deliver() (called from the watch thread) and
+    /// written one at a time by the gRPC callback machinery, so an idle
+    /// subscription holds no thread and costs no CPU.  The queue is bounded,
+    /// so a slow subscriber can never hold up the watch thread; see
+    /// OverflowPolicy.  A recursive subscription receives the events of all
+    /// subdirectories as well.  The events come from the EventFeed of the
+    /// subscription, encoded once for all its subscribers.  The reactor
+    /// deletes itself when gRPC reports the RPC as done.
+    class DirEventStreamer :
+      public ::grpc::ServerWriteReactor<::grpc::ByteBuffer>,
+      public FeedSubscriber
     {
     public:
-      explicit DirService(FileSystemFactory& factory_) : factory(factory_) {}
+      DirEventStreamer(EventFeeds& feeds_,
+                       const filewatch::EventSubscription& subscription,
+                       std::string_view peer,
+                       const EventQueueOptions& queue_options) :
+        feeds(feeds_),
+        dirname(subscription.name()),
+        recursive(subscription.recursive()),
+        pending(queue_options, std::string{without_trailing_slash(dirname)}),
+        subscriber(fmt::format("subscriber[{} {} {}{}]", next_stream_id(),
+                               peer, dirname,
+                               recursive ? " recursive" : "")),
+        queue_depth(statistics().counter(subscriber + ".queue_depth")),
+        dropped_events(statistics().counter(subscriber + ".dropped")),
+        coalesced_events(statistics().counter(subscriber + ".coalesced"))
+      {
+        try
+        {
+          feed = feeds.subscribe(subscription, *this, queue_options.max_size);
+        }
+        catch (const std::exception& e)
+        {
+          spdlog::error("ListenForEvents({}) failed: {}", dirname, e.what());
+          finish(grpc::Status(grpc::INTERNAL, e.what()));
+        }
+      }
+
+      void deliver(const EncodedEventPtr& event) override
+      {
+        Action action;
+        {
+          std::lock_guard<std::mutex> sentry(queue_mutex);
+          action = push_locked(event);
+        }
+        run(action);
+      }
+
+      void OnWriteDone(bool ok) override
+      {
+        Action action;
+        {
+          std::lock_guard<std::mutex> sentry(queue_mutex);
+          action = write_done_locked(ok);
+        }
+        run(action);
+      }
+
+      void OnCancel() override { finish(grpc::Status::OK); }
+
+      void OnDone() override
+      {
+        // waits for a deliver() in progress on the watch thread, so that
+        // none can touch the reactor once it is deleted below
+        if (feed)
+        {
+          feeds.unsubscribe(feed, *this);
+        }
+        statistics().remove(subscriber + ".queue_depth");
+        statistics().remove(subscriber + ".dropped");
+        statistics().remove(subscriber + ".coalesced");
+        delete this;  // NOLINT - reactor owns itself
+      }
+
+    private:
+      /// What to do once queue_mutex is released, as gRPC may run the
+      /// reactions to StartWrite and Finish inline, which lock it again
+      struct Action
+      {
+        const grpc::ByteBuffer* write = nullptr;
+        std::optional<grpc::Status> finish;
+      };
+
+      /// Tells streams on the same connection apart, so that each has its
+      /// own statistics
+      static uint64_t next_stream_id()
+      {
+        static std::atomic<uint64_t> id{0};
+        return ++id;
+      }
+
+      void run(const Action& action)
+      {
+        if (action.write != nullptr)
+        {
+          StartWrite(action.write);
+        }
+        else if (action.finish)
+        {
+          Finish(*action.finish);
+        }
+      }
+
+      // queue_mutex must be held by the callers of these
+      Action push_locked(const EncodedEventPtr& event)
+      {
+        Action action;
+        if (finished || finishing || closing)
+        {
+          return action;
+        }
+
+        switch (pending.push(event))
+        {
+        case EventQueue::PushResult::queued:
+          break;
+        case EventQueue::PushResult::dropped_oldest:
+          ++dropped_events;
+          break;
+        case EventQueue::PushResult::coalesced:
+          ++coalesced_events;
+          break;
+        case EventQueue::PushResult::resync_required:
+          spdlog::warn("Event queue of {} overflowed, requiring resync",
+                       subscriber);
+          closing = true;
+          break;
+        }
+        queue_depth = pending.size();
+
+        if (!pending.writing())
+        {
+          action.write = &pending.start_write().bytes();
+        }
+        return action;
+      }
+
+      Action write_done_locked(bool ok)
+      {
+        pending.pop();
+        queue_depth = pending.size();
+        if (!ok)
+        {
+          spdlog::debug("ListenForEvents: write failed, closing stream");
+          return finish_locked(grpc::Status::OK);
+        }
+        if (finishing)
+        {
+          return finish_locked(*finishing);
+        }
+        if (finished)
+        {
+          return Action{};
+        }
+
+        if (!pending.empty())
+        {
+          return Action{&pending.start_write().bytes(), std::nullopt};
+        }
+        if (closing)
+        {
+          return finish_locked(grpc::Status::OK);
+        }
+        return Action{};
+      }
+
+      Action finish_locked(const grpc::Status& status)
+      {
+        Action action;
+        if (finished)
+        {
+          return action;
+        }
+        if (pending.writing())
+        {
+          // the write may not be started yet, and must not follow Finish;
+          // OnWriteDone finishes once it is done
+          if (!finishing)
+          {
+            finishing = status;
+          }
+          return action;
+        }
+        finished = true;
+        action.finish = status;
+        return action;
+      }
+
+      void finish(const grpc::Status& status)
+      {
+        Action action;
+        {
+          std::lock_guard<std::mutex> sentry(queue_mutex);
+          action = finish_locked(status);
+        }
+        run(action);
+      }
+
+      EventFeeds& feeds;
+      std::string dirname;
+      bool recursive;
+      std::shared_ptr<EventFeed> feed;
+      std::mutex queue_mutex;
+      EventQueue pending;
+      bool closing = false;  // a RESYNC_REQUIRED event is queued
+      std::optional<grpc::Status> finishing;  // once the write is done
+      bool finished = false;
+      std::string subscriber;
+      Statistics::Counter& queue_depth;
+      Statistics::Counter& dropped_events;
+      Statistics::Counter& coalesced_events;
+    };
+
+    /// Finishes a ListenForEvents call whose request cannot be parsed
+    class InvalidSubscription :
+      public ::grpc::ServerWriteReactor<::grpc::ByteBuffer>
+    {
+    public:
+      InvalidSubscription()
+      {
+        Finish(grpc::Status(grpc::INVALID_ARGUMENT,
+                            "Unable to parse EventSubscription"));
+      }
+
+      void OnDone() override
+      {
+        delete this;  // NOLINT - reactor owns itself
+      }
+    };
+
+    // ListenForEvents is a raw method, so the events can be written as the
+    // bytes shared by all subscribers
+    using DirServiceBase =
+      filewatch::Directory::WithRawCallbackMethod_ListenForEvents<
+        filewatch::Directory::Service>;
+
+    class DirService : public DirServiceBase
+    {
+    public:
+      DirService(FileSystemFactory& factory_,
+                 const EventQueueOptions& queue_options_,
+                 const EventJournalOptions& journal_options,
+                 const EventLogOptions& log_options) :
+        factory(factory_),
+        queue_options(queue_options_), feeds(factory_, journal_options),
+        tracked(feeds, journal_options)
+      {
+        if (!log_options.directory.empty())
+        {
+          log_writer = std::make_unique<EventLogWriter>(feeds, log_options);
+        }
+      }
 
       ::grpc::Status ListFiles(::grpc::ServerContext* /*context*/,
                                const ::filewatch::Directoryname* request,
                                ::filewatch::FileList* response) override
       {
+        set_generation(request->name(), *response);
         auto dirview = factory.create_directory(request->name());
         return dirview->fill_file_list(*response);
       }
@@ -113,28 +977,283 @@ namespace fw::dm
                                      const ::filewatch::Directoryname* request,
                                      ::filewatch::DirList* response) override
       {
+        set_generation(request->name(), *response);
         auto dirview = factory.create_directory(request->name());
         return dirview->fill_dir_list(*response);
       }
 
-      ::grpc::Status ListenForEvents(
+      ::grpc::Status ListEntries(::grpc::ServerContext* /*context*/,
+                                 const ::filewatch::Directoryname* request,
+                                 ::filewatch::EntryList* response) override
+      {
+        set_generation(request->name(), *response);
+        auto dirview = factory.create_directory(request->name());
+        return dirview->fill_entries(*response);
+      }
+
+      ::grpc::Status ListFilesPaged(::grpc::ServerContext* /*context*/,
+                                    const ::filewatch::ListingRequest* request,
+                                    ::filewatch::FileList* response) override
+      {
+        if (request->page_token().empty())
+        {
+          set_generation(request->name(), *response);
+        }
+        auto dirview = factory.create_directory(request->name());
+        return dirview->fill_file_page(*response, request->page_token(),
+                                       page_size_of(*request));
+      }
+
+      ::grpc::Status
+      ListDirectoriesPaged(::grpc::ServerContext* /*context*/,
+                           const ::filewatch::ListingRequest* request,
+                           ::filewatch::DirList* response) override
+      {
+        if (request->page_token().empty())
+        {
+          set_generation(request->name(), *response);
+        }
+        auto dirview = factory.create_directory(request->name());
+        return dirview->fill_dir_page(*response, request->page_token(),
+                                      page_size_of(*request));
+      }
+
+      ::grpc::Status
+      StreamFiles(::grpc::ServerContext* context,
+                  const ::filewatch::ListingRequest* request,
+                  ::grpc::ServerWriter<::filewatch::FileList>* writer) override
+      {
+        return stream_pages(
+          *context, *request, *writer,
+          [](const DirectoryView& dirview, filewatch::FileList& page,
+             std::string_view page_token, std::size_t page_size) {
+            return dirview.fill_file_page(page, page_token, page_size);
+          });
+      }
+
+      ::grpc::Status StreamDirectories(
         ::grpc::ServerContext* context,
-        const ::filewatch::Directoryname* request,
+        const ::filewatch::ListingRequest* request,
+        ::grpc::ServerWriter<::filewatch::DirList>* writer) override
+      {
+        return stream_pages(
+          *context, *request, *writer,
+          [](const DirectoryView& dirview, filewatch::DirList& page,
+             std::string_view page_token, std::size_t page_size) {
+            return dirview.fill_dir_page(page, page_token, page_size);
+          });
+      }
+
+      ::grpc::Status StreamEntries(
+        ::grpc::ServerContext* context,
+        const ::filewatch::ListingRequest* request,
+        ::grpc::ServerWriter<::filewatch::EntryList>* writer) override
+      {
+        return stream_pages(
+          *context, *request, *writer,
+          [](const DirectoryView& dirview, filewatch::EntryList& page,
+             std::string_view page_token, std::size_t page_size) {
+            return dirview.fill_entries_page(page, page_token, page_size);
+          });
+      }
+
+      ::grpc::Status
+      GetChangesSince(::grpc::ServerContext* /*context*/,
+                      const ::filewatch::ChangesRequest* request,
+                      ::filewatch::Changes* response) override
+      {
+        static auto& snapshots =
+          statistics().counter("changes.snapshots_required");
+
+        response->mutable_name()->set_name(request->name());
+        auto directory = tracked.track(request->name());
+        if (!directory)
+        {
+          response->set_snapshot_required(true);
+          ++snapshots;
+          return grpc::Status::OK;
+        }
+
+        // the generation first, as changes may follow while reading them
+        auto generation = directory->changes().generation();
+        auto changes = directory->changes().since(request->generation());
+        if (!changes)
+        {
+          response->set_generation(generation);
+          response->set_snapshot_required(true);
+          ++snapshots;
+          return grpc::Status::OK;
+        }
+
+        for (const auto& change : *changes)
+        {
+          if (!change.exists)
+          {
+            response->add_removed(change.name);
+          }
+          else if (change.is_dir)
+          {
+            auto* dn = response->add_directories();
+            dn->set_name(change.name);
+            dn->mutable_modification_time()->set_epoch(change.mtime);
+          }
+          else
+          {
+            auto* fn = response->add_files();
+            fn->mutable_dirname()->set_name(request->name());
+            fn->set_name(change.name);
+            fn->mutable_modification_time()->set_epoch(change.mtime);
+            fn->set_size(change.size);
+          }
+          generation = std::max(generation, change.generation);
+        }
+        response->set_generation(generation);
+        return grpc::Status::OK;
+      }
+
+      ::grpc::Status ReplayEvents(
+        ::grpc::ServerContext* context,
+        const ::filewatch::ReplayRequest* request,
         ::grpc::ServerWriter<::filewatch::DirectoryEvent>* writer) override
       {
-        auto dirview = factory.create_directory(request->name());
-        MyDirEventListener listener(writer);
-        dirview->register_event_listener(listener);
-        while (!context->IsCancelled())
+        static auto& replayed = statistics().counter("eventlog.replayed");
+
+        if (!log_writer)
         {
-          std::this_thread::yield();
+          return grpc::Status(grpc::FAILED_PRECONDITION,
+                              "The event log is disabled, see --event-log");
+        }
+        if (log_writer->disabled())
+        {
+          return grpc::Status(grpc::UNAVAILABLE,
+                              "The event log was disabled by a write error");
+        }
+
+        const auto& log = log_writer->events();
+        auto position = request->after_sequence() != 0
+                          ? request->after_sequence()
+                          : log.sequence_before(request->since().epoch());
+        if (position < log.complete_after())
+        {
+          filewatch::DirectoryEvent snapshot;
+          snapshot.set_event(filewatch::DirectoryEvent::SNAPSHOT_REQUIRED);
+          snapshot.set_name(request->name());
+          snapshot.set_relative_path(".");
+          snapshot.set_sequence(log.complete_after());
+          if (!writer->Write(snapshot))
+          {
+            return grpc::Status::CANCELLED;
+          }
+        }
+
+        constexpr std::size_t batch_size = 1024;
+        for (auto records = log.read_after(position, batch_size);
+             !records.empty(); records = log.read_after(position, batch_size))
+        {
+          for (const auto& record : records)
+          {
+            position = record.sequence;
+            filewatch::DirectoryEvent direvt;
+            if (!direvt.ParseFromString(record.event))
+            {
+              continue;
+            }
+
+            if (direvt.event() == filewatch::DirectoryEvent::SNAPSHOT_REQUIRED)
+            {
+              direvt.set_name(request->name());  // a restart of the daemon
+            }
+            else if (!is_in(direvt.name(), request->name(),
+                            request->recursive()))
+            {
+              continue;
+            }
+            direvt.set_relative_path(
+              relative_path(request->name(), direvt.name()));
+
+            if (context->IsCancelled() || !writer->Write(direvt))
+            {
+              return grpc::Status::CANCELLED;
+            }
+            ++replayed;
+          }
         }
-        dirview->unregister_event_listener(listener);
         return grpc::Status::OK;
       }
 
+      using DirServiceBase::ListenForEvents;
+
+      ::grpc::ServerWriteReactor<::grpc::ByteBuffer>*
+      ListenForEvents(::grpc::CallbackServerContext* context,
+                      const ::grpc::ByteBuffer* request) override
+      {
+        // Deserialize takes ownership of the slices it reads
+        ::grpc::ByteBuffer request_bytes(*request);
+        filewatch::EventSubscription subscription;
+        auto status =
+          grpc::SerializationTraits<filewatch::EventSubscription>::Deserialize(
+            &request_bytes, &subscription);
+        if (!status.ok())
+        {
+          spdlog::warn("ListenForEvents: {}", status.error_message());
+          return new InvalidSubscription;
+        }
+        return new DirEventStreamer(feeds, subscription, context->peer(),
+                                    queue_options);
+      }
+
     private:
+      /// The generation of dirname for GetChangesSince, if it is tracked
+      template<typename ListT>
+      void set_generation(const std::string& dirname, ListT& response)
+      {
+        auto directory = tracked.find(dirname);
+        if (directory)
+        {
+          response.set_generation(directory->changes().generation());
+        }
+      }
+
+      /// Writes the pages of a listing as they are read, so that neither
+      /// the daemon nor the client holds all of it
+      template<typename ListT, typename FillPageT>
+      ::grpc::Status stream_pages(::grpc::ServerContext& context,
+                                  const filewatch::ListingRequest& request,
+                                  ::grpc::ServerWriter<ListT>& writer,
+                                  FillPageT fill_page)
+      {
+        static auto& pages = statistics().counter("listing.streamed_pages");
+
+        auto dirview = factory.create_directory(request.name());
+        auto page_token = request.page_token();
+        do
+        {
+          ListT page;
+          if (page_token.empty())
+          {
+            set_generation(request.name(), page);
+          }
+          auto status =
+            fill_page(*dirview, page, page_token, page_size_of(request));
+          if (!status.ok())
+          {
+            return status;
+          }
+          page_token = page.next_page_token();
+          if (context.IsCancelled() || !writer.Write(page))
+          {
+            return grpc::Status::CANCELLED;
+          }
+          ++pages;
+        } while (!page_token.empty());
+        return grpc::Status::OK;
+      }
+
       FileSystemFactory& factory;
+      EventQueueOptions queue_options;
+      EventFeeds feeds;
+      TrackedDirectories tracked;
+      std::unique_ptr<EventLogWriter> log_writer;
     };
 
     class FileService : public filewatch::File::Service
@@ -161,8 +1280,13 @@ namespace fw::dm
   class Services
   {
   public:
-    explicit Services(std::unique_ptr<FileSystemFactory> factory_) :
-      factory(std::move(factory_)), Directory(*factory), File(*factory)
+    Services(std::unique_ptr<FileSystemFactory> factory_,
+             const EventQueueOptions& queue_options,
+             const EventJournalOptions& journal_options,
+             const EventLogOptions& log_options) :
+      factory(std::move(factory_)),
+      Directory(*factory, queue_options, journal_options, log_options),
+      File(*factory)
     {
     }
 
@@ -207,8 +1331,12 @@ namespace fw::dm
   }
 
 
-  Server::Server(std::unique_ptr<FileSystemFactory> factory) :
-    services(std::make_unique<Services>(std::move(factory)))
+  Server::Server(std::unique_ptr<FileSystemFactory> factory,
+                 const EventQueueOptions& queue_options,
+                 const EventJournalOptions& journal_options,
+                 const EventLogOptions& log_options) :
+    services(std::make_unique<Services>(std::move(factory), queue_options,
+                                        journal_options, log_options))
   {
     g_server = this;
     std::signal(SIGTERM, signal_handler);
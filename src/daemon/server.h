@@ -40,11 +40,17 @@ namespace fw
   {
     class FileSystemFactory;
     class Services;
+    struct EventJournalOptions;
+    struct EventLogOptions;
+    struct EventQueueOptions;
 
     class Server
     {
     public:
-      explicit Server(std::unique_ptr<FileSystemFactory> factory);
+      Server(std::unique_ptr<FileSystemFactory> factory,
+             const EventQueueOptions& queue_options,
+             const EventJournalOptions& journal_options,
+             const EventLogOptions& log_options);
       ~Server();
 
       int run();
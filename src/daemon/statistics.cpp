@@ -0,0 +1,43 @@
+#include "statistics.h"
+
+fw::dm::Statistics::Counter&
+fw::dm::Statistics::counter(std::string_view name)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = counters.find(name);
+  if (iter == std::end(counters))
+  {
+    iter = counters
+             .insert(std::make_pair(std::string{name},
+                                    std::make_unique<Counter>(0)))
+             .first;
+  }
+  return *iter->second;
+}
+
+void fw::dm::Statistics::remove(std::string_view name)
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  auto iter = counters.find(name);
+  if (iter != std::end(counters))
+  {
+    counters.erase(iter);
+  }
+}
+
+std::map<std::string, uint64_t> fw::dm::Statistics::snapshot() const
+{
+  std::lock_guard<std::mutex> sentry(mutex);
+  std::map<std::string, uint64_t> values;
+  for (const auto& c : counters)
+  {
+    values[c.first] = c.second->load();
+  }
+  return values;
+}
+
+fw::dm::Statistics& fw::dm::statistics()
+{
+  static Statistics stats;
+  return stats;
+}
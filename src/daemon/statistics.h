@@ -0,0 +1,41 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace fw
+{
+  namespace dm
+  {
+    /// Named counters describing the daemon's current state, served by the
+    /// FileWatch.GetStatistics rpc.
+    class Statistics
+    {
+    public:
+      using Counter = std::atomic<uint64_t>;
+
+      /// Return the counter with the given name, creating it (as 0) if it
+      /// does not exist.  The reference stays valid until remove(name).
+      Counter& counter(std::string_view name);
+      void remove(std::string_view name);
+
+      std::map<std::string, uint64_t> snapshot() const;
+
+    private:
+      mutable std::mutex mutex;
+      std::map<std::string, std::unique_ptr<Counter>, std::less<>> counters;
+    };
+
+    /// The daemon wide statistics
+    Statistics& statistics();
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* STATISTICS_H */
@@ -0,0 +1,373 @@
+#include "treeindex.h"
+
+#include "cachingfilesystem.h"
+#include "filesystem.h"
+#include "recursiveeventlistener.h"
+#include "statistics.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+
+fw::dm::dtls::ScanQueues::ScanQueues(std::size_t threads)
+{
+  for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i)
+  {
+    queues.push_back(std::make_unique<Queue>());
+  }
+}
+
+void fw::dm::dtls::ScanQueues::push(std::size_t thread, std::string dirname)
+{
+  ++pending;
+  ++queued;
+  {
+    auto& queue = *queues[thread % queues.size()];
+    std::lock_guard<std::mutex> sentry(queue.mutex);
+    queue.dirnames.push_back(std::move(dirname));
+  }
+  wake(false);
+}
+
+std::optional<std::string> fw::dm::dtls::ScanQueues::pop(std::size_t thread)
+{
+  thread %= queues.size();
+  {
+    auto& own = *queues[thread];
+    std::lock_guard<std::mutex> sentry(own.mutex);
+    if (!own.dirnames.empty())
+    {
+      auto dirname = std::move(own.dirnames.back());
+      own.dirnames.pop_back();
+      --queued;
+      return dirname;
+    }
+  }
+
+  for (std::size_t i = 1; i < queues.size(); ++i)
+  {
+    auto& other = *queues[(thread + i) % queues.size()];
+    std::lock_guard<std::mutex> sentry(other.mutex);
+    if (!other.dirnames.empty())
+    {
+      auto dirname = std::move(other.dirnames.front());
+      other.dirnames.pop_front();
+      --queued;
+      return dirname;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> fw::dm::dtls::ScanQueues::wait(std::size_t thread)
+{
+  while (!cancelled)
+  {
+    auto dirname = pop(thread);
+    if (dirname)
+    {
+      return dirname;
+    }
+
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    changed.wait(lock, [this] {
+      return queued.load() > 0 || pending.load() == 0 || cancelled.load();
+    });
+    if (pending.load() == 0)
+    {
+      return std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+void fw::dm::dtls::ScanQueues::done()
+{
+  if (--pending == 0)
+  {
+    wake(true);
+  }
+}
+
+void fw::dm::dtls::ScanQueues::cancel()
+{
+  cancelled = true;
+  wake(true);
+}
+
+void fw::dm::dtls::ScanQueues::wake(bool all)
+{
+  // a thread in wait() either sees the change, or is waiting for the
+  // notification once the mutex is released
+  {
+    std::lock_guard<std::mutex> sentry(wait_mutex);
+  }
+  if (all)
+  {
+    changed.notify_all();
+  }
+  else
+  {
+    changed.notify_one();
+  }
+}
+
+fw::dm::TreeIndex::TreeIndex(FileSystem& fs_, std::string rootdir_,
+                             const TreeIndexOptions& options_) :
+  fs(fs_),
+  cache(dynamic_cast<ListingCache*>(&fs_)), rootdir(std::move(rootdir_)),
+  options(options_)
+{
+  options.scan_threads = std::max<std::size_t>(options.scan_threads, 1);
+}
+
+fw::dm::TreeIndex::~TreeIndex()
+{
+  {
+    std::lock_guard<std::mutex> sentry(stop_mutex);
+    stopped = true;
+  }
+  stop_condition.notify_all();
+  wait();
+  save();
+  if (recursive)
+  {
+    recursive->stop();
+  }
+  unpin();
+}
+
+void fw::dm::TreeIndex::start()
+{
+  scan_thread = std::thread([this] { run(); });
+}
+
+void fw::dm::TreeIndex::wait()
+{
+  if (scan_thread.joinable())
+  {
+    scan_thread.join();
+  }
+}
+
+void fw::dm::TreeIndex::notify(filewatch::DirectoryEvent::Event /*event*/,
+                               std::string_view /*containing_dir*/,
+                               std::string_view /*dir_name*/,
+                               uint64_t /*mtime*/,
+                               uint64_t /*size*/,
+                               std::string_view /*old_name*/)
+{
+  // the watches are only held to keep the directories in the cache
+}
+
+void fw::dm::TreeIndex::run()
+{
+  static auto& warm_counter = statistics().counter("index.warm");
+
+  spdlog::info("Indexing {} with {} threads", rootdir, options.scan_threads);
+  auto started = std::chrono::steady_clock::now();
+  if (!options.path.empty() && cache != nullptr)
+  {
+    loaded = load_index(options.path);
+    if (loaded)
+    {
+      spdlog::info("Revalidating {} directories of {}",
+                   loaded->directories.size(), options.path);
+    }
+  }
+
+  dtls::ScanQueues queues(options.scan_threads);
+  queues.push(0, rootdir);
+  std::atomic<std::size_t> scanned{0};
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < options.scan_threads; ++i)
+  {
+    threads.emplace_back(
+      [this, &queues, &scanned, i] { scan(queues, i, scanned); });
+  }
+  scan(queues, 0, scanned);
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  loaded.reset();
+
+  if (stopped)
+  {
+    return;
+  }
+
+  // every directory is listed from memory by now, so taking over the
+  // watches one by one is quick
+  auto listener = std::make_unique<RecursiveEventListener>(fs, rootdir, *this);
+  try
+  {
+    listener->start();
+    recursive = std::move(listener);
+  }
+  catch (const std::exception& e)
+  {
+    spdlog::warn("Unable to keep {} indexed: {}", rootdir, e.what());
+  }
+  unpin();
+
+  warm = true;
+  warm_counter = 1;
+  spdlog::info(
+    "Indexed {} directories below {} in {} ms", scanned.load(), rootdir,
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started)
+      .count());
+
+  if (options.save_interval.count() == 0)
+  {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(stop_mutex);
+  while (!stop_condition.wait_for(lock, options.save_interval,
+                                  [this] { return stopped.load(); }))
+  {
+    lock.unlock();
+    save();
+    lock.lock();
+  }
+}
+
+void fw::dm::TreeIndex::scan(dtls::ScanQueues& queues, std::size_t thread,
+                             std::atomic<std::size_t>& scanned)
+{
+  static auto& directories = statistics().counter("index.directories");
+  static auto& entries = statistics().counter("index.entries");
+
+  for (auto dirname = queues.wait(thread); dirname;
+       dirname = queues.wait(thread))
+  {
+    if (stopped)
+    {
+      queues.cancel();  // so the threads waiting for more return
+      break;
+    }
+
+    try
+    {
+      // a directory changed in the millisecond it was saved in may have
+      // the mtime it was saved with, so it is listed again
+      const IndexedDirectory* saved = nullptr;
+      if (loaded)
+      {
+        auto iter = loaded->directories.find(*dirname);
+        if (iter != std::end(loaded->directories)
+            && iter->second.mtime < loaded->timestamp)
+        {
+          saved = &iter->second;
+        }
+      }
+
+      std::deque<fs::DirectoryEntry> listing;
+      if (saved != nullptr)
+      {
+        // neither the cache nor the watch list the directory
+        listing = cache->watch_revalidated(*dirname, *this, saved->mtime,
+                                           saved->entries);
+      }
+      else
+      {
+        fs.watch(*dirname, *this);
+      }
+      {
+        std::lock_guard<std::mutex> sentry(mutex);
+        pinned.push_back(*dirname);
+      }
+      if (saved == nullptr)
+      {
+        // from memory, the watch filled the cache
+        listing = fs.ls(*dirname);
+      }
+
+      for (const auto& entry : listing)
+      {
+        ++entries;
+        if (entry.is_dir)
+        {
+          queues.push(thread, fs.join(*dirname, entry.name));
+        }
+      }
+      ++directories;
+      ++scanned;
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::warn("Unable to index {}: {}", *dirname, e.what());
+    }
+    queues.done();
+  }
+}
+
+void fw::dm::TreeIndex::save()
+{
+  static auto& saved = statistics().counter("index.saved");
+
+  if (options.path.empty() || !warm)
+  {
+    return;
+  }
+
+  IndexSnapshot snapshot;
+  snapshot.timestamp = static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch())
+      .count());
+  try
+  {
+    // from memory, as the whole tree is watched
+    std::vector<std::string> pending{rootdir};
+    while (!pending.empty())
+    {
+      auto dirname = std::move(pending.back());
+      pending.pop_back();
+      // the mtime before the entries, so a change in between makes the
+      // directory be listed again when loaded
+      auto direntry = fs.get_direntry(dirname);
+      if (!direntry)
+      {
+        continue;
+      }
+      auto entries = fs.ls(dirname);
+      for (const auto& entry : entries)
+      {
+        if (entry.is_dir)
+        {
+          pending.push_back(fs.join(dirname, entry.name));
+        }
+      }
+      snapshot.directories.emplace(
+        std::move(dirname),
+        IndexedDirectory{direntry->mtime, std::move(entries)});
+    }
+
+    save_index(options.path, snapshot);
+    ++saved;
+    spdlog::info("Saved {} directories to {}", snapshot.directories.size(),
+                 options.path);
+  }
+  catch (const std::exception& e)
+  {
+    spdlog::warn("Unable to save the index to {}: {}", options.path,
+                 e.what());
+  }
+}
+
+void fw::dm::TreeIndex::unpin()
+{
+  std::vector<std::string> dirnames;
+  {
+    std::lock_guard<std::mutex> sentry(mutex);
+    dirnames.swap(pinned);
+  }
+
+  for (const auto& dirname : dirnames)
+  {
+    fs.stop_watching(dirname, *this);
+  }
+}
@@ -0,0 +1,149 @@
+#ifndef TREEINDEX_H
+#define TREEINDEX_H
+
+#include "directoryeventlistener.h"
+#include "indexfile.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fw
+{
+  namespace dm
+  {
+    class FileSystem;
+    class ListingCache;
+    class RecursiveEventListener;
+
+    struct TreeIndexOptions
+    {
+      std::size_t scan_threads = 8;
+      std::string path;  // where the index is persisted, empty for nowhere
+      // save the index this often, besides at shutdown.  0 disables.
+      std::chrono::seconds save_interval{0};
+    };
+
+    namespace dtls
+    {
+      /// The directories waiting to be scanned, a queue per scan thread.  A
+      /// thread takes the directory it queued last, so it walks depth
+      /// first, or else steals the one another thread queued first, which
+      /// is likely the root of the largest unscanned subtree.  Thread safe.
+      class ScanQueues
+      {
+      public:
+        explicit ScanQueues(std::size_t threads);
+
+        void push(std::size_t thread, std::string dirname);
+        /// The next directory for thread to scan, or nothing if every
+        /// queue is empty.  Call done() once it is scanned.
+        std::optional<std::string> pop(std::size_t thread);
+        /// As pop(), but blocks while the queues are empty and directories
+        /// are being scanned, which may queue more.  Nothing once every
+        /// directory is scanned, or cancel() is called.
+        std::optional<std::string> wait(std::size_t thread);
+        void done();
+        /// Wake the threads in wait(), and return nothing from it from now
+        void cancel();
+
+        /// true once every directory pushed is scanned
+        bool finished() const { return pending.load() == 0; }
+
+      private:
+        struct Queue
+        {
+          std::mutex mutex;
+          std::deque<std::string> dirnames;
+        };
+
+        /// Wake the threads in wait() after the counters changed
+        void wake(bool all);
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::atomic<std::size_t> pending{0};  // pushed, but not done
+        std::atomic<std::size_t> queued{0};  // pushed, but not popped
+        std::atomic<bool> cancelled{false};
+        std::mutex wait_mutex;
+        std::condition_variable changed;
+      };
+
+    }  // namespace dtls
+
+    /// Watches and lists every directory below rootdir at startup, with
+    /// scan_threads threads, so a CachingFileSystem holds the whole tree
+    /// in memory before the first listing is asked for.  Once the scan is
+    /// done, a RecursiveEventListener takes over the watches, so added
+    /// subdirectories are kept in the index as well.
+    ///
+    /// With a path in the options, the listings are saved there at
+    /// shutdown, and loaded at the next start: a directory whose mtime is
+    /// unchanged since it was saved is not listed again, its saved entries
+    /// are taken by the cache and the watch instead.  Writing to a file
+    /// leaves the mtime unchanged, so the cache stats the saved entries
+    /// again when they are first read.
+    ///
+    /// The progress is published as the index.* statistics.
+    class TreeIndex : public DirectoryEventListener
+    {
+    public:
+      TreeIndex(FileSystem& fs, std::string rootdir,
+                const TreeIndexOptions& options);
+      TreeIndex(const TreeIndex&) = delete;
+      TreeIndex& operator=(const TreeIndex&) = delete;
+      TreeIndex(TreeIndex&&) = delete;
+      TreeIndex& operator=(TreeIndex&&) = delete;
+      ~TreeIndex() override;
+
+      /// Start the scan in the background
+      void start();
+      /// Wait for the scan to finish
+      void wait();
+
+      /// true once the whole tree is scanned
+      bool is_warm() const { return warm.load(); }
+
+      /// Save the index to the path in the options, if it is warm
+      void save();
+
+      void notify(filewatch::DirectoryEvent::Event event,
+                  std::string_view containing_dir,
+                  std::string_view dir_name,
+                  uint64_t mtime,
+                  uint64_t size,
+                  std::string_view old_name) override;
+
+    private:
+      void run();
+      /// Scan the directories of queues, counting them in scanned
+      void scan(dtls::ScanQueues& queues, std::size_t thread,
+                std::atomic<std::size_t>& scanned);
+      void unpin();
+
+      FileSystem& fs;
+      ListingCache* cache;  // nullptr if fs does not cache listings
+      std::string rootdir;
+      TreeIndexOptions options;
+      std::optional<IndexSnapshot> loaded;  // during the scan
+      std::atomic<bool> stopped{false};
+      std::mutex stop_mutex;
+      std::condition_variable stop_condition;
+      std::atomic<bool> warm{false};
+      std::thread scan_thread;
+      std::mutex mutex;
+      std::vector<std::string> pinned;  // watched by the scan
+      std::unique_ptr<RecursiveEventListener> recursive;
+    };
+
+  }  // namespace dm
+}  // namespace fw
+
+#endif /* TREEINDEX_H */
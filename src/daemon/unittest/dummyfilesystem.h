@@ -299,8 +299,14 @@ public:
       }
   }
 
+  void directory_moved(std::string_view dirname) override
+  {
+    moved.emplace_back(dirname);
+  }
+
   std::vector<std::pair<fw::dm::DirectoryEventListener*, std::string>>
     listeners;
+  std::vector<std::string> moved;
 };
 
 #endif /* DUMMYFILESYSTEM_H */
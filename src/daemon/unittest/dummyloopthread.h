@@ -0,0 +1,96 @@
+#ifndef DUMMYLOOPTHREAD_H
+#define DUMMYLOOPTHREAD_H
+
+#include "common/loop_thread.h"
+
+#include <functional>
+#include <memory>
+#include <set>
+
+class DummyLoopThread;
+
+class DummyThreads
+{
+public:
+  DummyThreads() = default;
+
+  void run_once();
+
+  void add_thread(DummyLoopThread& th) { threads.insert(&th); }
+  void remove_thread(DummyLoopThread& th) { threads.erase(&th); }
+
+private:
+  std::set<DummyLoopThread*> threads;
+};
+
+class DummyLoopThread : public threading::LoopThread
+{
+public:
+  DummyLoopThread(DummyThreads& threads_, std::function<void()> iter_fun) :
+    threads(threads_), iteration_fun(std::move(iter_fun)), suspended(true),
+    stopped(false), joined(false)
+  {
+    threads.add_thread(*this);
+  }
+  DummyLoopThread(const DummyLoopThread&) = delete;
+  DummyLoopThread& operator=(const DummyLoopThread&) = delete;
+  DummyLoopThread(DummyLoopThread&&) = delete;
+  DummyLoopThread& operator=(DummyLoopThread&&) = delete;
+  ~DummyLoopThread() override { threads.remove_thread(*this); }
+
+  void join() override { joined = true; }
+  [[nodiscard]] bool is_joinable() const override { return !joined; }
+  void suspend() override { suspended = true; }
+  void unsuspend() override { suspended = false; }
+  [[nodiscard]] bool is_suspended() const override { return suspended; }
+  void stop() override { stopped = true; }
+  [[nodiscard]] bool is_stopped() const override { return stopped; }
+
+  void run_one_iteration()
+  {
+    if (!stopped || !suspended)
+    {
+      iteration_fun();
+    }
+  }
+
+private:
+  DummyThreads& threads;
+  std::function<void()> iteration_fun;
+  bool suspended, stopped, joined;
+};
+
+inline void DummyThreads::run_once()
+{
+  for (auto* thread : threads)
+  {
+    thread->run_one_iteration();
+  }
+}
+
+class DummyLoopThreadFactory : public threading::LoopThreadFactory
+{
+public:
+  DummyLoopThreadFactory() : threads(my_threads) {}
+  explicit DummyLoopThreadFactory(DummyThreads& threads_) : threads(threads_)
+  {
+  }
+
+  std::unique_ptr<threading::LoopThread>
+  create_thread(std::function<void()> iteration_fun,
+                bool create_suspended = false) override
+  {
+    auto t = std::make_unique<DummyLoopThread>(threads, iteration_fun);
+    if (!create_suspended)
+    {
+      t->unsuspend();
+    }
+    return t;
+  }
+
+private:
+  DummyThreads my_threads;
+  DummyThreads& threads;
+};
+
+#endif /* DUMMYLOOPTHREAD_H */
@@ -0,0 +1,276 @@
+#include "daemon/cachingfilesystem.h"
+#include "daemon/statistics.h"
+#include "dummyfilesystem.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+  class NullListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    void notify(filewatch::DirectoryEvent::Event /*event*/,
+                std::string_view /*containing_dir*/,
+                std::string_view /*dir_name*/,
+                uint64_t /*mtime*/,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
+    {
+    }
+  };
+
+  /// Counts the calls that reach the disk, i.e., DummyFileSystem
+  class CountingFileSystem : public DummyFileSystem
+  {
+  public:
+    using DummyFileSystem::DummyFileSystem;
+
+    std::deque<fw::dm::fs::DirectoryEntry>
+    ls(std::string_view dirname) const override
+    {
+      ++ls_count;
+      return DummyFileSystem::ls(dirname);
+    }
+
+    std::optional<fw::dm::fs::DirectoryEntry>
+    get_direntry(std::string_view entryname) const override
+    {
+      ++stat_count;
+      if (on_stat)
+      {
+        on_stat();
+      }
+      return DummyFileSystem::get_direntry(entryname);
+    }
+
+    void watch(std::string_view dirname,
+               fw::dm::DirectoryEventListener& listener) override
+    {
+      DummyFileSystem::watch(dirname, listener);
+      if (on_watch)
+      {
+        on_watch();
+      }
+    }
+
+    /// Notify the listeners of dirname, like the watch thread does
+    void event(filewatch::DirectoryEvent::Event event, std::string_view dirname,
+               std::string_view name, uint64_t mtime, uint64_t size = 0,
+               std::string_view old_name = {})
+    {
+      for (const auto& l : listeners)
+      {
+        if (l.second == dirname)
+        {
+          l.first->notify(event, dirname, name, mtime, size, old_name);
+        }
+      }
+    }
+
+    mutable int ls_count = 0;
+    mutable int stat_count = 0;
+    // e.g., a change right after a watch is armed, which it has no event of
+    std::function<void()> on_watch;
+    // e.g., an event that arrives while an entry is stat'ed
+    std::function<void()> on_stat;
+  };
+
+  std::vector<std::string> names(const std::deque<fw::dm::fs::DirectoryEntry>& entries)
+  {
+    std::vector<std::string> result;
+    for (const auto& e : entries)
+    {
+      result.push_back(e.name);
+    }
+    std::sort(std::begin(result), std::end(result));
+    return result;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("metadata cache", "[CachingFileSystem]")
+{
+  fw::dm::CachingFileSystem<CountingFileSystem> fs("/rootdir");
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/dir", "sub", 2);
+  fs.add_file("/dir", "file", 3);
+  fs.add_dir("/", "unwatched", 4);
+
+  NullListener listener;
+  fs.watch("/dir", listener);
+  REQUIRE(fs.listeners.size() == 2);
+
+  CHECK(names(fs.ls("/dir")) == std::vector<std::string>{"file", "sub"});
+  REQUIRE(fs.ls_count == 1);
+  auto hits = fw::dm::statistics().counter("cache.hits").load();
+
+  SECTION("watched directories are listed from memory")
+  {
+    CHECK(names(fs.ls("/dir")) == std::vector<std::string>{"file", "sub"});
+    CHECK(fs.get_direntry("/dir/file")->mtime == 3);
+    CHECK(fs.exists("/dir/file"));
+    CHECK_FALSE(fs.exists("/dir/missing"));
+    CHECK(fs.isdir("/dir/sub"));
+    CHECK_FALSE(fs.isdir("/dir/file"));
+    CHECK(fs.ls_count == 1);
+    CHECK(fs.stat_count == 0);
+    CHECK(fw::dm::statistics().counter("cache.hits") == hits + 6);
+  }
+
+  SECTION("watched directories are packed into listings from memory")
+  {
+    auto listing = fs.list("/dir");
+    REQUIRE(listing.size() == 2);
+    CHECK(listing[0].name == "file");
+    CHECK(listing[0].mtime == 3);
+    CHECK(listing[1].name == "sub");
+    CHECK(listing[1].is_dir);
+    CHECK(fs.ls_count == 1);
+    CHECK(fs.list("/unwatched").size() == 0);
+    CHECK(fs.ls_count == 2);
+  }
+
+  SECTION("unwatched directories are passed through")
+  {
+    fs.ls("/unwatched");
+    fs.ls("/unwatched");
+    CHECK(fs.ls_count == 3);
+    CHECK(fs.get_direntry("/unwatched")->mtime == 4);
+    CHECK(fs.stat_count == 1);
+  }
+
+  SECTION("events patch the entries")
+  {
+    fs.add_file("/dir", "new", 5);
+    fs.event(filewatch::DirectoryEvent::FILE_ADDED, "/dir", "new", 5, 10);
+    fs.event(filewatch::DirectoryEvent::FILE_REMOVED, "/dir", "file", 0);
+    fs.event(filewatch::DirectoryEvent::FILE_MODIFIED, "/dir", "new", 6, 20);
+    fs.event(filewatch::DirectoryEvent::DIRECTORY_RENAMED, "/dir", "moved", 7,
+             0, "sub");
+
+    CHECK(names(fs.ls("/dir")) == std::vector<std::string>{"moved", "new"});
+    CHECK(fs.get_direntry("/dir/new")->mtime == 6);
+    CHECK(fs.get_direntry("/dir/new")->size == 20);
+    CHECK(fs.isdir("/dir/moved"));
+    CHECK_FALSE(fs.exists("/dir/sub"));
+    CHECK(fs.ls_count == 1);
+  }
+
+  SECTION("events about a subdirectory refresh its mtime in the parent")
+  {
+    NullListener sublistener;
+    fs.watch("/dir/sub", sublistener);
+    fs.ls("/dir/sub");
+    fs.rm_dir("/dir", "sub");
+    fs.add_dir("/dir", "sub", 42);
+
+    fs.event(filewatch::DirectoryEvent::FILE_ADDED, "/dir/sub", "f", 8);
+    CHECK(fs.get_direntry("/dir/sub")->mtime == 42);
+    CHECK(fs.stat_count == 1);
+    CHECK(fs.get_direntry("/dir/sub")->mtime == 42);
+    CHECK(fs.stat_count == 1);
+    fs.stop_watching("/dir/sub", sublistener);
+  }
+
+  SECTION("stale entries are stat'ed without holding up events")
+  {
+    fs.add_file("/dir", "new", 5);
+    fs.event(filewatch::DirectoryEvent::FILE_ADDED, "/dir", "new", 0);
+    fs.on_stat = [&fs]()
+    {
+      fs.on_stat = nullptr;
+      fs.event(filewatch::DirectoryEvent::FILE_MODIFIED, "/dir", "file", 9,
+               30);
+    };
+    CHECK(names(fs.ls("/dir"))
+          == std::vector<std::string>{"file", "new", "sub"});
+    CHECK(fs.stat_count == 1);
+    // only the entry asked for is stat'ed
+    CHECK(fs.get_direntry("/dir/file")->mtime == 9);
+    CHECK(fs.stat_count == 1);
+    // the event arrived during the stat, so new is stat'ed again
+    CHECK(fs.get_direntry("/dir/new")->mtime == 5);
+    CHECK(fs.stat_count == 2);
+    CHECK(fs.get_direntry("/dir/new")->mtime == 5);
+    CHECK(fs.stat_count == 2);
+  }
+
+  SECTION("directories are listed once as they are watched")
+  {
+    NullListener sublistener;
+    fs.watch("/dir/sub", sublistener);
+    CHECK(fs.ls_count == 2);
+    fs.add_file("/dir/sub", "f", 8);
+    fs.event(filewatch::DirectoryEvent::FILE_ADDED, "/dir/sub", "f", 8);
+    CHECK(names(fs.ls("/dir/sub")) == std::vector<std::string>{"f"});
+    CHECK(fs.ls_count == 2);
+    fs.stop_watching("/dir/sub", sublistener);
+  }
+
+  SECTION("directories are listed after their watch is armed")
+  {
+    NullListener sublistener;
+    fs.on_watch = [&fs]() { fs.add_file("/dir/sub", "early", 8); };
+    fs.watch("/dir/sub", sublistener);
+    fs.on_watch = nullptr;
+    CHECK(names(fs.ls("/dir/sub")) == std::vector<std::string>{"early"});
+    CHECK(fs.ls_count == 2);
+    fs.stop_watching("/dir/sub", sublistener);
+  }
+
+  SECTION("unchanged directories are cached with the saved entries")
+  {
+    NullListener sublistener;
+    fs.add_file("/dir/sub", "saved", 12);  // written to since it was saved
+    std::deque<fw::dm::fs::DirectoryEntry> saved{{"saved", false, 9, 1}};
+    CHECK(names(fs.watch_revalidated("/dir/sub", sublistener, 2, saved))
+          == std::vector<std::string>{"saved"});
+    CHECK(fs.ls_count == 1);
+    // before and after the watch is armed
+    CHECK(fs.stat_count == 2);
+    // the saved entries are stat'ed again when they are first read
+    CHECK(names(fs.ls("/dir/sub")) == std::vector<std::string>{"saved"});
+    CHECK(fs.get_direntry("/dir/sub/saved")->mtime == 12);
+    CHECK(fs.stat_count == 3);
+
+    SECTION("changed directories are listed from disk")
+    {
+      fs.add_dir("/dir", "other", 10);
+      NullListener otherlistener;
+      CHECK(fs.watch_revalidated("/dir/other", otherlistener, 2, saved)
+              .empty());
+      CHECK(fs.ls_count == 2);
+      fs.stop_watching("/dir/other", otherlistener);
+    }
+    SECTION("cached directories are not revalidated")
+    {
+      NullListener otherlistener;
+      CHECK(names(fs.watch_revalidated("/dir/sub", otherlistener, 1, {}))
+            == std::vector<std::string>{"saved"});
+      CHECK(fs.ls_count == 1);
+      CHECK(fs.stat_count == 3);
+      fs.stop_watching("/dir/sub", otherlistener);
+    }
+    fs.stop_watching("/dir/sub", sublistener);
+  }
+
+  SECTION("the cache stops listening with the last listener")
+  {
+    NullListener other;
+    fs.watch("/dir", other);
+    CHECK(fs.listeners.size() == 3);
+    fs.stop_watching("/dir", other);
+    CHECK(fs.listeners.size() == 2);
+    fs.stop_watching("/dir", listener);
+    CHECK(fs.listeners.empty());
+
+    fs.ls("/dir");
+    CHECK(fs.ls_count == 2);
+    fs.watch("/dir", listener);
+  }
+
+  fs.stop_watching("/dir", listener);
+}
@@ -0,0 +1,118 @@
+#include "daemon/changetracker.h"
+
+#include "daemon/eventjournal.h"
+
+#include <catch2/catch.hpp>
+
+namespace
+{
+  using Event = filewatch::DirectoryEvent;
+  using Changes = std::optional<std::vector<fw::dm::ChangeTracker::Change>>;
+
+  uint64_t next() { return fw::dm::next_event_sequence(); }
+
+  std::vector<std::string> names(const Changes& changes)
+  {
+    REQUIRE(changes);
+    std::vector<std::string> result;
+    for (const auto& c : *changes)
+    {
+      result.push_back(c.name);
+    }
+    return result;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("change tracker", "[ChangeTracker]")
+{
+  fw::dm::ChangeTracker tracker(10);
+  auto start = tracker.generation();
+  CHECK(names(tracker.since(start)).empty());
+  CHECK_FALSE(tracker.since(start - 1));
+  CHECK_FALSE(tracker.since(start + 1));
+
+  tracker.add(Event::FILE_ADDED, "a", 1, 10, {}, next());
+  tracker.add(Event::DIRECTORY_ADDED, "b", 2, 0, {}, next());
+  auto middle = tracker.generation();
+  CHECK(middle > start);
+  tracker.add(Event::FILE_MODIFIED, "a", 3, 20, {}, next());
+
+  SECTION("the latest change of every entry")
+  {
+    auto changes = tracker.since(start);
+    CHECK(names(changes) == std::vector<std::string>{"b", "a"});
+    CHECK(changes->at(0).is_dir);
+    CHECK(changes->at(1).exists);
+    CHECK_FALSE(changes->at(1).is_dir);
+    CHECK(changes->at(1).mtime == 3);
+    CHECK(changes->at(1).size == 20);
+    CHECK(changes->at(1).generation == tracker.generation());
+    CHECK(names(tracker.since(middle)) == std::vector<std::string>{"a"});
+    CHECK(names(tracker.since(tracker.generation())).empty());
+  }
+
+  SECTION("removed and renamed entries")
+  {
+    tracker.add(Event::DIRECTORY_REMOVED, "b", 0, 0, {}, next());
+    tracker.add(Event::FILE_RENAMED, "c", 4, 20, "a", next());
+    auto changes = tracker.since(middle);
+    CHECK(names(changes) == std::vector<std::string>{"b", "a", "c"});
+    CHECK_FALSE(changes->at(0).exists);
+    CHECK(changes->at(0).is_dir);
+    CHECK_FALSE(changes->at(1).exists);
+    CHECK(changes->at(2).exists);
+  }
+
+  SECTION("watching the directory is not a change")
+  {
+    auto before = tracker.generation();
+    tracker.add(Event::WATCHING_DIRECTORY, ".", 0, 0, {}, next());
+    CHECK(tracker.generation() == before);
+  }
+
+  SECTION("a rename is one generation")
+  {
+    auto before = tracker.generation();
+    auto renamed = next();
+    tracker.add(Event::FILE_RENAMED, "c", 4, 20, "a", renamed);
+    auto changes = tracker.since(before);
+    CHECK(names(changes) == std::vector<std::string>{"a", "c"});
+    CHECK(changes->at(0).generation == renamed);
+    CHECK(changes->at(1).generation == renamed);
+  }
+
+  SECTION("restarting forgets the changes")
+  {
+    auto restarted = next();
+    tracker.restart(restarted);
+    CHECK(tracker.generation() == restarted);
+    CHECK_FALSE(tracker.since(start));
+    CHECK(names(tracker.since(restarted)).empty());
+  }
+
+  SECTION("other directories do not affect the generations")
+  {
+    auto before = tracker.generation();
+    fw::dm::next_event_sequence();
+    CHECK(tracker.generation() == before);
+    CHECK(names(tracker.since(before)).empty());
+  }
+}
+
+TEST_CASE("change tracker forgets the oldest changes", "[ChangeTracker]")
+{
+  fw::dm::ChangeTracker tracker(2);
+  auto start = tracker.generation();
+  tracker.add(Event::FILE_ADDED, "a", 0, 0, {}, next());
+  auto after_a = tracker.generation();
+  tracker.add(Event::FILE_ADDED, "b", 0, 0, {}, next());
+  auto after_b = tracker.generation();
+  tracker.add(Event::FILE_ADDED, "a", 0, 0, {}, next());
+  CHECK(names(tracker.since(start)) == std::vector<std::string>{"b", "a"});
+
+  tracker.add(Event::FILE_ADDED, "c", 0, 0, {}, next());
+  CHECK_FALSE(tracker.since(start));
+  CHECK_FALSE(tracker.since(after_a));
+  CHECK(names(tracker.since(after_b)) == std::vector<std::string>{"a", "c"});
+}
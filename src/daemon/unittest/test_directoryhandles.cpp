@@ -0,0 +1,242 @@
+#include "daemon/details/directoryhandles.h"
+
+#ifdef __linux__
+
+#  include "daemon/defaultfilesystem.h"
+#  include "daemon/directoryeventlistener.h"
+
+#  include <catch2/catch.hpp>
+
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+
+#  include <fstream>
+#  include <string>
+
+namespace
+{
+  class TemporaryDirectory
+  {
+  public:
+    TemporaryDirectory() :
+      path(std::filesystem::temp_directory_path()
+           / ("fwdaemon_dirhandles_" + std::to_string(::getpid())))
+    {
+      std::filesystem::create_directories(path);
+    }
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+    TemporaryDirectory(TemporaryDirectory&&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory&&) = delete;
+    ~TemporaryDirectory() { std::filesystem::remove_all(path); }
+
+    void write(const std::string& name, const std::string& contents) const
+    {
+      std::ofstream out(path / name, std::ios::binary);
+      out << contents;
+    }
+
+    std::filesystem::path path;
+  };
+
+  bool exists_at(const fw::dm::dtls::ResolvedPath& resolved)
+  {
+    struct stat st
+    {
+    };
+    return ::fstatat(resolved.fd(), resolved.relative.c_str(), &st, 0) == 0;
+  }
+
+  class NullListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    void notify(filewatch::DirectoryEvent::Event /*event*/,
+                std::string_view /*containing_dir*/,
+                std::string_view /*dir_name*/,
+                uint64_t /*mtime*/,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
+    {
+    }
+  };
+
+  /// Holds the watched directories, without watching them
+  class HoldingFileSystem : public fw::dm::DefaultFileSystem
+  {
+  public:
+    using DefaultFileSystem::DefaultFileSystem;
+
+    void watch(std::string_view dirname,
+               fw::dm::DirectoryEventListener& /*listener*/) override
+    {
+      hold_directory(dirname);
+    }
+    void stop_watching(std::string_view dirname,
+                       fw::dm::DirectoryEventListener& /*listener*/) override
+    {
+      release_directory(dirname);
+    }
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("directory handles", "[DirectoryHandles]")
+{
+  TemporaryDirectory tmp;
+  std::filesystem::create_directories(tmp.path / "a" / "b");
+  tmp.write("a/b/file", "contents");
+
+  fw::dm::dtls::DirectoryHandles handles(tmp.path.string());
+
+  SECTION("paths are resolved relative to the root by default")
+  {
+    auto resolved = handles.resolve("/a/b/file");
+    CHECK(resolved.relative == "a/b/file");
+    CHECK(exists_at(resolved));
+    CHECK(handles.resolve("/").relative == ".");
+    CHECK(handles.size() == 0);
+  }
+
+  SECTION("paths are resolved relative to the nearest held directory")
+  {
+    handles.hold("/a");
+    handles.hold("/a/b/");
+    CHECK(handles.size() == 2);
+    CHECK(handles.resolve("/a/b/file").relative == "file");
+    CHECK(handles.resolve("/a/b").relative == ".");
+    CHECK(handles.resolve("/a/c").relative == "c");
+    CHECK(exists_at(handles.resolve("/a/b/file")));
+
+    handles.release("/a/b");
+    CHECK(handles.resolve("/a/b/file").relative == "b/file");
+    handles.release("/a");
+    CHECK(handles.size() == 0);
+  }
+
+  SECTION("directories are held until released as many times")
+  {
+    handles.hold("/a");
+    handles.hold("/a");
+    handles.release("/a");
+    CHECK(handles.resolve("/a/b").relative == "b");
+    handles.release("/a");
+    CHECK(handles.resolve("/a/b").relative == "a/b");
+  }
+
+  SECTION("held directories that are moved are resolved by path")
+  {
+    std::filesystem::create_directories(tmp.path / "a-b");
+    handles.hold("/a");
+    handles.hold("/a/b");
+    handles.hold("/a-b");
+    auto before = handles.resolve("/a/b/file");
+    CHECK(before.relative == "file");
+    std::filesystem::rename(tmp.path / "a", tmp.path / "moved");
+    CHECK(exists_at(before));
+    // as the watch of /a reports
+    handles.invalidate("/a");
+    auto after = handles.resolve("/a/b/file");
+    CHECK(after.relative == "a/b/file");
+    CHECK_FALSE(exists_at(after));
+    CHECK(handles.size() == 1);
+    CHECK(handles.resolve("/a-b/x").relative == "x");
+
+    // and opened again once they are back
+    std::filesystem::create_directories(tmp.path / "a" / "b");
+    CHECK(handles.resolve("/a/b/file").relative == "file");
+    CHECK(handles.size() == 2);
+    handles.release("/a/b");
+    handles.release("/a");
+    handles.release("/a-b");
+    CHECK(handles.size() == 0);
+  }
+
+  SECTION("held directories below a moved directory are resolved by path")
+  {
+    handles.hold("/a/b");
+    auto before = handles.resolve("/a/b/file");
+    CHECK(before.relative == "file");
+    // without an event about it, as /a is not held
+    std::filesystem::rename(tmp.path / "a", tmp.path / "moved");
+    CHECK(exists_at(before));
+    auto after = handles.resolve("/a/b/file");
+    CHECK(after.relative == "a/b/file");
+    CHECK_FALSE(exists_at(after));
+    CHECK(handles.size() == 0);
+
+    std::filesystem::create_directories(tmp.path / "a" / "b");
+    CHECK(handles.resolve("/a/b/file").relative == "file");
+    CHECK(handles.size() == 1);
+
+    SECTION("also when the directory above them is no longer held")
+    {
+      handles.hold("/a");
+      handles.release("/a");
+      std::filesystem::rename(tmp.path / "a", tmp.path / "again");
+      CHECK(handles.resolve("/a/b/file").relative == "a/b/file");
+    }
+    handles.release("/a/b");
+  }
+
+  SECTION("invalidated directories are opened again")
+  {
+    handles.hold("/a/b");
+    handles.invalidate("/a");
+    CHECK(handles.size() == 0);
+    CHECK(handles.resolve("/a/b/file").relative == "file");
+    CHECK(handles.size() == 1);
+    handles.release("/a/b");
+  }
+
+  SECTION("missing directories are resolved by path")
+  {
+    handles.hold("/missing");
+    CHECK(handles.size() == 0);
+    CHECK(handles.resolve("/missing/x").relative == "missing/x");
+    handles.release("/missing");
+  }
+
+  CHECK_THROWS(fw::dm::dtls::DirectoryHandles((tmp.path / "none").string()));
+}
+
+TEST_CASE("default file system resolves paths relative to held directories",
+          "[DirectoryHandles]")
+{
+  TemporaryDirectory tmp;
+  std::filesystem::create_directories(tmp.path / "a" / "b");
+  tmp.write("a/b/file", "contents");
+
+  HoldingFileSystem fs(tmp.path.string());
+  NullListener listener;
+  fs.watch("/a/b", listener);
+
+  CHECK(fs.read("/a/b/file") == "contents");
+  CHECK(fs.ls("/a/b").size() == 1);
+  CHECK(fs.isdir("/a/b"));
+  CHECK(fs.exists("/a/b/file"));
+  CHECK(fs.get_direntry("/a/b/file")->name == "file");
+  CHECK_FALSE(fs.exists("/a/b/none"));
+  CHECK(fs.read("/a/b/none").empty());
+
+  SECTION("a removed held directory does not exist")
+  {
+    std::filesystem::remove_all(tmp.path / "a" / "b");
+    CHECK_FALSE(fs.exists("/a/b"));
+  }
+  SECTION("a held directory replaced below a renamed parent is the new one")
+  {
+    std::filesystem::rename(tmp.path / "a", tmp.path / "z");
+    std::filesystem::create_directories(tmp.path / "a" / "b");
+    tmp.write("a/b/new", "");
+    CHECK(fs.exists("/a/b/new"));
+    CHECK_FALSE(fs.exists("/a/b/file"));
+    auto entries = fs.ls("/a/b");
+    REQUIRE(entries.size() == 1);
+    CHECK(entries[0].name == "new");
+  }
+
+  fs.stop_watching("/a/b", listener);
+}
+
+#endif  // __linux__
@@ -0,0 +1,178 @@
+#include "daemon/details/directoryreader.h"
+
+#ifdef __linux__
+
+#  include "daemon/defaultfilesystem.h"
+
+#  include <catch2/catch.hpp>
+
+#  include <dirent.h>
+#  include <unistd.h>
+
+#  include <algorithm>
+#  include <fstream>
+#  include <set>
+#  include <string>
+
+namespace
+{
+  class TemporaryDirectory
+  {
+  public:
+    TemporaryDirectory() :
+      path(std::filesystem::temp_directory_path()
+           / ("fwdaemon_dirreader_" + std::to_string(::getpid())))
+    {
+      std::filesystem::create_directories(path);
+    }
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+    TemporaryDirectory(TemporaryDirectory&&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory&&) = delete;
+    ~TemporaryDirectory() { std::filesystem::remove_all(path); }
+
+    void write(const std::string& name, const std::string& contents) const
+    {
+      std::ofstream out(path / name, std::ios::binary);
+      out << contents;
+    }
+
+    std::filesystem::path path;
+  };
+
+  std::deque<fw::dm::fs::DirectoryEntry>
+  sorted(std::deque<fw::dm::fs::DirectoryEntry> entries)
+  {
+    std::sort(std::begin(entries), std::end(entries),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.name < rhs.name;
+              });
+    return entries;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("directory reader", "[DirectoryReader]")
+{
+  TemporaryDirectory tmp;
+  std::filesystem::create_directory(tmp.path / "subdir");
+  tmp.write("file", "12345");
+  std::filesystem::create_directory_symlink(tmp.path / "subdir",
+                                            tmp.path / "link");
+
+  fw::dm::dtls::DirectoryReader reader(tmp.path.string());
+
+  SECTION("entries are stat'ed, following symbolic links")
+  {
+    auto entries = sorted(reader.entries());
+    REQUIRE(entries.size() == 3);
+    CHECK(entries[0].name == "file");
+    CHECK_FALSE(entries[0].is_dir);
+    CHECK(entries[0].size == 5);
+    CHECK(entries[1].name == "link");
+    CHECK(entries[1].is_dir);
+    CHECK(entries[2].name == "subdir");
+    CHECK(entries[2].is_dir);
+    CHECK(entries[2].size == 0);
+    for (const auto& e : entries)
+    {
+      CHECK(e.mtime > 0);
+    }
+  }
+
+  SECTION("the listing has the same entries")
+  {
+    auto entries = sorted(reader.listing().entries());
+    REQUIRE(entries.size() == 3);
+    CHECK(entries[0].name == "file");
+    CHECK(entries[0].size == 5);
+    CHECK(entries[1].is_dir);
+    CHECK(entries[2].name == "subdir");
+    CHECK(entries[2].is_dir);
+  }
+
+  SECTION("the entries can be read again")
+  {
+    CHECK(reader.entries().size() == 3);
+    tmp.write("new", "");
+    CHECK(reader.entries().size() == 4);
+  }
+
+  SECTION("removed entries are not found")
+  {
+    CHECK_FALSE(reader.stat("missing", DT_UNKNOWN));
+    CHECK_FALSE(fw::dm::dtls::stat_entry((tmp.path / "missing").string()));
+  }
+
+  SECTION("single entries")
+  {
+    auto file = fw::dm::dtls::stat_entry((tmp.path / "file").string());
+    REQUIRE(file);
+    CHECK(file->name == "file");
+    CHECK(file->size == 5);
+    CHECK(fw::dm::dtls::stat_entry((tmp.path / "link").string())->is_dir);
+  }
+
+  CHECK_THROWS(fw::dm::dtls::DirectoryReader((tmp.path / "file").string()));
+  CHECK_THROWS(fw::dm::dtls::DirectoryReader((tmp.path / "none").string()));
+}
+
+TEST_CASE("directory reader reads large directories in several batches",
+          "[DirectoryReader]")
+{
+  TemporaryDirectory tmp;
+  const std::string prefix(200, 'x');
+  for (int i = 0; i < 1000; ++i)
+  {
+    tmp.write(prefix + std::to_string(i), "");
+  }
+
+  std::size_t count = 0;
+  fw::dm::dtls::DirectoryReader(tmp.path.string())
+    .for_each([&](std::string_view name, unsigned char /*type*/) {
+      CHECK(name.starts_with(prefix));
+      ++count;
+    });
+  CHECK(count == 1000);
+}
+
+TEST_CASE("directory reader reads pages", "[DirectoryReader]")
+{
+  TemporaryDirectory tmp;
+  for (int i = 0; i < 10; ++i)
+  {
+    tmp.write("file" + std::to_string(i), "");
+  }
+
+  fw::dm::dtls::DirectoryReader reader(tmp.path.string());
+  std::set<std::string> names;
+  uint64_t position = 0;
+  for (int pages = 1;; ++pages)
+  {
+    // a new reader per page, as a later request would
+    auto page = fw::dm::dtls::DirectoryReader(tmp.path.string())
+                  .page(position, 3);
+    REQUIRE(page.entries.size() <= 3);
+    REQUIRE(page.cursors.size() == page.entries.size());
+    for (const auto& e : page.entries)
+    {
+      CHECK(names.insert(std::string(e.name)).second);
+    }
+    position = page.next;
+    if (page.end)
+    {
+      CHECK(pages >= 4);
+      break;
+    }
+    REQUIRE(pages < 5);
+  }
+  CHECK(names.size() == 10);
+
+  // from the cursor of an entry on
+  auto first = reader.page(0, 3);
+  auto rest = reader.page(first.cursors[1], 100);
+  CHECK(rest.entries.size() == 8);
+  CHECK(rest.end);
+}
+
+#endif  // __linux__
@@ -6,6 +6,9 @@
 #include <catch2/catch.hpp>
 #include <grpcpp/impl/codegen/status.h>
 
+#include <set>
+#include <string>
+
 TEST_CASE("fill root dir directory list", "[DirectoryWatcher]")
 {
   DummyFileSystem fs("rootdir");
@@ -275,6 +278,117 @@ TEST_CASE("fill file list sets size", "[DirectoryWatcher]")
   }
 }
 
+TEST_CASE("fill pages of a file list", "[DirectoryWatcher]")
+{
+  DummyFileSystem fs("rootdir");
+  fs.add_dir("/", "subdir", 1);
+  for (int i = 0; i < 5; ++i)
+  {
+    fs.add_file("/subdir", "file" + std::to_string(i), 2);
+    fs.add_dir("/subdir", "dir" + std::to_string(i), 3);
+  }
+  fw::dm::DirectoryWatcher dw("/subdir", fs);
+
+  SECTION("the pages together have every file once")
+  {
+    std::set<std::string> names;
+    std::string page_token;
+    int pages = 0;
+    do
+    {
+      filewatch::FileList response;
+      REQUIRE(dw.fill_file_page(response, page_token, 2).ok());
+      CHECK(response.name().name() == "/subdir");
+      CHECK(response.filenames_size() <= 2);
+      for (const auto& fn : response.filenames())
+      {
+        CHECK(names.insert(fn.name()).second);
+        CHECK(fn.dirname().name() == "/subdir");
+      }
+      page_token = response.next_page_token();
+      REQUIRE(++pages <= 3);
+    } while (!page_token.empty());
+    CHECK(names.size() == 5);
+    CHECK(pages == 3);
+  }
+
+  SECTION("a page large enough is the last")
+  {
+    filewatch::DirList response;
+    CHECK(dw.fill_dir_page(response, "", 6).ok());
+    CHECK(response.dirnames_size() == 5);
+    CHECK(response.next_page_token().empty());
+  }
+
+  SECTION("the last page may be empty")
+  {
+    filewatch::DirList response;
+    CHECK(dw.fill_dir_page(response, "", 5).ok());
+    CHECK(response.dirnames_size() == 5);
+    filewatch::DirList last;
+    CHECK(dw.fill_dir_page(last, response.next_page_token(), 5).ok());
+    CHECK(last.dirnames_size() == 0);
+    CHECK(last.next_page_token().empty());
+  }
+
+  SECTION("invalid pages")
+  {
+    filewatch::FileList response;
+    CHECK(dw.fill_file_page(response, "x1", 2).error_code()
+          == grpc::INVALID_ARGUMENT);
+    CHECK(dw.fill_file_page(response, "", 0).error_code()
+          == grpc::INVALID_ARGUMENT);
+    fw::dm::DirectoryWatcher missing("/missing", fs);
+    CHECK(missing.fill_file_page(response, "", 2).error_code()
+          == grpc::NOT_FOUND);
+  }
+}
+
+TEST_CASE("fill entry list", "[DirectoryWatcher]")
+{
+  DummyFileSystem fs("rootdir", 1);
+  fs.add_dir("/", "subdir", 2);
+  fs.add_file("/subdir", "file", 3);
+  fs.write_file("/subdir/file", "content");
+  fs.add_dir("/subdir", "dir", 4);
+  fw::dm::DirectoryWatcher dw("/subdir", fs);
+
+  SECTION("files and directories together")
+  {
+    filewatch::EntryList response;
+    CHECK(dw.fill_entries(response).ok());
+    CHECK(response.name().name() == "/subdir");
+    CHECK(response.name().modification_time().epoch() == 2);
+    REQUIRE(response.files_size() == 1);
+    CHECK(response.files(0).name() == "file");
+    CHECK(response.files(0).size() == fs.size("/subdir/file"));
+    CHECK(response.files(0).dirname().name() == "/subdir");
+    CHECK(response.files(0).dirname().modification_time().epoch() == 2);
+    REQUIRE(response.directories_size() == 1);
+    CHECK(response.directories(0).name() == "dir");
+    CHECK(response.directories(0).modification_time().epoch() == 4);
+  }
+
+  SECTION("in pages")
+  {
+    filewatch::EntryList first;
+    CHECK(dw.fill_entries_page(first, "", 1).ok());
+    CHECK(first.files_size() + first.directories_size() == 1);
+    filewatch::EntryList second;
+    CHECK(dw.fill_entries_page(second, first.next_page_token(), 1).ok());
+    CHECK(first.files_size() + second.files_size() == 1);
+    CHECK(first.directories_size() + second.directories_size() == 1);
+    CHECK(second.next_page_token().empty());
+  }
+
+  SECTION("not a directory")
+  {
+    filewatch::EntryList response;
+    fw::dm::DirectoryWatcher file("/subdir/file", fs);
+    CHECK(file.fill_entries(response).error_code() == grpc::NOT_FOUND);
+  }
+}
+
 namespace
 {
   class DummyDirectoryEventListener : public fw::dm::DirectoryEventListener
@@ -283,7 +397,9 @@ namespace
     void notify(filewatch::DirectoryEvent::Event event,
                 std::string_view containing_dir,
                 std::string_view dir_name,
-                uint64_t mtime) override
+                uint64_t mtime,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
     {
       events.emplace_back(EventStruct{event, containing_dir, dir_name, mtime});
     }
@@ -0,0 +1,109 @@
+#include "daemon/encodedevent.h"
+#include "daemon/eventjournal.h"
+#include "daemon/statistics.h"
+
+#include <catch2/catch.hpp>
+
+#include <grpcpp/impl/codegen/proto_utils.h>
+
+namespace
+{
+  filewatch::DirectoryEvent decode(const fw::dm::EncodedEvent& encoded)
+  {
+    grpc::ByteBuffer bytes(encoded.bytes());
+    filewatch::DirectoryEvent direvt;
+    auto status =
+      grpc::SerializationTraits<filewatch::DirectoryEvent>::Deserialize(
+        &bytes, &direvt);
+    REQUIRE(status.ok());
+    return direvt;
+  }
+
+  fw::dm::EventDescription
+  description(std::string_view dir_name, std::string_view relative_path,
+              uint64_t sequence = 3)
+  {
+    return fw::dm::EventDescription{filewatch::DirectoryEvent::FILE_RENAMED,
+                                    "/root/dir",
+                                    dir_name,
+                                    42,
+                                    7,
+                                    "old",
+                                    relative_path,
+                                    sequence};
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("encoded event", "[EncodedEvent]")
+{
+  auto desc = description("new", "dir");
+  fw::dm::EncodedEvent encoded(fw::dm::to_message(desc));
+  CHECK(encoded.event() == filewatch::DirectoryEvent::FILE_RENAMED);
+  CHECK(encoded.name() == "/root/dir");
+  CHECK(encoded.entry_name() == "new");
+  CHECK(encoded.is_rename());
+
+  auto direvt = decode(encoded);
+  CHECK(direvt.name() == "/root/dir");
+  CHECK(direvt.dirname().name() == "new");
+  CHECK(direvt.old_name() == "old");
+  CHECK(direvt.relative_path() == "dir");
+  CHECK(direvt.filename().name() == "new");
+  CHECK(direvt.filename().size() == 7);
+  CHECK(direvt.modification_time().epoch() == 42);
+  CHECK(direvt.sequence() == 3);
+  CHECK(encoded.sequence() == 3);
+}
+
+TEST_CASE("events are encoded once per relative path", "[EncodedEvent]")
+{
+  auto& encoded = fw::dm::statistics().counter("events.encoded");
+  auto& shared = fw::dm::statistics().counter("events.shared");
+  auto encoded_before = encoded.load();
+  auto shared_before = shared.load();
+
+  auto first = fw::dm::encode_shared(description("a", "dir"));
+  auto second = fw::dm::encode_shared(description("a", "dir"));
+  auto other_root = fw::dm::encode_shared(description("a", "."));
+  auto third = fw::dm::encode_shared(description("a", "dir"));
+  CHECK(first == second);
+  CHECK(first == third);
+  CHECK(first != other_root);
+  CHECK(decode(*other_root).relative_path() == ".");
+  CHECK(encoded == encoded_before + 2);
+  CHECK(shared == shared_before + 2);
+
+  auto next = fw::dm::encode_shared(description("b", "dir"));
+  CHECK(next != first);
+  CHECK(next->entry_name() == "b");
+  CHECK(fw::dm::encode_shared(description("a", "dir")) != first);
+  CHECK(fw::dm::encode_shared(description("a", "dir", 4))->sequence() == 4);
+}
+
+TEST_CASE("the feeds of an event share its encoding", "[EncodedEvent]")
+{
+  std::vector<fw::dm::EncodedEventPtr> encodings;
+  std::mutex order;
+  auto deliver = [&](std::string_view relative_path) {
+    fw::dm::sequenced(order, [&encodings, relative_path](uint64_t sequence) {
+      encodings.push_back(
+        fw::dm::encode_shared(description("a", relative_path, sequence)));
+    });
+  };
+
+  {
+    fw::dm::EventDispatch dispatch;
+    deliver("dir");
+    deliver(".");
+    deliver("dir");
+  }
+  {
+    fw::dm::EventDispatch dispatch;
+    deliver("dir");
+  }
+  REQUIRE(encodings.size() == 4);
+  CHECK(encodings[0] == encodings[2]);
+  CHECK(encodings[0] != encodings[1]);
+  CHECK(encodings[3]->sequence() > encodings[0]->sequence());
+}
@@ -0,0 +1,182 @@
+#include "daemon/eventjournal.h"
+
+#include <catch2/catch.hpp>
+
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+  fw::dm::EncodedEventPtr event(uint64_t sequence)
+  {
+    filewatch::DirectoryEvent direvt;
+    direvt.set_event(filewatch::DirectoryEvent::FILE_ADDED);
+    direvt.set_name("/dir");
+    direvt.mutable_dirname()->set_name(std::to_string(sequence));
+    direvt.set_sequence(sequence);
+    return std::make_shared<const fw::dm::EncodedEvent>(direvt);
+  }
+
+  std::vector<uint64_t>
+  sequences(const std::optional<std::vector<fw::dm::EncodedEventPtr>>& events)
+  {
+    REQUIRE(events);
+    std::vector<uint64_t> result;
+    for (const auto& e : *events)
+    {
+      result.push_back(e->sequence());
+    }
+    return result;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("sequence numbers increase", "[EventJournal]")
+{
+  auto first = fw::dm::next_event_sequence();
+  CHECK(fw::dm::last_event_sequence() >= first);
+  CHECK(fw::dm::next_event_sequence() > first);
+}
+
+TEST_CASE("event journal", "[EventJournal]")
+{
+  fw::dm::EventJournal journal(3, 10);
+  CHECK(journal.last_sequence() == 10);
+  CHECK(sequences(journal.since(10)).empty());
+  CHECK_FALSE(journal.since(9));
+  CHECK_FALSE(journal.since(11));
+
+  journal.append(event(12));
+  journal.append(event(15));
+
+  SECTION("events after the given sequence number")
+  {
+    CHECK(journal.last_sequence() == 15);
+    CHECK(sequences(journal.since(10)) == std::vector<uint64_t>{12, 15});
+    CHECK(sequences(journal.since(11)) == std::vector<uint64_t>{12, 15});
+    CHECK(sequences(journal.since(12)) == std::vector<uint64_t>{15});
+    CHECK(sequences(journal.since(15)).empty());
+    CHECK_FALSE(journal.since(16));
+  }
+
+  SECTION("evicted events cannot be resumed from")
+  {
+    journal.append(event(16));
+    journal.append(event(20));
+    journal.append(event(21));
+    CHECK(journal.size() == 3);
+    CHECK_FALSE(journal.since(10));
+    CHECK_FALSE(journal.since(14));
+    CHECK(sequences(journal.since(15)) == std::vector<uint64_t>{16, 20, 21});
+    CHECK(sequences(journal.since(17)) == std::vector<uint64_t>{20, 21});
+  }
+}
+
+TEST_CASE("empty event journal", "[EventJournal]")
+{
+  fw::dm::EventJournal journal(0, 10);
+  CHECK(sequences(journal.since(10)).empty());
+  journal.append(event(11));
+  CHECK(journal.last_sequence() == 11);
+  CHECK_FALSE(journal.since(10));
+  CHECK(sequences(journal.since(11)).empty());
+}
+
+TEST_CASE("event dispatch", "[EventJournal]")
+{
+  std::vector<std::pair<std::string, uint64_t>> delivered;
+  std::mutex order;
+  auto deliver = [&](std::string name) {
+    fw::dm::sequenced(order, [&delivered, name](uint64_t sequence) {
+      delivered.emplace_back(name, sequence);
+    });
+  };
+
+  SECTION("without a dispatch events are delivered right away")
+  {
+    deliver("a");
+    REQUIRE(delivered.size() == 1);
+    CHECK(delivered[0].second == fw::dm::last_event_sequence());
+  }
+  SECTION("the listeners of an event share its sequence number")
+  {
+    {
+      fw::dm::EventDispatch dispatch;
+      deliver("a");
+      deliver("b");
+      CHECK(delivered.empty());
+    }
+    REQUIRE(delivered.size() == 2);
+    CHECK(delivered[0].second == delivered[1].second);
+  }
+  SECTION("events dispatched while dispatching come after")
+  {
+    {
+      fw::dm::EventDispatch dispatch;
+      deliver("outer");
+      {
+        fw::dm::EventDispatch inner;
+        deliver("inner");
+      }
+      deliver("outer again");
+      CHECK(delivered.empty());
+    }
+    REQUIRE(delivered.size() == 3);
+    CHECK(delivered[0].first == "outer");
+    CHECK(delivered[1].first == "outer again");
+    CHECK(delivered[1].second == delivered[0].second);
+    CHECK(delivered[2].first == "inner");
+    CHECK(delivered[2].second > delivered[0].second);
+  }
+  SECTION("events without a mutex in common are delivered in parallel")
+  {
+    std::promise<void> other_delivered;
+    auto other_future = other_delivered.get_future();
+    std::future_status status = std::future_status::timeout;
+    {
+      fw::dm::EventDispatch dispatch;
+      fw::dm::sequenced(order, [&](uint64_t /*sequence*/) {
+        std::thread other([&]() {
+          std::mutex other_order;
+          fw::dm::EventDispatch other_dispatch;
+          fw::dm::sequenced(other_order, [&](uint64_t /*sequence*/) {
+            other_delivered.set_value();
+          });
+        });
+        status = other_future.wait_for(std::chrono::seconds(10));
+        other.join();
+      });
+    }
+    CHECK(status == std::future_status::ready);
+  }
+  SECTION("the deliveries of an event hold the mutexes of all of them")
+  {
+    std::mutex other_order;
+    bool locked = true;
+    {
+      fw::dm::EventDispatch dispatch;
+      fw::dm::sequenced(order, [&](uint64_t /*sequence*/) {
+        std::thread([&]() {
+          locked = !other_order.try_lock();
+          if (!locked)
+          {
+            other_order.unlock();
+          }
+        }).join();
+      });
+      fw::dm::sequenced(other_order, [](uint64_t /*sequence*/) {});
+    }
+    CHECK(locked);
+    CHECK(order.try_lock());
+    order.unlock();
+  }
+  SECTION("an event nobody asks a sequence number for gets none")
+  {
+    auto last = fw::dm::last_event_sequence();
+    {
+      fw::dm::EventDispatch dispatch;
+    }
+    CHECK(fw::dm::last_event_sequence() == last);
+  }
+}
@@ -0,0 +1,195 @@
+#include "daemon/eventlog.h"
+
+#include <catch2/catch.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+  class TemporaryDirectory
+  {
+  public:
+    TemporaryDirectory() :
+      path(std::filesystem::temp_directory_path()
+           / ("fwdaemon_eventlog_" + std::to_string(::getpid())))
+    {
+      std::filesystem::remove_all(path);
+    }
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+    TemporaryDirectory(TemporaryDirectory&&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory&&) = delete;
+    ~TemporaryDirectory() { std::filesystem::remove_all(path); }
+
+    std::size_t files() const
+    {
+      return static_cast<std::size_t>(
+        std::distance(std::filesystem::directory_iterator(path),
+                      std::filesystem::directory_iterator()));
+    }
+
+    std::filesystem::path path;
+  };
+
+  fw::dm::EncodedEvent event(uint64_t sequence, std::size_t name_size = 10)
+  {
+    filewatch::DirectoryEvent direvt;
+    direvt.set_event(filewatch::DirectoryEvent::FILE_ADDED);
+    direvt.set_name("/dir");
+    direvt.mutable_dirname()->set_name(std::string(name_size, 'x'));
+    direvt.set_sequence(sequence);
+    return fw::dm::EncodedEvent(direvt);
+  }
+
+  std::vector<uint64_t>
+  sequences(const std::vector<fw::dm::EventLog::Record>& records)
+  {
+    std::vector<uint64_t> result;
+    for (const auto& r : records)
+    {
+      result.push_back(r.sequence);
+    }
+    return result;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("event log", "[EventLog]")
+{
+  TemporaryDirectory tmp;
+  fw::dm::EventLogOptions options;
+  options.directory = tmp.path.string();
+  options.segment_size = 4096;
+  options.retention = std::chrono::seconds(10);
+
+  {
+    fw::dm::EventLog log(options, 100);
+    CHECK(log.complete_after() == 100);
+    CHECK(log.last_sequence() == 100);
+    CHECK(log.read_after(0, 10).empty());
+
+    log.append(event(101), 1000);
+    log.append(event(105), 2000);
+    log.append(event(106), 3000);
+    CHECK(log.last_sequence() == 106);
+    CHECK(sequences(log.read_after(100, 10))
+          == std::vector<uint64_t>{101, 105, 106});
+    CHECK(sequences(log.read_after(101, 1)) == std::vector<uint64_t>{105});
+    CHECK(log.sequence_before(500) == 100);
+    CHECK(log.sequence_before(2000) == 101);
+    CHECK(log.sequence_before(2500) == 105);
+    CHECK(log.sequence_before(9000) == 106);
+
+    filewatch::DirectoryEvent direvt;
+    REQUIRE(direvt.ParseFromString(log.read_after(104, 1).front().event));
+    CHECK(direvt.sequence() == 105);
+    CHECK(direvt.name() == "/dir");
+  }
+
+  SECTION("the events survive reopening the log")
+  {
+    fw::dm::EventLog log(options, 500);
+    CHECK(log.complete_after() == 100);
+    CHECK(log.last_sequence() == 106);
+    CHECK(sequences(log.read_after(100, 10))
+          == std::vector<uint64_t>{101, 105, 106});
+
+    log.append(event(600), 4000);
+    CHECK(tmp.files() == 2);  // a reopened log starts a new segment
+    CHECK(sequences(log.read_after(105, 10))
+          == std::vector<uint64_t>{106, 600});
+  }
+
+  SECTION("a torn record ends the records of a segment")
+  {
+    auto segment = std::filesystem::directory_iterator(tmp.path)->path();
+    {
+      std::fstream file(segment, std::ios::in | std::ios::out
+                                   | std::ios::binary);
+      // segment header, two records of 48 bytes, into the third payload
+      file.seekp(16 + 2 * 48 + 24 + 5);
+      file.put('!');
+    }
+    fw::dm::EventLog log(options, 500);
+    CHECK(log.last_sequence() == 105);
+  }
+
+  SECTION("expired segments are deleted when a segment is started")
+  {
+    fw::dm::EventLog log(options, 500);
+    for (uint64_t i = 0; i < 20; ++i)
+    {
+      log.append(event(1000 + i, 1000), 20000 + i);
+    }
+    CHECK(log.complete_after() == 106);
+    CHECK(tmp.files() > 2);
+    CHECK(sequences(log.read_after(106, 1)) == std::vector<uint64_t>{1000});
+  }
+}
+
+TEST_CASE("event log reads from the index", "[EventLog]")
+{
+  TemporaryDirectory tmp;
+  fw::dm::EventLogOptions options;
+  options.directory = tmp.path.string();
+  options.segment_size = 16 * 1024;
+
+  std::vector<uint64_t> all;
+  {
+    fw::dm::EventLog log(options, 0);
+    for (uint64_t i = 1; i <= 1000; ++i)
+    {
+      log.append(event(2 * i), 1000 + i);
+      all.push_back(2 * i);
+    }
+  }
+
+  // reopened, so the index of the older segments is built as they are
+  // opened
+  fw::dm::EventLog log(options, 0);
+  log.append(event(3000), 5000);
+  all.push_back(3000);
+  for (uint64_t after :
+       std::vector<uint64_t>{0, 1, 2, 127, 128, 129, 130, 999, 1000, 2000})
+  {
+    auto first = std::upper_bound(std::begin(all), std::end(all), after);
+    std::vector<uint64_t> expected(first, std::end(all));
+    expected.resize(std::min<std::size_t>(expected.size(), 100));
+    CHECK(sequences(log.read_after(after, 100)) == expected);
+  }
+
+  std::vector<uint64_t> replayed;
+  for (uint64_t position = 0;;)
+  {
+    auto records = log.read_after(position, 64);
+    if (records.empty())
+    {
+      break;
+    }
+    for (const auto& r : records)
+    {
+      replayed.push_back(r.sequence);
+    }
+    position = records.back().sequence;
+  }
+  CHECK(replayed == all);
+
+  CHECK(log.sequence_before(1001) == 0);
+  CHECK(log.sequence_before(1065) == 128);
+  CHECK(log.sequence_before(1066) == 130);
+  CHECK(log.sequence_before(1500) == 998);
+  CHECK(log.sequence_before(4000) == 2000);
+}
+
+TEST_CASE("event log segments have a minimum size", "[EventLog]")
+{
+  TemporaryDirectory tmp;
+  fw::dm::EventLogOptions options;
+  options.directory = tmp.path.string();
+  options.segment_size = 100;
+  CHECK_THROWS_AS(fw::dm::EventLog(options, 0), std::invalid_argument);
+}
@@ -0,0 +1,172 @@
+#include "daemon/eventqueue.h"
+
+#include <catch2/catch.hpp>
+
+#include <grpcpp/impl/codegen/proto_utils.h>
+
+namespace
+{
+  fw::dm::EncodedEventPtr make_event(filewatch::DirectoryEvent::Event event,
+                                     std::string_view name,
+                                     std::string_view old_name = {})
+  {
+    filewatch::DirectoryEvent direvt;
+    direvt.set_event(event);
+    direvt.set_name("/dir");
+    direvt.mutable_dirname()->set_name(std::string{name});
+    direvt.set_old_name(std::string{old_name});
+    return std::make_shared<const fw::dm::EncodedEvent>(direvt);
+  }
+
+  fw::dm::EncodedEventPtr added(std::string_view name)
+  {
+    return make_event(filewatch::DirectoryEvent::FILE_ADDED, name);
+  }
+
+  fw::dm::EncodedEventPtr removed(std::string_view name)
+  {
+    return make_event(filewatch::DirectoryEvent::FILE_REMOVED, name);
+  }
+
+  fw::dm::EventQueueOptions options(std::size_t max_size,
+                                    fw::dm::OverflowPolicy policy)
+  {
+    fw::dm::EventQueueOptions opts;
+    opts.max_size = max_size;
+    opts.overflow_policy = policy;
+    return opts;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("parse overflow policy", "[EventQueue]")
+{
+  CHECK(fw::dm::parse_overflow_policy("drop-oldest")
+        == fw::dm::OverflowPolicy::drop_oldest);
+  CHECK(fw::dm::parse_overflow_policy("coalesce")
+        == fw::dm::OverflowPolicy::coalesce);
+  CHECK(fw::dm::parse_overflow_policy("disconnect")
+        == fw::dm::OverflowPolicy::disconnect);
+  CHECK_THROWS_WITH(fw::dm::parse_overflow_policy("ignore"),
+                    "Unknown overflow policy: ignore");
+}
+
+TEST_CASE("queue events in order", "[EventQueue]")
+{
+  fw::dm::EventQueue queue(options(3, fw::dm::OverflowPolicy::disconnect),
+                           "/dir");
+  CHECK(queue.empty());
+  CHECK(queue.push(added("a")) == fw::dm::EventQueue::PushResult::queued);
+  CHECK(queue.push(added("b")) == fw::dm::EventQueue::PushResult::queued);
+  CHECK(queue.size() == 2);
+  CHECK_FALSE(queue.writing());
+  CHECK(queue.start_write().entry_name() == "a");
+  CHECK(queue.writing());
+  queue.pop();
+  CHECK_FALSE(queue.writing());
+  CHECK(queue.start_write().entry_name() == "b");
+  queue.pop();
+  CHECK(queue.empty());
+}
+
+TEST_CASE("overflow policy drop-oldest", "[EventQueue]")
+{
+  fw::dm::EventQueue queue(options(2, fw::dm::OverflowPolicy::drop_oldest),
+                           "/dir");
+  queue.push(added("a"));
+  queue.push(added("b"));
+
+  SECTION("nothing in flight")
+  {
+    CHECK(queue.push(added("c"))
+          == fw::dm::EventQueue::PushResult::dropped_oldest);
+    REQUIRE(queue.size() == 2);
+    CHECK(queue.start_write().entry_name() == "b");
+  }
+  SECTION("event in flight is kept")
+  {
+    queue.start_write();
+    CHECK(queue.push(added("c")) == fw::dm::EventQueue::PushResult::queued);
+    CHECK(queue.push(added("d"))
+          == fw::dm::EventQueue::PushResult::dropped_oldest);
+    REQUIRE(queue.size() == 3);
+    CHECK(queue.start_write().entry_name() == "a");
+    queue.pop();
+    CHECK(queue.start_write().entry_name() == "c");
+  }
+}
+
+TEST_CASE("overflow policy coalesce", "[EventQueue]")
+{
+  fw::dm::EventQueue queue(options(2, fw::dm::OverflowPolicy::coalesce),
+                           "/dir");
+  queue.push(added("a"));
+  queue.push(added("b"));
+
+  SECTION("newest event about same entry replaces waiting event")
+  {
+    CHECK(queue.push(removed("a"))
+          == fw::dm::EventQueue::PushResult::coalesced);
+    REQUIRE(queue.size() == 2);
+    CHECK(queue.start_write().entry_name() == "b");
+    queue.pop();
+    CHECK(queue.start_write().event()
+          == filewatch::DirectoryEvent::FILE_REMOVED);
+  }
+  SECTION("event in flight is not coalesced")
+  {
+    queue.start_write();
+    queue.push(added("c"));
+    CHECK(queue.push(removed("a"))
+          == fw::dm::EventQueue::PushResult::resync_required);
+  }
+  SECTION("renames are not coalesced")
+  {
+    queue.start_write();
+    queue.pop();
+    queue.push(make_event(filewatch::DirectoryEvent::FILE_RENAMED, "c", "b"));
+    CHECK(queue.push(removed("c"))
+          == fw::dm::EventQueue::PushResult::resync_required);
+  }
+  SECTION("nothing to coalesce requires resync")
+  {
+    CHECK(queue.push(added("c"))
+          == fw::dm::EventQueue::PushResult::resync_required);
+    REQUIRE(queue.size() == 1);
+    CHECK(queue.start_write().event()
+          == filewatch::DirectoryEvent::RESYNC_REQUIRED);
+  }
+}
+
+TEST_CASE("overflow policy disconnect", "[EventQueue]")
+{
+  fw::dm::EventQueue queue(options(2, fw::dm::OverflowPolicy::disconnect),
+                           "/dir");
+  queue.push(added("a"));
+  queue.push(added("b"));
+  queue.start_write();
+  queue.push(added("c"));
+
+  filewatch::DirectoryEvent in_subdir;
+  in_subdir.set_event(filewatch::DirectoryEvent::FILE_ADDED);
+  in_subdir.set_name("/dir/sub");
+  in_subdir.mutable_dirname()->set_name("d");
+  in_subdir.set_sequence(7);
+  CHECK(queue.push(std::make_shared<const fw::dm::EncodedEvent>(in_subdir))
+        == fw::dm::EventQueue::PushResult::resync_required);
+  REQUIRE(queue.size() == 2);
+  CHECK(queue.start_write().entry_name() == "a");
+  queue.pop();
+  const auto& resync = queue.start_write();
+  CHECK(resync.event() == filewatch::DirectoryEvent::RESYNC_REQUIRED);
+  CHECK(resync.name() == "/dir");
+  CHECK(resync.entry_name() == ".");
+  CHECK(resync.sequence() == 7);
+
+  grpc::ByteBuffer bytes(resync.bytes());
+  filewatch::DirectoryEvent message;
+  REQUIRE(grpc::SerializationTraits<filewatch::DirectoryEvent>::Deserialize(
+            &bytes, &message)
+            .ok());
+  CHECK(message.relative_path() == ".");
+}
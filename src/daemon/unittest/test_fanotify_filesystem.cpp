@@ -0,0 +1,430 @@
+#include "daemon/directoryeventlistener.h"
+#include "daemon/fanotifyfilesystem.h"
+#include "daemon/statistics.h"
+#include "dummyfilesystem.h"
+#include "dummyloopthread.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+
+#ifdef __linux__
+
+#  include <fcntl.h>
+#  include <sys/epoll.h>
+#  include <sys/fanotify.h>
+
+#  include <cstring>
+
+namespace
+{
+  class FanotifyDummy : public fw::dm::dtls::Fanotify
+  {
+  public:
+    FanotifyDummy() = default;
+    FanotifyDummy(const FanotifyDummy&) = delete;
+    FanotifyDummy& operator=(const FanotifyDummy&) = delete;
+    FanotifyDummy(FanotifyDummy&&) = delete;
+    FanotifyDummy& operator=(FanotifyDummy&&) = delete;
+    ~FanotifyDummy() override { CHECK(closed_fds.count(init_fd) == 1); }
+
+    static constexpr int init_fd = 42;
+    static constexpr int epoll_fd = 44;
+    static constexpr int event_fd = 45;
+
+    int init_count = 0;
+    int handle_lookups = 0;
+    std::multiset<int> closed_fds;
+
+    struct Mark
+    {
+      unsigned int flags;
+      uint32_t mask;
+      std::string pathname;
+    };
+
+    std::vector<Mark> marks;
+    int mark_error = 0;
+    std::vector<std::string> directories;  // handle id -> absolute path
+
+    int syscall_inotify_init() override
+    {
+      ++init_count;
+      return init_fd;
+    }
+
+    int syscall_close(int fd) override
+    {
+      closed_fds.insert(fd);
+      return 0;
+    }
+
+    int syscall_fanotify_mark(int fd, unsigned int flags, uint32_t mask,
+                              const char* pathname) override
+    {
+      CHECK(fd == init_fd);
+      if (mark_error != 0)
+      {
+        errno = mark_error;
+        return -1;
+      }
+      marks.push_back(Mark{flags, mask, pathname});
+      return 0;
+    }
+
+    int syscall_name_to_handle_at(int dirfd, const char* pathname,
+                                  file_handle* handle, int* /*mount_id*/,
+                                  int /*flags*/) override
+    {
+      CHECK(dirfd == AT_FDCWD);
+      REQUIRE(handle->handle_bytes >= sizeof(int));
+      ++handle_lookups;
+      // the latest directory of that name
+      auto iter = std::find(std::rbegin(directories), std::rend(directories),
+                            pathname);
+      if (iter == std::rend(directories))
+      {
+        errno = ENOENT;
+        return -1;
+      }
+      auto id = static_cast<int>(std::rend(directories) - iter) - 1;
+      handle->handle_bytes = sizeof(int);
+      handle->handle_type = 1;
+      std::memcpy(handle->f_handle, &id, sizeof(int));  // NOLINT
+      return 0;
+    }
+
+    ssize_t syscall_read(int fd, void* buf, size_t count) noexcept override
+    {
+      if (fd != init_fd || waiting_events.empty())
+      {
+        errno = EAGAIN;  // fanotify fd is non-blocking
+        return -1;
+      }
+
+      std::size_t bytes_in_buf = 0;
+      auto* cbuf = static_cast<char*>(buf);
+      while (!waiting_events.empty()
+             && waiting_events.front().size() <= count - bytes_in_buf)
+      {
+        const auto& evt = waiting_events.front();
+        std::memcpy(cbuf + bytes_in_buf, evt.data(), evt.size());  // NOLINT
+        bytes_in_buf += evt.size();
+        waiting_events.pop_front();
+      }
+      return static_cast<ssize_t>(bytes_in_buf);
+    }
+
+    int syscall_epoll_create1(int /*flags*/) override { return epoll_fd; }
+
+    int syscall_eventfd(unsigned int /*initval*/, int /*flags*/) override
+    {
+      return event_fd;
+    }
+
+    int syscall_epoll_ctl(int /*epfd*/, int /*op*/, int /*fd*/,
+                          epoll_event* /*event*/) override
+    {
+      return 0;
+    }
+
+    int syscall_epoll_wait(int /*epfd*/, epoll_event* events,
+                           int /*maxevents*/, int timeout_ms) override
+    {
+      if (waiting_events.empty())
+      {
+        if (timeout_ms == -1)
+        {
+          // emulate error when timeout set to infinity
+          errno = EINTR;
+          return -1;
+        }
+        return 0;
+      }
+      events[0].events = EPOLLIN;  // NOLINT pointer arithmetic
+      events[0].data.fd = init_fd;  // NOLINT pointer arithmetic
+      return 1;
+    }
+
+    ssize_t syscall_write(int fd, const void* /*buf*/, size_t count) override
+    {
+      CHECK(fd == event_fd);
+      return static_cast<ssize_t>(count);
+    }
+
+    int directory(std::string_view absolute_path)
+    {
+      directories.emplace_back(absolute_path);
+      return static_cast<int>(directories.size()) - 1;
+    }
+
+    void push_event(int dir_handle, std::string_view filename, uint64_t mask)
+    {
+      // metadata, fid info record, file handle, handle id, name, padding
+      const auto unpadded = sizeof(fanotify_event_metadata)
+                            + sizeof(fanotify_event_info_fid)
+                            + sizeof(file_handle) + sizeof(int)
+                            + filename.size() + 1;
+      const auto size = (unpadded + 7) / 8 * 8;
+      std::vector<char> evt(size, '\0');
+
+      fanotify_event_metadata metadata{};
+      metadata.event_len = static_cast<uint32_t>(size);
+      metadata.vers = FANOTIFY_METADATA_VERSION;
+      metadata.metadata_len = sizeof(fanotify_event_metadata);
+      metadata.mask = mask;
+      metadata.fd = FAN_NOFD;
+      std::memcpy(evt.data(), &metadata, sizeof(metadata));
+
+      fanotify_event_info_fid fid{};
+      fid.hdr.info_type = FAN_EVENT_INFO_TYPE_DFID_NAME;
+      fid.hdr.len =
+        static_cast<uint16_t>(size - sizeof(fanotify_event_metadata));
+      auto* pos = evt.data() + sizeof(metadata);  // NOLINT
+      std::memcpy(pos, &fid, sizeof(fid));
+
+      file_handle handle{};
+      handle.handle_bytes = sizeof(int);
+      handle.handle_type = 1;
+      pos += sizeof(fid);  // NOLINT
+      std::memcpy(pos, &handle, sizeof(handle));
+      pos += sizeof(handle);  // NOLINT
+      std::memcpy(pos, &dir_handle, sizeof(int));
+      pos += sizeof(int);  // NOLINT
+      std::memcpy(pos, filename.data(), filename.size());
+      waiting_events.push_back(std::move(evt));
+    }
+
+    void queue_overflow()
+    {
+      std::vector<char> evt(sizeof(fanotify_event_metadata), '\0');
+      fanotify_event_metadata metadata{};
+      metadata.event_len = sizeof(fanotify_event_metadata);
+      metadata.vers = FANOTIFY_METADATA_VERSION;
+      metadata.metadata_len = sizeof(fanotify_event_metadata);
+      metadata.mask = FAN_Q_OVERFLOW;
+      metadata.fd = FAN_NOFD;
+      std::memcpy(evt.data(), &metadata, sizeof(metadata));
+      waiting_events.push_back(std::move(evt));
+    }
+
+    std::deque<std::vector<char>> waiting_events;
+  };
+
+  class LoggingDirectoryEventListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    struct Event
+    {
+      filewatch::DirectoryEvent::Event event;
+      std::string containing_dir;
+      std::string dir_name;
+      uint64_t mtime;
+      uint64_t size;
+    };
+
+    std::vector<Event> events;
+
+    void notify(filewatch::DirectoryEvent::Event event,
+                std::string_view containing_dir,
+                std::string_view dir_name,
+                uint64_t mtime,
+                uint64_t size,
+                std::string_view /*old_name*/) override
+    {
+      events.push_back(Event{event, std::string(containing_dir),
+                             std::string(dir_name), mtime, size});
+    }
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("fanotify init and dtor", "[FanotifyFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Fanotify::create<FanotifyDummy>();
+  auto* fanotify = dynamic_cast<FanotifyDummy*>(ptr.get());
+  fw::dm::FanotifyFileSystem<DummyFileSystem> fs(
+    "/rootdir", std::move(ptr), std::make_unique<DummyLoopThreadFactory>());
+  CHECK(fanotify->init_count == 1);
+
+  // CHECK in FanotifyDummy dtor verifies that the fanotify fd is closed
+}
+
+TEST_CASE("fanotify marks the filesystem once", "[FanotifyFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Fanotify::create<FanotifyDummy>();
+  auto* fanotify = dynamic_cast<FanotifyDummy*>(ptr.get());
+  fw::dm::FanotifyFileSystem<DummyFileSystem> fs(
+    "/rootdir", std::move(ptr), std::make_unique<DummyLoopThreadFactory>());
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/", "other", 2);
+  fanotify->directory("/rootdir/dir");
+  fanotify->directory("/rootdir/other");
+  LoggingDirectoryEventListener listener;
+
+  SECTION("marked while directories are watched")
+  {
+    fs.watch("/dir", listener);
+    fs.watch("/other", listener);
+    REQUIRE(fanotify->marks.size() == 1);
+    CHECK(fanotify->marks[0].pathname == "/rootdir");
+    CHECK((fanotify->marks[0].flags & FAN_MARK_ADD) != 0);
+    CHECK((fanotify->marks[0].flags & FAN_MARK_FILESYSTEM) != 0);
+    CHECK(fanotify->marks[0].mask == fw::dm::dtls::fanotify_mask());
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[0].event
+          == filewatch::DirectoryEvent::WATCHING_DIRECTORY);
+
+    fs.stop_watching("/dir", listener);
+    CHECK(fanotify->marks.size() == 1);
+    fs.stop_watching("/other", listener);
+    REQUIRE(fanotify->marks.size() == 2);
+    CHECK((fanotify->marks[1].flags & FAN_MARK_REMOVE) != 0);
+  }
+
+  SECTION("mark error is reported")
+  {
+    fanotify->mark_error = EPERM;
+    CHECK_THROWS_WITH(fs.watch("/dir", listener),
+                      Catch::Contains("CAP_SYS_ADMIN"));
+  }
+}
+
+TEST_CASE("fanotify events", "[FanotifyFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Fanotify::create<FanotifyDummy>();
+  auto* fanotify = dynamic_cast<FanotifyDummy*>(ptr.get());
+  DummyThreads threads;
+  fw::dm::FanotifyFileSystem<DummyFileSystem> fs(
+    "/rootdir", std::move(ptr),
+    std::make_unique<DummyLoopThreadFactory>(threads));
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/dir", "sub", 2);
+  auto dir = fanotify->directory("/rootdir/dir");
+  auto sub = fanotify->directory("/rootdir/dir/sub");
+  auto outside = fanotify->directory("/elsewhere/dir");
+  LoggingDirectoryEventListener listener;
+  fs.watch("/dir/", listener);
+  listener.events.clear();
+  CHECK(fanotify->handle_lookups == 1);
+
+  SECTION("file added")
+  {
+    fs.add_file("/dir", "file", 1234);
+    fanotify->push_event(dir, "file", FAN_CREATE);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 1);
+    CHECK(listener.events[0].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[0].containing_dir == "/dir");
+    CHECK(listener.events[0].dir_name == "file");
+    CHECK(listener.events[0].mtime == 1234);
+  }
+
+  SECTION("directory added and removed")
+  {
+    fs.add_dir("/dir", "newdir", 5678);
+    fanotify->push_event(dir, "newdir", FAN_CREATE | FAN_ONDIR);
+    fanotify->push_event(dir, "sub", FAN_DELETE | FAN_ONDIR);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[0].event
+          == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+    CHECK(listener.events[0].mtime == 5678);
+    CHECK(listener.events[1].event
+          == filewatch::DirectoryEvent::DIRECTORY_REMOVED);
+    CHECK(listener.events[1].dir_name == "sub");
+    CHECK(fs.moved == std::vector<std::string>{"/dir/sub"});
+  }
+
+  SECTION("merged create and delete of an entry that is gone")
+  {
+    fanotify->push_event(dir, "tmpfile", FAN_CREATE | FAN_DELETE);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[0].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_REMOVED);
+  }
+
+  SECTION("file modified")
+  {
+    fs.add_file("/dir", "file", 1234);
+    fs.write_file("/dir/file", "abc");
+    fanotify->push_event(dir, "file", FAN_CLOSE_WRITE);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 1);
+    CHECK(listener.events[0].event == filewatch::DirectoryEvent::FILE_MODIFIED);
+    CHECK(listener.events[0].size == 3);
+  }
+
+  SECTION("moves are removals and additions")
+  {
+    fs.rm_dir("/dir", "sub");
+    fs.add_dir("/dir", "renamed", 2);
+    fanotify->push_event(dir, "sub", FAN_MOVED_FROM | FAN_ONDIR);
+    fanotify->push_event(dir, "renamed", FAN_MOVED_TO | FAN_ONDIR);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[0].event
+          == filewatch::DirectoryEvent::DIRECTORY_REMOVED);
+    CHECK(listener.events[1].event
+          == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+    CHECK(listener.events[1].dir_name == "renamed");
+    CHECK(fs.moved == std::vector<std::string>{"/dir/sub"});
+  }
+
+  SECTION("events in unwatched directories are ignored")
+  {
+    fanotify->push_event(sub, "file", FAN_CREATE);
+    fanotify->push_event(outside, "file", FAN_CREATE);
+    fanotify->push_event(1000, "file", FAN_CREATE);  // stale handle
+    threads.run_once();
+    CHECK(listener.events.empty());
+    CHECK(fanotify->handle_lookups == 1);
+  }
+
+  SECTION("a watched directory that is replaced is followed")
+  {
+    fs.watch("/dir/sub", listener);
+    fs.rm_dir("/dir", "sub");
+    fs.add_dir("/dir", "sub", 3);
+    auto replaced = fanotify->directory("/rootdir/dir/sub");
+    fanotify->push_event(dir, "sub", FAN_MOVED_TO | FAN_ONDIR);
+    fs.add_file("/dir/sub", "file", 1234);
+    fanotify->push_event(replaced, "file", FAN_CREATE);
+    threads.run_once();
+    CHECK(listener.events.back().event
+          == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events.back().containing_dir == "/dir/sub");
+    fanotify->push_event(sub, "file", FAN_CREATE);
+    auto count = listener.events.size();
+    threads.run_once();
+    CHECK(listener.events.size() == count);
+    fs.stop_watching("/dir/sub", listener);
+  }
+
+  SECTION("resync after event queue overflow")
+  {
+    fs.add_file("/dir", "missed", 42);
+    fanotify->queue_overflow();
+    threads.run_once();
+    REQUIRE(listener.events.size() == 1);
+    CHECK(listener.events[0].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[0].dir_name == "missed");
+  }
+
+  fs.stop_watching("/dir", listener);
+}
+
+TEST_CASE("fanotify watched directory names", "[FanotifyFileSystem]")
+{
+  using fw::dm::dtls::watched_dirname;
+  CHECK(watched_dirname("/rootdir", "/rootdir") == "/");
+  CHECK(watched_dirname("/rootdir/", "/rootdir/a/b") == "/a/b");
+  CHECK(watched_dirname("/", "/a") == "/a");
+  CHECK_FALSE(watched_dirname("/rootdir", "/rootdir2/a").has_value());
+  CHECK_FALSE(watched_dirname("/rootdir", "/other").has_value());
+}
+
+#endif  // __linux__
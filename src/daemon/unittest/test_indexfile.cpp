@@ -0,0 +1,88 @@
+#include "daemon/indexfile.h"
+
+#include <catch2/catch.hpp>
+
+#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
+
+namespace
+{
+  class TemporaryFile
+  {
+  public:
+    TemporaryFile() :
+      path(std::filesystem::temp_directory_path()
+           / ("fwdaemon_index_" + std::to_string(::getpid())))
+    {
+      std::filesystem::remove(path);
+    }
+    TemporaryFile(const TemporaryFile&) = delete;
+    TemporaryFile& operator=(const TemporaryFile&) = delete;
+    TemporaryFile(TemporaryFile&&) = delete;
+    TemporaryFile& operator=(TemporaryFile&&) = delete;
+    ~TemporaryFile() { std::filesystem::remove(path); }
+
+    std::filesystem::path path;
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("index file", "[IndexFile]")
+{
+  TemporaryFile tmp;
+  const auto path = tmp.path.string();
+  CHECK_FALSE(fw::dm::load_index(path));
+
+  fw::dm::IndexSnapshot snapshot;
+  snapshot.timestamp = 1234;
+  snapshot.directories["/"] =
+    fw::dm::IndexedDirectory{10, {{"dir", true, 11, 4096}}};
+  snapshot.directories["/dir"] = fw::dm::IndexedDirectory{
+    11, {{"a", false, 12, 100}, {"b", false, 13, 200}}};
+  snapshot.directories["/dir/empty"] = fw::dm::IndexedDirectory{14, {}};
+  fw::dm::save_index(path, snapshot);
+
+  SECTION("the saved snapshot is loaded")
+  {
+    auto loaded = fw::dm::load_index(path);
+    REQUIRE(loaded);
+    CHECK(loaded->timestamp == 1234);
+    REQUIRE(loaded->directories.size() == 3);
+    const auto& dir = loaded->directories.at("/dir");
+    CHECK(dir.mtime == 11);
+    REQUIRE(dir.entries.size() == 2);
+    CHECK(dir.entries[1].name == "b");
+    CHECK_FALSE(dir.entries[1].is_dir);
+    CHECK(dir.entries[1].mtime == 13);
+    CHECK(dir.entries[1].size == 200);
+    CHECK(loaded->directories.at("/").entries[0].is_dir);
+    CHECK(loaded->directories.at("/dir/empty").entries.empty());
+  }
+
+  SECTION("a new snapshot replaces the old one")
+  {
+    snapshot.directories.erase("/dir");
+    fw::dm::save_index(path, snapshot);
+    auto loaded = fw::dm::load_index(path);
+    REQUIRE(loaded);
+    CHECK(loaded->directories.size() == 2);
+  }
+
+  SECTION("a damaged file is ignored")
+  {
+    {
+      std::fstream file(tmp.path, std::ios::in | std::ios::out);
+      file.seekp(-3, std::ios::end);
+      file.put('x');
+    }
+    CHECK_FALSE(fw::dm::load_index(path));
+  }
+
+  SECTION("a truncated file is ignored")
+  {
+    std::filesystem::resize_file(tmp.path, 20);
+    CHECK_FALSE(fw::dm::load_index(path));
+  }
+}
@@ -1,16 +1,23 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "common/loop_thread.h"
 #include "daemon/directoryeventlistener.h"
 #include "daemon/linuxfilesystem.h"
+#include "daemon/statistics.h"
 #include "dummyfilesystem.h"
+#include "dummyloopthread.h"
 
 #include <catch2/catch.hpp>
+#include <fmt/format.h>
 
-#include <queue>
+#include <set>
+#include <thread>
 
 #ifdef __linux__
 
+#  include <sys/epoll.h>
 #  include <sys/inotify.h>
 
+#  include <algorithm>
 #  include <cstring>
 
 namespace
@@ -51,8 +58,11 @@ namespace
 
     int syscall_close(int fd) override
     {
-      CHECK(fd == init_fd);
-      closed_fd = fd;
+      CHECK((fd == init_fd || fd == epoll_fd || fd == event_fd));
+      if (fd == init_fd)
+      {
+        closed_fd = fd;
+      }
       return 0;
     }
 
@@ -88,23 +98,26 @@ namespace
 
     ssize_t syscall_read(int fd, void* buf, size_t count) noexcept override
     {
-      if (fd == 42)  // pipe fd
+      if (fd == event_fd)
       {
-        const size_t n = std::min(count, pipe_queue.size());
-        for (size_t i = 0; i < n; ++i)
+        if (eventfd_counter == 0 || count < sizeof(uint64_t))
         {
-          static_cast<char*>(buf)[i] = pipe_queue.front();  // NOLINT ptr arithm
-          pipe_queue.pop();
+          errno = EAGAIN;
+          return -1;
         }
+        std::memcpy(buf, &eventfd_counter, sizeof(uint64_t));
+        eventfd_counter = 0;
+        return sizeof(uint64_t);
       }
-      else if (fd != init_fd)
+      if (fd != init_fd)
       {
         return 0;
       }
 
       if (event_pos == waiting_events.size())
       {
-        return 0;
+        errno = EAGAIN;  // inotify fd is non-blocking
+        return -1;
       }
 
       size_t bytes_in_buf = 0;
@@ -119,8 +132,7 @@ namespace
         auto event_struct_size = waiting_events[event_pos].second;
         count -= event_struct_size;
         std::memcpy(cbuf, waiting_events[event_pos].first, event_struct_size);
-        // NOLINTNEXTLINE (pointer arithmetic)
-        cbuf += enforce_4byte_alignment(event_struct_size);
+        cbuf += event_struct_size;  // NOLINT (pointer arithmetic)
         bytes_in_buf += event_struct_size;
         ++event_pos;
       }
@@ -135,63 +147,61 @@ namespace
       return -1;
     }
 
-    int syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) override
+    int syscall_epoll_create1(int /*flags*/) override { return epoll_fd; }
+
+    int syscall_eventfd(unsigned int /*initval*/, int /*flags*/) override
+    {
+      return event_fd;
+    }
+
+    int syscall_epoll_ctl(int epfd, int op, int fd,
+                          epoll_event* event) override
     {
-      int fd_count_with_events = 0;
-      for (nfds_t i = 0; i < nfds; ++i)
+      CHECK(epfd == epoll_fd);
+      CHECK(op == EPOLL_CTL_ADD);
+      CHECK(event->data.fd == fd);
+      registered_fds.insert(fd);
+      return 0;
+    }
+
+    int syscall_epoll_wait(int epfd, epoll_event* events, int maxevents,
+                           int timeout_ms) override
+    {
+      CHECK(epfd == epoll_fd);
+      ++epoll_wait_count;
+      int ready = 0;
+      if (registered_fds.count(init_fd) != 0
+          && waiting_events.size() > event_pos && ready < maxevents)
       {
-        if (fds[i].fd == init_fd)  // NOLINT pointer arithmetic
-        {
-          if ((fds[i].events & POLLIN) != 0)  // NOLINT pointer arithmetic
-          {
-            if (waiting_events.size() > event_pos)
-            {
-              fds[i].revents |= POLLIN;  // NOLINT pointer arithmetic
-              ++fd_count_with_events;
-            }
-          }
-        }
-        if (fds[i].fd == 42)  // NOLINT - pipe fd
-        {
-          if ((fds[i].events & POLLIN) != 0)  // NOLINT
-          {
-            if (!pipe_queue.empty())
-            {
-              fds[i].revents |= POLLIN;  // NOLINT
-              ++fd_count_with_events;
-            }
-          }
-        }
+        events[ready].events = EPOLLIN;  // NOLINT pointer arithmetic
+        events[ready].data.fd = init_fd;  // NOLINT pointer arithmetic
+        ++ready;
       }
-      if (timeout_ms == -1 && fd_count_with_events == 0)
+      if (registered_fds.count(event_fd) != 0 && eventfd_counter != 0
+          && ready < maxevents)
+      {
+        events[ready].events = EPOLLIN;  // NOLINT pointer arithmetic
+        events[ready].data.fd = event_fd;  // NOLINT pointer arithmetic
+        ++ready;
+      }
+      if (timeout_ms == -1 && ready == 0)
       {
         // emulate error when timeout set to infinity
         errno = EINTR;  // A signal occurred before any requested event
         return -1;
       }
 
-      return fd_count_with_events;
+      return ready;
     }
 
-    int syscall_pipe2(std::array<int, 2>& pipefd, int /*flags*/) override
-    {
-      pipefd[0] = 42;
-      pipefd[1] = 44;
-      return 0;
-    }
     ssize_t syscall_write(int fd, const void* buf, size_t count) override
     {
-      if (fd == 44)
-      {
-        for (size_t i = 0; i < count; ++i)
-        {
-          pipe_queue.push(
-            static_cast<const char*>(buf)[i]);  // NOLINT ptr arith
-        }
-
-        return static_cast<ssize_t>(count);
-      }
-      return 0;
+      CHECK(fd == event_fd);
+      REQUIRE(count == sizeof(uint64_t));
+      uint64_t value = 0;
+      std::memcpy(&value, buf, sizeof(uint64_t));
+      eventfd_counter += value;
+      return static_cast<ssize_t>(count);
     }
 
     void file_added(std::string_view containing_dir, std::string_view filename)
@@ -207,23 +217,53 @@ namespace
       push_event(containing_dir, filename, IN_DELETE);
     }
 
+    void file_moved(std::string_view from_dir, std::string_view from,
+                    std::string_view to_dir, std::string_view to,
+                    uint32_t cookie)
+    {
+      spdlog::debug("file moved: {}/{} -> {}/{}\n", from_dir, from, to_dir,
+                    to);
+      push_event(from_dir, from, IN_MOVED_FROM, cookie);
+      push_event(to_dir, to, IN_MOVED_TO, cookie);
+    }
+
+    void file_written(std::string_view containing_dir,
+                      std::string_view filename)
+    {
+      spdlog::debug("file written: {} in {}\n", filename, containing_dir);
+      push_event(containing_dir, filename, IN_CLOSE_WRITE);
+    }
+
+    void queue_overflow()
+    {
+      void* eventmem = std::calloc(1, sizeof(inotify_event));  // NOLINT
+      REQUIRE(eventmem != nullptr);
+      inotify_event* event = new (eventmem) inotify_event;  // NOLINT
+      event->wd = -1;
+      event->mask = IN_Q_OVERFLOW;
+      waiting_events.emplace_back(
+        std::make_pair(eventmem, sizeof(inotify_event)));
+    }
+
     void push_event(std::string_view containing_dir, std::string_view filename,
-                    uint32_t mask)
+                    uint32_t mask, uint32_t cookie = 0)
     {
       static_assert(NAME_MAX < 0xFFFFFFFF);
       REQUIRE(filename.size() < NAME_MAX);
-      const auto structsize = sizeof(inotify_event) + filename.size();
+      // like the kernel, pad name with null bytes to keep events aligned
+      const auto namesize = enforce_4byte_alignment(filename.size());
+      const auto structsize = sizeof(inotify_event) + namesize;
       for (std::size_t i = 0; i < watches.size(); ++i)
       {
         if (watches[i].pathname == containing_dir)
         {
-          void* eventmem = std::malloc(structsize);  // NOLINT
+          void* eventmem = std::calloc(1, structsize);  // NOLINT
           REQUIRE(eventmem != nullptr);
           inotify_event* event = new (eventmem) inotify_event;  // NOLINT
           event->wd = static_cast<int>(i);
           event->mask = mask;
-          event->cookie = 0;
-          event->len = static_cast<uint32_t>(filename.size());
+          event->cookie = cookie;
+          event->len = static_cast<uint32_t>(namesize);
           // NOLINTNEXTLINE
           std::strncpy(event->name, filename.data(), filename.size());
           waiting_events.emplace_back(std::make_pair(eventmem, structsize));
@@ -233,96 +273,51 @@ namespace
 
     std::vector<std::pair<void*, size_t>> waiting_events;
     std::size_t event_pos = 0;
-    std::queue<char> pipe_queue;
+    int epoll_fd = 43;
+    int event_fd = 44;
+    std::set<int> registered_fds;
+    uint64_t eventfd_counter = 0;
+    int epoll_wait_count = 0;
   };
 
-  class DummyLoopThread;
-
-  class DummyThreads
-  {
-  public:
-    DummyThreads() = default;
-
-    void run_once();
-
-    void add_thread(DummyLoopThread& th) { threads.insert(&th); }
-    void remove_thread(DummyLoopThread& th) { threads.erase(&th); }
+}  // anonymous namespace
 
-  private:
-    std::set<DummyLoopThread*> threads;
-  };
+TEST_CASE("inotify epoll loop", "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  CHECK(inotify->registered_fds == std::set<int>{42, 44});
 
-  class DummyLoopThread : public threading::LoopThread
+  SECTION("adding and removing watches does not signal the poll thread")
   {
-  public:
-    DummyLoopThread(DummyThreads& threads_, std::function<void()> iter_fun) :
-      threads(threads_), iteration_fun(std::move(iter_fun)), suspended(true),
-      stopped(false), joined(false)
-    {
-      threads.add_thread(*this);
-    }
-    DummyLoopThread(const DummyLoopThread&) = delete;
-    DummyLoopThread& operator=(const DummyLoopThread&) = delete;
-    DummyLoopThread(DummyLoopThread&&) = delete;
-    DummyLoopThread& operator=(DummyLoopThread&&) = delete;
-    ~DummyLoopThread() override { threads.remove_thread(*this); }
-
-    void join() override { joined = true; }
-    [[nodiscard]] bool is_joinable() const override { return !joined; }
-    void suspend() override { suspended = true; }
-    void unsuspend() override { suspended = false; }
-    [[nodiscard]] bool is_suspended() const override { return suspended; }
-    void stop() override { stopped = true; }
-    [[nodiscard]] bool is_stopped() const override { return stopped; }
-
-    void run_one_iteration()
-    {
-      if (!stopped || !suspended)
-      {
-        iteration_fun();
-      }
-    }
-
-  private:
-    DummyThreads& threads;
-    std::function<void()> iteration_fun;
-    bool suspended, stopped, joined;
-  };
+    auto wd = inotify->add_watch("/some/dir", IN_CREATE);
+    inotify->rm_watch(wd);
+    CHECK(inotify->eventfd_counter == 0);
+  }
 
-  void DummyThreads::run_once()
+  SECTION("terminate_poll interrupts poll")
   {
-    for (auto* thread : threads)
-    {
-      thread->run_one_iteration();
-    }
+    inotify->terminate_poll();
+    uint32_t revents = 0;
+    errno = 0;
+    CHECK(inotify->poll(revents, 0) == -1);
+    CHECK(errno == EINTR);
+    CHECK(inotify->eventfd_counter == 0);
+    CHECK(inotify->poll(revents, 0) == 0);
   }
 
-  class DummyLoopThreadFactory : public threading::LoopThreadFactory
+  SECTION("pending events are returned before termination")
   {
-  public:
-    DummyLoopThreadFactory() : threads(my_threads) {}
-    explicit DummyLoopThreadFactory(DummyThreads& threads_) : threads(threads_)
-    {
-    }
-
-    std::unique_ptr<threading::LoopThread>
-    create_thread(std::function<void()> iteration_fun,
-                  bool create_suspended = false) override
-    {
-      auto t = std::make_unique<DummyLoopThread>(threads, iteration_fun);
-      if (!create_suspended)
-      {
-        t->unsuspend();
-      }
-      return t;
-    }
-
-  private:
-    DummyThreads my_threads;
-    DummyThreads& threads;
-  };
+    inotify->add_watch("/some/dir", IN_CREATE);
+    inotify->file_added("/some/dir", "file");
+    inotify->terminate_poll();
+    uint32_t revents = 0;
+    CHECK(inotify->poll(revents, 0) == 1);
+    CHECK((revents & EPOLLIN) != 0);
+  }
 
-}  // anonymous namespace
+  fw::dm::dtls::close_inotify(*inotify);
+}
 
 TEST_CASE("inotify init and dtor", "[LinuxFileSystem]")
 {
@@ -336,6 +331,27 @@ TEST_CASE("inotify init and dtor", "[LinuxFileSystem]")
   // CHECK's in InotifyDummy dtor and syscall_close() verifies dtor behaviour
 }
 
+namespace
+{
+  class EpollFailingInotifyDummy : public InotifyDummy
+  {
+  public:
+    int syscall_epoll_create1(int /*flags*/) override
+    {
+      errno = EMFILE;
+      return -1;
+    }
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("inotify closes its fd if init fails", "[LinuxFileSystem]")
+{
+  // the InotifyDummy dtor checks that the inotify fd was closed
+  CHECK_THROWS_AS(fw::dm::dtls::Inotify::create<EpollFailingInotifyDummy>(),
+                  std::runtime_error);
+}
+
 namespace
 {
   class LoggingDirectoryEventListener : public fw::dm::DirectoryEventListener
@@ -347,6 +363,8 @@ namespace
       std::string containing_dir;
       std::string dir_name;
       uint64_t mtime;
+      uint64_t size;
+      std::string old_name;
     };
 
     std::vector<Event> events;
@@ -354,12 +372,15 @@ namespace
     void notify(filewatch::DirectoryEvent::Event event,
                 std::string_view containing_dir,
                 std::string_view dir_name,
-                uint64_t mtime) override
+                uint64_t mtime,
+                uint64_t size,
+                std::string_view old_name) override
     {
       spdlog::debug("LoggingDirectoryEventListener::notify(x, {}, {} {})\n",
                     containing_dir, dir_name, mtime);
       events.push_back(Event{event, std::string(containing_dir),
-                             std::string(dir_name), mtime});
+                             std::string(dir_name), mtime, size,
+                             std::string(old_name)});
     }
   };
 
@@ -477,9 +498,12 @@ TEST_CASE("notify DirectoryEventListener", "[LinuxFileSystem]")
   auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
   auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
   DummyThreads threads;
+  fw::dm::WatchOptions options;
+  auto now = std::chrono::steady_clock::now();
+  options.clock = [&now]() { return now; };
   fw::dm::OSFileSystem<DummyFileSystem> fs(
     "/home/user/rootdir", std::move(ptr),
-    std::make_unique<DummyLoopThreadFactory>(threads));
+    std::make_unique<DummyLoopThreadFactory>(threads), options);
   fs.add_dir("/", "dir", 12356780);
   fs.add_file("/dir", "filename", 12356789);
   fs.add_dir("/dir", "dirname", 12356790);
@@ -502,6 +526,17 @@ TEST_CASE("notify DirectoryEventListener", "[LinuxFileSystem]")
     CHECK(listener.events[1].dir_name == "filename");
     CHECK(listener.events[1].mtime == 12356789);
   }
+  SECTION("several events are read in one batch")
+  {
+    fs.add_file("/dir", "otherfile", 12356791);
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    inotify->file_added("/home/user/rootdir/dir", "otherfile");
+    threads.run_once();
+    REQUIRE(listener.events.size() == 3);
+    CHECK(listener.events[1].dir_name == "filename");
+    CHECK(listener.events[2].dir_name == "otherfile");
+    CHECK(fw::dm::statistics().counter("inotify.events_per_read") == 2);
+  }
   SECTION("remove file")
   {
     fs.rm_file("/dir", "filename");
@@ -536,6 +571,663 @@ TEST_CASE("notify DirectoryEventListener", "[LinuxFileSystem]")
     CHECK(listener.events[1].dir_name == "dirname");
     CHECK(listener.events[1].mtime == 0);
   }
+  SECTION("added file has a size")
+  {
+    fs.write_file("/dir/filename", "contents");
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].size == 8);
+  }
+  SECTION("modify file")
+  {
+    fs.write_file("/dir/filename", "new contents");
+    inotify->file_written("/home/user/rootdir/dir", "filename");
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_MODIFIED);
+    CHECK(listener.events[1].dir_name == "filename");
+    CHECK(listener.events[1].mtime == 12356789);
+    CHECK(listener.events[1].size == 12);
+  }
+  SECTION("rename within the directory is one event")
+  {
+    fs.rm_file("/dir", "filename");
+    fs.add_file("/dir", "filename.1", 12356789);
+    inotify->file_moved("/home/user/rootdir/dir", "filename",
+                        "/home/user/rootdir/dir", "filename.1", 17);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_RENAMED);
+    CHECK(listener.events[1].dir_name == "filename.1");
+    CHECK(listener.events[1].old_name == "filename");
+    CHECK(listener.events[1].mtime == 12356789);
+  }
+  SECTION("rename directory")
+  {
+    fs.rm_dir("/dir", "dirname");
+    fs.add_dir("/dir", "newname", 12356790);
+    inotify->push_event("/home/user/rootdir/dir", "dirname",
+                        IN_MOVED_FROM | IN_ISDIR, 18);
+    inotify->push_event("/home/user/rootdir/dir", "newname",
+                        IN_MOVED_TO | IN_ISDIR, 18);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event
+          == filewatch::DirectoryEvent::DIRECTORY_RENAMED);
+    CHECK(listener.events[1].dir_name == "newname");
+    CHECK(listener.events[1].old_name == "dirname");
+    CHECK(fs.moved == std::vector<std::string>{"/dir/dirname"});
+
+    // the new name is known to be a directory now
+    fs.rm_dir("/dir", "newname");
+    inotify->file_removed("/home/user/rootdir/dir", "newname");
+    threads.run_once();
+    REQUIRE(listener.events.size() == 3);
+    CHECK(listener.events[2].event
+          == filewatch::DirectoryEvent::DIRECTORY_REMOVED);
+  }
+  SECTION("a watched directory that is moved is not at its path anymore")
+  {
+    inotify->push_event("/home/user/rootdir/dir", "", IN_MOVE_SELF);
+    threads.run_once();
+    CHECK(fs.moved == std::vector<std::string>{"/dir"});
+  }
+  SECTION("moved out of the watched directories is a removal")
+  {
+    fs.rm_file("/dir", "filename");
+    inotify->push_event("/home/user/rootdir/dir", "filename", IN_MOVED_FROM,
+                        19);
+    threads.run_once();
+    CHECK(listener.events.size() == 1);
+
+    // once the IN_MOVED_TO cannot be on its way anymore
+    now += fw::dm::dtls::move_pairing_window;
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_REMOVED);
+    CHECK(listener.events[1].dir_name == "filename");
+  }
+  SECTION("a rename split over two reads is one event")
+  {
+    fs.rm_file("/dir", "filename");
+    fs.add_file("/dir", "filename.1", 12356789);
+    inotify->push_event("/home/user/rootdir/dir", "filename", IN_MOVED_FROM,
+                        22);
+    threads.run_once();
+    inotify->push_event("/home/user/rootdir/dir", "filename.1", IN_MOVED_TO,
+                        22);
+    threads.run_once();
+    now += fw::dm::dtls::move_pairing_window;
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_RENAMED);
+    CHECK(listener.events[1].old_name == "filename");
+    CHECK(listener.events[1].dir_name == "filename.1");
+  }
+  SECTION("a file moved away and created again is removed before it is added")
+  {
+    inotify->push_event("/home/user/rootdir/dir", "filename", IN_MOVED_FROM,
+                        23);
+    threads.run_once();
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    threads.run_once();
+    REQUIRE(listener.events.size() == 3);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_REMOVED);
+    CHECK(listener.events[1].dir_name == "filename");
+    CHECK(listener.events[2].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[2].dir_name == "filename");
+
+    now += fw::dm::dtls::move_pairing_window;
+    threads.run_once();
+    CHECK(listener.events.size() == 3);
+  }
+  SECTION("moved in from outside the watched directories is an addition")
+  {
+    fs.add_file("/dir", "incoming", 12356791);
+    inotify->push_event("/home/user/rootdir/dir", "incoming", IN_MOVED_TO, 20);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].dir_name == "incoming");
+    CHECK(listener.events[1].mtime == 12356791);
+  }
+  SECTION("moved between watched directories")
+  {
+    fs.add_dir("/", "other", 12356792);
+    LoggingDirectoryEventListener other_listener;
+    fs.watch("/other", other_listener);
+    fs.rm_file("/dir", "filename");
+    fs.add_file("/other", "filename", 12356789);
+    inotify->file_moved("/home/user/rootdir/dir", "filename",
+                        "/home/user/rootdir/other", "filename", 21);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_REMOVED);
+    REQUIRE(other_listener.events.size() == 2);
+    CHECK(other_listener.events[1].event
+          == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(other_listener.events[1].dir_name == "filename");
+  }
+}
+
+TEST_CASE("directories are spread over inotify shards", "[LinuxFileSystem]")
+{
+  std::vector<std::unique_ptr<fw::dm::dtls::Inotify>> inotifies;
+  std::vector<InotifyDummy*> dummies;
+  for (int i = 0; i < 4; ++i)
+  {
+    inotifies.push_back(fw::dm::dtls::Inotify::create<InotifyDummy>());
+    dummies.push_back(dynamic_cast<InotifyDummy*>(inotifies.back().get()));
+  }
+  DummyThreads threads;
+  fw::dm::OSFileSystem<DummyFileSystem> fs(
+    "/home/user/rootdir", std::move(inotifies),
+    std::make_unique<DummyLoopThreadFactory>(threads));
+
+  const std::vector<std::string> dirnames{"/a", "/b", "/c", "/d", "/e",
+                                          "/f", "/g", "/h"};
+  LoggingDirectoryEventListener listener;
+  for (const auto& dirname : dirnames)
+  {
+    fs.add_dir("/", dirname.substr(1), 12356780);
+    fs.add_file(dirname, "file", 12356781);
+    fs.watch(dirname, listener);
+  }
+  REQUIRE(listener.events.size() == dirnames.size());
+
+  SECTION("each directory is watched by the shard its name hashes to")
+  {
+    std::size_t watch_count = 0;
+    for (const auto& dirname : dirnames)
+    {
+      auto* inotify = dummies[fw::dm::dtls::shard_index(dirname, 4)];
+      CHECK(std::count_if(std::begin(inotify->watches),
+                          std::end(inotify->watches), [&](const auto& w) {
+                            return w.pathname == "/home/user/rootdir" + dirname;
+                          })
+            == 1);
+    }
+    for (auto* inotify : dummies)
+    {
+      watch_count += inotify->watches.size();
+    }
+    CHECK(watch_count == dirnames.size());
+  }
+
+  SECTION("events are read from every shard, in order per directory")
+  {
+    for (const auto& dirname : dirnames)
+    {
+      auto* inotify = dummies[fw::dm::dtls::shard_index(dirname, 4)];
+      inotify->file_removed("/home/user/rootdir" + dirname, "file");
+      inotify->file_added("/home/user/rootdir" + dirname, "file");
+    }
+    threads.run_once();
+
+    REQUIRE(listener.events.size() == 3 * dirnames.size());
+    for (const auto& dirname : dirnames)
+    {
+      std::vector<filewatch::DirectoryEvent::Event> events;
+      for (const auto& e : listener.events)
+      {
+        if (e.containing_dir == dirname)
+        {
+          events.push_back(e.event);
+        }
+      }
+      CHECK(events
+            == std::vector<filewatch::DirectoryEvent::Event>{
+              filewatch::DirectoryEvent::WATCHING_DIRECTORY,
+              filewatch::DirectoryEvent::FILE_REMOVED,
+              filewatch::DirectoryEvent::FILE_ADDED});
+    }
+  }
+
+  for (const auto& dirname : dirnames)
+  {
+    fs.stop_watching(dirname, listener);
+  }
+}
+
+TEST_CASE("watch registry", "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  fw::dm::dtls::WatchRegistry registry;
+  std::vector<fw::dm::dtls::WatchPtr> entries;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const auto dirname = fmt::format("/dir{}", i);
+    entries.push_back(std::make_shared<fw::dm::dtls::WatchEntry>(
+      std::piecewise_construct, std::forward_as_tuple(dirname),
+      std::forward_as_tuple(*inotify, "/root" + dirname,
+                            std::deque<fw::dm::fs::DirectoryEntry>{})));
+    registry.publish(registry.snapshot()->with(entries.back()));
+  }
+
+  SECTION("watches are found by name and by descriptor")
+  {
+    auto current = registry.snapshot();
+    CHECK(current->size() == 1000);
+    for (const auto& entry : entries)
+    {
+      REQUIRE(current->find(entry->first) != nullptr);
+      CHECK(*current->find(entry->first) == entry);
+      REQUIRE(current->find(entry->second.descriptor()) != nullptr);
+      CHECK(*current->find(entry->second.descriptor()) == entry);
+    }
+    CHECK(current->find("/unknown") == nullptr);
+    CHECK(current->find(1000) == nullptr);
+
+    std::size_t count = 0;
+    current->for_each([&](const fw::dm::dtls::WatchEntry&) { ++count; });
+    CHECK(count == 1000);
+  }
+
+  SECTION("published versions do not change snapshots")
+  {
+    auto before = registry.snapshot();
+    registry.publish(before->without(entries[10]));
+    CHECK(before->size() == 1000);
+    CHECK(before->find("/dir10") != nullptr);
+    CHECK(before->find(10) != nullptr);
+    CHECK(registry.snapshot()->size() == 999);
+    CHECK(registry.snapshot()->find("/dir10") == nullptr);
+    CHECK(registry.snapshot()->find(10) == nullptr);
+    CHECK(registry.snapshot()->find("/dir11") != nullptr);
+  }
+
+  SECTION("synchronize waits for the reader")
+  {
+    std::atomic<bool> reading = false;
+    std::atomic<bool> done = false;
+    std::thread reader([&]() {
+      registry.begin_read();
+      reading = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      done = true;
+      registry.end_read();
+    });
+    while (!reading)
+    {
+      std::this_thread::yield();
+    }
+
+    // on a thread of its own, as this one may have been a watch thread
+    bool done_after_synchronize = false;
+    std::thread writer([&]() {
+      registry.synchronize();
+      done_after_synchronize = done;
+    });
+    writer.join();
+    reader.join();
+    CHECK(done_after_synchronize);
+  }
+
+  SECTION("the reader of another registry waits for the reader")
+  {
+    std::atomic<bool> reading = false;
+    std::atomic<bool> done = false;
+    std::thread reader([&]() {
+      registry.begin_read();
+      reading = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      done = true;
+      registry.end_read();
+    });
+    while (!reading)
+    {
+      std::this_thread::yield();
+    }
+
+    fw::dm::dtls::WatchRegistry other;
+    bool done_after_synchronize = false;
+    std::thread writer([&]() {
+      other.begin_read();
+      registry.synchronize();
+      done_after_synchronize = done;
+      other.end_read();
+    });
+    writer.join();
+    reader.join();
+    CHECK(done_after_synchronize);
+  }
+
+  entries.clear();
+  registry.publish(
+    std::make_shared<const fw::dm::dtls::WatchRegistry::Version>());
+  fw::dm::dtls::close_inotify(*inotify);
+}
+
+namespace
+{
+  /// Stops watching a directory from the watch thread, like
+  /// RecursiveEventListener when a subdirectory is removed
+  class UnwatchingListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    UnwatchingListener(fw::dm::FileSystem& fs_, std::string dirname_) :
+      fs(fs_), dirname(std::move(dirname_))
+    {
+    }
+
+    void notify(filewatch::DirectoryEvent::Event event,
+                std::string_view /*containing_dir*/,
+                std::string_view /*dir_name*/,
+                uint64_t /*mtime*/,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
+    {
+      ++count;
+      if (event == filewatch::DirectoryEvent::FILE_ADDED)
+      {
+        fs.stop_watching(dirname, *this);
+      }
+    }
+
+    fw::dm::FileSystem& fs;
+    std::string dirname;
+    int count = 0;
+  };
+
+  /// Hands a task to after_dispatch() from the watch thread
+  class DeferringListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    explicit DeferringListener(fw::dm::FileSystem& fs_) : fs(fs_) {}
+
+    void notify(filewatch::DirectoryEvent::Event event,
+                std::string_view /*containing_dir*/,
+                std::string_view /*dir_name*/,
+                uint64_t /*mtime*/,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
+    {
+      if (event == filewatch::DirectoryEvent::FILE_ADDED)
+      {
+        fs.after_dispatch([this]() { ++ran; });
+        ran_during_dispatch = ran;
+      }
+    }
+
+    fw::dm::FileSystem& fs;
+    int ran = 0;
+    int ran_during_dispatch = -1;
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("stop watching from the watch thread", "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  DummyThreads threads;
+  fw::dm::OSFileSystem<DummyFileSystem> fs(
+    "/home/user/rootdir", std::move(ptr),
+    std::make_unique<DummyLoopThreadFactory>(threads));
+  fs.add_dir("/", "dir", 12356780);
+  fs.add_file("/dir", "file", 12356781);
+  fs.add_file("/dir", "other", 12356782);
+  UnwatchingListener listener(fs, "/dir");
+  fs.watch("/dir", listener);
+  REQUIRE(listener.count == 1);
+
+  inotify->file_added("/home/user/rootdir/dir", "file");
+  inotify->file_added("/home/user/rootdir/dir", "other");
+  threads.run_once();
+  CHECK(listener.count == 2);  // not notified after it stopped watching
+  CHECK(inotify->watches[0].active == false);
+}
+
+TEST_CASE("tasks of the watch thread run after the dispatch",
+          "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  DummyThreads threads;
+  fw::dm::OSFileSystem<DummyFileSystem> fs(
+    "/home/user/rootdir", std::move(ptr),
+    std::make_unique<DummyLoopThreadFactory>(threads));
+  fs.add_dir("/", "dir", 12356780);
+  fs.add_file("/dir", "file", 12356781);
+  DeferringListener listener(fs);
+  fs.watch("/dir", listener);
+
+  inotify->file_added("/home/user/rootdir/dir", "file");
+  threads.run_once();
+  CHECK(listener.ran_during_dispatch == 0);
+  CHECK(listener.ran == 1);
+
+  // other threads run their tasks at once
+  fs.after_dispatch([&listener]() { ++listener.ran; });
+  CHECK(listener.ran == 2);
+  fs.stop_watching("/dir", listener);
+}
+
+TEST_CASE("resync after event queue overflow", "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  DummyThreads threads;
+  fw::dm::WatchOptions options;
+  options.resync_interval = std::chrono::hours(1);
+  options.resync_batch_size = 1;
+  fw::dm::OSFileSystem<DummyFileSystem> fs(
+    "/home/user/rootdir", std::move(ptr),
+    std::make_unique<DummyLoopThreadFactory>(threads), options);
+  fs.add_dir("/", "dir", 12356780);
+  fs.add_file("/dir", "kept", 12356781);
+  fs.add_file("/dir", "removed", 12356782);
+  fs.add_dir("/dir", "removeddir", 12356783);
+  LoggingDirectoryEventListener listener;
+  fs.watch("/dir", listener);
+  REQUIRE(listener.events.size() == 1);
+
+  fs.rm_file("/dir", "removed");
+  fs.rm_dir("/dir", "removeddir");
+  fs.add_file("/dir", "added", 12356784);
+  fs.add_dir("/dir", "addeddir", 12356785);
+  inotify->queue_overflow();
+  threads.run_once();
+
+  REQUIRE(listener.events.size() == 5);
+  CHECK(listener.events[1].event
+        == filewatch::DirectoryEvent::DIRECTORY_REMOVED);
+  CHECK(listener.events[1].dir_name == "removeddir");
+  CHECK(listener.events[2].event == filewatch::DirectoryEvent::FILE_REMOVED);
+  CHECK(listener.events[2].dir_name == "removed");
+  CHECK(listener.events[3].event == filewatch::DirectoryEvent::FILE_ADDED);
+  CHECK(listener.events[3].dir_name == "added");
+  CHECK(listener.events[3].mtime == 12356784);
+  CHECK(listener.events[4].event
+        == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+  CHECK(listener.events[4].dir_name == "addeddir");
+  CHECK(listener.events[4].mtime == 12356785);
+
+  SECTION("resync is rate limited")
+  {
+    CHECK(fw::dm::statistics().counter("resync.pending") == 0);
+    fs.add_dir("/", "other", 12356790);
+    LoggingDirectoryEventListener other_listener;
+    fs.watch("/other", other_listener);
+    fs.add_file("/dir", "late", 12356791);
+    fs.add_file("/other", "late", 12356792);
+    inotify->queue_overflow();
+    threads.run_once();
+    CHECK(listener.events.size() == 5);
+    CHECK(other_listener.events.size() == 1);
+    CHECK(fw::dm::statistics().counter("resync.pending") == 2);
+  }
+}
+
+TEST_CASE("debounce events per directory entry", "[LinuxFileSystem]")
+{
+  auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+  auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+  DummyThreads threads;
+  fw::dm::WatchOptions options;
+  options.debounce_window = std::chrono::milliseconds(5);
+  auto now = std::chrono::steady_clock::now();
+  options.clock = [&now]() { return now; };
+  fw::dm::OSFileSystem<DummyFileSystem> fs(
+    "/home/user/rootdir", std::move(ptr),
+    std::make_unique<DummyLoopThreadFactory>(threads), options);
+  fs.add_dir("/", "dir", 12356780);
+  fs.add_file("/dir", "existing", 12356781);
+  LoggingDirectoryEventListener listener;
+  fs.watch("/dir", listener);
+  REQUIRE(listener.events.size() == 1);
+
+  // the first run reads the events, the second flushes them
+  auto run_after_window = [&]() {
+    threads.run_once();
+    now += std::chrono::milliseconds(5);
+    threads.run_once();
+  };
+
+  SECTION("events are held back until the window has passed")
+  {
+    fs.add_file("/dir", "filename", 12356789);
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    threads.run_once();
+    CHECK(listener.events.size() == 1);
+
+    now += std::chrono::milliseconds(4);
+    threads.run_once();
+    CHECK(listener.events.size() == 1);
+
+    now += std::chrono::milliseconds(1);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].dir_name == "filename");
+    CHECK(listener.events[1].mtime == 12356789);
+  }
+  SECTION("created and deleted within the window gives no event")
+  {
+    auto folded = fw::dm::statistics().counter("debounce.folded").load();
+    inotify->file_added("/home/user/rootdir/dir", "tmpfile");
+    inotify->file_removed("/home/user/rootdir/dir", "tmpfile");
+    run_after_window();
+    CHECK(listener.events.size() == 1);
+    CHECK(fw::dm::statistics().counter("debounce.folded") == folded + 1);
+  }
+  SECTION("deleted and created again within the window is a replacement")
+  {
+    fs.rm_file("/dir", "existing");
+    fs.add_dir("/dir", "existing", 12356790);
+    inotify->file_removed("/home/user/rootdir/dir", "existing");
+    inotify->file_added("/home/user/rootdir/dir", "existing");
+    run_after_window();
+    REQUIRE(listener.events.size() == 3);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_REMOVED);
+    CHECK(listener.events[2].event
+          == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+    CHECK(listener.events[2].mtime == 12356790);
+  }
+  SECTION("writes within the window are one modification")
+  {
+    fs.write_file("/dir/existing", "abc");
+    inotify->file_written("/home/user/rootdir/dir", "existing");
+    inotify->file_written("/home/user/rootdir/dir", "existing");
+    run_after_window();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_MODIFIED);
+    CHECK(listener.events[1].size == 3);
+  }
+  SECTION("a written new file is one addition")
+  {
+    fs.add_file("/dir", "filename", 12356789);
+    fs.write_file("/dir/filename", "abcd");
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    inotify->file_written("/home/user/rootdir/dir", "filename");
+    run_after_window();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].size == 4);
+  }
+  SECTION("a rename is not delayed")
+  {
+    fs.rm_file("/dir", "existing");
+    fs.add_file("/dir", "renamed", 12356781);
+    inotify->file_moved("/home/user/rootdir/dir", "existing",
+                        "/home/user/rootdir/dir", "renamed", 22);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_RENAMED);
+  }
+  SECTION("a rename comes after the pending events of its names")
+  {
+    fs.add_file("/dir", "renamed", 12356789);
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    inotify->file_moved("/home/user/rootdir/dir", "filename",
+                        "/home/user/rootdir/dir", "renamed", 23);
+    threads.run_once();
+    REQUIRE(listener.events.size() == 3);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].dir_name == "filename");
+    CHECK(listener.events[2].event == filewatch::DirectoryEvent::FILE_RENAMED);
+    CHECK(listener.events[2].old_name == "filename");
+    CHECK(listener.events[2].dir_name == "renamed");
+    run_after_window();
+    CHECK(listener.events.size() == 3);
+  }
+  SECTION("pending events come before the removal of their directory")
+  {
+    fs.add_file("/dir", "filename", 12356789);
+    inotify->file_added("/home/user/rootdir/dir", "filename");
+    inotify->push_event("/home/user/rootdir/dir", "", IN_DELETE_SELF);
+    threads.run_once();
+    REQUIRE(listener.events.size() >= 2);
+    CHECK(listener.events[1].event == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(listener.events[1].dir_name == "filename");
+  }
+  SECTION("pending events are dropped when the watch is removed")
+  {
+    inotify->file_added("/home/user/rootdir/dir", "existing");
+    threads.run_once();
+    fs.stop_watching("/dir", listener);
+    fs.watch("/dir", listener);
+    run_after_window();
+    CHECK(listener.events.size() == 2);
+  }
+}
+
+TEST_CASE("event dispatch cost is independent of watch count",
+          "[LinuxFileSystem][!benchmark]")
+{
+  auto log_level = spdlog::get_level();
+  spdlog::set_level(spdlog::level::warn);
+
+  for (std::size_t watch_count : {10U, 1000U, 50000U})
+  {
+    auto ptr = fw::dm::dtls::Inotify::create<InotifyDummy>();
+    auto* inotify = dynamic_cast<InotifyDummy*>(ptr.get());
+    DummyThreads threads;
+    fw::dm::OSFileSystem<DummyFileSystem> fs(
+      "/home/user/rootdir", std::move(ptr),
+      std::make_unique<DummyLoopThreadFactory>(threads));
+    LoggingDirectoryEventListener listener;
+    for (std::size_t i = 0; i < watch_count; ++i)
+    {
+      fs.watch(fmt::format("/dir{}", i), listener);
+    }
+    const auto last_dir =
+      fmt::format("/home/user/rootdir/dir{}", watch_count - 1);
+
+    BENCHMARK_ADVANCED(fmt::format("one event, {} watches", watch_count))
+    (Catch::Benchmark::Chronometer meter)
+    {
+      for (int i = 0; i < meter.runs(); ++i)
+      {
+        inotify->file_added(last_dir, "filename");
+      }
+      meter.measure([&] { threads.run_once(); });
+    };
+  }
+
+  spdlog::set_level(log_level);
 }
 
 #endif  // __linux__
@@ -0,0 +1,79 @@
+#include "daemon/filesystem.h"
+#include "dummyfilesystem.h"
+
+#include <catch2/catch.hpp>
+
+#include <cstring>
+
+TEST_CASE("listing", "[Listing]")
+{
+  fw::dm::fs::Listing listing;
+  CHECK(listing.empty());
+  CHECK(listing.begin() == listing.end());
+
+  listing.reserve(3, 16);
+  listing.add("file", false, 1, 100);
+  listing.add("dir", true, 2, 0);
+  listing.add("", false, 3, 0);
+
+  SECTION("entries are looked up by index")
+  {
+    REQUIRE(listing.size() == 3);
+    CHECK(listing[0].name == "file");
+    CHECK_FALSE(listing[0].is_dir);
+    CHECK(listing[0].mtime == 1);
+    CHECK(listing[0].size == 100);
+    CHECK(listing[1].name == "dir");
+    CHECK(listing[1].is_dir);
+    CHECK(listing[2].name.empty());
+  }
+
+  SECTION("names are NUL terminated")
+  {
+    CHECK(std::strcmp(listing.c_str(0), "file") == 0);
+    CHECK(std::strcmp(listing.c_str(1), "dir") == 0);
+    CHECK(std::strcmp(listing.c_str(2), "") == 0);
+  }
+
+  SECTION("entries are iterated in order")
+  {
+    uint64_t mtime = 0;
+    for (const auto& e : listing)
+    {
+      CHECK(e.mtime == ++mtime);
+    }
+    CHECK(mtime == 3);
+  }
+
+  SECTION("to and from DirectoryEntry")
+  {
+    auto entries = listing.entries();
+    REQUIRE(entries.size() == 3);
+    CHECK(entries[1].name == "dir");
+    CHECK(entries[1].is_dir);
+
+    fw::dm::fs::Listing copy(entries);
+    REQUIRE(copy.size() == 3);
+    CHECK(copy[0].name == "file");
+    CHECK(copy[0].size == 100);
+  }
+}
+
+TEST_CASE("listing pages by index by default", "[Listing]")
+{
+  DummyFileSystem fs("rootdir");
+  for (int i = 0; i < 5; ++i)
+  {
+    fs.add_file("/", "file" + std::to_string(i), 1);
+  }
+
+  auto first = fs.list_page("/", 0, 2);
+  CHECK(first.entries.size() == 2);
+  CHECK(first.cursors == std::vector<uint64_t>{1, 2});
+  CHECK_FALSE(first.end);
+
+  auto last = fs.list_page("/", first.next, 10);
+  CHECK(last.entries.size() == 3);
+  CHECK(last.end);
+  CHECK(fs.list_page("/", 100, 10).end);
+}
@@ -0,0 +1,227 @@
+#include "daemon/recursiveeventlistener.h"
+#include "dummyfilesystem.h"
+#include "filewatch.pb.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+namespace
+{
+  class DummyDirectoryEventListener : public fw::dm::DirectoryEventListener
+  {
+  public:
+    void notify(filewatch::DirectoryEvent::Event event,
+                std::string_view containing_dir,
+                std::string_view dir_name,
+                uint64_t /*mtime*/,
+                uint64_t /*size*/,
+                std::string_view /*old_name*/) override
+    {
+      events.emplace_back(event, std::string(containing_dir) + " "
+                                   + std::string(dir_name));
+    }
+
+    std::vector<std::pair<filewatch::DirectoryEvent::Event, std::string>>
+      events;
+  };
+
+  bool is_watched(const DummyFileSystem& fs, std::string_view dirname)
+  {
+    return std::any_of(std::begin(fs.listeners), std::end(fs.listeners),
+                       [&](const auto& l) { return l.second == dirname; });
+  }
+
+  /// Delivers an event from another thread while a watch is stopped, as a
+  /// watch thread does while stop_watching() waits for it
+  class DeliveringFileSystem : public DummyFileSystem
+  {
+  public:
+    using DummyFileSystem::DummyFileSystem;
+
+    void stop_watching(std::string_view dirname,
+                       fw::dm::DirectoryEventListener& listener) override
+    {
+      std::thread watch_thread([&listener]() {
+        listener.notify(filewatch::DirectoryEvent::FILE_ADDED, "/dir",
+                        "delivered", 5, 0, {});
+      });
+      watch_thread.join();
+      DummyFileSystem::stop_watching(dirname, listener);
+    }
+  };
+
+  /// Holds the tasks given to after_dispatch() back until they are run, as
+  /// a watch thread does until it has dispatched its events
+  class DeferringFileSystem : public DummyFileSystem
+  {
+  public:
+    using DummyFileSystem::DummyFileSystem;
+
+    void after_dispatch(std::function<void()> task) override
+    {
+      tasks.push_back(std::move(task));
+    }
+
+    void run_tasks()
+    {
+      auto pending = std::move(tasks);
+      tasks.clear();
+      for (const auto& task : pending)
+      {
+        task();
+      }
+    }
+
+    std::vector<std::function<void()>> tasks;
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("recursive event listener", "[RecursiveEventListener]")
+{
+  DummyFileSystem fs("rootdir");
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/dir", "sub", 2);
+  fs.add_dir("/dir/sub", "subsub", 3);
+  fs.add_file("/dir/sub", "file", 4);
+  DummyDirectoryEventListener target;
+  fw::dm::RecursiveEventListener listener(fs, "/dir", target);
+  listener.start();
+
+  SECTION("watches the directory and all existing subdirectories")
+  {
+    CHECK(fs.listeners.size() == 3);
+    CHECK(is_watched(fs, "/dir"));
+    CHECK(is_watched(fs, "/dir/sub"));
+    CHECK(is_watched(fs, "/dir/sub/subsub"));
+    CHECK(target.events.empty());
+  }
+
+  SECTION("stop removes all watches")
+  {
+    listener.stop();
+    CHECK(fs.listeners.empty());
+  }
+
+  SECTION("forwards events from subdirectories")
+  {
+    listener.notify(filewatch::DirectoryEvent::FILE_ADDED, "/dir/sub",
+                    "newfile", 5, 0, {});
+    REQUIRE(target.events.size() == 1);
+    CHECK(target.events[0].first == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(target.events[0].second == "/dir/sub newfile");
+  }
+
+  SECTION("only the subscribed directory is announced")
+  {
+    listener.notify(filewatch::DirectoryEvent::WATCHING_DIRECTORY, "/dir/sub",
+                    ".", 0, 0, {});
+    CHECK(target.events.empty());
+    listener.notify(filewatch::DirectoryEvent::WATCHING_DIRECTORY, "/dir", ".",
+                    0, 0, {});
+    CHECK(target.events.size() == 1);
+  }
+
+  SECTION("watches added subtree and reports its contents")
+  {
+    fs.add_dir("/dir", "new", 6);
+    fs.add_dir("/dir/new", "inner", 7);
+    fs.add_file("/dir/new/inner", "early", 8);
+    listener.notify(filewatch::DirectoryEvent::DIRECTORY_ADDED, "/dir", "new",
+                    6, 0, {});
+
+    CHECK(is_watched(fs, "/dir/new"));
+    CHECK(is_watched(fs, "/dir/new/inner"));
+    REQUIRE(target.events.size() == 3);
+    CHECK(target.events[0].second == "/dir new");
+    CHECK(target.events[1].first
+          == filewatch::DirectoryEvent::DIRECTORY_ADDED);
+    CHECK(target.events[1].second == "/dir/new inner");
+    CHECK(target.events[2].first == filewatch::DirectoryEvent::FILE_ADDED);
+    CHECK(target.events[2].second == "/dir/new/inner early");
+  }
+
+  SECTION("stops watching removed subtree")
+  {
+    listener.notify(filewatch::DirectoryEvent::DIRECTORY_REMOVED, "/dir", "sub",
+                    0, 0, {});
+    CHECK(fs.listeners.size() == 1);
+    CHECK(is_watched(fs, "/dir"));
+  }
+
+  SECTION("follows renamed subtree without reporting its contents")
+  {
+    fs.rm_dir("/dir", "sub");
+    fs.add_dir("/dir", "moved", 9);
+    fs.add_dir("/dir/moved", "subsub", 3);
+    listener.notify(filewatch::DirectoryEvent::DIRECTORY_RENAMED, "/dir",
+                    "moved", 9, 0, "sub");
+
+    CHECK(fs.listeners.size() == 3);
+    CHECK(!is_watched(fs, "/dir/sub"));
+    CHECK(!is_watched(fs, "/dir/sub/subsub"));
+    CHECK(is_watched(fs, "/dir/moved"));
+    CHECK(is_watched(fs, "/dir/moved/subsub"));
+    REQUIRE(target.events.size() == 1);
+    CHECK(target.events[0].first
+          == filewatch::DirectoryEvent::DIRECTORY_RENAMED);
+  }
+}
+
+TEST_CASE("recursive event listener stops watches without its mutex",
+          "[RecursiveEventListener]")
+{
+  DeliveringFileSystem fs("rootdir");
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/dir", "sub", 2);
+  DummyDirectoryEventListener target;
+  fw::dm::RecursiveEventListener listener(fs, "/dir", target);
+  listener.start();
+
+  listener.notify(filewatch::DirectoryEvent::DIRECTORY_REMOVED, "/dir", "sub",
+                  0, 0, {});
+  CHECK(fs.listeners.size() == 1);
+  REQUIRE(target.events.size() == 2);
+  CHECK(target.events[1].second == "/dir delivered");
+  listener.stop();
+}
+
+TEST_CASE("recursive event listener stops watches after the dispatch",
+          "[RecursiveEventListener]")
+{
+  DeferringFileSystem fs("rootdir");
+  fs.add_dir("/", "dir", 1);
+  fs.add_dir("/dir", "sub", 2);
+  DummyDirectoryEventListener target;
+  fw::dm::RecursiveEventListener listener(fs, "/dir", target);
+  listener.start();
+
+  fs.rm_dir("/dir", "sub");
+  listener.notify(filewatch::DirectoryEvent::DIRECTORY_REMOVED, "/dir", "sub",
+                  0, 0, {});
+  CHECK(is_watched(fs, "/dir/sub"));
+  REQUIRE(fs.tasks.size() == 1);
+
+  SECTION("the watches are stopped when the task runs")
+  {
+    fs.run_tasks();
+    CHECK_FALSE(is_watched(fs, "/dir/sub"));
+    CHECK(fs.listeners.size() == 1);
+  }
+
+  SECTION("stop waits for the task")
+  {
+    std::thread watch_thread([&fs]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      fs.run_tasks();
+    });
+    listener.stop();
+    CHECK(fs.tasks.empty());
+    CHECK(fs.listeners.empty());
+    watch_thread.join();
+  }
+}
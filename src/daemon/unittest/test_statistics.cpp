@@ -0,0 +1,24 @@
+#include "daemon/statistics.h"
+
+#include <catch2/catch.hpp>
+
+TEST_CASE("counters", "[Statistics]")
+{
+  fw::dm::Statistics stats;
+  CHECK(stats.snapshot().empty());
+
+  auto& counter = stats.counter("foo");
+  ++counter;
+  CHECK(stats.counter("foo") == 1);
+  stats.counter("bar") = 42;
+
+  auto snapshot = stats.snapshot();
+  REQUIRE(snapshot.size() == 2);
+  CHECK(snapshot["foo"] == 1);
+  CHECK(snapshot["bar"] == 42);
+
+  stats.remove("foo");
+  CHECK(stats.snapshot().count("foo") == 0);
+  stats.remove("not there");
+  CHECK(stats.snapshot().size() == 1);
+}
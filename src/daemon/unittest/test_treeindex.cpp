@@ -0,0 +1,341 @@
+#include "daemon/treeindex.h"
+#include "daemon/cachingfilesystem.h"
+#include "daemon/statistics.h"
+#include "dummyfilesystem.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+namespace
+{
+  /// DummyFileSystem for the scan threads, which takes the entries of
+  /// unchanged directories from the persisted index
+  class LockedFileSystem : public DummyFileSystem, public fw::dm::ListingCache
+  {
+  public:
+    using DummyFileSystem::DummyFileSystem;
+
+    std::deque<fw::dm::fs::DirectoryEntry> watch_revalidated(
+      std::string_view dirname, fw::dm::DirectoryEventListener& listener,
+      uint64_t mtime,
+      const std::deque<fw::dm::fs::DirectoryEntry>& entries) override
+    {
+      watch(dirname, listener);
+      std::lock_guard<std::mutex> sentry(mutex);
+      if (DummyFileSystem::get_direntry(dirname)->mtime == mtime)
+      {
+        ++revalidated;
+        return entries;
+      }
+      return DummyFileSystem::ls(dirname);
+    }
+
+    std::optional<fw::dm::fs::DirectoryEntry>
+    get_direntry(std::string_view entryname) const override
+    {
+      std::lock_guard<std::mutex> sentry(mutex);
+      return DummyFileSystem::get_direntry(entryname);
+    }
+
+    std::deque<fw::dm::fs::DirectoryEntry>
+    ls(std::string_view entryname) const override
+    {
+      std::lock_guard<std::mutex> sentry(mutex);
+      return DummyFileSystem::ls(entryname);
+    }
+
+    void watch(std::string_view dirname,
+               fw::dm::DirectoryEventListener& listener) override
+    {
+      std::lock_guard<std::mutex> sentry(mutex);
+      DummyFileSystem::watch(dirname, listener);
+    }
+
+    void stop_watching(std::string_view dirname,
+                       fw::dm::DirectoryEventListener& listener) override
+    {
+      std::lock_guard<std::mutex> sentry(mutex);
+      DummyFileSystem::stop_watching(dirname, listener);
+    }
+
+    int revalidated = 0;
+
+    std::vector<std::string> watched() const
+    {
+      std::lock_guard<std::mutex> sentry(mutex);
+      std::vector<std::string> dirnames;
+      for (const auto& l : listeners)
+      {
+        dirnames.push_back(l.second);
+      }
+      std::sort(std::begin(dirnames), std::end(dirnames));
+      return dirnames;
+    }
+
+  private:
+    mutable std::mutex mutex;
+  };
+
+  /// Counts the calls that reach the disk.  Watching a directory lists it,
+  /// as OSFileSystem does, unless it is given the entries.  Not thread
+  /// safe, so for one scan thread.
+  class CountingFileSystem : public DummyFileSystem
+  {
+  public:
+    using DummyFileSystem::DummyFileSystem;
+
+    std::deque<fw::dm::fs::DirectoryEntry>
+    ls(std::string_view dirname) const override
+    {
+      ++ls_count;
+      return DummyFileSystem::ls(dirname);
+    }
+
+    std::optional<fw::dm::fs::DirectoryEntry>
+    get_direntry(std::string_view entryname) const override
+    {
+      ++stat_count;
+      return DummyFileSystem::get_direntry(entryname);
+    }
+
+    void watch(std::string_view dirname,
+               fw::dm::DirectoryEventListener& listener) override
+    {
+      if (std::none_of(std::begin(listeners), std::end(listeners),
+                       [&](const auto& l) { return l.second == dirname; }))
+      {
+        // for itself, as OSFileSystem does, not through a cache above it
+        CountingFileSystem::ls(dirname);
+      }
+      DummyFileSystem::watch(dirname, listener);
+    }
+
+    void watch_listed(std::string_view dirname,
+                      fw::dm::DirectoryEventListener& listener,
+                      const std::deque<fw::dm::fs::DirectoryEntry>& /*entries*/)
+    {
+      DummyFileSystem::watch(dirname, listener);
+    }
+
+    mutable int ls_count = 0;
+    mutable int stat_count = 0;
+  };
+
+}  // anonymous namespace
+
+TEST_CASE("scan queues", "[TreeIndex]")
+{
+  fw::dm::dtls::ScanQueues queues(2);
+  CHECK(queues.finished());
+  CHECK_FALSE(queues.pop(0));
+
+  queues.push(0, "a");
+  queues.push(0, "b");
+  queues.push(0, "c");
+  CHECK_FALSE(queues.finished());
+
+  SECTION("a thread takes the directory it queued last")
+  {
+    CHECK(queues.pop(0) == "c");
+  }
+
+  SECTION("other threads steal the directory queued first")
+  {
+    CHECK(queues.pop(1) == "a");
+  }
+
+  SECTION("finished once every directory is done")
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      REQUIRE(queues.pop(1));
+      CHECK_FALSE(queues.finished());
+      queues.done();
+    }
+    CHECK(queues.finished());
+    CHECK_FALSE(queues.pop(0));
+  }
+
+  SECTION("waiting threads get the directories queued while they wait")
+  {
+    // taken before the waiter starts, which could otherwise take it all
+    auto dirname = queues.wait(0);
+    REQUIRE(dirname);
+
+    std::vector<std::string> taken;
+    std::jthread waiter([&] {
+      for (auto next = queues.wait(1); next; next = queues.wait(1))
+      {
+        taken.push_back(*next);
+        queues.done();
+      }
+    });
+    queues.push(0, "d");
+    queues.done();
+    waiter.join();  // returns once every directory is done
+    CHECK(queues.finished());
+    CHECK(taken.size() == 3);
+  }
+
+  SECTION("cancelling wakes the waiting threads")
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      REQUIRE(queues.pop(0));
+    }
+    bool woken_empty = false;
+    std::jthread waiter([&] { woken_empty = !queues.wait(1); });
+    queues.cancel();
+    waiter.join();
+    CHECK(woken_empty);
+    CHECK_FALSE(queues.finished());
+  }
+}
+
+namespace
+{
+  std::vector<std::string>
+  names(const std::deque<fw::dm::fs::DirectoryEntry>& entries)
+  {
+    std::vector<std::string> result;
+    for (const auto& e : entries)
+    {
+      result.push_back(e.name);
+    }
+    std::sort(std::begin(result), std::end(result));
+    return result;
+  }
+
+  void make_tree(DummyFileSystem& fs, std::vector<std::string>& expected)
+  {
+    expected.emplace_back("/");
+    for (const auto* dirname : {"a", "b", "c"})
+    {
+      fs.add_dir("/", dirname, 1);
+      expected.push_back(std::string{"/"} + dirname);
+      fs.add_file(expected.back(), "file", 3);
+      for (const auto* subname : {"x", "y"})
+      {
+        fs.add_dir(expected.back(), subname, 2);
+      }
+      expected.push_back(expected.back() + "/x");
+      expected.push_back(expected[expected.size() - 2] + "/y");
+    }
+    std::sort(std::begin(expected), std::end(expected));
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("tree index", "[TreeIndex]")
+{
+  LockedFileSystem fs("rootdir");
+  std::vector<std::string> expected;
+  make_tree(fs, expected);
+
+  fw::dm::TreeIndexOptions options;
+  options.scan_threads = static_cast<std::size_t>(GENERATE(1, 4));
+  {
+    fw::dm::TreeIndex index(fs, "/", options);
+    CHECK_FALSE(index.is_warm());
+    index.start();
+    index.wait();
+    CHECK(index.is_warm());
+    CHECK(fw::dm::statistics().counter("index.warm") == 1);
+
+    // every directory is watched once, by the recursive listener
+    CHECK(fs.watched() == expected);
+  }
+  CHECK(fs.watched().empty());
+}
+
+TEST_CASE("persisted tree index", "[TreeIndex]")
+{
+  const auto path = std::filesystem::temp_directory_path()
+                    / ("fwdaemon_treeindex_" + std::to_string(::getpid()));
+  std::filesystem::remove(path);
+
+  LockedFileSystem fs("rootdir");
+  std::vector<std::string> expected;
+  make_tree(fs, expected);
+
+  fw::dm::TreeIndexOptions options;
+  options.path = path.string();
+  {
+    fw::dm::TreeIndex index(fs, "/", options);
+    index.start();
+    index.wait();
+  }
+  REQUIRE(std::filesystem::exists(path));
+  CHECK(fs.revalidated == 0);
+
+  // /a is changed while the daemon is not running
+  fs.rm_dir("/", "a");
+  fs.add_dir("/", "a", 5);
+  fs.add_dir("/a", "new", 6);
+  std::erase_if(expected,
+                [](const auto& d) { return d.starts_with("/a/"); });
+  expected.emplace_back("/a/new");
+  std::sort(std::begin(expected), std::end(expected));
+  {
+    fw::dm::TreeIndex index(fs, "/", options);
+    index.start();
+    index.wait();
+    CHECK(fs.watched() == expected);
+  }
+  // all but /a and the new /a/new, which was not in the index
+  CHECK(fs.revalidated == static_cast<int>(expected.size()) - 2);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("warm restart of a tree index", "[TreeIndex]")
+{
+  const auto path =
+    std::filesystem::temp_directory_path()
+    / ("fwdaemon_treeindex_warm_" + std::to_string(::getpid()));
+  std::filesystem::remove(path);
+
+  fw::dm::CachingFileSystem<CountingFileSystem> fs("rootdir");
+  std::vector<std::string> expected;
+  make_tree(fs, expected);
+
+  fw::dm::TreeIndexOptions options;
+  options.path = path.string();
+  options.scan_threads = 1;
+  {
+    fw::dm::TreeIndex index(fs, "/", options);
+    index.start();
+    index.wait();
+
+    // each directory is listed by the watch, and by the cache once the
+    // watch is armed
+    CHECK(fs.ls_count == 2 * static_cast<int>(expected.size()));
+  }
+  REQUIRE(std::filesystem::exists(path));
+  auto listed = names(fs.DummyFileSystem::ls("/a"));
+  // appended to while the daemon is not running, which leaves the mtime
+  // of /a unchanged
+  fs.write_file("/a/file", "appended");
+
+  fs.ls_count = 0;
+  fs.stat_count = 0;
+  {
+    fw::dm::TreeIndex index(fs, "/", options);
+    index.start();
+    index.wait();
+
+    // the saved entries of the unchanged directories are taken by the
+    // cache and the watches, after a stat of each directory before and
+    // after its watch is armed.  The entries are stat'ed as they are read.
+    CHECK(fs.ls_count == 0);
+    CHECK(fs.stat_count >= 2 * static_cast<int>(expected.size()));
+    CHECK(names(fs.ls("/a")) == listed);
+    CHECK(fs.get_direntry("/a/file")->size == 8);
+  }
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,124 @@
+#include "daemon/defaultfilesystem.h"
+#include "daemon/uringfilesystem.h"
+
+#include <catch2/catch.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+namespace
+{
+  class TemporaryDirectory
+  {
+  public:
+    TemporaryDirectory() :
+      path(std::filesystem::temp_directory_path()
+           / ("fwdaemon_test_" + std::to_string(::getpid())))
+    {
+      std::filesystem::create_directories(path);
+    }
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+    TemporaryDirectory(TemporaryDirectory&&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory&&) = delete;
+    ~TemporaryDirectory() { std::filesystem::remove_all(path); }
+
+    void write(const std::string& name, const std::string& contents) const
+    {
+      std::ofstream out(path / name, std::ios::binary);
+      out << contents;
+    }
+
+    std::filesystem::path path;
+  };
+
+  /// The listing and reading parts of a file system
+  template<typename BaseT>
+  class Unwatched : public BaseT
+  {
+  public:
+    using BaseT::BaseT;
+
+    void watch(std::string_view /*dirname*/,
+               fw::dm::DirectoryEventListener& /*listener*/) override
+    {
+    }
+    void stop_watching(std::string_view /*dirname*/,
+                       fw::dm::DirectoryEventListener& /*listener*/) override
+    {
+    }
+  };
+
+  bool by_name(const fw::dm::fs::DirectoryEntry& lhs,
+               const fw::dm::fs::DirectoryEntry& rhs)
+  {
+    return lhs.name < rhs.name;
+  }
+
+}  // anonymous namespace
+
+TEST_CASE("io_uring listing matches the default listing", "[UringFileSystem]")
+{
+  TemporaryDirectory tmp;
+  std::filesystem::create_directory(tmp.path / "subdir");
+  // more entries than one io_uring batch
+  for (std::size_t i = 0; i < 100; ++i)
+  {
+    tmp.write("file" + std::to_string(i), std::string(i, 'x'));
+  }
+
+  Unwatched<fw::dm::DefaultFileSystem> default_fs(tmp.path.string());
+  Unwatched<fw::dm::UringFileSystem> uring_fs(tmp.path.string());
+  auto expected = default_fs.ls("/");
+  auto actual = uring_fs.ls("/");
+  std::sort(std::begin(expected), std::end(expected), by_name);
+  std::sort(std::begin(actual), std::end(actual), by_name);
+
+  REQUIRE(actual.size() == expected.size());
+  for (std::size_t i = 0; i < actual.size(); ++i)
+  {
+    CHECK(actual[i].name == expected[i].name);
+    CHECK(actual[i].is_dir == expected[i].is_dir);
+    CHECK(actual[i].size == expected[i].size);
+    // DefaultFileSystem converts between clocks, which may round differently
+    CHECK(std::max(actual[i].mtime, expected[i].mtime)
+            - std::min(actual[i].mtime, expected[i].mtime)
+          <= 1);
+  }
+
+  CHECK_THROWS(uring_fs.ls("/does not exist"));
+}
+
+TEST_CASE("io_uring read", "[UringFileSystem]")
+{
+  TemporaryDirectory tmp;
+  Unwatched<fw::dm::UringFileSystem> uring_fs(tmp.path.string());
+
+  SECTION("file spanning several chunks")
+  {
+    std::string contents;
+    for (int i = 0; contents.size() < 1024 * 1024 + 17; ++i)
+    {
+      contents += std::to_string(i) + " ";
+    }
+    tmp.write("big", contents);
+    CHECK(uring_fs.read("/big") == contents);
+  }
+
+  SECTION("empty file")
+  {
+    tmp.write("empty", "");
+    CHECK(uring_fs.read("/empty").empty());
+  }
+
+  SECTION("contents end at the first null character, like DefaultFileSystem")
+  {
+    tmp.write("nul", std::string("abc\0def", 7));
+    Unwatched<fw::dm::DefaultFileSystem> default_fs(tmp.path.string());
+    CHECK(uring_fs.read("/nul") == "abc");
+    CHECK(default_fs.read("/nul") == "abc");
+  }
+}
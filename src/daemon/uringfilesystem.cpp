@@ -0,0 +1,253 @@
+#include "uringfilesystem.h"
+
+#ifdef __linux__
+
+#  include "details/directoryreader.h"
+#  include "details/iouring.h"
+#  include "statistics.h"
+
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+
+#  include <spdlog/spdlog.h>
+
+#  include <atomic>
+#  include <cstring>
+#  include <functional>
+#  include <memory>
+#  include <vector>
+
+namespace
+{
+  constexpr unsigned ring_entries = 64;
+  constexpr std::size_t read_chunk_size = 128 * 1024;
+
+  /// The calling thread's io_uring, or nullptr if io_uring is unavailable
+  fw::dm::dtls::IoUring* thread_ring()
+  {
+    static std::atomic<bool> unavailable = false;
+    thread_local std::unique_ptr<fw::dm::dtls::IoUring> ring;
+    if (ring == nullptr && !unavailable)
+    {
+      try
+      {
+        ring = std::make_unique<fw::dm::dtls::IoUring>(ring_entries);
+      }
+      catch (const std::runtime_error& e)
+      {
+        if (!unavailable.exchange(true))
+        {
+          spdlog::warn("{} Falling back to synchronous I/O.", e.what());
+        }
+      }
+    }
+    return ring.get();
+  }
+
+  /// Submit the operations queued in ring and wait for them, false if
+  /// io_uring failed and the caller is to fall back to synchronous I/O
+  bool submit_and_wait(
+    fw::dm::dtls::IoUring& ring,
+    const std::function<void(uint64_t user_data, int result)>& on_complete)
+  {
+    try
+    {
+      ring.submit_and_wait(on_complete);
+      return true;
+    }
+    catch (const std::runtime_error& e)
+    {
+      spdlog::warn("{} Falling back to synchronous I/O.", e.what());
+      return false;
+    }
+  }
+
+  class FileDescriptor
+  {
+  public:
+    explicit FileDescriptor(int fd_) : fd(fd_) {}
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    FileDescriptor(FileDescriptor&&) = delete;
+    FileDescriptor& operator=(FileDescriptor&&) = delete;
+    ~FileDescriptor()
+    {
+      if (fd != -1)
+      {
+        ::close(fd);
+      }
+    }
+
+    int fd;
+  };
+
+  uint64_t mtime_ms(const struct statx& stx)
+  {
+    return static_cast<uint64_t>(stx.stx_mtime.tv_sec) * 1000
+           + stx.stx_mtime.tv_nsec / 1000000;
+  }
+
+}  // anonymous namespace
+
+fw::dm::UringFileSystem::UringFileSystem(std::string_view rootdir_) :
+  DefaultFileSystem(rootdir_)
+{
+}
+
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::UringFileSystem::ls(std::string_view dirname) const
+{
+  if (thread_ring() == nullptr)
+  {
+    return DefaultFileSystem::ls(dirname);
+  }
+  return list(dirname).entries();
+}
+
+fw::dm::fs::Listing
+fw::dm::UringFileSystem::list(std::string_view dirname) const
+{
+  auto* ring = thread_ring();
+  if (ring == nullptr)
+  {
+    return DefaultFileSystem::list(dirname);
+  }
+
+  static auto& batches = statistics().counter("io_uring.statx_batches");
+  static auto& statxs = statistics().counter("io_uring.statx");
+
+  // the entries are stat'ed relative to the directory
+  const auto resolved = resolve(dirname);
+  const dtls::DirectoryReader dir(resolved.fd(), resolved.relative);
+  fs::Listing names;
+  dir.for_each([&](std::string_view name, unsigned char /*type*/) {
+    names.add(name, false, 0, 0);
+  });
+
+  std::vector<struct statx> stats(names.size());
+  std::vector<int> results(names.size(), 0);
+  for (std::size_t first = 0; first < names.size(); first += ring->capacity())
+  {
+    const auto last = std::min(names.size(), first + ring->capacity());
+    for (auto i = first; i < last; ++i)
+    {
+      ring->prepare_statx(dir.fd(), names.c_str(i), 0,
+                          STATX_TYPE | STATX_MTIME | STATX_SIZE, &stats[i],
+                          i);
+    }
+    if (!submit_and_wait(
+          *ring, [&](uint64_t i, int result) { results[i] = result; }))
+    {
+      return DefaultFileSystem::list(dirname);
+    }
+    ++batches;
+    statxs += last - first;
+  }
+
+  fs::Listing entries;
+  for (std::size_t i = 0; i < names.size(); ++i)
+  {
+    if (results[i] < 0)
+    {
+      // removed since it was listed
+      spdlog::debug("statx({}) failed: {}", names.c_str(i),
+                    std::strerror(-results[i]));
+      continue;
+    }
+    const bool is_dir = S_ISDIR(stats[i].stx_mode);
+    entries.add(names[i].name, is_dir, mtime_ms(stats[i]),
+                is_dir ? 0 : stats[i].stx_size);
+  }
+  return entries;
+}
+
+std::string fw::dm::UringFileSystem::read(std::string_view filepath) const
+{
+  auto* ring = thread_ring();
+  if (ring == nullptr)
+  {
+    return DefaultFileSystem::read(filepath);
+  }
+
+  static auto& chunks = statistics().counter("io_uring.read_chunks");
+
+  const auto path = resolve(filepath);
+  FileDescriptor file{
+    ::openat(path.fd(), path.relative.c_str(), O_RDONLY | O_CLOEXEC)};
+  struct stat st
+  {
+  };
+  if (file.fd == -1 || ::fstat(file.fd, &st) == -1 || st.st_size == 0)
+  {
+    // e.g., files in /proc report no size but still have contents
+    return DefaultFileSystem::read(filepath);
+  }
+
+  std::string contents(static_cast<std::size_t>(st.st_size), '\0');
+  std::size_t size = 0;  // bytes read from the start of the file
+  bool short_read = false;
+  for (std::size_t first = 0; first < contents.size() && !short_read;
+       first += ring->capacity() * read_chunk_size)
+  {
+    std::vector<int> results;
+    for (std::size_t offset = first;
+         offset < contents.size()
+         && offset < first + ring->capacity() * read_chunk_size;
+         offset += read_chunk_size)
+    {
+      auto len = std::min(read_chunk_size, contents.size() - offset);
+      ring->prepare_read(file.fd, contents.data() + offset,
+                         static_cast<unsigned>(len), offset, results.size());
+      results.push_back(static_cast<int>(len));
+    }
+    std::vector<int> expected = results;
+    if (!submit_and_wait(
+          *ring, [&](uint64_t i, int result) { results[i] = result; }))
+    {
+      return DefaultFileSystem::read(filepath);
+    }
+    chunks += results.size();
+
+    for (std::size_t i = 0; i < results.size() && !short_read; ++i)
+    {
+      if (results[i] > 0)
+      {
+        size += static_cast<std::size_t>(results[i]);
+      }
+      short_read = results[i] != expected[i];
+    }
+  }
+
+  // the file shrank while being read, or a read failed
+  contents.resize(size);
+  // like DefaultFileSystem, contents end at the first null character
+  contents.resize(std::min(contents.size(), contents.find('\0')));
+  return contents;
+}
+
+#else  // __linux__
+
+fw::dm::UringFileSystem::UringFileSystem(std::string_view rootdir_) :
+  DefaultFileSystem(rootdir_)
+{
+}
+
+std::deque<fw::dm::fs::DirectoryEntry>
+fw::dm::UringFileSystem::ls(std::string_view dirname) const
+{
+  return DefaultFileSystem::ls(dirname);
+}
+
+fw::dm::fs::Listing
+fw::dm::UringFileSystem::list(std::string_view dirname) const
+{
+  return DefaultFileSystem::list(dirname);
+}
+
+std::string fw::dm::UringFileSystem::read(std::string_view filepath) const
+{
+  return DefaultFileSystem::read(filepath);
+}
+
+#endif  // __linux__
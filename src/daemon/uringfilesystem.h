@@ -0,0 +1,31 @@
+#ifndef URINGFILESYSTEM_H
+#define URINGFILESYSTEM_H
+
+#include "daemon/defaultfilesystem.h"
+
+namespace fw
+{
+  namespace dm
+  {
+    /// DefaultFileSystem doing its bulk I/O through io_uring: the entries of
+    /// a directory listing are stat'ed in one batch, and file contents are
+    /// read as chunks submitted together, so that the disk can serve them
+    /// concurrently.  Falls back to DefaultFileSystem where io_uring is not
+    /// available.
+    class UringFileSystem : public DefaultFileSystem
+    {
+    public:
+      explicit UringFileSystem(std::string_view rootdir_);
+
+      std::deque<fs::DirectoryEntry>
+      ls(std::string_view dirname) const override;
+      fs::Listing list(std::string_view dirname) const override;
+
+      std::string read(std::string_view filepath) const override;
+    };
+
+  }  // namespace dm
+
+}  // namespace fw
+
+#endif /* URINGFILESYSTEM_H */
@@ -7,6 +7,8 @@
 #include <spdlog/spdlog.h>
 
 #include <filesystem>
+#include <string>
+#include <vector>
 
 fw::web::FileResources::FileResources(crow::SimpleApp& app,
                                       std::shared_ptr<grpc::Channel>
@@ -57,11 +59,33 @@ crow::json::wvalue fw::web::FileResources::build_tree(const std::string& path,
 {
   auto dirstub = filewatch::Directory::NewStub(channel);
 
+  // files and directories from one streamed listing, in pages, so large
+  // directories fit in the message size limit
+  filewatch::ListingRequest request;
+  request.set_name(std::string{path});
+
   grpc::ClientContext ctxt;
+  auto reader = dirstub->StreamEntries(&ctxt, request);
+  filewatch::EntryList page;
   filewatch::Directoryname dirname;
-  dirname.set_name(std::string{path});
-  filewatch::DirList dirlist;
-  auto status = dirstub->ListDirectories(&ctxt, dirname, &dirlist);
+  std::vector<std::string> dirnames;
+  std::vector<filewatch::Filename> files;
+  while (reader->Read(&page))
+  {
+    if (dirname.name().empty())
+    {
+      dirname = page.name();
+    }
+    for (const auto& dn : page.directories())
+    {
+      dirnames.push_back(dn.name());
+    }
+    for (auto& fn : *page.mutable_files())
+    {
+      files.push_back(std::move(fn));
+    }
+  }
+  auto status = reader->Finish();
   if (!status.ok())
   {
     spdlog::warn("Unable to list directory: {}. Msg: {}", path,
@@ -82,32 +106,24 @@ crow::json::wvalue fw::web::FileResources::build_tree(const std::string& path,
 
   crow::json::wvalue o;
   o["index"] = index;
-  o["label"] = create_dir_label(dirlist.name().name());
-  o["mtime"] = dirlist.name().modification_time().epoch();
+  o["label"] = create_dir_label(dirname.name());
+  o["mtime"] = dirname.modification_time().epoch();
   crow::json::wvalue nodes;
-  for (int i = 0; i < dirlist.dirnames_size(); ++i)
+  const auto n_dirs = static_cast<int>(dirnames.size());
+  for (int i = 0; i < n_dirs; ++i)
   {
-    auto dname = dirlist.dirnames(i).name();
+    const auto& dname = dirnames[static_cast<std::size_t>(i)];
     nodes[dname] = build_tree(path + dname + "/", i);
   }
 
-  filewatch::FileList filelist;
-  grpc::ClientContext ctxt2;
-  status = dirstub->ListFiles(&ctxt2, dirname, &filelist);
-
-  if (!status.ok())
-  {
-    spdlog::warn("status not ok");
-    return crow::json::wvalue{};
-  }
-
-  for (int i = 0; i < filelist.filenames_size(); ++i)
+  int file_index = n_dirs;
+  for (const auto& fn : files)
   {
-    auto fname = filelist.filenames(i).name();
-    nodes[fname]["index"] = dirlist.dirnames_size() + i;
+    const auto& fname = fn.name();
+    nodes[fname]["index"] = file_index++;
     nodes[fname]["label"] = fname;
-    nodes[fname]["mtime"] = filelist.filenames(i).modification_time().epoch();
-    nodes[fname]["size"] = filelist.filenames(i).size();
+    nodes[fname]["mtime"] = fn.modification_time().epoch();
+    nodes[fname]["size"] = fn.size();
   }
 
   o["nodes"] = std::move(nodes);
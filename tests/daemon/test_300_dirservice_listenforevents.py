@@ -42,14 +42,17 @@ class TestCase(unittest.TestCase):
         self.channel = grpc.insecure_channel('localhost:45678')
         self.stub = filewatch_pb2_grpc.DirectoryStub(self.channel)
 
-    def listen_for_events(self, name_of_dir):
-        dirname = filewatch_pb2.Directoryname()
-        dirname.name = name_of_dir
-        direvt_generator = self.stub.ListenForEvents(dirname)
+    def listen_for_events(self, name_of_dir, recursive=False, resume_from=0):
+        subscription = filewatch_pb2.EventSubscription()
+        subscription.name = name_of_dir
+        subscription.recursive = recursive
+        subscription.resume_from = resume_from
+        direvt_generator = self.stub.ListenForEvents(subscription)
         direvt = next(direvt_generator)
         self.assertEqual(filewatch_pb2.DirectoryEvent.WATCHING_DIRECTORY, direvt.event)
         self.assertEqual(name_of_dir, direvt.name)
         self.assertEqual('.', direvt.dirname.name)
+        self.assertEqual('.', direvt.relative_path)
         return direvt_generator
 
     def test_DIRECTORY_ADDED_when_directory_is_added(self):
@@ -97,6 +100,39 @@ class TestCase(unittest.TestCase):
         self.assertEqual(mtime, direvt.modification_time.epoch)
         direvt_generator.cancel()
 
+    def test_FILE_MODIFIED_when_file_is_written(self):
+        direvt_generator = self.listen_for_events("/dir")
+
+        fs.create_file("dir/written", "contents")
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_ADDED, direvt.event)
+
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_MODIFIED, direvt.event)
+        self.assertEqual('written', direvt.filename.name)
+        self.assertEqual('/dir', direvt.filename.dirname.name)
+        self.assertEqual(fs.size("dir/written"), direvt.filename.size)
+        self.assertEqual(fs.mtime("dir/written"),
+                         direvt.filename.modification_time.epoch)
+        direvt_generator.cancel()
+
+    def test_FILE_RENAMED_when_file_is_renamed(self):
+        direvt_generator = self.listen_for_events("/dir")
+
+        fs.create_file("dir/app.log", "contents")
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_ADDED,
+                         next(direvt_generator).event)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_MODIFIED,
+                         next(direvt_generator).event)
+
+        fs.rename_file("dir/app.log", "dir/app.log.1")
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_RENAMED, direvt.event)
+        self.assertEqual('app.log', direvt.old_name)
+        self.assertEqual('app.log.1', direvt.filename.name)
+        self.assertEqual(fs.size("dir/app.log.1"), direvt.filename.size)
+        direvt_generator.cancel()
+
     def test_FILE_REMOVED_when_file_is_removed(self):
         direvt_generator = self.listen_for_events("/otherdir")
 
@@ -104,6 +140,8 @@ class TestCase(unittest.TestCase):
         direvt = next(direvt_generator)
 
         self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_ADDED, direvt.event)
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_MODIFIED, direvt.event)
         fs.rm_file("otherdir/somefile")
 
         direvt = next(direvt_generator)
@@ -114,6 +152,56 @@ class TestCase(unittest.TestCase):
         self.assertEqual(0, direvt.modification_time.epoch)
         direvt_generator.cancel()
 
+    def test_recursive_subscription_reports_events_in_subdirectories(self):
+        fs.create_dir("recursivedir/sub")
+        direvt_generator = self.listen_for_events("/recursivedir", recursive=True)
+
+        fs.create_file("recursivedir/sub/file", "contents")
+        direvt = next(direvt_generator)
+
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_ADDED, direvt.event)
+        self.assertEqual('/recursivedir/sub', direvt.name)
+        self.assertEqual('sub', direvt.relative_path)
+        self.assertEqual('file', direvt.dirname.name)
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_MODIFIED, direvt.event)
+
+        fs.create_dir("recursivedir/sub/newdir")
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.DIRECTORY_ADDED, direvt.event)
+        self.assertEqual('newdir', direvt.dirname.name)
+
+        fs.create_file("recursivedir/sub/newdir/other", "contents")
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.FILE_ADDED, direvt.event)
+        self.assertEqual('sub/newdir', direvt.relative_path)
+        self.assertEqual('other', direvt.dirname.name)
+        direvt_generator.cancel()
+
+    def test_resumed_subscription_receives_missed_events(self):
+        direvt_generator = self.listen_for_events("/resumedir")
+        fs.create_dir("resumedir/first")
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.DIRECTORY_ADDED, direvt.event)
+        self.assertNotEqual(0, direvt.sequence)
+        direvt_generator.cancel()
+
+        fs.create_dir("resumedir/missed")
+        direvt_generator = self.listen_for_events("/resumedir",
+                                                  resume_from=direvt.sequence)
+        missed = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.DIRECTORY_ADDED, missed.event)
+        self.assertEqual('missed', missed.dirname.name)
+        self.assertGreater(missed.sequence, direvt.sequence)
+        direvt_generator.cancel()
+
+    def test_SNAPSHOT_REQUIRED_when_missed_events_are_unknown(self):
+        direvt_generator = self.listen_for_events("/otherdir", resume_from=1)
+        direvt = next(direvt_generator)
+        self.assertEqual(filewatch_pb2.DirectoryEvent.SNAPSHOT_REQUIRED, direvt.event)
+        self.assertEqual('/otherdir', direvt.name)
+        direvt_generator.cancel()
+
 
 def run_test(tempdir):
     global fs
@@ -121,6 +209,8 @@ def run_test(tempdir):
         fs = fs_
         fs.create_dir("dir")
         fs.create_dir("otherdir")
+        fs.create_dir("recursivedir")
+        fs.create_dir("resumedir")
 
         runner = unittest.TextTestRunner(verbosity=2)
         result = runner.run(unittest.makeSuite(TestCase))
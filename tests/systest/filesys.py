@@ -71,6 +71,12 @@ class FilesystemCleanup:
         if self.dirs is not None:
             self.dirs.append(os.path.join(subpath))
 
+    def rename_file(self, subpath, new_subpath):
+        os.rename(os.path.join(self.rootdir, subpath),
+                  os.path.join(self.rootdir, new_subpath))
+        self.files.remove(os.path.join(subpath))
+        self.files.append(os.path.join(new_subpath))
+
     def rm_file(self, subpath):
         os.unlink(os.path.join(self.rootdir, subpath))
         self.files.remove(os.path.join(subpath))